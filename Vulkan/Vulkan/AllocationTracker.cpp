@@ -0,0 +1,88 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* AllocationTracker.cpp | Counts heap allocations, for checking that steady state frames make none
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "AllocationTracker.h"
+#include "BUILD_OPTIONS.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if BUILD_ENABLE_ALLOCATION_TRACKING
+
+static std::atomic<uint64_t> allocation_count(0);
+
+void * operator new(size_t size) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+	void * memory = malloc(size == 0 ? 1 : size);
+	if (nullptr == memory) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void * operator new[](size_t size) {
+	return operator new(size);
+}
+
+void * operator new(size_t size, const std::nothrow_t &) throw() {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size == 0 ? 1 : size);
+}
+
+void * operator new[](size_t size, const std::nothrow_t & nothrow) throw() {
+	return operator new(size, nothrow);
+}
+
+void operator delete(void * memory) throw() {
+	free(memory);
+}
+
+void operator delete[](void * memory) throw() {
+	free(memory);
+}
+
+void operator delete(void * memory, const std::nothrow_t &) throw() {
+	free(memory);
+}
+
+void operator delete[](void * memory, const std::nothrow_t &) throw() {
+	free(memory);
+}
+
+const uint64_t getAllocationCount() {
+	return allocation_count.load(std::memory_order_relaxed);
+}
+
+const bool isAllocationTrackingEnabled() {
+	return true;
+}
+
+#else
+
+const uint64_t getAllocationCount() {
+	return 0;
+}
+
+const bool isAllocationTrackingEnabled() {
+	return false;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,27 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* AllocationTracker.h | Counts heap allocations, for checking that steady state frames make none
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+
+// With BUILD_ENABLE_ALLOCATION_TRACKING the global operator new and delete are replaced by versions that count
+// every allocation. Without it the count stays at zero
+const uint64_t getAllocationCount();
+const bool isAllocationTrackingEnabled();
\ No newline at end of file
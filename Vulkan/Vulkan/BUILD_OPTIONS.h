@@ -23,4 +23,24 @@
 
 #define BUILD_ENABLE_FRAMERATE 0
 
-#define BUILD_ENABLE_MODEL 0
\ No newline at end of file
+#define BUILD_ENABLE_WAYLAND 0 // Linux only, XCB otherwise
+
+#define BUILD_LATENCY_MODE 1 // 0 low latency, 1 vsync, 2 uncapped
+#define BUILD_FRAME_RATE_LIMIT 0 // Frames per second the CPU paces to, 0 leaves pacing to the present mode
+
+#define BUILD_ENABLE_THREAD_PINNING 0
+
+#define BUILD_ENABLE_MODEL 0
+
+#define BUILD_ENABLE_GPU_CULLING 1
+
+#define BUILD_MSAA_SAMPLE_COUNT 4 // 1 turns multisampling off, clamped to what the device supports
+
+#define BUILD_ENABLE_VIRTUAL_TEXTURE 0
+
+#define BUILD_ENABLE_BENCHMARKS 0
+
+#define BUILD_ENABLE_GOLDEN_IMAGES 0 // Renders fixed scenes, preferably on a software implementation, and compares them against Golden/
+#define BUILD_RECORD_GOLDEN_IMAGES 0 // Writes the captures to Golden/ as the new references instead of comparing against them
+
+#define BUILD_ENABLE_ALLOCATION_TRACKING 0
\ No newline at end of file
@@ -0,0 +1,452 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* Benchmark.cpp | Headless benchmarks of the CPU side systems
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Benchmark.h"
+#include "Scene.h"
+#include "TaskScheduler.h"
+#include "LinearArena.h"
+#include "AllocationTracker.h"
+#include "ClusteredLighting.h"
+#include "BUILD_OPTIONS.h"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <iostream>
+
+const std::array<uint32_t, 3> BENCHMARK_OBJECT_COUNTS = { { 100000, 1000000, 4000000 } };
+const uint32_t BENCHMARK_ITERATIONS = 10;
+const float BENCHMARK_WORLD_SIZE = 1000.0f; // Objects are scattered through a cube this wide
+
+const uint32_t FORK_JOIN_ITEM_COUNT = 1 << 22;
+const uint32_t FORK_JOIN_CUTOFF = 1 << 14; // Leaves of the fork tree, small enough for one thread each in the naive version
+const uint32_t FINE_GRAINED_ITEM_COUNT = 1 << 18;
+const uint32_t FINE_GRAINED_GRAIN_SIZE = 256;
+const uint32_t IMBALANCED_ITEM_COUNT = 4096;
+const uint32_t IMBALANCED_GRAIN_SIZE = 16;
+
+const uint32_t FRAME_OBJECT_COUNT = 100000;
+const uint32_t FRAME_COUNT = 64;
+const uint32_t FRAME_WARMUP_COUNT = 16; // Long enough for every arena and scratch buffer to reach its largest size
+const uint32_t FRAMES_IN_FLIGHT = 3;
+const uint32_t FRAME_VIEW_COUNT = 8; // The camera cycles through this many directions
+
+const std::array<uint32_t, 2> BENCHMARK_LIGHT_COUNTS = { { 1024, 4096 } };
+const uint32_t LIGHT_SAMPLES_PER_LIGHT = 16; // Points inside each light checked against the cluster they land in
+
+// Average wall time of one call, in milliseconds
+template<typename Function>
+static double timeMilliseconds(Function function, uint32_t iterations) {
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < iterations; i++) {
+		function();
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+static bool sameObjects(std::vector<uint32_t> a, std::vector<uint32_t> b) {
+	std::sort(a.begin(), a.end());
+	std::sort(b.begin(), b.end());
+	return a == b;
+}
+
+// A little integer work whose cost scales with iterations. Sums of these do not depend on the order they are added in
+static uint64_t workItem(uint32_t index, uint32_t iterations) {
+	uint64_t value = index + 1;
+	for (uint32_t i = 0; i < iterations; i++) {
+		value ^= value << 13;
+		value ^= value >> 7;
+		value ^= value << 17;
+	}
+	return value;
+}
+
+static uint64_t forkJoinSum(TaskScheduler & scheduler, uint32_t begin, uint32_t end) {
+	if (end - begin <= FORK_JOIN_CUTOFF) {
+		uint64_t sum = 0;
+		for (uint32_t i = begin; i < end; i++) {
+			sum += workItem(i, 4);
+		}
+		return sum;
+	}
+
+	uint32_t middle = begin + (end - begin) / 2;
+	uint64_t left = 0;
+
+	TaskGroup group;
+	scheduler.run(group, [&]() {
+		left = forkJoinSum(scheduler, begin, middle);
+	});
+	uint64_t right = forkJoinSum(scheduler, middle, end);
+	scheduler.wait(group);
+
+	return left + right;
+}
+
+// What the scheduler replaces: a new thread for every fork
+static uint64_t forkJoinSumThreads(uint32_t begin, uint32_t end) {
+	if (end - begin <= FORK_JOIN_CUTOFF) {
+		uint64_t sum = 0;
+		for (uint32_t i = begin; i < end; i++) {
+			sum += workItem(i, 4);
+		}
+		return sum;
+	}
+
+	uint32_t middle = begin + (end - begin) / 2;
+	uint64_t left = 0;
+
+	std::thread thread([&]() {
+		left = forkJoinSumThreads(begin, middle);
+	});
+	uint64_t right = forkJoinSumThreads(middle, end);
+	thread.join();
+
+	return left + right;
+}
+
+// Cost grows with the index, so equal slices of the range are far from equal amounts of work
+static uint32_t imbalancedIterations(uint32_t index) {
+	return 1 + index / 4;
+}
+
+// Splits [0, itemCount) into pieces of pieceSize, running at most one thread per core at a time
+static void runPiecesOnThreads(uint32_t itemCount, uint32_t pieceSize, uint32_t threadCount, const std::function<void(uint32_t, uint32_t)> & body) {
+	std::vector<std::thread> threads;
+	for (uint32_t begin = 0; begin < itemCount; begin += pieceSize) {
+		threads.emplace_back(body, begin, std::min(begin + pieceSize, itemCount));
+
+		if (threads.size() == threadCount) {
+			for (auto & thread : threads) {
+				thread.join();
+			}
+			threads.clear();
+		}
+	}
+
+	for (auto & thread : threads) {
+		thread.join();
+	}
+}
+
+static bool benchmarkTaskScheduler(TaskScheduler & scheduler) {
+	uint32_t thread_count = scheduler.getWorkerCount() + 1;
+
+	std::cout << "Task scheduler, " << thread_count << " threads, times in ms" << std::endl;
+	std::cout << "workload\tserial\tthreads\tscheduler" << std::endl;
+
+	bool passed = true;
+	auto report = [&](const char * name, double serialTime, double threadTime, double schedulerTime, bool matches) {
+		std::cout << name << "\t" << serialTime << "\t" << threadTime << "\t" << schedulerTime << std::endl;
+		if (!matches) {
+			std::cerr << "Task scheduler " << name << " result disagrees with the serial reference" << std::endl;
+			passed = false;
+		}
+	};
+
+	// Fork-join: recursive halving, one task (or thread) per fork
+	{
+		uint64_t serial_sum = 0;
+		uint64_t thread_sum = 0;
+		uint64_t scheduler_sum = 0;
+
+		double serial_time = timeMilliseconds([&]() {
+			serial_sum = 0;
+			for (uint32_t i = 0; i < FORK_JOIN_ITEM_COUNT; i++) {
+				serial_sum += workItem(i, 4);
+			}
+		}, BENCHMARK_ITERATIONS);
+		double thread_time = timeMilliseconds([&]() { thread_sum = forkJoinSumThreads(0, FORK_JOIN_ITEM_COUNT); }, BENCHMARK_ITERATIONS);
+		double scheduler_time = timeMilliseconds([&]() { scheduler_sum = forkJoinSum(scheduler, 0, FORK_JOIN_ITEM_COUNT); }, BENCHMARK_ITERATIONS);
+
+		report("fork-join", serial_time, thread_time, scheduler_time, serial_sum == thread_sum && serial_sum == scheduler_sum);
+	}
+
+	// Fine-grained: many small pieces of cheap work, where per-piece overhead dominates
+	{
+		uint64_t serial_sum = 0;
+		std::atomic<uint64_t> thread_sum(0);
+		std::atomic<uint64_t> scheduler_sum(0);
+
+		auto body = [](std::atomic<uint64_t> & sum) {
+			return [&sum](uint32_t begin, uint32_t end) {
+				uint64_t partial = 0;
+				for (uint32_t i = begin; i < end; i++) {
+					partial += workItem(i, 1);
+				}
+				sum += partial;
+			};
+		};
+
+		double serial_time = timeMilliseconds([&]() {
+			serial_sum = 0;
+			for (uint32_t i = 0; i < FINE_GRAINED_ITEM_COUNT; i++) {
+				serial_sum += workItem(i, 1);
+			}
+		}, BENCHMARK_ITERATIONS);
+		double thread_time = timeMilliseconds([&]() {
+			thread_sum = 0;
+			runPiecesOnThreads(FINE_GRAINED_ITEM_COUNT, FINE_GRAINED_GRAIN_SIZE, thread_count, body(thread_sum));
+		}, BENCHMARK_ITERATIONS);
+		double scheduler_time = timeMilliseconds([&]() {
+			scheduler_sum = 0;
+			scheduler.parallelFor(0, FINE_GRAINED_ITEM_COUNT, FINE_GRAINED_GRAIN_SIZE, body(scheduler_sum));
+		}, BENCHMARK_ITERATIONS);
+
+		report("fine", serial_time, thread_time, scheduler_time, serial_sum == thread_sum && serial_sum == scheduler_sum);
+	}
+
+	// Imbalanced: the threads get one equal slice of the range each, the scheduler rebalances by stealing
+	{
+		uint64_t serial_sum = 0;
+		std::atomic<uint64_t> thread_sum(0);
+		std::atomic<uint64_t> scheduler_sum(0);
+
+		auto body = [](std::atomic<uint64_t> & sum) {
+			return [&sum](uint32_t begin, uint32_t end) {
+				uint64_t partial = 0;
+				for (uint32_t i = begin; i < end; i++) {
+					partial += workItem(i, imbalancedIterations(i));
+				}
+				sum += partial;
+			};
+		};
+
+		double serial_time = timeMilliseconds([&]() {
+			serial_sum = 0;
+			for (uint32_t i = 0; i < IMBALANCED_ITEM_COUNT; i++) {
+				serial_sum += workItem(i, imbalancedIterations(i));
+			}
+		}, BENCHMARK_ITERATIONS);
+		double thread_time = timeMilliseconds([&]() {
+			thread_sum = 0;
+			uint32_t slice_size = (IMBALANCED_ITEM_COUNT + thread_count - 1) / thread_count;
+			runPiecesOnThreads(IMBALANCED_ITEM_COUNT, slice_size, thread_count, body(thread_sum));
+		}, BENCHMARK_ITERATIONS);
+		double scheduler_time = timeMilliseconds([&]() {
+			scheduler_sum = 0;
+			scheduler.parallelFor(0, IMBALANCED_ITEM_COUNT, IMBALANCED_GRAIN_SIZE, body(scheduler_sum));
+		}, BENCHMARK_ITERATIONS);
+
+		report("imbalanced", serial_time, thread_time, scheduler_time, serial_sum == thread_sum && serial_sum == scheduler_sum);
+	}
+
+	std::cout << std::endl;
+	return passed;
+}
+
+static bool benchmarkSceneCulling(TaskScheduler & scheduler) {
+	std::mt19937 random(1234); // Fixed seed so runs are comparable
+	std::uniform_real_distribution<float> position(-BENCHMARK_WORLD_SIZE / 2, BENCHMARK_WORLD_SIZE / 2);
+	std::uniform_real_distribution<float> radius(0.5f, 5.0f);
+
+	// A camera in the middle of the scene sees a fraction of it, like a real frame
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.3f, 0.2f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, BENCHMARK_WORLD_SIZE / 2);
+	projection[1][1] *= -1.0f;
+	glm::mat4 view_projection = projection * view;
+
+	uint32_t thread_count = scheduler.getWorkerCount() + 1;
+
+	std::cout << "Scene culling, " << thread_count << " threads, times in ms" << std::endl;
+	std::cout << "objects\tvisible\tbuild\tbrute\tbvh\tbvh_mt" << std::endl;
+
+	for (uint32_t object_count : BENCHMARK_OBJECT_COUNTS) {
+		Scene scene;
+		for (uint32_t i = 0; i < object_count; i++) {
+			scene.addObject(glm::vec4(position(random), position(random), position(random), radius(random)));
+		}
+
+		double build_time = timeMilliseconds([&]() { scene.build(); }, 1);
+
+		std::vector<uint32_t> brute_force_visible;
+		std::vector<uint32_t> visible;
+		std::vector<uint32_t> threaded_visible;
+
+		double brute_force_time = timeMilliseconds([&]() { scene.cullBruteForce(view_projection, brute_force_visible); }, BENCHMARK_ITERATIONS);
+		double bvh_time = timeMilliseconds([&]() { scene.cull(view_projection, visible); }, BENCHMARK_ITERATIONS);
+		double threaded_time = timeMilliseconds([&]() { scene.cull(view_projection, threaded_visible, &scheduler); }, BENCHMARK_ITERATIONS);
+
+		std::cout << object_count << "\t" << brute_force_visible.size() << "\t" << build_time << "\t" << brute_force_time << "\t" << bvh_time << "\t" << threaded_time << std::endl;
+
+		if (!sameObjects(brute_force_visible, visible) || !sameObjects(brute_force_visible, threaded_visible)) {
+			std::cerr << "Scene culling disagrees with the brute force reference" << std::endl;
+			return false;
+		}
+	}
+
+	std::cout << std::endl;
+	return true;
+}
+
+// Culls and builds a draw list every frame, the way the render loop does, and counts heap allocations once warm
+static bool benchmarkFrameAllocations(TaskScheduler & scheduler) {
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-BENCHMARK_WORLD_SIZE / 2, BENCHMARK_WORLD_SIZE / 2);
+	std::uniform_real_distribution<float> radius(0.5f, 5.0f);
+
+	Scene scene;
+	for (uint32_t i = 0; i < FRAME_OBJECT_COUNT; i++) {
+		scene.addObject(glm::vec4(position(random), position(random), position(random), radius(random)));
+	}
+	scene.build();
+
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, BENCHMARK_WORLD_SIZE / 2);
+	projection[1][1] *= -1.0f;
+
+	FrameArena frame_arena(&scheduler, FRAMES_IN_FLIGHT);
+	std::vector<uint32_t> visible;
+	uint64_t steady_allocations = 0;
+	uint32_t frame = 0;
+
+	double frame_time = timeMilliseconds([&]() {
+		frame_arena.beginFrame(frame % FRAMES_IN_FLIGHT);
+
+		uint64_t allocations = getAllocationCount();
+
+		float angle = glm::radians(360.0f) * (frame % FRAME_VIEW_COUNT) / FRAME_VIEW_COUNT;
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(std::cos(angle), std::sin(angle), 0.2f), glm::vec3(0.0f, 0.0f, 1.0f));
+		scene.cull(projection * view, visible, &scheduler);
+
+		// Transient per-frame data, like the instance data and commands of a draw list
+		ArenaVector<glm::vec4> draw_list(frame_arena.get());
+		draw_list.reserve(visible.size());
+		for (auto object : visible) {
+			draw_list.push_back(glm::vec4((float)object));
+		}
+
+		if (frame++ >= FRAME_WARMUP_COUNT) {
+			steady_allocations += getAllocationCount() - allocations;
+		}
+	}, FRAME_COUNT);
+
+	std::cout << "Frame allocations, " << FRAME_OBJECT_COUNT << " objects" << std::endl;
+	if (!isAllocationTrackingEnabled()) {
+		std::cout << "frame\t" << frame_time << " ms, allocation tracking disabled" << std::endl << std::endl;
+		return true;
+	}
+
+	std::cout << "frame\t" << frame_time << " ms, " << steady_allocations << " steady state allocations" << std::endl << std::endl;
+	if (steady_allocations > 0) {
+		std::cerr << "Steady state frames allocated from the heap" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Bins the lights on the CPU the way ClusterLights.comp does, then checks that a fragment anywhere inside a light's
+// radius finds that light in its cluster. Lights sit over the demo scene, seen from the demo camera
+static bool benchmarkLightBinning() {
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	const float near_plane = 0.1f;
+	const float far_plane = 10.0f;
+	VkExtent2D extent = { 1600, 900 };
+
+	glm::mat4 view = glm::lookAt(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), (float)extent.width / (float)extent.height, near_plane, far_plane);
+	projection[1][1] *= -1.0f;
+
+	std::cout << "Light binning, " << CLUSTER_COUNT << " clusters, times in ms" << std::endl;
+	std::cout << "lights\tbin\tper_cluster\tfull\tchecked" << std::endl;
+
+	for (uint32_t light_count : BENCHMARK_LIGHT_COUNTS) {
+		std::vector<PointLight> lights(light_count);
+		for (auto & light : lights) {
+			glm::vec3 position(unit(random) * 2.0f - 1.0f, unit(random) * 2.0f - 1.0f, 0.05f + unit(random) * 0.25f);
+			light.positionRadius = glm::vec4(position, 0.15f + unit(random) * 0.15f);
+			light.color = glm::vec4(1.0f);
+		}
+
+		ClusterBinningConstants constants = ClusteredLighting::getBinningConstants(view, projection, near_plane, far_plane, extent, light_count, glm::vec3(0.0f));
+
+		std::vector<uint32_t> cluster_lights;
+		double bin_time = timeMilliseconds([&]() { ClusteredLighting::binLightsReference(constants, lights, cluster_lights); }, BENCHMARK_ITERATIONS);
+
+		// Lights a fragment evaluates on average, against every light without clustering
+		uint64_t listed = 0;
+		uint32_t occupied = 0;
+		uint32_t full = 0;
+		for (uint32_t cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+			uint32_t count = cluster_lights[cluster * (1 + MAX_LIGHTS_PER_CLUSTER)];
+			listed += count;
+			occupied += (count > 0) ? 1 : 0;
+			full += (count == MAX_LIGHTS_PER_CLUSTER) ? 1 : 0;
+		}
+
+		uint32_t checked = 0;
+		for (uint32_t light = 0; light < light_count; light++) {
+			for (uint32_t sample = 0; sample < LIGHT_SAMPLES_PER_LIGHT; sample++) {
+				// Anywhere well inside the radius, so rounding at cluster edges cannot matter
+				glm::vec3 direction = glm::normalize(glm::vec3(unit(random) * 2.0f - 1.0f, unit(random) * 2.0f - 1.0f, unit(random) * 2.0f - 1.0f) + glm::vec3(1e-4f));
+				glm::vec3 point = glm::vec3(lights[light].positionRadius) + direction * lights[light].positionRadius.w * 0.95f * unit(random);
+
+				glm::vec4 view_point = view * glm::vec4(point, 1.0f);
+				glm::vec4 clip = projection * view_point;
+				float view_depth = -view_point.z;
+				if (view_depth < near_plane || view_depth > far_plane || std::abs(clip.x) > clip.w || std::abs(clip.y) > clip.w) {
+					continue; // Off screen, no fragment would look it up
+				}
+
+				glm::vec2 frag_coord = (glm::vec2(clip.x, clip.y) / clip.w * 0.5f + glm::vec2(0.5f)) * constants.screenSize;
+				const uint32_t * cluster = &cluster_lights[ClusteredLighting::findCluster(constants, frag_coord, view_depth) * (1 + MAX_LIGHTS_PER_CLUSTER)];
+				if (cluster[0] == MAX_LIGHTS_PER_CLUSTER) {
+					continue; // Overflowed, dropping lights is allowed
+				}
+
+				if (std::find(cluster + 1, cluster + 1 + cluster[0], light) == cluster + 1 + cluster[0]) {
+					std::cerr << "Light " << light << " missing from the cluster of a point it lights" << std::endl;
+					return false;
+				}
+				checked++;
+			}
+		}
+
+		std::cout << light_count << "\t" << bin_time << "\t" << (occupied > 0 ? (double)listed / occupied : 0.0) << "\t\t" << full << "\t" << checked << std::endl;
+	}
+
+	std::cout << std::endl;
+	return true;
+}
+
+int runBenchmarks() {
+	bool passed = true;
+
+	TaskScheduler scheduler(0, BUILD_ENABLE_THREAD_PINNING != 0);
+
+	passed = benchmarkTaskScheduler(scheduler) && passed;
+	passed = benchmarkSceneCulling(scheduler) && passed;
+	passed = benchmarkFrameAllocations(scheduler) && passed;
+	passed = benchmarkLightBinning() && passed;
+
+	return passed ? 0 : 1;
+}
\ No newline at end of file
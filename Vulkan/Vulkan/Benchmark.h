@@ -0,0 +1,22 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* Benchmark.h | Headless benchmarks of the CPU side systems
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+// Runs without a window or Vulkan device. Returns non-zero if a result disagrees with its reference
+int runBenchmarks();
\ No newline at end of file
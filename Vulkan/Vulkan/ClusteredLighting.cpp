@@ -0,0 +1,264 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* ClusteredLighting.cpp | Point lights binned into view space clusters, shaded per cluster
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ClusteredLighting.h"
+#include "util.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+const std::string CLUSTER_LIGHTS_PATH = "cluster_lights.spv";
+
+const uint32_t CLUSTER_STRIDE = 1 + MAX_LIGHTS_PER_CLUSTER; // Count, then indices
+
+ClusteredLighting::ClusteredLighting(Renderer * renderer) {
+	_renderer = renderer;
+	_device = renderer->getDevice();
+
+	_InitBuffers();
+	_InitPipeline();
+}
+
+ClusteredLighting::~ClusteredLighting() {
+	_DeInitPipeline();
+	_DeInitBuffers();
+}
+
+void ClusteredLighting::setLights(const std::vector<PointLight> & lights) {
+	assert(lights.size() <= MAX_POINT_LIGHTS);
+	_light_count = (uint32_t)std::min<size_t>(lights.size(), MAX_POINT_LIGHTS);
+
+	if (_light_count == 0) {
+		return;
+	}
+
+	void * mapped;
+	ErrorCheck(vkMapMemory(_device, _light_buffer_memory, 0, _light_count * sizeof(PointLight), 0, &mapped));
+	memcpy(mapped, lights.data(), _light_count * sizeof(PointLight));
+	vkUnmapMemory(_device, _light_buffer_memory);
+}
+
+void ClusteredLighting::setAmbient(const glm::vec3 & ambient) {
+	_ambient = ambient;
+}
+
+void ClusteredLighting::bin(VkCommandBuffer commandBuffer, const glm::mat4 & view, const glm::mat4 & projection, float nearPlane, float farPlane, VkExtent2D extent) {
+	// Last frame's fragment shaders read the clusters about to be overwritten
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	ClusterBinningConstants constants = getBinningConstants(view, projection, nearPlane, farPlane, extent, _light_count, _ambient);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline_layout, 0, 1, &_set, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, _pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ClusterBinningConstants), &constants);
+	vkCmdDispatch(commandBuffer, (CLUSTER_COUNT + CLUSTER_BINNING_GROUP_SIZE - 1) / CLUSTER_BINNING_GROUP_SIZE, 1, 1);
+
+	VkMemoryBarrier cluster_barrier = vkStruct<VkMemoryBarrier>();
+	cluster_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cluster_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &cluster_barrier, 0, nullptr, 0, nullptr);
+}
+
+void ClusteredLighting::bind(VkCommandBuffer commandBuffer) {
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _renderer->getPipelineLayout(), 1, 1, &_set, 0, nullptr);
+}
+
+const uint32_t ClusteredLighting::getLightCount() const {
+	return _light_count;
+}
+
+VkDescriptorSetLayout ClusteredLighting::getSetLayout(DescriptorLayoutCache * layoutCache) {
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+
+	bindings[0].binding = 0; // Lights
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	bindings[1].binding = 1; // Clusters
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayoutCreateInfo set_layout_create_info = vkStruct<VkDescriptorSetLayoutCreateInfo>();
+	set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+	set_layout_create_info.pBindings = bindings.data();
+
+	return layoutCache->createDescriptorLayout(set_layout_create_info);
+}
+
+ClusterBinningConstants ClusteredLighting::getBinningConstants(const glm::mat4 & view, const glm::mat4 & projection, float nearPlane, float farPlane, VkExtent2D extent, uint32_t lightCount, const glm::vec3 & ambient) {
+	ClusterBinningConstants constants {};
+	constants.view = view;
+	constants.projection = glm::vec4(projection[0][0], projection[1][1], nearPlane, farPlane);
+	constants.ambient = glm::vec4(ambient, 0.0f);
+	constants.screenSize = glm::vec2((float)extent.width, (float)extent.height);
+	constants.lightCount = lightCount;
+	return constants;
+}
+
+// Mirrors cluster_bounds() in ClusterLights.comp
+ClusterBounds ClusteredLighting::computeClusterBounds(const ClusterBinningConstants & constants, uint32_t x, uint32_t y, uint32_t z) {
+	float near_plane = constants.projection.z;
+	float far_plane = constants.projection.w;
+
+	glm::vec2 ndc_min(2.0f * x / CLUSTER_GRID_X - 1.0f, 2.0f * y / CLUSTER_GRID_Y - 1.0f);
+	glm::vec2 ndc_max(2.0f * (x + 1) / CLUSTER_GRID_X - 1.0f, 2.0f * (y + 1) / CLUSTER_GRID_Y - 1.0f);
+	float depth_near = near_plane * std::pow(far_plane / near_plane, (float)z / CLUSTER_GRID_Z);
+	float depth_far = near_plane * std::pow(far_plane / near_plane, (float)(z + 1) / CLUSTER_GRID_Z);
+
+	// The tile's edges fan out with depth, so the box spans its corners on both slice planes
+	ClusterBounds bounds;
+	bounds.min = glm::vec3(INFINITY);
+	bounds.max = glm::vec3(-INFINITY);
+	for (uint32_t corner = 0; corner < 8; corner++) {
+		glm::vec2 ndc((corner & 1) ? ndc_max.x : ndc_min.x, (corner & 2) ? ndc_max.y : ndc_min.y);
+		float depth = (corner & 4) ? depth_far : depth_near;
+
+		glm::vec3 point(ndc.x * depth / constants.projection.x, ndc.y * depth / constants.projection.y, -depth);
+		bounds.min = glm::min(bounds.min, point);
+		bounds.max = glm::max(bounds.max, point);
+	}
+	return bounds;
+}
+
+void ClusteredLighting::binLightsReference(const ClusterBinningConstants & constants, const std::vector<PointLight> & lights, std::vector<uint32_t> & clusterLights) {
+	clusterLights.assign(CLUSTER_COUNT * CLUSTER_STRIDE, 0);
+
+	std::vector<glm::vec4> view_lights(constants.lightCount);
+	for (uint32_t i = 0; i < constants.lightCount; i++) {
+		glm::vec4 view_position = constants.view * glm::vec4(glm::vec3(lights[i].positionRadius), 1.0f);
+		view_lights[i] = glm::vec4(glm::vec3(view_position), lights[i].positionRadius.w);
+	}
+
+	for (uint32_t z = 0; z < CLUSTER_GRID_Z; z++) {
+		for (uint32_t y = 0; y < CLUSTER_GRID_Y; y++) {
+			for (uint32_t x = 0; x < CLUSTER_GRID_X; x++) {
+				ClusterBounds bounds = computeClusterBounds(constants, x, y, z);
+				uint32_t * cluster = &clusterLights[((z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x) * CLUSTER_STRIDE];
+
+				uint32_t count = 0;
+				for (uint32_t i = 0; i < constants.lightCount && count < MAX_LIGHTS_PER_CLUSTER; i++) {
+					glm::vec3 centre = glm::vec3(view_lights[i]);
+					glm::vec3 offset = glm::clamp(centre, bounds.min, bounds.max) - centre;
+					if (glm::dot(offset, offset) <= view_lights[i].w * view_lights[i].w) {
+						cluster[1 + count++] = i;
+					}
+				}
+				cluster[0] = count;
+			}
+		}
+	}
+}
+
+// Mirrors find_cluster() in the lit fragment shaders
+uint32_t ClusteredLighting::findCluster(const ClusterBinningConstants & constants, const glm::vec2 & fragCoord, float viewDepth) {
+	float near_plane = constants.projection.z;
+	float far_plane = constants.projection.w;
+
+	glm::vec2 tile_size = constants.screenSize / glm::vec2((float)CLUSTER_GRID_X, (float)CLUSTER_GRID_Y);
+	float slice_scale = CLUSTER_GRID_Z / std::log(far_plane / near_plane);
+	float slice_bias = -CLUSTER_GRID_Z * std::log(near_plane) / std::log(far_plane / near_plane);
+
+	uint32_t x = std::min((uint32_t)std::max(fragCoord.x / tile_size.x, 0.0f), CLUSTER_GRID_X - 1);
+	uint32_t y = std::min((uint32_t)std::max(fragCoord.y / tile_size.y, 0.0f), CLUSTER_GRID_Y - 1);
+	uint32_t z = std::min((uint32_t)std::max(std::log(std::max(viewDepth, near_plane)) * slice_scale + slice_bias, 0.0f), CLUSTER_GRID_Z - 1);
+
+	return (z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x;
+}
+
+void ClusteredLighting::_InitBuffers() {
+	_renderer->createBuffer(MAX_POINT_LIGHTS * sizeof(PointLight), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _light_buffer, _light_buffer_memory);
+	_renderer->createBuffer(sizeof(ClusterHeader) + CLUSTER_COUNT * CLUSTER_STRIDE * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _cluster_buffer, _cluster_buffer_memory);
+
+	_set_layout = getSetLayout(_renderer->getDescriptorLayoutCache());
+	if (!_renderer->getDescriptorAllocator()->allocate(_set_layout, _set)) {
+		throw std::runtime_error("Failed to allocate the light culling descriptor set");
+	}
+
+	std::array<VkDescriptorBufferInfo, 2> buffer_infos {};
+	buffer_infos[0] = { _light_buffer, 0, VK_WHOLE_SIZE };
+	buffer_infos[1] = { _cluster_buffer, 0, VK_WHOLE_SIZE };
+
+	std::array<VkWriteDescriptorSet, 2> descriptor_writes = {};
+	for (uint32_t binding = 0; binding < descriptor_writes.size(); binding++) {
+		descriptor_writes[binding] = vkStruct<VkWriteDescriptorSet>();
+		descriptor_writes[binding].dstSet = _set;
+		descriptor_writes[binding].dstBinding = binding;
+		descriptor_writes[binding].descriptorCount = 1;
+		descriptor_writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptor_writes[binding].pBufferInfo = &buffer_infos[binding];
+	}
+
+	vkUpdateDescriptorSets(_device, (uint32_t)descriptor_writes.size(), descriptor_writes.data(), 0, nullptr);
+}
+
+void ClusteredLighting::_DeInitBuffers() {
+	vkDestroyBuffer(_device, _cluster_buffer, nullptr);
+	_cluster_buffer = VK_NULL_HANDLE;
+	vkFreeMemory(_device, _cluster_buffer_memory, nullptr);
+	_cluster_buffer_memory = VK_NULL_HANDLE;
+	vkDestroyBuffer(_device, _light_buffer, nullptr);
+	_light_buffer = VK_NULL_HANDLE;
+	vkFreeMemory(_device, _light_buffer_memory, nullptr);
+	_light_buffer_memory = VK_NULL_HANDLE;
+
+	_set = VK_NULL_HANDLE; // Returned with the renderer's descriptor pools
+	_set_layout = VK_NULL_HANDLE; // Belongs to the renderer's layout cache
+}
+
+void ClusteredLighting::_InitPipeline() {
+	VkPushConstantRange push_constant_range {};
+	push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	push_constant_range.offset = 0;
+	push_constant_range.size = sizeof(ClusterBinningConstants);
+
+	VkPipelineLayoutCreateInfo pipeline_layout_create_info = vkStruct<VkPipelineLayoutCreateInfo>();
+	pipeline_layout_create_info.setLayoutCount = 1;
+	pipeline_layout_create_info.pSetLayouts = &_set_layout;
+	pipeline_layout_create_info.pushConstantRangeCount = 1;
+	pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
+
+	ErrorCheck(vkCreatePipelineLayout(_device, &pipeline_layout_create_info, nullptr, &_pipeline_layout));
+
+	VkShaderModule shader_module;
+	_renderer->createShaderModule(CLUSTER_LIGHTS_PATH, shader_module);
+
+	VkComputePipelineCreateInfo pipeline_create_info = vkStruct<VkComputePipelineCreateInfo>();
+	pipeline_create_info.stage = vkStruct<VkPipelineShaderStageCreateInfo>();
+	pipeline_create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline_create_info.stage.module = shader_module;
+	pipeline_create_info.stage.pName = "main";
+	pipeline_create_info.layout = _pipeline_layout;
+
+	ErrorCheck(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &pipeline_create_info, nullptr, &_pipeline));
+
+	vkDestroyShaderModule(_device, shader_module, nullptr);
+}
+
+void ClusteredLighting::_DeInitPipeline() {
+	vkDestroyPipeline(_device, _pipeline, nullptr);
+	_pipeline = VK_NULL_HANDLE;
+	vkDestroyPipelineLayout(_device, _pipeline_layout, nullptr);
+	_pipeline_layout = VK_NULL_HANDLE;
+}
\ No newline at end of file
@@ -0,0 +1,122 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* ClusteredLighting.h | Point lights binned into view space clusters, shaded per cluster
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Renderer.h"
+#include "DescriptorAllocator.h"
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Must match ClusterLights.comp and the lit fragment shaders
+const uint32_t CLUSTER_GRID_X = 16;
+const uint32_t CLUSTER_GRID_Y = 9;
+const uint32_t CLUSTER_GRID_Z = 24; // Depth slices, exponentially spaced from near to far
+const uint32_t CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+const uint32_t MAX_LIGHTS_PER_CLUSTER = 128; // Further lights touching a cluster are dropped
+const uint32_t MAX_POINT_LIGHTS = 4096;
+
+const uint32_t CLUSTER_BINNING_GROUP_SIZE = 64; // local_size_x in ClusterLights.comp
+
+// Must match the structs in ClusterLights.comp and the lit fragment shaders
+struct PointLight {
+	glm::vec4 positionRadius; // xyz world space, w radius. Nothing beyond the radius is lit
+	glm::vec4 color; // rgb, a unused
+};
+
+struct ClusterHeader { // std430, head of the cluster buffer, written by ClusterLights.comp every frame
+	glm::vec4 ambient;
+	glm::vec2 tileSize; // Pixels per cluster in x and y
+	float sliceScale; // slice = log(view depth) * sliceScale + sliceBias
+	float sliceBias;
+};
+
+struct ClusterBinningConstants { // Push constants of ClusterLights.comp
+	glm::mat4 view;
+	glm::vec4 projection; // projection[0][0], projection[1][1], near, far
+	glm::vec4 ambient;
+	glm::vec2 screenSize;
+	uint32_t lightCount;
+	uint32_t padding;
+};
+
+// View space box around a cluster
+struct ClusterBounds {
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// Clustered forward lighting. The view frustum is split into a CLUSTER_GRID_X by CLUSTER_GRID_Y grid of screen tiles,
+// each cut into depth slices, and a compute pass lists the lights whose spheres touch each cluster. Fragment shaders
+// find their cluster from gl_FragCoord and view depth and only evaluate the lights listed there, so the cost per
+// pixel follows the lights nearby rather than the lights in the scene.
+// Cluster bounds follow from the projection, so they are rebuilt by the same pass every frame at no extra cost.
+// Both buffers live in one set, set 1 of the renderer's pipeline layout, shared by the binning pass.
+class ClusteredLighting {
+public:
+	ClusteredLighting(Renderer * renderer);
+	~ClusteredLighting();
+
+	// Not while a frame that reads the lights is in flight
+	void setLights(const std::vector<PointLight> & lights);
+	void setAmbient(const glm::vec3 & ambient);
+
+	// Outside a render pass, before anything is drawn with the lights. projection is symmetric and perspective
+	void bin(VkCommandBuffer commandBuffer, const glm::mat4 & view, const glm::mat4 & projection, float nearPlane, float farPlane, VkExtent2D extent);
+	// With the graphics pipeline bound
+	void bind(VkCommandBuffer commandBuffer);
+
+	const uint32_t getLightCount() const;
+
+	// Layout of set 1 in the lit shaders and of the binning pass, shared through the cache
+	static VkDescriptorSetLayout getSetLayout(DescriptorLayoutCache * layoutCache);
+
+	// The binning pass on the CPU, for reference and headless tests. Fills clusterLights exactly as the pass fills
+	// the buffer after its header: per cluster a count, then MAX_LIGHTS_PER_CLUSTER light indices
+	static ClusterBinningConstants getBinningConstants(const glm::mat4 & view, const glm::mat4 & projection, float nearPlane, float farPlane, VkExtent2D extent, uint32_t lightCount, const glm::vec3 & ambient);
+	static ClusterBounds computeClusterBounds(const ClusterBinningConstants & constants, uint32_t x, uint32_t y, uint32_t z);
+	static void binLightsReference(const ClusterBinningConstants & constants, const std::vector<PointLight> & lights, std::vector<uint32_t> & clusterLights);
+	// The cluster a fragment shader would look in
+	static uint32_t findCluster(const ClusterBinningConstants & constants, const glm::vec2 & fragCoord, float viewDepth);
+
+private:
+	void _InitBuffers();
+	void _DeInitBuffers();
+
+	void _InitPipeline();
+	void _DeInitPipeline();
+
+	Renderer * _renderer = nullptr;
+	VkDevice _device = VK_NULL_HANDLE;
+
+	uint32_t _light_count = 0;
+	glm::vec3 _ambient = glm::vec3(0.05f);
+
+	VkBuffer _light_buffer = VK_NULL_HANDLE; // Host visible, MAX_POINT_LIGHTS long
+	VkDeviceMemory _light_buffer_memory = VK_NULL_HANDLE;
+	VkBuffer _cluster_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory _cluster_buffer_memory = VK_NULL_HANDLE;
+
+	VkDescriptorSetLayout _set_layout = VK_NULL_HANDLE;
+	VkDescriptorSet _set = VK_NULL_HANDLE;
+	VkPipelineLayout _pipeline_layout = VK_NULL_HANDLE;
+	VkPipeline _pipeline = VK_NULL_HANDLE;
+};
\ No newline at end of file
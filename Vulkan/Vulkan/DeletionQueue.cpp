@@ -0,0 +1,110 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* DeletionQueue.cpp | Owning handle wrappers and per-frame queues that destroy them once the GPU is done
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "DeletionQueue.h"
+
+#include <assert.h>
+
+DeletionQueue::DeletionQueue(VkDevice device, uint32_t frameCount) {
+	assert(frameCount > 0);
+
+	_device = device;
+	_queues.resize(frameCount);
+}
+
+DeletionQueue::~DeletionQueue() {
+	flush();
+}
+
+void DeletionQueue::beginFrame(uint32_t frame) {
+	assert(frame < _queues.size());
+
+	_frame = frame;
+	_Drain(_queues[_frame]);
+}
+
+void DeletionQueue::destroyBuffer(VkBuffer buffer) {
+	_queues[_frame].buffers.push_back(buffer);
+}
+
+void DeletionQueue::destroyImage(VkImage image) {
+	_queues[_frame].images.push_back(image);
+}
+
+void DeletionQueue::destroyImageView(VkImageView imageView) {
+	_queues[_frame].imageViews.push_back(imageView);
+}
+
+void DeletionQueue::destroySampler(VkSampler sampler) {
+	_queues[_frame].samplers.push_back(sampler);
+}
+
+void DeletionQueue::destroyPipeline(VkPipeline pipeline) {
+	_queues[_frame].pipelines.push_back(pipeline);
+}
+
+void DeletionQueue::freeMemory(VkDeviceMemory memory) {
+	_queues[_frame].memory.push_back(memory);
+}
+
+void DeletionQueue::flush() {
+	for (auto & queue : _queues) {
+		_Drain(queue);
+	}
+}
+
+const size_t DeletionQueue::getPendingCount() const {
+	size_t count = 0;
+	for (const auto & queue : _queues) {
+		count += queue.imageViews.size() + queue.samplers.size() + queue.pipelines.size() + queue.images.size() + queue.buffers.size() + queue.memory.size();
+	}
+	return count;
+}
+
+void DeletionQueue::_Drain(FrameQueue & queue) {
+	// Cleared rather than freed, so a steady stream of releases stops touching the heap
+	for (auto image_view : queue.imageViews) {
+		vkDestroyImageView(_device, image_view, nullptr);
+	}
+	queue.imageViews.clear();
+
+	for (auto sampler : queue.samplers) {
+		vkDestroySampler(_device, sampler, nullptr);
+	}
+	queue.samplers.clear();
+
+	for (auto pipeline : queue.pipelines) {
+		vkDestroyPipeline(_device, pipeline, nullptr);
+	}
+	queue.pipelines.clear();
+
+	for (auto image : queue.images) {
+		vkDestroyImage(_device, image, nullptr);
+	}
+	queue.images.clear();
+
+	for (auto buffer : queue.buffers) {
+		vkDestroyBuffer(_device, buffer, nullptr);
+	}
+	queue.buffers.clear();
+
+	for (auto memory : queue.memory) {
+		vkFreeMemory(_device, memory, nullptr);
+	}
+	queue.memory.clear();
+}
\ No newline at end of file
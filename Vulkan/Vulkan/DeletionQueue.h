@@ -0,0 +1,141 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* DeletionQueue.h | Owning handle wrappers and per-frame queues that destroy them once the GPU is done
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+
+#include <vector>
+
+// Vulkan objects handed over for destruction while frames in flight may still use them. Each frame in flight has
+// its own queue; beginFrame() destroys what was released the last time that frame was current, and must only be
+// called once the queue timeline has reached that frame's last submission, like FrameArena::beginFrame. Reaching it
+// means every earlier submission is complete too, so whatever frame used the object last is done with it.
+// Not thread safe, releases come from the thread that records frames.
+class DeletionQueue {
+public:
+	DeletionQueue(VkDevice device, uint32_t frameCount);
+	// Destroys everything still queued, so the device must be idle
+	~DeletionQueue();
+
+	void beginFrame(uint32_t frame);
+
+	void destroyBuffer(VkBuffer buffer);
+	void destroyImage(VkImage image);
+	void destroyImageView(VkImageView imageView);
+	void destroySampler(VkSampler sampler);
+	void destroyPipeline(VkPipeline pipeline);
+	void freeMemory(VkDeviceMemory memory);
+
+	// Destroys every queue at once. Only with the device idle
+	void flush();
+
+	// Objects waiting on a frame, across all frames
+	const size_t getPendingCount() const;
+
+private:
+	DeletionQueue(const DeletionQueue &);
+	DeletionQueue & operator=(const DeletionQueue &);
+
+	// Grouped by type so views go before their images and memory goes last
+	struct FrameQueue {
+		std::vector<VkImageView> imageViews;
+		std::vector<VkSampler> samplers;
+		std::vector<VkPipeline> pipelines;
+		std::vector<VkImage> images;
+		std::vector<VkBuffer> buffers;
+		std::vector<VkDeviceMemory> memory;
+	};
+
+	void _Drain(FrameQueue & queue);
+
+	VkDevice _device = VK_NULL_HANDLE;
+	uint32_t _frame = 0;
+
+	std::vector<FrameQueue> _queues;
+};
+
+// Owns one Vulkan object and releases it through a DeletionQueue when destroyed or replaced, so dropping the last
+// reference never stalls on the GPU. Move only
+template<typename T, void (DeletionQueue::*Destroy)(T)>
+class UniqueHandle {
+public:
+	UniqueHandle() {}
+	explicit UniqueHandle(DeletionQueue * deletionQueue, T handle = VK_NULL_HANDLE) : _deletion_queue(deletionQueue), _handle(handle) {}
+
+	UniqueHandle(UniqueHandle && other) : _deletion_queue(other._deletion_queue), _handle(other._handle) {
+		other._handle = VK_NULL_HANDLE;
+	}
+
+	UniqueHandle & operator=(UniqueHandle && other) {
+		if (this != &other) {
+			reset();
+			_deletion_queue = other._deletion_queue;
+			_handle = other._handle;
+			other._handle = VK_NULL_HANDLE;
+		}
+		return *this;
+	}
+
+	~UniqueHandle() {
+		reset();
+	}
+
+	// Releases the current object and hands out the empty slot for a create call to fill, e.g.
+	// renderer->createBuffer(..., buffer.replace(), memory.replace())
+	T & replace() {
+		reset();
+		return _handle;
+	}
+
+	void reset() {
+		if (_handle != VK_NULL_HANDLE) {
+			(_deletion_queue->*Destroy)(_handle);
+			_handle = VK_NULL_HANDLE;
+		}
+	}
+
+	// Gives up ownership without destroying anything
+	T release() {
+		T handle = _handle;
+		_handle = VK_NULL_HANDLE;
+		return handle;
+	}
+
+	T get() const {
+		return _handle;
+	}
+
+	operator T() const {
+		return _handle;
+	}
+
+private:
+	UniqueHandle(const UniqueHandle &);
+	UniqueHandle & operator=(const UniqueHandle &);
+
+	DeletionQueue * _deletion_queue = nullptr;
+	T _handle = VK_NULL_HANDLE;
+};
+
+typedef UniqueHandle<VkBuffer, &DeletionQueue::destroyBuffer> UniqueBuffer;
+typedef UniqueHandle<VkImage, &DeletionQueue::destroyImage> UniqueImage;
+typedef UniqueHandle<VkImageView, &DeletionQueue::destroyImageView> UniqueImageView;
+typedef UniqueHandle<VkSampler, &DeletionQueue::destroySampler> UniqueSampler;
+typedef UniqueHandle<VkPipeline, &DeletionQueue::destroyPipeline> UniquePipeline;
+typedef UniqueHandle<VkDeviceMemory, &DeletionQueue::freeMemory> UniqueMemory;
\ No newline at end of file
@@ -0,0 +1,294 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* DescriptorAllocator.cpp | Growable descriptor pools and a descriptor set layout cache
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "DescriptorAllocator.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+
+const uint32_t MAX_POOL_SET_COUNT = 4096;
+
+// Descriptors per set used to size pools before any allocations have been seen
+const std::array<std::pair<VkDescriptorType, float>, 4> DEFAULT_POOL_RATIOS = { {
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0.5f },
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 0.5f }
+} };
+
+// The members every extensible Vulkan structure starts with
+struct ChainedStructure {
+	VkStructureType sType;
+	const void * pNext;
+};
+
+// Layout cache
+bool DescriptorLayoutCache::LayoutInfo::operator==(const LayoutInfo & other) const {
+	if (flags != other.flags || bindings.size() != other.bindings.size() || bindingFlags != other.bindingFlags) {
+		return false;
+	}
+
+	for (size_t i = 0; i < bindings.size(); i++) {
+		const VkDescriptorSetLayoutBinding & a = bindings[i];
+		const VkDescriptorSetLayoutBinding & b = other.bindings[i];
+		if (a.binding != b.binding || a.descriptorType != b.descriptorType || a.descriptorCount != b.descriptorCount ||
+			a.stageFlags != b.stageFlags || a.pImmutableSamplers != b.pImmutableSamplers) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+size_t DescriptorLayoutCache::LayoutHash::operator()(const LayoutInfo & info) const {
+	size_t result = std::hash<uint32_t>()(info.flags);
+
+	for (const auto & binding : info.bindings) {
+		// Fold the binding into one word. Fields overlap once a number or mask outgrows its byte, which only costs collisions
+		size_t binding_hash = binding.binding | (binding.descriptorType << 8) | (binding.stageFlags << 16) | ((size_t)binding.descriptorCount << 24);
+		result ^= std::hash<size_t>()(binding_hash) + 0x9e3779b9 + (result << 6) + (result >> 2);
+	}
+
+	for (auto binding_flags : info.bindingFlags) {
+		result ^= std::hash<uint32_t>()(binding_flags) + 0x9e3779b9 + (result << 6) + (result >> 2);
+	}
+
+	return result;
+}
+
+DescriptorLayoutCache::DescriptorLayoutCache(VkDevice device) {
+	_device = device;
+}
+
+DescriptorLayoutCache::~DescriptorLayoutCache() {
+	for (auto & layout : _layouts) {
+		vkDestroyDescriptorSetLayout(_device, layout.second, nullptr);
+	}
+	_layouts.clear();
+	_layout_infos.clear();
+}
+
+VkDescriptorSetLayout DescriptorLayoutCache::createDescriptorLayout(const VkDescriptorSetLayoutCreateInfo & createInfo) {
+	// Binding flags are the only chained structure the key covers, a layout with anything else would be merged with one without it
+	std::vector<VkFlags> binding_flags;
+	for (const ChainedStructure * next = (const ChainedStructure *)createInfo.pNext; next != nullptr; next = (const ChainedStructure *)next->pNext) {
+#ifdef VK_EXT_descriptor_indexing
+		if (next->sType == VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT) {
+			const VkDescriptorSetLayoutBindingFlagsCreateInfoEXT * flags_info = (const VkDescriptorSetLayoutBindingFlagsCreateInfoEXT *)next;
+			binding_flags.assign(flags_info->pBindingFlags, flags_info->pBindingFlags + flags_info->bindingCount);
+			continue;
+		}
+#endif
+		throw std::runtime_error("Descriptor set layout extension cannot be cached");
+	}
+
+	// Sort the bindings by number, each binding's flags moving with it
+	std::vector<uint32_t> order(createInfo.bindingCount);
+	for (uint32_t i = 0; i < createInfo.bindingCount; i++) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&createInfo](uint32_t a, uint32_t b) {
+		return createInfo.pBindings[a].binding < createInfo.pBindings[b].binding;
+	});
+
+	LayoutInfo layout_info {};
+	layout_info.flags = createInfo.flags;
+	for (auto i : order) {
+		layout_info.bindings.push_back(createInfo.pBindings[i]);
+		if (!binding_flags.empty()) {
+			layout_info.bindingFlags.push_back(binding_flags[i]);
+		}
+	}
+
+	// Pool statistics are indexed by descriptor type, which only works for the contiguous core range
+	for (const auto & binding : layout_info.bindings) {
+		if (binding.descriptorType >= DESCRIPTOR_TYPE_COUNT) {
+			throw std::runtime_error("Descriptor type cannot be pooled");
+		}
+	}
+
+	auto cached = _layouts.find(layout_info);
+	if (cached != _layouts.end()) {
+		return cached->second;
+	}
+
+	VkDescriptorSetLayout layout;
+	ErrorCheck(vkCreateDescriptorSetLayout(_device, &createInfo, nullptr, &layout));
+
+	auto inserted = _layouts.emplace(std::move(layout_info), layout).first;
+	_layout_infos[layout] = &inserted->first; // Node based, so the key stays put when the map rehashes
+
+	return layout;
+}
+
+const std::vector<VkDescriptorSetLayoutBinding> * DescriptorLayoutCache::getBindings(VkDescriptorSetLayout layout) const {
+	auto info = _layout_infos.find(layout);
+	if (info == _layout_infos.end()) {
+		return nullptr;
+	}
+	return &info->second->bindings;
+}
+
+// Allocator
+DescriptorAllocator::DescriptorAllocator(VkDevice device, const DescriptorLayoutCache * layoutCache, VkDescriptorPoolCreateFlags poolFlags, uint32_t initialSetCount) {
+	_device = device;
+	_layout_cache = layoutCache;
+	_pool_flags = poolFlags;
+	_next_pool_set_count = initialSetCount;
+}
+
+DescriptorAllocator::~DescriptorAllocator() {
+	for (auto pool : _used_pools) {
+		vkDestroyDescriptorPool(_device, pool, nullptr);
+	}
+	for (auto pool : _free_pools) {
+		vkDestroyDescriptorPool(_device, pool, nullptr);
+	}
+	_used_pools.clear();
+	_free_pools.clear();
+	_current_pool = VK_NULL_HANDLE;
+}
+
+bool DescriptorAllocator::allocate(VkDescriptorSetLayout layout, VkDescriptorSet & descriptorSet) {
+	// Count the layout first so a freshly grown pool is guaranteed to have room for it
+	_RecordAllocation(layout);
+
+	if (_current_pool == VK_NULL_HANDLE) {
+		_current_pool = _GrabPool();
+	}
+
+	VkDescriptorSetAllocateInfo allocate_info = vkStruct<VkDescriptorSetAllocateInfo>();
+	allocate_info.descriptorPool = _current_pool;
+	allocate_info.descriptorSetCount = 1;
+	allocate_info.pSetLayouts = &layout;
+
+	VkResult result = vkAllocateDescriptorSets(_device, &allocate_info, &descriptorSet);
+
+	// Pool is exhausted or fragmented, move on down the chain. A freshly created pool is sized for this layout, so only it may fail for good
+	while (result != VK_SUCCESS) {
+		bool fresh_pool = _free_pools.empty();
+
+		_current_pool = _GrabPool();
+		allocate_info.descriptorPool = _current_pool;
+
+		result = vkAllocateDescriptorSets(_device, &allocate_info, &descriptorSet);
+		if (fresh_pool) {
+			ErrorCheck(result);
+			break;
+		}
+	}
+
+	return result == VK_SUCCESS;
+}
+
+void DescriptorAllocator::resetPools() {
+	for (auto pool : _used_pools) {
+		ErrorCheck(vkResetDescriptorPool(_device, pool, 0));
+		_free_pools.push_back(pool);
+	}
+
+	_used_pools.clear();
+	_current_pool = VK_NULL_HANDLE;
+}
+
+const DescriptorPoolStatistics & DescriptorAllocator::getStatistics() const {
+	return _statistics;
+}
+
+VkDescriptorPool DescriptorAllocator::_GrabPool() {
+	VkDescriptorPool pool;
+
+	if (!_free_pools.empty()) {
+		pool = _free_pools.back();
+		_free_pools.pop_back();
+	}
+	else {
+		pool = _CreatePool(_next_pool_set_count);
+		_next_pool_set_count = std::min(_next_pool_set_count * 2, MAX_POOL_SET_COUNT);
+	}
+
+	_used_pools.push_back(pool);
+	return pool;
+}
+
+VkDescriptorPool DescriptorAllocator::_CreatePool(uint32_t setCount) {
+	std::vector<VkDescriptorPoolSize> pool_sizes;
+
+	// Scale the average descriptor mix per set up to the size of the new pool
+	for (uint32_t type = 0; type < DESCRIPTOR_TYPE_COUNT; type++) {
+		if (_statistics.descriptorCounts[type] == 0) {
+			continue;
+		}
+
+		double per_set = (double)_statistics.descriptorCounts[type] / (double)_statistics.setCount;
+
+		VkDescriptorPoolSize pool_size {};
+		pool_size.type = (VkDescriptorType)type;
+		pool_size.descriptorCount = std::max(_largest_set_counts[type], (uint32_t)std::ceil(per_set * setCount));
+		pool_sizes.push_back(pool_size);
+	}
+
+	// No statistics yet, or the layouts did not come from the cache
+	if (pool_sizes.empty()) {
+		for (const auto & ratio : DEFAULT_POOL_RATIOS) {
+			VkDescriptorPoolSize pool_size {};
+			pool_size.type = ratio.first;
+			pool_size.descriptorCount = std::max(1u, (uint32_t)(ratio.second * setCount));
+			pool_sizes.push_back(pool_size);
+		}
+	}
+
+	VkDescriptorPoolCreateInfo pool_create_info = vkStruct<VkDescriptorPoolCreateInfo>();
+	pool_create_info.flags = _pool_flags;
+	pool_create_info.poolSizeCount = (uint32_t)pool_sizes.size();
+	pool_create_info.pPoolSizes = pool_sizes.data();
+	pool_create_info.maxSets = setCount;
+
+	VkDescriptorPool pool;
+	ErrorCheck(vkCreateDescriptorPool(_device, &pool_create_info, nullptr, &pool));
+
+	_statistics.poolCount++;
+
+	return pool;
+}
+
+void DescriptorAllocator::_RecordAllocation(VkDescriptorSetLayout layout) {
+	_statistics.setCount++;
+
+	if (nullptr == _layout_cache) {
+		return;
+	}
+
+	const std::vector<VkDescriptorSetLayoutBinding> * bindings = _layout_cache->getBindings(layout);
+	if (nullptr == bindings) {
+		return;
+	}
+
+	std::array<uint32_t, DESCRIPTOR_TYPE_COUNT> set_counts {};
+	for (const auto & binding : *bindings) {
+		set_counts[binding.descriptorType] += binding.descriptorCount;
+	}
+
+	for (uint32_t type = 0; type < DESCRIPTOR_TYPE_COUNT; type++) {
+		_statistics.descriptorCounts[type] += set_counts[type];
+		_largest_set_counts[type] = std::max(_largest_set_counts[type], set_counts[type]);
+	}
+}
\ No newline at end of file
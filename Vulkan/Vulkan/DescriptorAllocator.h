@@ -0,0 +1,97 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* DescriptorAllocator.h | Growable descriptor pools and a descriptor set layout cache
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+
+#include <vector>
+#include <array>
+#include <unordered_map>
+
+const uint32_t DESCRIPTOR_TYPE_COUNT = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT + 1; // Core types only, the cache rejects the rest
+
+// Deduplicates VkDescriptorSetLayouts with identical flags, bindings and binding flags
+class DescriptorLayoutCache {
+public:
+	DescriptorLayoutCache(VkDevice device);
+	~DescriptorLayoutCache();
+
+	VkDescriptorSetLayout createDescriptorLayout(const VkDescriptorSetLayoutCreateInfo & createInfo);
+
+	// Bindings a cached layout was created with, or nullptr if the layout is unknown
+	const std::vector<VkDescriptorSetLayoutBinding> * getBindings(VkDescriptorSetLayout layout) const;
+
+	struct LayoutInfo {
+		VkDescriptorSetLayoutCreateFlags flags;
+		std::vector<VkDescriptorSetLayoutBinding> bindings; // Sorted by binding number
+		std::vector<VkFlags> bindingFlags; // From a chained VkDescriptorSetLayoutBindingFlagsCreateInfoEXT, in the order of bindings. Empty without one
+
+		bool operator==(const LayoutInfo & other) const;
+	};
+
+	// Mixes the flags, each binding's number, type, stages and count, and the binding flags. Immutable samplers are left
+	// to operator==
+	struct LayoutHash {
+		size_t operator()(const LayoutInfo & info) const;
+	};
+
+private:
+	VkDevice _device = VK_NULL_HANDLE;
+
+	std::unordered_map<LayoutInfo, VkDescriptorSetLayout, LayoutHash> _layouts;
+	std::unordered_map<VkDescriptorSetLayout, const LayoutInfo *> _layout_infos;
+};
+
+struct DescriptorPoolStatistics {
+	uint64_t setCount;
+	std::array<uint64_t, DESCRIPTOR_TYPE_COUNT> descriptorCounts;
+	uint32_t poolCount;
+};
+
+// Allocates descriptor sets from a chain of pools, adding a larger pool whenever the current one runs dry.
+// New pools are sized from the descriptor mix seen so far, which needs the layouts to come from layoutCache.
+// Per-frame allocators free all of their sets at once with resetPools().
+class DescriptorAllocator {
+public:
+	DescriptorAllocator(VkDevice device, const DescriptorLayoutCache * layoutCache, VkDescriptorPoolCreateFlags poolFlags = 0, uint32_t initialSetCount = 16);
+	~DescriptorAllocator();
+
+	NODISCARD bool allocate(VkDescriptorSetLayout layout, VkDescriptorSet & descriptorSet);
+	void resetPools();
+
+	const DescriptorPoolStatistics & getStatistics() const;
+
+private:
+	VkDescriptorPool _GrabPool();
+	VkDescriptorPool _CreatePool(uint32_t setCount);
+	void _RecordAllocation(VkDescriptorSetLayout layout);
+
+	VkDevice _device = VK_NULL_HANDLE;
+	const DescriptorLayoutCache * _layout_cache = nullptr;
+	VkDescriptorPoolCreateFlags _pool_flags = 0;
+
+	VkDescriptorPool _current_pool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorPool> _used_pools;
+	std::vector<VkDescriptorPool> _free_pools;
+
+	uint32_t _next_pool_set_count = 16;
+
+	DescriptorPoolStatistics _statistics {};
+	std::array<uint32_t, DESCRIPTOR_TYPE_COUNT> _largest_set_counts {}; // A new pool always fits the largest set seen
+};
\ No newline at end of file
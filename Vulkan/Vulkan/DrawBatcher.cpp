@@ -0,0 +1,166 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* DrawBatcher.cpp | Groups repeated meshes into instanced draws
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "DrawBatcher.h"
+#include "util.h"
+#include "DeletionQueue.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cstring>
+
+DrawBatcher::DrawBatcher(Renderer * renderer, uint32_t frameCount, uint32_t initialInstanceCount) {
+	_renderer = renderer;
+
+	_frame_buffers.resize(frameCount);
+	for (auto & frame_buffer : _frame_buffers) {
+		_CreateFrameBuffer(frame_buffer, initialInstanceCount);
+	}
+}
+
+DrawBatcher::~DrawBatcher() {
+	for (auto & frame_buffer : _frame_buffers) {
+		_DestroyFrameBuffer(frame_buffer);
+	}
+	_frame_buffers.clear();
+}
+
+void DrawBatcher::begin(uint32_t frame) {
+	assert(frame < _frame_buffers.size());
+	_frame = frame;
+
+	for (uint32_t i = 0; i < _batch_count; i++) {
+		_batches[i].instances.clear();
+	}
+	_batch_count = 0;
+
+	LinearArena * arena = _renderer->getFrameArena()->get();
+	_batch_lookup = arena->create<BatchLookup>(std::max((size_t)_batches.size(), (size_t)16), BatchKeyHash(), std::equal_to<BatchKey>(), ArenaAllocator<std::pair<const BatchKey, uint32_t>>(arena));
+	_instance_count = 0;
+}
+
+void DrawBatcher::draw(const Mesh * mesh, uint32_t textureIndex, const glm::mat4 & model, uint32_t lod) {
+	assert(nullptr != _batch_lookup && "DrawBatcher::begin() must be called first");
+	assert(lod < mesh->getLodCount());
+	BatchKey key = { mesh, lod, textureIndex };
+
+	auto found = _batch_lookup->find(key);
+	uint32_t batch_index;
+	if (found != _batch_lookup->end()) {
+		batch_index = found->second;
+	}
+	else {
+		batch_index = _batch_count++;
+		if (batch_index == _batches.size()) {
+			_batches.emplace_back();
+		}
+		_batches[batch_index].key = key;
+		(*_batch_lookup)[key] = batch_index;
+	}
+
+	InstanceData instance;
+	instance.model = model;
+	_batches[batch_index].instances.push_back(instance);
+	_instance_count++;
+}
+
+void DrawBatcher::record(VkCommandBuffer commandBuffer, const glm::mat4 & transform) {
+	if (_batch_count == 0) {
+		return;
+	}
+
+	FrameBuffer & frame_buffer = _frame_buffers[_frame];
+	if (_instance_count > frame_buffer.capacity) {
+		// The old buffer goes through the deletion queue, so growing never waits on the GPU
+		uint32_t capacity = std::max(frame_buffer.capacity, 1u);
+		while (capacity < _instance_count) {
+			capacity *= 2;
+		}
+
+		_DestroyFrameBuffer(frame_buffer);
+		_CreateFrameBuffer(frame_buffer, capacity);
+	}
+
+	// Keep groups sharing a mesh together so its buffers are only bound once
+	std::sort(_batches.begin(), _batches.begin() + _batch_count, [](const Batch & a, const Batch & b) {
+		return a.key.mesh < b.key.mesh;
+	});
+
+	VkDeviceSize instance_offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 1, 1, &frame_buffer.buffer, &instance_offset);
+
+	DrawPushConstants push_constants {};
+	push_constants.model = transform;
+
+	const Mesh * bound_mesh = nullptr;
+	uint32_t first_instance = 0;
+	InstanceData * instances = (InstanceData *)frame_buffer.mapped;
+
+	for (uint32_t i = 0; i < _batch_count; i++) {
+		const Batch & batch = _batches[i];
+		uint32_t instance_count = (uint32_t)batch.instances.size();
+
+		memcpy(instances + first_instance, batch.instances.data(), instance_count * sizeof(InstanceData));
+
+		if (batch.key.mesh != bound_mesh) {
+			bound_mesh = batch.key.mesh;
+
+			VkDeviceSize vertex_offset = 0;
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &bound_mesh->vertexBuffer, &vertex_offset);
+			vkCmdBindIndexBuffer(commandBuffer, bound_mesh->indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+		}
+
+		push_constants.textureIndex = batch.key.textureIndex;
+		vkCmdPushConstants(commandBuffer, _renderer->getPipelineLayout(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(DrawPushConstants), &push_constants);
+
+		// firstInstance offsets the instance-rate binding, so every group shares one buffer binding
+		MeshLod lod = bound_mesh->getLod(batch.key.lod);
+		vkCmdDrawIndexed(commandBuffer, lod.indexCount, instance_count, lod.firstIndex, bound_mesh->vertexOffset, first_instance);
+
+		first_instance += instance_count;
+	}
+}
+
+const uint32_t DrawBatcher::getInstanceCount() const {
+	return _instance_count;
+}
+
+const uint32_t DrawBatcher::getDrawCount() const {
+	return _batch_count;
+}
+
+void DrawBatcher::_CreateFrameBuffer(FrameBuffer & frameBuffer, uint32_t capacity) {
+	frameBuffer.capacity = capacity;
+
+	// Written once per frame and read once by the GPU, not worth a staging copy
+	_renderer->createBuffer(capacity * sizeof(InstanceData), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frameBuffer.buffer, frameBuffer.memory);
+	ErrorCheck(vkMapMemory(_renderer->getDevice(), frameBuffer.memory, 0, VK_WHOLE_SIZE, 0, &frameBuffer.mapped));
+}
+
+void DrawBatcher::_DestroyFrameBuffer(FrameBuffer & frameBuffer) {
+	if (frameBuffer.buffer == VK_NULL_HANDLE) {
+		return;
+	}
+
+	// Freeing the memory unmaps it
+	DeletionQueue * deletion_queue = _renderer->getDeletionQueue();
+	deletion_queue->destroyBuffer(frameBuffer.buffer);
+	deletion_queue->freeMemory(frameBuffer.memory);
+
+	frameBuffer = FrameBuffer();
+}
\ No newline at end of file
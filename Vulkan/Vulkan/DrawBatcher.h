@@ -0,0 +1,95 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* DrawBatcher.h | Groups repeated meshes into instanced draws
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Renderer.h"
+#include "Mesh.h"
+#include "LinearArena.h"
+
+#include <vector>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+
+// Collects draws for a frame and records one instanced vkCmdDrawIndexed per (mesh, LOD, texture).
+// Instance transforms go into a host visible buffer per frame, so frame i may be refilled once its
+// previous submission has finished. The batch lookup lives in the renderer's frame arena, so begin()
+// must follow FrameArena::beginFrame() for the same frame.
+class DrawBatcher {
+public:
+	DrawBatcher(Renderer * renderer, uint32_t frameCount, uint32_t initialInstanceCount = 1024);
+	~DrawBatcher();
+
+	// Starts collecting draws for a frame, dropping the previous contents
+	void begin(uint32_t frame);
+	void draw(const Mesh * mesh, uint32_t textureIndex, const glm::mat4 & model, uint32_t lod = 0);
+
+	// Uploads the instances and records the draws. transform is pushed for every group
+	void record(VkCommandBuffer commandBuffer, const glm::mat4 & transform);
+
+	const uint32_t getInstanceCount() const;
+	const uint32_t getDrawCount() const;
+
+private:
+	struct BatchKey {
+		const Mesh * mesh;
+		uint32_t lod;
+		uint32_t textureIndex;
+
+		bool operator==(const BatchKey & other) const {
+			return mesh == other.mesh && lod == other.lod && textureIndex == other.textureIndex;
+		}
+	};
+
+	struct BatchKeyHash {
+		size_t operator()(const BatchKey & key) const {
+			return std::hash<const Mesh *>()(key.mesh) ^ (std::hash<uint32_t>()(key.textureIndex) << 1) ^ (std::hash<uint32_t>()(key.lod) << 2);
+		}
+	};
+
+	struct Batch {
+		BatchKey key;
+		std::vector<InstanceData> instances;
+	};
+
+	struct FrameBuffer {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void * mapped = nullptr;
+		uint32_t capacity = 0;
+	};
+
+	void _CreateFrameBuffer(FrameBuffer & frameBuffer, uint32_t capacity);
+	void _DestroyFrameBuffer(FrameBuffer & frameBuffer);
+
+	Renderer * _renderer = nullptr;
+
+	std::vector<FrameBuffer> _frame_buffers;
+	uint32_t _frame = 0;
+
+	typedef std::unordered_map<BatchKey, uint32_t, BatchKeyHash, std::equal_to<BatchKey>, ArenaAllocator<std::pair<const BatchKey, uint32_t>>> BatchLookup;
+
+	// Batches keep their storage between frames, only _batch_count of them are live
+	std::vector<Batch> _batches;
+	uint32_t _batch_count = 0;
+	BatchLookup * _batch_lookup = nullptr; // Rebuilt in the frame arena every frame
+
+	uint32_t _instance_count = 0;
+};
\ No newline at end of file
@@ -0,0 +1,106 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* FramePacer.cpp | Latency modes and CPU side frame pacing
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FramePacer.h"
+#include "QueueTimeline.h"
+
+#include <algorithm>
+#include <thread>
+
+// Sleeping overshoots by up to a scheduler tick, so the last stretch before a deadline is spun instead
+const std::chrono::microseconds PACING_SPIN_TIME(1500);
+
+const double LATENCY_SMOOTHING = 0.1; // Weight of the newest frame in the running averages
+
+FramePacer::FramePacer(LatencyMode latencyMode, uint32_t targetFrameRate, QueueTimeline * queueTimeline) {
+	_latency_mode = latencyMode;
+	_queue_timeline = queueTimeline;
+
+	setTargetFrameRate(targetFrameRate);
+
+	_next_frame = Clock::now();
+	_last_frame = _next_frame;
+}
+
+FramePacer::~FramePacer() {
+}
+
+void FramePacer::markInput(Clock::time_point inputTime) {
+	if (inputTime != _input_time) {
+		_input_time = inputTime;
+		_input_pending = true;
+	}
+}
+
+void FramePacer::endFrame(uint64_t submission) {
+	Clock::time_point presented = Clock::now();
+
+	if (_input_pending) {
+		double latency = std::chrono::duration<double>(presented - _input_time).count();
+		_input_latency += (latency - _input_latency) * LATENCY_SMOOTHING;
+		_input_pending = false;
+	}
+
+	double interval = std::chrono::duration<double>(presented - _last_frame).count();
+	_frame_interval += (interval - _frame_interval) * LATENCY_SMOOTHING;
+	_last_frame = presented;
+
+	// Nothing queues up behind the frame, so the next one starts from an idle GPU
+	if (_latency_mode == LATENCY_MODE_LOW_LATENCY) {
+		_queue_timeline->wait(submission);
+	}
+
+	if (_target_interval == Clock::duration::zero()) {
+		return;
+	}
+
+	// A frame that ran long moves the schedule rather than making the next ones hurry to catch up
+	_next_frame = std::max(_next_frame + _target_interval, Clock::now());
+	_SleepUntil(_next_frame);
+}
+
+void FramePacer::setTargetFrameRate(uint32_t targetFrameRate) {
+	if (targetFrameRate == 0) {
+		_target_interval = Clock::duration::zero();
+		return;
+	}
+	_target_interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFrameRate));
+}
+
+const LatencyMode FramePacer::getLatencyMode() const {
+	return _latency_mode;
+}
+
+const double FramePacer::getFrameInterval() const {
+	return _frame_interval;
+}
+
+const double FramePacer::getInputLatency() const {
+	return _input_latency;
+}
+
+void FramePacer::_SleepUntil(Clock::time_point deadline) {
+	Clock::time_point now = Clock::now();
+	if (deadline - now > PACING_SPIN_TIME) {
+		std::this_thread::sleep_for(deadline - now - PACING_SPIN_TIME);
+	}
+
+	while (Clock::now() < deadline) {
+		std::this_thread::yield();
+	}
+}
\ No newline at end of file
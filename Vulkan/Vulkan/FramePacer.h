@@ -0,0 +1,75 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* FramePacer.h | Latency modes and CPU side frame pacing
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+
+#include <chrono>
+
+class QueueTimeline;
+
+// What presentation favours. The window maps a mode onto a present mode and swapchain image count, the pacer
+// onto how far the CPU may run ahead
+enum LatencyMode {
+	LATENCY_MODE_LOW_LATENCY, // MAILBOX or FIFO with the fewest images, one frame in flight
+	LATENCY_MODE_VSYNC, // FIFO, never tears
+	LATENCY_MODE_UNCAPPED // IMMEDIATE where available, as many frames as the GPU can take
+};
+
+// Holds the frame loop to a target interval and measures latency from input to present. Input is sampled after
+// the pacer has slept, so the time spent waiting does not count against the frame shown.
+// Latency runs from when the OS delivered the newest input to endFrame() of the first frame built from it, which is
+// when that frame is queued for presentation; when it reaches the display is up to the presentation engine.
+class FramePacer {
+public:
+	// targetFrameRate of 0 leaves pacing to the present mode
+	FramePacer(LatencyMode latencyMode, uint32_t targetFrameRate, QueueTimeline * queueTimeline);
+	~FramePacer();
+
+	// Right after input was sampled for a frame, with the time the newest input arrived. Frames without new input
+	// leave the latency alone
+	void markInput(std::chrono::high_resolution_clock::time_point inputTime);
+	// Right after the frame was presented. Waits until the next frame is due, and in LATENCY_MODE_LOW_LATENCY for the
+	// frame's submission to complete, so the next frame's input is as fresh as possible
+	void endFrame(uint64_t submission);
+
+	void setTargetFrameRate(uint32_t targetFrameRate);
+
+	const LatencyMode getLatencyMode() const;
+	// Smoothed over recent frames, in seconds
+	const double getFrameInterval() const;
+	const double getInputLatency() const;
+
+private:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	void _SleepUntil(Clock::time_point deadline);
+
+	LatencyMode _latency_mode = LATENCY_MODE_VSYNC;
+	QueueTimeline * _queue_timeline = nullptr;
+
+	Clock::duration _target_interval = Clock::duration::zero();
+	Clock::time_point _next_frame;
+	Clock::time_point _last_frame;
+	Clock::time_point _input_time;
+	bool _input_pending = false;
+
+	double _frame_interval = 0.0;
+	double _input_latency = 0.0;
+};
\ No newline at end of file
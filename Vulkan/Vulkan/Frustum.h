@@ -0,0 +1,61 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* Frustum.h | View frustum planes for culling
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <array>
+
+#include <glm/glm.hpp>
+
+// Planes point inwards, a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them
+struct Frustum {
+	std::array<glm::vec4, 6> planes;
+
+	// Gribb/Hartmann, with Vulkan's 0 to 1 clip depth. Planes end up in the space viewProjection transforms from
+	static Frustum fromViewProjection(const glm::mat4 & m) {
+		glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		Frustum frustum;
+		frustum.planes = { {
+			row3 + row0, // Left
+			row3 - row0, // Right
+			row3 + row1, // Bottom
+			row3 - row1, // Top
+			row2, // Near
+			row3 - row2 // Far
+		} };
+
+		for (auto & plane : frustum.planes) {
+			plane = plane / glm::length(glm::vec3(plane));
+		}
+
+		return frustum;
+	}
+
+	bool intersectsSphere(const glm::vec3 & centre, float radius) const {
+		for (const auto & plane : planes) {
+			if (glm::dot(glm::vec3(plane), centre) + plane.w < -radius) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
\ No newline at end of file
@@ -3,10 +3,79 @@
 
 layout(location = 0) in vec3 mbrot_pos;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragPosition;
+layout(location = 3) in vec3 fragNormal;
+layout(location = 4) in float fragViewDepth;
 
 layout(location = 0) out vec4 color;
 
-layout(binding = 1) uniform sampler2D texSampler;
+// Bindless texture table, sized to the device limits by the renderer
+layout(constant_id = 3) const uint TEXTURE_TABLE_SIZE = 128;
+layout(binding = 1) uniform sampler2D textures[TEXTURE_TABLE_SIZE];
+
+// Must match DrawPushConstants in Renderer.h
+layout(push_constant) uniform DrawConstants {
+	mat4 model;
+	uint textureIndex;
+} draw;
+
+// Specialized per pipeline variant so the iteration loop can be unrolled and folded
+layout(constant_id = 0) const int MAX_ITERATIONS = 100;
+layout(constant_id = 1) const float ESCAPE_RADIUS = 2.0;
+layout(constant_id = 2) const float PALETTE_SCALE = 100.0;
+
+// Clustered point lights, filled in by ClusterLights.comp. Must match ClusteredLighting.h
+const uint CLUSTER_GRID_X = 16;
+const uint CLUSTER_GRID_Y = 9;
+const uint CLUSTER_GRID_Z = 24;
+const uint MAX_LIGHTS_PER_CLUSTER = 128;
+
+struct PointLight {
+	vec4 positionRadius;
+	vec4 color;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer Lights {
+	PointLight lights[];
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer Clusters {
+	vec4 ambient;
+	vec2 tileSize;
+	float sliceScale;
+	float sliceBias;
+	uint entries[];
+} clusters;
+
+// Mirrors ClusteredLighting::findCluster
+uint find_cluster(vec2 frag_coord, float view_depth) {
+	uvec2 tile = min(uvec2(max(frag_coord / clusters.tileSize, 0.0)), uvec2(CLUSTER_GRID_X, CLUSTER_GRID_Y) - 1u);
+	uint slice = min(uint(max(log(max(view_depth, 1e-6)) * clusters.sliceScale + clusters.sliceBias, 0.0)), CLUSTER_GRID_Z - 1u);
+	return (slice * CLUSTER_GRID_Y + tile.y) * CLUSTER_GRID_X + tile.x;
+}
+
+// Only the lights binned into this fragment's cluster are evaluated
+vec3 clustered_lighting(vec3 position, vec3 normal, float view_depth) {
+	uint base = find_cluster(gl_FragCoord.xy, view_depth) * (1u + MAX_LIGHTS_PER_CLUSTER);
+	uint count = clusters.entries[base];
+
+	vec3 n = normalize(normal);
+	vec3 light = clusters.ambient.rgb;
+	for (uint i = 0u; i < count; i++) {
+		PointLight point_light = lights[clusters.entries[base + 1u + i]];
+
+		vec3 to_light = point_light.positionRadius.xyz - position;
+		float distance_squared = max(dot(to_light, to_light), 1e-8);
+		float radius = point_light.positionRadius.w;
+
+		// Reaches zero at the radius, so a light never lights anything outside the clusters it was binned into
+		float window = clamp(1.0 - (distance_squared * distance_squared) / (radius * radius * radius * radius), 0.0, 1.0);
+		float diffuse = max(dot(n, to_light * inversesqrt(distance_squared)), 0.0);
+
+		light += point_light.color.rgb * diffuse * window * window;
+	}
+	return light;
+}
 
 const vec4 K = vec4(1.0, 0.66, 0.33, 3.0);
 
@@ -16,7 +85,7 @@ vec4 hsv_to_rgb(float hue, float saturation, float value) {
 }
 
 vec4 i_to_rgb(int i) {
-	float hue = float(i) / 100.0;
+	float hue = float(i) / PALETTE_SCALE;
 	return hsv_to_rgb(hue, 0.5, 0.8);
 }
 
@@ -30,8 +99,9 @@ vec2 mandelbrot(vec2 c, vec2 c0) {
 
 vec4 iterate_pixel(vec2 position) {
 	vec2 c = vec2(0);
-	for (int i = 0; i < 100; i++) {
-		if (c.x*c.x + c.y*c.y > 2.0*2.0) {
+	float escape = ESCAPE_RADIUS * ESCAPE_RADIUS;
+	for (int i = 0; i < MAX_ITERATIONS; i++) {
+		if (c.x*c.x + c.y*c.y > escape) {
 			return i_to_rgb(i);
 		}
 		c = mandelbrot(c, position);
@@ -40,5 +110,6 @@ vec4 iterate_pixel(vec2 position) {
 }
 
 void main() {
-	color = vec4(iterate_pixel(mbrot_pos.xy).rgb * texture(texSampler, fragTexCoord).rgb, 1.0);
+	vec3 albedo = iterate_pixel(mbrot_pos.xy).rgb * texture(textures[draw.textureIndex], fragTexCoord).rgb;
+	color = vec4(albedo * clustered_lighting(fragPosition, fragNormal, fragViewDepth), 1.0);
 }
\ No newline at end of file
@@ -3,11 +3,76 @@
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragPosition;
+layout(location = 3) in vec3 fragNormal;
+layout(location = 4) in float fragViewDepth;
 
 layout(location = 0) out vec4 outColor;
 
-layout(binding = 1) uniform sampler2D texSampler;
+// Bindless texture table, sized to the device limits by the renderer
+layout(constant_id = 3) const uint TEXTURE_TABLE_SIZE = 128;
+layout(binding = 1) uniform sampler2D textures[TEXTURE_TABLE_SIZE];
+
+// Must match DrawPushConstants in Renderer.h
+layout(push_constant) uniform DrawConstants {
+	mat4 model;
+	uint textureIndex;
+} draw;
+
+// Clustered point lights, filled in by ClusterLights.comp. Must match ClusteredLighting.h
+const uint CLUSTER_GRID_X = 16;
+const uint CLUSTER_GRID_Y = 9;
+const uint CLUSTER_GRID_Z = 24;
+const uint MAX_LIGHTS_PER_CLUSTER = 128;
+
+struct PointLight {
+	vec4 positionRadius;
+	vec4 color;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer Lights {
+	PointLight lights[];
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer Clusters {
+	vec4 ambient;
+	vec2 tileSize;
+	float sliceScale;
+	float sliceBias;
+	uint entries[];
+} clusters;
+
+// Mirrors ClusteredLighting::findCluster
+uint find_cluster(vec2 frag_coord, float view_depth) {
+	uvec2 tile = min(uvec2(max(frag_coord / clusters.tileSize, 0.0)), uvec2(CLUSTER_GRID_X, CLUSTER_GRID_Y) - 1u);
+	uint slice = min(uint(max(log(max(view_depth, 1e-6)) * clusters.sliceScale + clusters.sliceBias, 0.0)), CLUSTER_GRID_Z - 1u);
+	return (slice * CLUSTER_GRID_Y + tile.y) * CLUSTER_GRID_X + tile.x;
+}
+
+// Only the lights binned into this fragment's cluster are evaluated
+vec3 clustered_lighting(vec3 position, vec3 normal, float view_depth) {
+	uint base = find_cluster(gl_FragCoord.xy, view_depth) * (1u + MAX_LIGHTS_PER_CLUSTER);
+	uint count = clusters.entries[base];
+
+	vec3 n = normalize(normal);
+	vec3 light = clusters.ambient.rgb;
+	for (uint i = 0u; i < count; i++) {
+		PointLight point_light = lights[clusters.entries[base + 1u + i]];
+
+		vec3 to_light = point_light.positionRadius.xyz - position;
+		float distance_squared = max(dot(to_light, to_light), 1e-8);
+		float radius = point_light.positionRadius.w;
+
+		// Reaches zero at the radius, so a light never lights anything outside the clusters it was binned into
+		float window = clamp(1.0 - (distance_squared * distance_squared) / (radius * radius * radius * radius), 0.0, 1.0);
+		float diffuse = max(dot(n, to_light * inversesqrt(distance_squared)), 0.0);
+
+		light += point_light.color.rgb * diffuse * window * window;
+	}
+	return light;
+}
 
 void main() {
-    outColor = texture(texSampler, fragTexCoord); // vec4(fragColor * texture(texSampler, fragTexCoord).rgb, 1.0);
+	vec4 albedo = texture(textures[draw.textureIndex], fragTexCoord);
+    outColor = vec4(albedo.rgb * clustered_lighting(fragPosition, fragNormal, fragViewDepth), albedo.a);
 }
\ No newline at end of file
@@ -4,22 +4,39 @@
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in mat4 instanceModel; // Per instance, locations 3-6
+layout(location = 7) in vec3 inNormal;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec3 fragPosition; // World space, for lighting
+layout(location = 3) out vec3 fragNormal;
+layout(location = 4) out float fragViewDepth; // Picks the light cluster
 
 layout(binding = 0) uniform UniformBufferObject {
-	mat4 model;
 	mat4 view;
 	mat4 projection;
 } ubo;
 
+// Must match DrawPushConstants in Renderer.h
+layout(push_constant) uniform DrawConstants {
+	mat4 model;
+	uint textureIndex;
+} draw;
+
 out gl_PerVertex {
     vec4 gl_Position;
 };
 
 void main() {
-    gl_Position = ubo.projection * ubo.view * ubo.model * vec4(inPosition, 1.0);
+	mat4 model = draw.model * instanceModel;
+	vec4 world_position = model * vec4(inPosition, 1.0);
+	vec4 view_position = ubo.view * world_position;
+
+    gl_Position = ubo.projection * view_position;
     fragColor = inColor;
 	fragTexCoord = inTexCoord;
+	fragPosition = world_position.xyz;
+	fragNormal = mat3(model) * inNormal; // Instances are only ever scaled uniformly
+	fragViewDepth = -view_position.z;
 }
\ No newline at end of file
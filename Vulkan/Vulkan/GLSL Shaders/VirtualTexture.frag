@@ -0,0 +1,131 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragPosition;
+layout(location = 3) in vec3 fragNormal;
+layout(location = 4) in float fragViewDepth;
+
+layout(location = 0) out vec4 outColor;
+
+const uint MAX_VIRTUAL_TEXTURE_MIPS = 16;
+const uint PAGE_RESIDENT_BIT = 0x80000000u;
+
+// Must match VirtualTextureMip in VirtualTexture.h
+struct VirtualTextureMip {
+	uint firstPage;
+	uint pagesX;
+	uint pagesY;
+	uint padding;
+};
+
+layout(set = 2, binding = 0) uniform sampler2D pageCache;
+
+// Must match VirtualTextureInfo in VirtualTexture.h, followed by one entry per page
+layout(std430, set = 2, binding = 1) readonly buffer PageTable {
+	uvec2 size;
+	uint tileSize;
+	uint border;
+	uint mipCount;
+	uint cacheSize;
+	uvec2 padding;
+	VirtualTextureMip mips[MAX_VIRTUAL_TEXTURE_MIPS];
+	uint entries[];
+} pageTable;
+
+layout(std430, set = 2, binding = 2) buffer Feedback {
+	uint requested[];
+} feedback;
+
+// Clustered point lights, filled in by ClusterLights.comp. Must match ClusteredLighting.h
+const uint CLUSTER_GRID_X = 16;
+const uint CLUSTER_GRID_Y = 9;
+const uint CLUSTER_GRID_Z = 24;
+const uint MAX_LIGHTS_PER_CLUSTER = 128;
+
+struct PointLight {
+	vec4 positionRadius;
+	vec4 color;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer Lights {
+	PointLight lights[];
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer Clusters {
+	vec4 ambient;
+	vec2 tileSize;
+	float sliceScale;
+	float sliceBias;
+	uint entries[];
+} clusters;
+
+// Mirrors ClusteredLighting::findCluster
+uint find_cluster(vec2 frag_coord, float view_depth) {
+	uvec2 tile = min(uvec2(max(frag_coord / clusters.tileSize, 0.0)), uvec2(CLUSTER_GRID_X, CLUSTER_GRID_Y) - 1u);
+	uint slice = min(uint(max(log(max(view_depth, 1e-6)) * clusters.sliceScale + clusters.sliceBias, 0.0)), CLUSTER_GRID_Z - 1u);
+	return (slice * CLUSTER_GRID_Y + tile.y) * CLUSTER_GRID_X + tile.x;
+}
+
+// Only the lights binned into this fragment's cluster are evaluated
+vec3 clustered_lighting(vec3 position, vec3 normal, float view_depth) {
+	uint base = find_cluster(gl_FragCoord.xy, view_depth) * (1u + MAX_LIGHTS_PER_CLUSTER);
+	uint count = clusters.entries[base];
+
+	vec3 n = normalize(normal);
+	vec3 light = clusters.ambient.rgb;
+	for (uint i = 0u; i < count; i++) {
+		PointLight point_light = lights[clusters.entries[base + 1u + i]];
+
+		vec3 to_light = point_light.positionRadius.xyz - position;
+		float distance_squared = max(dot(to_light, to_light), 1e-8);
+		float radius = point_light.positionRadius.w;
+
+		// Reaches zero at the radius, so a light never lights anything outside the clusters it was binned into
+		float window = clamp(1.0 - (distance_squared * distance_squared) / (radius * radius * radius * radius), 0.0, 1.0);
+		float diffuse = max(dot(n, to_light * inversesqrt(distance_squared)), 0.0);
+
+		light += point_light.color.rgb * diffuse * window * window;
+	}
+	return light;
+}
+
+void main() {
+	// Mip from the screen space footprint in virtual texels, as the hardware would pick it
+	vec2 texel = fragTexCoord * vec2(pageTable.size);
+	vec2 dx = dFdx(texel);
+	vec2 dy = dFdy(texel);
+	float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0));
+	uint mip = min(uint(lod), pageTable.mipCount - 1);
+
+	vec2 uv = fract(fragTexCoord); // Repeat
+	VirtualTextureMip level = pageTable.mips[mip];
+	uvec2 mip_size = max(pageTable.size >> mip, uvec2(1));
+	uvec2 page = min(uvec2(uv * vec2(mip_size)) / pageTable.tileSize, uvec2(level.pagesX, level.pagesY) - 1u);
+	uint page_index = level.firstPage + page.y * level.pagesX + page.x;
+
+	// One pixel in sixteen reports the page it wanted, plenty to see every page on screen
+	uvec2 pixel = uvec2(gl_FragCoord.xy);
+	if ((pixel.x & 3u) == 0u && (pixel.y & 3u) == 0u && feedback.requested[page_index] == 0u) {
+		feedback.requested[page_index] = 1u;
+	}
+
+	uint entry = pageTable.entries[page_index];
+	if ((entry & PAGE_RESIDENT_BIT) == 0u) {
+		outColor = vec4(0.5, 0.5, 0.5, 1.0); // Not even the last mip has arrived yet
+		return;
+	}
+
+	// The entry may be for an ancestor, find the sample within that page
+	uint resident_mip = (entry >> 24) & 0x1Fu;
+	vec2 resident_texel = uv * vec2(max(pageTable.size >> resident_mip, uvec2(1)));
+	vec2 in_page = mod(resident_texel, float(pageTable.tileSize));
+	uvec2 cache_page = uvec2(entry & 0xFFFu, (entry >> 12) & 0xFFFu);
+
+	float page_size = float(pageTable.tileSize + 2u * pageTable.border);
+	vec2 cache_texel = vec2(cache_page) * page_size + float(pageTable.border) + in_page;
+
+	vec4 albedo = textureLod(pageCache, cache_texel / (page_size * float(pageTable.cacheSize)), 0.0);
+	outColor = vec4(albedo.rgb * clustered_lighting(fragPosition, fragNormal, fragViewDepth), albedo.a);
+}
\ No newline at end of file
@@ -1,12 +1,26 @@
-D:/VulkanSDK/1.0.13.0/Bin/glslangValidator.exe -V Shader.vert
+rem Builds every shader into SPIR-V and copies the results next to the project and the debug executable.
+rem Needs the Vulkan SDK installed, its installer sets VULKAN_SDK.
+cd /d "%~dp0"
+set GLSLANG="%VULKAN_SDK%\Bin\glslangValidator.exe"
+set PROJECT_DIR=%~dp0..
+set OUTPUT_DIR=%~dp0..\..\x64\Debug
+
+%GLSLANG% -V Shader.vert
 echo "Is Model On?"
 set /p input= yes or no: 
 
-if %input%==yes D:/VulkanSDK/1.0.13.0/Bin/glslangValidator.exe -V Shader.frag
-if %input%==no D:/VulkanSDK/1.0.13.0/Bin/glslangValidator.exe -V Fractal.frag
+if %input%==yes %GLSLANG% -V Shader.frag
+if %input%==no %GLSLANG% -V Fractal.frag
+
+%GLSLANG% -V Cull.comp -o cull.spv
+%GLSLANG% -V ClusterCull.comp -o cluster_cull.spv
+%GLSLANG% -V DepthPyramid.comp -o depth_pyramid.spv
+%GLSLANG% -V DepthPyramidMultisample.comp -o depth_pyramid_ms.spv
+%GLSLANG% -V ClusterLights.comp -o cluster_lights.spv
+%GLSLANG% -V VirtualTexture.frag -o virtual_texture_frag.spv
 
-COPY vert.spv D:\Programming\Github\Graphics\Vulkan\VulkanTesting\Vulkan\x64\Debug\vert.spv
-COPY frag.spv D:\Programming\Github\Graphics\Vulkan\VulkanTesting\Vulkan\x64\Debug\frag.spv
-COPY vert.spv D:\Programming\Github\Graphics\Vulkan\VulkanTesting\Vulkan\Vulkan\vert.spv
-COPY frag.spv D:\Programming\Github\Graphics\Vulkan\VulkanTesting\Vulkan\Vulkan\frag.spv
+for %%f in (vert.spv frag.spv cull.spv cluster_cull.spv depth_pyramid.spv depth_pyramid_ms.spv cluster_lights.spv virtual_texture_frag.spv) do (
+	COPY %%f "%PROJECT_DIR%\%%f"
+	if exist "%OUTPUT_DIR%" COPY %%f "%OUTPUT_DIR%\%%f"
+)
 pause
\ No newline at end of file
@@ -0,0 +1,612 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* GpuCuller.cpp | GPU frustum and occlusion culling feeding indirect draws
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "GpuCuller.h"
+#include "DescriptorAllocator.h"
+#include "DeletionQueue.h"
+#include "Frustum.h"
+#include "util.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+const std::string CULL_PATH = "cull.spv";
+const std::string CLUSTER_CULL_PATH = "cluster_cull.spv";
+const std::string DEPTH_PYRAMID_PATH = "depth_pyramid.spv";
+const std::string DEPTH_PYRAMID_MULTISAMPLE_PATH = "depth_pyramid_ms.spv";
+
+const uint32_t CULL_GROUP_SIZE = 64; // local_size_x in Cull.comp
+const uint32_t PYRAMID_GROUP_SIZE = 8; // local_size_x/y in DepthPyramid.comp
+
+// Every entry is walked by the draw, visible or not, so this trades coverage against command processing.
+// Objects whose clusters do not fit are drawn whole instead
+const uint32_t MAX_CLUSTER_DRAWS = 16384;
+
+struct PyramidLevelPushConstants { // Must match PyramidLevel in DepthPyramid.comp
+	int32_t sourceSize[2];
+	int32_t destinationSize[2];
+};
+
+static uint32_t previousPowerOfTwo(uint32_t value) {
+	uint32_t result = 1;
+	while (result * 2 <= value) {
+		result *= 2;
+	}
+	return result;
+}
+
+GpuCuller::GpuCuller(Renderer * renderer, VkCommandPool commandPool, VkImageView depthImageView, uint32_t width, uint32_t height) {
+	_renderer = renderer;
+	_device = renderer->getDevice();
+	_command_pool = commandPool;
+
+	_depth_extent = { width, height };
+
+	const VkPhysicalDeviceFeatures & features = _renderer->getPhysicalDeviceFeatures();
+	_multi_draw_indirect = features.multiDrawIndirect == VK_TRUE;
+	_first_instance = features.drawIndirectFirstInstance == VK_TRUE;
+	_max_cluster_draws = std::min(MAX_CLUSTER_DRAWS, _renderer->getPhysicalDeviceProperties().limits.maxDrawIndirectCount);
+
+	_InitPipelines();
+	_InitDepthPyramid(depthImageView);
+}
+
+GpuCuller::~GpuCuller() {
+	_DeInitDepthPyramid();
+	_DeInitPipelines();
+	_DestroyBuffers();
+}
+
+uint32_t GpuCuller::addMesh(const Mesh & mesh) {
+	if (_meshes.empty()) {
+		_vertex_buffer = mesh.vertexBuffer;
+		_index_buffer = mesh.indexBuffer;
+	}
+	assert(mesh.vertexBuffer == _vertex_buffer && mesh.indexBuffer == _index_buffer);
+
+	_meshes.push_back(mesh);
+	_mesh_object_counts.push_back(0);
+
+	return (uint32_t)_meshes.size() - 1;
+}
+
+void GpuCuller::addObject(uint32_t meshIndex, const glm::mat4 & model) {
+	assert(meshIndex < _meshes.size());
+
+	CullObject object {};
+	object.model = model;
+	object.meshIndex = meshIndex;
+	_objects.push_back(object);
+
+	_mesh_object_counts[meshIndex]++;
+}
+
+void GpuCuller::upload() {
+	_DestroyBuffers();
+
+	if (_objects.empty()) {
+		return;
+	}
+
+	// Goes through a staging buffer into device local memory
+	auto upload_buffer = [&](const void * data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer & buffer, VkDeviceMemory & memory) {
+		VkBuffer staging_buffer;
+		VkDeviceMemory staging_buffer_memory;
+		_renderer->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging_buffer, staging_buffer_memory);
+
+		void * mapped;
+		ErrorCheck(vkMapMemory(_device, staging_buffer_memory, 0, size, 0, &mapped));
+		memcpy(mapped, data, (size_t)size);
+		vkUnmapMemory(_device, staging_buffer_memory);
+
+		_renderer->createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
+		_renderer->copyBuffer(_command_pool, staging_buffer, buffer, size);
+
+		_renderer->getDeletionQueue()->destroyBuffer(staging_buffer);
+		_renderer->getDeletionQueue()->freeMemory(staging_buffer_memory);
+	};
+
+	// Each mesh LOD gets a run of visible instance slots big enough for all of the mesh's objects
+	std::vector<CullMesh> cull_meshes(_meshes.size());
+	std::vector<VkDrawIndexedIndirectCommand> commands;
+	std::vector<Meshlet> meshlets;
+	_command_instance_bases.clear();
+
+	// Cluster draws all come from one multi draw, each picking its object's instance with firstInstance
+	bool cluster_culling_supported = _multi_draw_indirect && _first_instance && _max_cluster_draws > 0;
+	_cluster_culling = false;
+
+	uint32_t instance_base = 0;
+	for (size_t i = 0; i < _meshes.size(); i++) {
+		uint32_t lod_count = std::min(_meshes[i].getLodCount(), MAX_MESH_LODS);
+
+		cull_meshes[i] = CullMesh {};
+		cull_meshes[i].boundingSphere = _meshes[i].boundingSphere;
+		cull_meshes[i].instanceBase = instance_base;
+		cull_meshes[i].objectCount = _mesh_object_counts[i];
+		cull_meshes[i].commandBase = (uint32_t)commands.size();
+		cull_meshes[i].lodCount = lod_count;
+
+		if (cluster_culling_supported && !_meshes[i].meshlets.empty()) {
+			cull_meshes[i].meshletBase = (uint32_t)meshlets.size();
+			cull_meshes[i].meshletCount = (uint32_t)_meshes[i].meshlets.size();
+			meshlets.insert(meshlets.end(), _meshes[i].meshlets.begin(), _meshes[i].meshlets.end());
+			_cluster_culling = true;
+		}
+
+		for (uint32_t level = 0; level < lod_count; level++) {
+			MeshLod lod = _meshes[i].getLod(level);
+			cull_meshes[i].lodErrors[level] = lod.error;
+
+			VkDrawIndexedIndirectCommand command {};
+			command.indexCount = lod.indexCount;
+			command.instanceCount = 0; // Filled in by Cull.comp
+			command.firstIndex = lod.firstIndex;
+			command.vertexOffset = _meshes[i].vertexOffset;
+			command.firstInstance = _first_instance ? instance_base : 0;
+			commands.push_back(command);
+
+			_command_instance_bases.push_back(instance_base);
+			instance_base += _mesh_object_counts[i];
+		}
+	}
+
+	// Every cluster of every object could survive, so that bounds the draws rather than the device limit alone
+	uint64_t cluster_count = 0;
+	for (const CullObject & object : _objects) {
+		cluster_count += cull_meshes[object.meshIndex].meshletCount;
+	}
+	_cluster_draw_count = (uint32_t)std::min<uint64_t>(cluster_count, _max_cluster_draws);
+	_cluster_culling = _cluster_draw_count > 0;
+
+	_cluster_instance_base = instance_base;
+	if (_cluster_culling) {
+		instance_base += (uint32_t)_objects.size();
+	}
+
+	if (meshlets.empty()) {
+		meshlets.push_back(Meshlet {}); // Storage buffers cannot be empty
+	}
+
+	VkDeviceSize command_buffer_size = commands.size() * sizeof(VkDrawIndexedIndirectCommand);
+
+	upload_buffer(_objects.data(), _objects.size() * sizeof(CullObject), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, _object_buffer, _object_buffer_memory);
+	upload_buffer(cull_meshes.data(), cull_meshes.size() * sizeof(CullMesh), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, _mesh_buffer, _mesh_buffer_memory);
+	upload_buffer(commands.data(), command_buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, _command_template_buffer, _command_template_buffer_memory);
+
+	_renderer->createBuffer(command_buffer_size, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _command_buffer, _command_buffer_memory);
+	_renderer->createBuffer(instance_base * sizeof(InstanceData), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _visible_instance_buffer, _visible_instance_buffer_memory);
+	_renderer->createBuffer(sizeof(CullData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _cull_data_buffer, _cull_data_buffer_memory);
+
+	upload_buffer(meshlets.data(), meshlets.size() * sizeof(Meshlet), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, _meshlet_buffer, _meshlet_buffer_memory);
+	_renderer->createBuffer(sizeof(ClusterWork) + _objects.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _cluster_work_buffer, _cluster_work_buffer_memory);
+	_renderer->createBuffer(std::max(_cluster_draw_count, 1u) * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _cluster_draw_buffer, _cluster_draw_buffer_memory);
+
+	if (_cull_set == VK_NULL_HANDLE) {
+		if (!_renderer->getDescriptorAllocator()->allocate(_cull_set_layout, _cull_set)) {
+			throw std::runtime_error("Failed to allocate the culling descriptor set");
+		}
+	}
+
+	std::array<VkDescriptorBufferInfo, 9> buffer_infos {};
+	buffer_infos[0] = { _cull_data_buffer, 0, VK_WHOLE_SIZE };
+	buffer_infos[1] = { _object_buffer, 0, VK_WHOLE_SIZE };
+	buffer_infos[2] = { _mesh_buffer, 0, VK_WHOLE_SIZE };
+	buffer_infos[3] = { _command_buffer, 0, VK_WHOLE_SIZE };
+	buffer_infos[4] = { _visible_instance_buffer, 0, VK_WHOLE_SIZE };
+	buffer_infos[6] = { _meshlet_buffer, 0, VK_WHOLE_SIZE };
+	buffer_infos[7] = { _cluster_work_buffer, 0, VK_WHOLE_SIZE };
+	buffer_infos[8] = { _cluster_draw_buffer, 0, VK_WHOLE_SIZE };
+
+	VkDescriptorImageInfo pyramid_info {};
+	pyramid_info.sampler = _pyramid_sampler;
+	pyramid_info.imageView = _pyramid_view;
+	pyramid_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	std::array<VkWriteDescriptorSet, 9> descriptor_writes {};
+	for (uint32_t i = 0; i < descriptor_writes.size(); i++) {
+		descriptor_writes[i] = vkStruct<VkWriteDescriptorSet>();
+		descriptor_writes[i].dstSet = _cull_set;
+		descriptor_writes[i].dstBinding = i;
+		descriptor_writes[i].descriptorCount = 1;
+
+		if (i == 0) {
+			descriptor_writes[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			descriptor_writes[i].pBufferInfo = &buffer_infos[i];
+		}
+		else if (i == 5) {
+			descriptor_writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptor_writes[i].pImageInfo = &pyramid_info;
+		}
+		else {
+			descriptor_writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptor_writes[i].pBufferInfo = &buffer_infos[i];
+		}
+	}
+
+	vkUpdateDescriptorSets(_device, (uint32_t)descriptor_writes.size(), descriptor_writes.data(), 0, nullptr);
+}
+
+void GpuCuller::cull(VkCommandBuffer commandBuffer, const glm::mat4 & viewProjection, const glm::vec3 & cameraPosition, float lodScale, float lodThreshold) {
+	if (_objects.empty()) {
+		return;
+	}
+
+	CullData cull_data {};
+	cull_data.viewProjection = viewProjection;
+	cull_data.previousViewProjection = _pyramid_valid ? _previous_view_projection : viewProjection;
+	cull_data.frustumPlanes = Frustum::fromViewProjection(viewProjection).planes;
+	cull_data.pyramidSize = glm::vec2((float)_pyramid_extent.width, (float)_pyramid_extent.height);
+	cull_data.pyramidLevels = _pyramid_levels;
+	cull_data.objectCount = (uint32_t)_objects.size();
+	cull_data.occlusionEnabled = _pyramid_valid ? 1 : 0;
+	cull_data.lodScale = lodScale;
+	cull_data.lodThreshold = lodThreshold;
+	cull_data.clusterInstanceBase = _cluster_instance_base;
+	cull_data.maxClusterDraws = _cluster_culling ? _cluster_draw_count : 0;
+	cull_data.cameraPosition = glm::vec4(cameraPosition, 1.0f);
+
+	// The previous frame may still be reading the commands and cull data
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	vkCmdUpdateBuffer(commandBuffer, _cull_data_buffer, 0, sizeof(CullData), (const uint32_t *)&cull_data);
+
+	VkBufferCopy command_copy {};
+	command_copy.size = _command_instance_bases.size() * sizeof(VkDrawIndexedIndirectCommand);
+	vkCmdCopyBuffer(commandBuffer, _command_template_buffer, _command_buffer, 1, &command_copy);
+
+	if (_cluster_culling) {
+		ClusterWork cluster_work {};
+		cluster_work.dispatch = { 0, 1, 1 };
+		vkCmdUpdateBuffer(commandBuffer, _cluster_work_buffer, 0, sizeof(ClusterWork), (const uint32_t *)&cluster_work);
+		vkCmdFillBuffer(commandBuffer, _cluster_draw_buffer, 0, VK_WHOLE_SIZE, 0);
+	}
+
+	VkMemoryBarrier upload_barrier = vkStruct<VkMemoryBarrier>();
+	upload_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	upload_barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	// Also orders the visible instance writes after the previous frame's vertex fetches
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &upload_barrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _cull_pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _cull_pipeline_layout, 0, 1, &_cull_set, 0, nullptr);
+	vkCmdDispatch(commandBuffer, ((uint32_t)_objects.size() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	if (_cluster_culling) {
+		VkMemoryBarrier candidate_barrier = vkStruct<VkMemoryBarrier>();
+		candidate_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		candidate_barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &candidate_barrier, 0, nullptr, 0, nullptr);
+
+		// One workgroup per object the cull pass handed over
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _cluster_cull_pipeline);
+		vkCmdDispatchIndirect(commandBuffer, _cluster_work_buffer, 0);
+	}
+
+	VkMemoryBarrier cull_barrier = vkStruct<VkMemoryBarrier>();
+	cull_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cull_barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &cull_barrier, 0, nullptr, 0, nullptr);
+
+	// The depth this frame leaves in the pyramid was rendered from this view
+	_previous_view_projection = viewProjection;
+}
+
+void GpuCuller::draw(VkCommandBuffer commandBuffer, const glm::mat4 & transform, uint32_t textureIndex) {
+	if (_objects.empty()) {
+		return;
+	}
+
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &_vertex_buffer, &offset);
+	vkCmdBindVertexBuffers(commandBuffer, 1, 1, &_visible_instance_buffer, &offset);
+	vkCmdBindIndexBuffer(commandBuffer, _index_buffer, 0, VK_INDEX_TYPE_UINT32);
+
+	DrawPushConstants push_constants {};
+	push_constants.model = transform;
+	push_constants.textureIndex = textureIndex;
+	vkCmdPushConstants(commandBuffer, _renderer->getPipelineLayout(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(DrawPushConstants), &push_constants);
+
+	uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+	uint32_t command_count = (uint32_t)_command_instance_bases.size();
+
+	if (_cluster_culling) {
+		vkCmdDrawIndexedIndirect(commandBuffer, _cluster_draw_buffer, 0, _cluster_draw_count, stride);
+	}
+
+	if (_multi_draw_indirect && _first_instance) {
+		vkCmdDrawIndexedIndirect(commandBuffer, _command_buffer, 0, command_count, stride);
+		return;
+	}
+
+	// One call per mesh LOD, never per object
+	for (uint32_t i = 0; i < command_count; i++) {
+		if (!_first_instance) {
+			VkDeviceSize instance_offset = _command_instance_bases[i] * sizeof(InstanceData);
+			vkCmdBindVertexBuffers(commandBuffer, 1, 1, &_visible_instance_buffer, &instance_offset);
+		}
+
+		vkCmdDrawIndexedIndirect(commandBuffer, _command_buffer, i * stride, 1, stride);
+	}
+}
+
+void GpuCuller::buildDepthPyramid(VkCommandBuffer commandBuffer) {
+	// This frame's cull pass read the pyramid about to be overwritten
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	// A multisampled depth buffer needs its own first level, every level after that reads the pyramid
+	bool multisampled = _pyramid_multisample_pipeline != VK_NULL_HANDLE;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, multisampled ? _pyramid_multisample_pipeline : _pyramid_pipeline);
+
+	VkExtent2D source_extent = _depth_extent;
+	for (uint32_t level = 0; level < _pyramid_levels; level++) {
+		if (level == 1 && multisampled) {
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pyramid_pipeline);
+		}
+
+		VkExtent2D level_extent = { std::max(_pyramid_extent.width >> level, 1u), std::max(_pyramid_extent.height >> level, 1u) };
+
+		PyramidLevelPushConstants push_constants = { { (int32_t)source_extent.width, (int32_t)source_extent.height }, { (int32_t)level_extent.width, (int32_t)level_extent.height } };
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pyramid_pipeline_layout, 0, 1, &_pyramid_sets[level], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, _pyramid_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PyramidLevelPushConstants), &push_constants);
+		vkCmdDispatch(commandBuffer, (level_extent.width + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, (level_extent.height + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+
+		// The next level reads this one, and the next frame's cull reads them all
+		VkImageMemoryBarrier level_barrier = vkStruct<VkImageMemoryBarrier>();
+		level_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		level_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		level_barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		level_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		level_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		level_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		level_barrier.image = _pyramid_image;
+		level_barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &level_barrier);
+
+		source_extent = level_extent;
+	}
+
+	_pyramid_valid = true;
+}
+
+const uint32_t GpuCuller::getObjectCount() const {
+	return (uint32_t)_objects.size();
+}
+
+void GpuCuller::_InitDepthPyramid(VkImageView depthImageView) {
+	// Power of two levels, so every level above the first halves exactly
+	_pyramid_extent = { previousPowerOfTwo(_depth_extent.width), previousPowerOfTwo(_depth_extent.height) };
+	_pyramid_levels = 1;
+	while ((std::max(_pyramid_extent.width, _pyramid_extent.height) >> _pyramid_levels) > 0) {
+		_pyramid_levels++;
+	}
+
+	_renderer->createImage(_pyramid_extent.width, _pyramid_extent.height, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _pyramid_image, _pyramid_image_memory, _pyramid_levels);
+	_renderer->transitionImageLayout(_command_pool, _pyramid_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, _pyramid_levels);
+
+	_renderer->createImageView(_pyramid_image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, _pyramid_view, 0, _pyramid_levels);
+
+	_pyramid_level_views.resize(_pyramid_levels);
+	for (uint32_t level = 0; level < _pyramid_levels; level++) {
+		_renderer->createImageView(_pyramid_image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, _pyramid_level_views[level], level, 1);
+	}
+
+	VkSamplerCreateInfo sampler_info = vkStruct<VkSamplerCreateInfo>();
+	sampler_info.magFilter = VK_FILTER_NEAREST;
+	sampler_info.minFilter = VK_FILTER_NEAREST;
+	sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.minLod = 0.0f;
+	sampler_info.maxLod = (float)_pyramid_levels;
+	sampler_info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+
+	ErrorCheck(vkCreateSampler(_device, &sampler_info, nullptr, &_pyramid_sampler));
+
+	// Level 0 reduces the depth buffer itself, every other level the one below it
+	_pyramid_sets.resize(_pyramid_levels);
+	for (uint32_t level = 0; level < _pyramid_levels; level++) {
+		if (!_renderer->getDescriptorAllocator()->allocate(_pyramid_set_layout, _pyramid_sets[level])) {
+			throw std::runtime_error("Failed to allocate a depth pyramid descriptor set");
+		}
+
+		VkDescriptorImageInfo source_info {};
+		source_info.sampler = _pyramid_sampler;
+		source_info.imageView = (level == 0) ? depthImageView : _pyramid_level_views[level - 1];
+		source_info.imageLayout = (level == 0) ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+		VkDescriptorImageInfo destination_info {};
+		destination_info.imageView = _pyramid_level_views[level];
+		destination_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		std::array<VkWriteDescriptorSet, 2> descriptor_writes {};
+		descriptor_writes[0] = vkStruct<VkWriteDescriptorSet>();
+		descriptor_writes[0].dstSet = _pyramid_sets[level];
+		descriptor_writes[0].dstBinding = 0;
+		descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptor_writes[0].descriptorCount = 1;
+		descriptor_writes[0].pImageInfo = &source_info;
+
+		descriptor_writes[1] = vkStruct<VkWriteDescriptorSet>();
+		descriptor_writes[1].dstSet = _pyramid_sets[level];
+		descriptor_writes[1].dstBinding = 1;
+		descriptor_writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		descriptor_writes[1].descriptorCount = 1;
+		descriptor_writes[1].pImageInfo = &destination_info;
+
+		vkUpdateDescriptorSets(_device, (uint32_t)descriptor_writes.size(), descriptor_writes.data(), 0, nullptr);
+	}
+}
+
+void GpuCuller::_DeInitDepthPyramid() {
+	// Frames in flight may still sample the pyramid
+	DeletionQueue * deletion_queue = _renderer->getDeletionQueue();
+
+	deletion_queue->destroySampler(_pyramid_sampler);
+	_pyramid_sampler = VK_NULL_HANDLE;
+
+	for (auto & view : _pyramid_level_views) {
+		deletion_queue->destroyImageView(view);
+	}
+	_pyramid_level_views.clear();
+
+	deletion_queue->destroyImageView(_pyramid_view);
+	_pyramid_view = VK_NULL_HANDLE;
+	deletion_queue->destroyImage(_pyramid_image);
+	_pyramid_image = VK_NULL_HANDLE;
+	deletion_queue->freeMemory(_pyramid_image_memory);
+	_pyramid_image_memory = VK_NULL_HANDLE;
+
+	_pyramid_sets.clear(); // Returned with the renderer's descriptor pools
+}
+
+void GpuCuller::_InitPipelines() {
+	DescriptorLayoutCache * layout_cache = _renderer->getDescriptorLayoutCache();
+
+	{ // Cull pass
+		std::array<VkDescriptorSetLayoutBinding, 9> bindings {};
+		for (uint32_t i = 0; i < bindings.size(); i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		}
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+		VkDescriptorSetLayoutCreateInfo set_layout_create_info = vkStruct<VkDescriptorSetLayoutCreateInfo>();
+		set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+		set_layout_create_info.pBindings = bindings.data();
+
+		_cull_set_layout = layout_cache->createDescriptorLayout(set_layout_create_info);
+
+		VkPipelineLayoutCreateInfo pipeline_layout_create_info = vkStruct<VkPipelineLayoutCreateInfo>();
+		pipeline_layout_create_info.setLayoutCount = 1;
+		pipeline_layout_create_info.pSetLayouts = &_cull_set_layout;
+
+		ErrorCheck(vkCreatePipelineLayout(_device, &pipeline_layout_create_info, nullptr, &_cull_pipeline_layout));
+	}
+
+	{ // Depth pyramid reduction
+		std::array<VkDescriptorSetLayoutBinding, 2> bindings {};
+		bindings[0].binding = 0;
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[0].descriptorCount = 1;
+		bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		bindings[1].binding = 1;
+		bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		bindings[1].descriptorCount = 1;
+		bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		VkDescriptorSetLayoutCreateInfo set_layout_create_info = vkStruct<VkDescriptorSetLayoutCreateInfo>();
+		set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+		set_layout_create_info.pBindings = bindings.data();
+
+		_pyramid_set_layout = layout_cache->createDescriptorLayout(set_layout_create_info);
+
+		VkPushConstantRange push_constant_range {};
+		push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		push_constant_range.offset = 0;
+		push_constant_range.size = sizeof(PyramidLevelPushConstants);
+
+		VkPipelineLayoutCreateInfo pipeline_layout_create_info = vkStruct<VkPipelineLayoutCreateInfo>();
+		pipeline_layout_create_info.setLayoutCount = 1;
+		pipeline_layout_create_info.pSetLayouts = &_pyramid_set_layout;
+		pipeline_layout_create_info.pushConstantRangeCount = 1;
+		pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
+
+		ErrorCheck(vkCreatePipelineLayout(_device, &pipeline_layout_create_info, nullptr, &_pyramid_pipeline_layout));
+	}
+
+	auto create_compute_pipeline = [&](const std::string & path, VkPipelineLayout layout, VkPipeline & pipeline) {
+		VkShaderModule shader_module;
+		_renderer->createShaderModule(path, shader_module);
+
+		VkComputePipelineCreateInfo pipeline_create_info = vkStruct<VkComputePipelineCreateInfo>();
+		pipeline_create_info.stage = vkStruct<VkPipelineShaderStageCreateInfo>();
+		pipeline_create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipeline_create_info.stage.module = shader_module;
+		pipeline_create_info.stage.pName = "main";
+		pipeline_create_info.layout = layout;
+
+		ErrorCheck(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &pipeline_create_info, nullptr, &pipeline));
+
+		vkDestroyShaderModule(_device, shader_module, nullptr); // Not needed once the pipeline exists
+	};
+
+	create_compute_pipeline(CULL_PATH, _cull_pipeline_layout, _cull_pipeline);
+	create_compute_pipeline(CLUSTER_CULL_PATH, _cull_pipeline_layout, _cluster_cull_pipeline);
+	create_compute_pipeline(DEPTH_PYRAMID_PATH, _pyramid_pipeline_layout, _pyramid_pipeline);
+	if (_renderer->getSampleCount() != VK_SAMPLE_COUNT_1_BIT) {
+		create_compute_pipeline(DEPTH_PYRAMID_MULTISAMPLE_PATH, _pyramid_pipeline_layout, _pyramid_multisample_pipeline);
+	}
+}
+
+void GpuCuller::_DeInitPipelines() {
+	vkDestroyPipeline(_device, _cull_pipeline, nullptr);
+	_cull_pipeline = VK_NULL_HANDLE;
+	vkDestroyPipeline(_device, _cluster_cull_pipeline, nullptr);
+	_cluster_cull_pipeline = VK_NULL_HANDLE;
+	vkDestroyPipelineLayout(_device, _cull_pipeline_layout, nullptr);
+	_cull_pipeline_layout = VK_NULL_HANDLE;
+
+	vkDestroyPipeline(_device, _pyramid_pipeline, nullptr);
+	_pyramid_pipeline = VK_NULL_HANDLE;
+	if (_pyramid_multisample_pipeline != VK_NULL_HANDLE) {
+		vkDestroyPipeline(_device, _pyramid_multisample_pipeline, nullptr);
+		_pyramid_multisample_pipeline = VK_NULL_HANDLE;
+	}
+	vkDestroyPipelineLayout(_device, _pyramid_pipeline_layout, nullptr);
+	_pyramid_pipeline_layout = VK_NULL_HANDLE;
+
+	// Set layouts belong to the renderer's layout cache
+	_cull_set_layout = VK_NULL_HANDLE;
+	_pyramid_set_layout = VK_NULL_HANDLE;
+}
+
+void GpuCuller::_DestroyBuffers() {
+	// Uploading again replaces buffers that frames in flight are still culling with
+	DeletionQueue * deletion_queue = _renderer->getDeletionQueue();
+
+	auto destroy = [&](VkBuffer & buffer, VkDeviceMemory & memory) {
+		deletion_queue->destroyBuffer(buffer);
+		deletion_queue->freeMemory(memory);
+		buffer = VK_NULL_HANDLE;
+		memory = VK_NULL_HANDLE;
+	};
+
+	destroy(_object_buffer, _object_buffer_memory);
+	destroy(_mesh_buffer, _mesh_buffer_memory);
+	destroy(_command_template_buffer, _command_template_buffer_memory);
+	destroy(_command_buffer, _command_buffer_memory);
+	destroy(_visible_instance_buffer, _visible_instance_buffer_memory);
+	destroy(_cull_data_buffer, _cull_data_buffer_memory);
+	destroy(_meshlet_buffer, _meshlet_buffer_memory);
+	destroy(_cluster_work_buffer, _cluster_work_buffer_memory);
+	destroy(_cluster_draw_buffer, _cluster_draw_buffer_memory);
+}
\ No newline at end of file
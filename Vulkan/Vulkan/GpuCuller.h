@@ -0,0 +1,173 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* GpuCuller.h | GPU frustum and occlusion culling feeding indirect draws
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Renderer.h"
+#include "Mesh.h"
+
+#include <vector>
+#include <array>
+
+#include <glm/glm.hpp>
+
+// Must match the structs in Cull.comp and ClusterCull.comp
+struct CullObject {
+	glm::mat4 model;
+	uint32_t meshIndex;
+	uint32_t padding[3];
+};
+
+struct CullMesh {
+	glm::vec4 boundingSphere;
+	uint32_t instanceBase; // First slot of this mesh's visible instances, objectCount slots per LOD
+	uint32_t objectCount;
+	uint32_t commandBase; // First of this mesh's indirect commands, one per LOD
+	uint32_t lodCount;
+	float lodErrors[MAX_MESH_LODS];
+	uint32_t meshletBase;
+	uint32_t meshletCount; // Zero if the mesh is drawn whole at every LOD
+	uint32_t padding[2];
+};
+
+struct CullData { // std140
+	glm::mat4 viewProjection;
+	glm::mat4 previousViewProjection;
+	std::array<glm::vec4, 6> frustumPlanes;
+	glm::vec2 pyramidSize;
+	uint32_t pyramidLevels;
+	uint32_t objectCount;
+	uint32_t occlusionEnabled;
+	float lodScale;
+	float lodThreshold;
+	uint32_t clusterInstanceBase; // Slots for objects handed to the cluster pass, one per object
+	uint32_t maxClusterDraws;
+	uint32_t padding[3];
+	glm::vec4 cameraPosition; // In the space viewProjection transforms from
+};
+
+// Header of the cluster work buffer, followed by one mesh index per candidate object
+struct ClusterWork {
+	VkDispatchIndirectCommand dispatch; // One workgroup per candidate
+	uint32_t drawCount;
+};
+
+// Culls a static set of objects on the GPU. A compute pass tests each object's bounding sphere against the frustum
+// and against a depth pyramid reduced from the previous frame's depth buffer, picks a LOD from the projected error,
+// then appends survivors to an instanced VkDrawIndexedIndirectCommand per mesh LOD.
+// Objects at full detail whose mesh has meshlets go on to a second pass that culls each meshlet against the
+// frustum, its normal cone and the depth pyramid, emitting one indirect draw per surviving cluster. Without
+// mesh shaders these are plain indexed draws over the meshlet's index range. The CPU cost per frame is independent of the object count.
+// Every mesh must live in the same vertex/index buffer pair.
+class GpuCuller {
+public:
+	GpuCuller(Renderer * renderer, VkCommandPool commandPool, VkImageView depthImageView, uint32_t width, uint32_t height);
+	~GpuCuller();
+
+	uint32_t addMesh(const Mesh & mesh);
+	void addObject(uint32_t meshIndex, const glm::mat4 & model);
+
+	// Uploads the objects added so far; call once before the first cull
+	void upload();
+
+	// Outside a render pass. viewProjection must include the model matrix pushed for the draws, lodScale is from Mesh::computeLodScale
+	// cameraPosition is in the same space
+	void cull(VkCommandBuffer commandBuffer, const glm::mat4 & viewProjection, const glm::vec3 & cameraPosition, float lodScale, float lodThreshold = DEFAULT_LOD_THRESHOLD);
+	// Inside the render pass, with the graphics pipeline bound
+	void draw(VkCommandBuffer commandBuffer, const glm::mat4 & transform, uint32_t textureIndex);
+	// After the render pass, so the next frame can occlusion cull against this one. The depth buffer has the renderer's
+	// sample count and must already be in SHADER_READ_ONLY_OPTIMAL with its writes visible to compute, a RenderGraph
+	// read does both
+	void buildDepthPyramid(VkCommandBuffer commandBuffer);
+
+	const uint32_t getObjectCount() const;
+
+private:
+	void _InitDepthPyramid(VkImageView depthImageView);
+	void _DeInitDepthPyramid();
+
+	void _InitPipelines();
+	void _DeInitPipelines();
+
+	void _DestroyBuffers();
+
+	Renderer * _renderer = nullptr;
+	VkDevice _device = VK_NULL_HANDLE;
+	VkCommandPool _command_pool = VK_NULL_HANDLE;
+
+	std::vector<Mesh> _meshes;
+	std::vector<CullObject> _objects;
+	std::vector<uint32_t> _mesh_object_counts;
+	std::vector<uint32_t> _command_instance_bases; // Per indirect command, for drawing without firstInstance
+
+	VkBuffer _vertex_buffer = VK_NULL_HANDLE;
+	VkBuffer _index_buffer = VK_NULL_HANDLE;
+
+	VkBuffer _object_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory _object_buffer_memory = VK_NULL_HANDLE;
+	VkBuffer _mesh_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory _mesh_buffer_memory = VK_NULL_HANDLE;
+	VkBuffer _command_template_buffer = VK_NULL_HANDLE; // Commands with instanceCount zeroed, copied over every frame
+	VkDeviceMemory _command_template_buffer_memory = VK_NULL_HANDLE;
+	VkBuffer _command_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory _command_buffer_memory = VK_NULL_HANDLE;
+	VkBuffer _visible_instance_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory _visible_instance_buffer_memory = VK_NULL_HANDLE;
+	VkBuffer _cull_data_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory _cull_data_buffer_memory = VK_NULL_HANDLE;
+
+	VkBuffer _meshlet_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory _meshlet_buffer_memory = VK_NULL_HANDLE;
+	VkBuffer _cluster_work_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory _cluster_work_buffer_memory = VK_NULL_HANDLE;
+	VkBuffer _cluster_draw_buffer = VK_NULL_HANDLE; // Zeroed every frame, unused entries draw nothing
+	VkDeviceMemory _cluster_draw_buffer_memory = VK_NULL_HANDLE;
+	uint32_t _cluster_instance_base = 0;
+	uint32_t _max_cluster_draws = 0; // Device and MAX_CLUSTER_DRAWS cap
+	uint32_t _cluster_draw_count = 0; // Clusters of the uploaded objects under that cap, the draw walks exactly these
+	bool _cluster_culling = false;
+
+	// Without these features each mesh is drawn with its own indirect call and instance buffer offset
+	bool _multi_draw_indirect = false;
+	bool _first_instance = false;
+
+	VkExtent2D _depth_extent = {};
+
+	VkImage _pyramid_image = VK_NULL_HANDLE;
+	VkDeviceMemory _pyramid_image_memory = VK_NULL_HANDLE;
+	VkImageView _pyramid_view = VK_NULL_HANDLE; // Every level, for the cull pass
+	std::vector<VkImageView> _pyramid_level_views;
+	VkExtent2D _pyramid_extent = {};
+	uint32_t _pyramid_levels = 0;
+	VkSampler _pyramid_sampler = VK_NULL_HANDLE;
+	bool _pyramid_valid = false; // Nothing to occlusion cull against before the first frame
+	glm::mat4 _previous_view_projection;
+
+	VkDescriptorSetLayout _cull_set_layout = VK_NULL_HANDLE;
+	VkDescriptorSet _cull_set = VK_NULL_HANDLE;
+	VkPipelineLayout _cull_pipeline_layout = VK_NULL_HANDLE;
+	VkPipeline _cull_pipeline = VK_NULL_HANDLE;
+	VkPipeline _cluster_cull_pipeline = VK_NULL_HANDLE; // Same layout and set as the cull pass
+
+	VkDescriptorSetLayout _pyramid_set_layout = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> _pyramid_sets; // One per level
+	VkPipelineLayout _pyramid_pipeline_layout = VK_NULL_HANDLE;
+	VkPipeline _pyramid_pipeline = VK_NULL_HANDLE;
+	VkPipeline _pyramid_multisample_pipeline = VK_NULL_HANDLE; // First level only, when the depth buffer is multisampled
+};
\ No newline at end of file
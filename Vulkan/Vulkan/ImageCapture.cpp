@@ -0,0 +1,275 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* ImageCapture.cpp | Asynchronous readback of rendered images
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ImageCapture.h"
+#include "Renderer.h"
+#include "JobSystem.h"
+#include "QueueTimeline.h"
+#include "util.h"
+
+#include <stb_image.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <assert.h>
+#include <algorithm>
+#include <stdexcept>
+
+const uint32_t CAPTURE_TEXEL_SIZE = 4;
+
+ImageCapture::ImageCapture(Renderer * renderer, JobSystem * jobs) {
+	_renderer = renderer;
+	_jobs = jobs;
+	_queue_timeline = renderer->getQueueTimeline();
+}
+
+ImageCapture::~ImageCapture() {
+	for (auto readback : _readbacks) {
+		assert(readback->state == READBACK_FREE && "Captures still in flight, flush() first");
+		_DestroyBuffer(*readback);
+		delete readback;
+	}
+	_readbacks.clear();
+}
+
+bool ImageCapture::isFormatSupported(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void ImageCapture::capture(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkExtent2D extent, const CaptureCallback & callback) {
+	if (!isFormatSupported(format)) {
+		throw std::runtime_error("Image format cannot be captured");
+	}
+
+	Readback * readback = _Acquire((VkDeviceSize)extent.width * extent.height * CAPTURE_TEXEL_SIZE);
+	readback->state = READBACK_RECORDED;
+	readback->submission = 0;
+	readback->format = format;
+	readback->extent = extent;
+	readback->callback = callback;
+
+	VkBufferImageCopy region {};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0; // Tightly packed
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { extent.width, extent.height, 1 };
+
+	vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback->buffer, 1, &region);
+
+	// Completing the submission is not enough on its own, the copy has to be made visible to host reads
+	VkBufferMemoryBarrier barrier = vkStruct<VkBufferMemoryBarrier>();
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = readback->buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void ImageCapture::submitted(uint64_t submission) {
+	for (auto readback : _readbacks) {
+		if (readback->state == READBACK_RECORDED) {
+			readback->state = READBACK_SUBMITTED;
+			readback->submission = submission;
+		}
+	}
+}
+
+void ImageCapture::update() {
+	for (auto readback : _readbacks) {
+		if (readback->state == READBACK_SUBMITTED && _queue_timeline->isComplete(readback->submission)) {
+			if (!readback->coherent) {
+				VkMappedMemoryRange range = vkStruct<VkMappedMemoryRange>();
+				range.memory = readback->memory;
+				range.offset = 0;
+				range.size = VK_WHOLE_SIZE;
+				ErrorCheck(vkInvalidateMappedMemoryRanges(_renderer->getDevice(), 1, &range));
+			}
+
+			readback->state = READBACK_CONVERTING;
+			readback->job = _jobs->createJob([readback]() {
+				CapturedImage image;
+				_Convert(*readback, image);
+				readback->callback(image);
+			});
+			_jobs->submit(readback->job);
+		}
+		else if (readback->state == READBACK_CONVERTING && readback->job->isFinished()) {
+			Job * job = readback->job;
+			readback->job = nullptr;
+			readback->callback = nullptr;
+			readback->state = READBACK_FREE;
+
+			_jobs->wait(job); // Already finished, rethrows a failed callback
+		}
+	}
+}
+
+void ImageCapture::flush() {
+	for (auto readback : _readbacks) {
+		assert(readback->state != READBACK_RECORDED && "Captures recorded but never submitted");
+		if (readback->state == READBACK_SUBMITTED) {
+			_queue_timeline->wait(readback->submission);
+		}
+	}
+
+	update();
+
+	for (auto readback : _readbacks) {
+		if (readback->state == READBACK_CONVERTING) {
+			_jobs->wait(readback->job);
+		}
+	}
+
+	update();
+}
+
+const uint32_t ImageCapture::getPendingCount() const {
+	uint32_t count = 0;
+	for (auto readback : _readbacks) {
+		if (readback->state != READBACK_FREE) {
+			count++;
+		}
+	}
+	return count;
+}
+
+void ImageCapture::writePng(const CapturedImage & image, const std::string & path) {
+	if (!stbi_write_png(path.c_str(), (int)image.width, (int)image.height, CAPTURE_TEXEL_SIZE, image.pixels.data(), (int)(image.width * CAPTURE_TEXEL_SIZE))) {
+		throw std::runtime_error("Failed to write " + path);
+	}
+}
+
+bool ImageCapture::readPng(const std::string & path, CapturedImage & image) {
+	int width, height, channels;
+	stbi_uc * pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels) {
+		return false;
+	}
+
+	image.width = (uint32_t)width;
+	image.height = (uint32_t)height;
+	image.pixels.assign(pixels, pixels + (size_t)width * height * CAPTURE_TEXEL_SIZE);
+	stbi_image_free(pixels);
+
+	return true;
+}
+
+ImageCapture::Readback * ImageCapture::_Acquire(VkDeviceSize size) {
+	for (auto readback : _readbacks) {
+		if (readback->state == READBACK_FREE && readback->size >= size) {
+			return readback;
+		}
+	}
+
+	Readback * readback = new Readback();
+	_CreateBuffer(*readback, size);
+	readback->state = READBACK_FREE;
+	readback->job = nullptr;
+	_readbacks.push_back(readback);
+
+	return readback;
+}
+
+void ImageCapture::_CreateBuffer(Readback & readback, VkDeviceSize size) {
+	VkDevice device = _renderer->getDevice();
+
+	VkBufferCreateInfo buffer_create_info = vkStruct<VkBufferCreateInfo>();
+	buffer_create_info.size = size;
+	buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	ErrorCheck(vkCreateBuffer(device, &buffer_create_info, nullptr, &readback.buffer));
+
+	VkMemoryRequirements memory_requirements;
+	vkGetBufferMemoryRequirements(device, readback.buffer, &memory_requirements);
+
+	// The CPU reads every byte, which is painfully slow from uncached memory. Cached memory needs invalidating
+	// instead of being coherent, so fall back to coherent only where there is no cached type
+	const VkPhysicalDeviceMemoryProperties & memory_properties = _renderer->getPhysicalDeviceMemoryProperties();
+	const VkMemoryPropertyFlags preferences[] = {
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+	};
+
+	uint32_t memory_type = UINT32_MAX;
+	for (auto preference : preferences) {
+		for (uint32_t i = 0; i < memory_properties.memoryTypeCount && memory_type == UINT32_MAX; i++) {
+			if ((memory_requirements.memoryTypeBits & (1 << i)) && (memory_properties.memoryTypes[i].propertyFlags & preference) == preference) {
+				memory_type = i;
+			}
+		}
+	}
+	if (memory_type == UINT32_MAX) {
+		throw std::runtime_error("No host visible memory for image capture");
+	}
+
+	VkMemoryAllocateInfo memory_allocate_info = vkStruct<VkMemoryAllocateInfo>();
+	memory_allocate_info.allocationSize = memory_requirements.size;
+	memory_allocate_info.memoryTypeIndex = memory_type;
+
+	ErrorCheck(vkAllocateMemory(device, &memory_allocate_info, nullptr, &readback.memory));
+	ErrorCheck(vkBindBufferMemory(device, readback.buffer, readback.memory, 0));
+
+	void * data;
+	ErrorCheck(vkMapMemory(device, readback.memory, 0, VK_WHOLE_SIZE, 0, &data));
+
+	readback.data = static_cast<const uint8_t *>(data);
+	readback.size = size;
+	readback.coherent = (memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+void ImageCapture::_DestroyBuffer(Readback & readback) {
+	VkDevice device = _renderer->getDevice();
+
+	vkUnmapMemory(device, readback.memory);
+	vkDestroyBuffer(device, readback.buffer, nullptr);
+	vkFreeMemory(device, readback.memory, nullptr);
+}
+
+void ImageCapture::_Convert(const Readback & readback, CapturedImage & image) {
+	image.width = readback.extent.width;
+	image.height = readback.extent.height;
+
+	size_t size = (size_t)image.width * image.height * CAPTURE_TEXEL_SIZE;
+	image.pixels.assign(readback.data, readback.data + size);
+
+	bool bgra = readback.format == VK_FORMAT_B8G8R8A8_UNORM || readback.format == VK_FORMAT_B8G8R8A8_SRGB;
+	if (bgra) {
+		for (size_t i = 0; i < size; i += CAPTURE_TEXEL_SIZE) {
+			std::swap(image.pixels[i], image.pixels[i + 2]);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,102 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* ImageCapture.h | Asynchronous readback of rendered images
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+
+#include <vector>
+#include <string>
+#include <functional>
+
+class Renderer;
+class JobSystem;
+class Job;
+class QueueTimeline;
+
+struct CapturedImage {
+	uint32_t width;
+	uint32_t height;
+	std::vector<uint8_t> pixels; // RGBA8, rows tightly packed
+};
+
+typedef std::function<void(const CapturedImage & image)> CaptureCallback;
+
+// Copies images into host memory without stalling the frame that rendered them. capture() only records a copy into
+// a pooled readback buffer; once the queue timeline passes the submission that carried it, update() hands the
+// buffer to a worker, which converts the texels to RGBA8 and runs the callback. Buffers are reused once their
+// callback has finished.
+class ImageCapture {
+public:
+	ImageCapture(Renderer * renderer, JobSystem * jobs);
+	// Everything captured must have been flushed
+	~ImageCapture();
+
+	static bool isFormatSupported(VkFormat format);
+
+	// image must be in TRANSFER_SRC_OPTIMAL, with earlier writes made visible to transfers, e.g. by a render graph
+	// pass that reads it as ACCESS_TRANSFER_SRC. Needs VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+	void capture(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkExtent2D extent, const CaptureCallback & callback);
+	// After submitting the command buffers capture() recorded into
+	void submitted(uint64_t submission);
+	// Starts work on copies that have completed and recycles finished buffers, never waits. Rethrows anything a
+	// callback threw
+	void update();
+	// Waits for every submitted capture, callbacks included
+	void flush();
+
+	const uint32_t getPendingCount() const;
+
+	static void writePng(const CapturedImage & image, const std::string & path);
+	// False if there is no readable image at path
+	NODISCARD static bool readPng(const std::string & path, CapturedImage & image);
+
+private:
+	enum ReadbackState {
+		READBACK_FREE,
+		READBACK_RECORDED,
+		READBACK_SUBMITTED,
+		READBACK_CONVERTING
+	};
+
+	struct Readback {
+		VkBuffer buffer;
+		VkDeviceMemory memory;
+		const uint8_t * data; // Persistently mapped
+		VkDeviceSize size;
+		bool coherent;
+
+		ReadbackState state;
+		uint64_t submission;
+		VkFormat format;
+		VkExtent2D extent;
+		CaptureCallback callback;
+		Job * job;
+	};
+
+	Readback * _Acquire(VkDeviceSize size);
+	void _CreateBuffer(Readback & readback, VkDeviceSize size);
+	void _DestroyBuffer(Readback & readback);
+	static void _Convert(const Readback & readback, CapturedImage & image);
+
+	Renderer * _renderer = nullptr;
+	JobSystem * _jobs = nullptr;
+	QueueTimeline * _queue_timeline = nullptr;
+
+	std::vector<Readback *> _readbacks; // Stable addresses, workers hold on to them
+};
\ No newline at end of file
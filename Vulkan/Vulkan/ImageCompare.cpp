@@ -0,0 +1,119 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* ImageCompare.cpp | Perceptual comparison of captured images against references
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ImageCompare.h"
+
+#include <array>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+typedef std::array<float, 3> LabColor;
+
+static float srgbToLinear(uint8_t value) {
+	float c = value / 255.0f;
+	return (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float labCurve(float t) {
+	const float epsilon = 216.0f / 24389.0f;
+	const float kappa = 24389.0f / 27.0f;
+	return (t > epsilon) ? std::cbrt(t) : (kappa * t + 16.0f) / 116.0f;
+}
+
+// sRGB under D65 to CIELAB, alpha is ignored
+static void toLab(const CapturedImage & image, std::vector<LabColor> & lab) {
+	std::array<float, 256> linear;
+	for (uint32_t i = 0; i < 256; i++) {
+		linear[i] = srgbToLinear((uint8_t)i);
+	}
+
+	size_t pixel_count = (size_t)image.width * image.height;
+	lab.resize(pixel_count);
+
+	for (size_t i = 0; i < pixel_count; i++) {
+		const uint8_t * pixel = &image.pixels[i * 4];
+		float r = linear[pixel[0]];
+		float g = linear[pixel[1]];
+		float b = linear[pixel[2]];
+
+		// Relative to the D65 white point
+		float x = labCurve((0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.95047f);
+		float y = labCurve(0.2126f * r + 0.7152f * g + 0.0722f * b);
+		float z = labCurve((0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.08883f);
+
+		lab[i][0] = 116.0f * y - 16.0f;
+		lab[i][1] = 500.0f * (x - y);
+		lab[i][2] = 200.0f * (y - z);
+	}
+}
+
+static float deltaE(const LabColor & a, const LabColor & b) {
+	float dl = a[0] - b[0];
+	float da = a[1] - b[1];
+	float db = a[2] - b[2];
+	return std::sqrt(dl * dl + da * da + db * db);
+}
+
+ImageComparison compareImages(const CapturedImage & image, const CapturedImage & reference, const ImageTolerance & tolerance) {
+	ImageComparison comparison {};
+	comparison.sizeMatches = image.width == reference.width && image.height == reference.height;
+	if (!comparison.sizeMatches || image.width == 0 || image.height == 0) {
+		comparison.passed = comparison.sizeMatches;
+		return comparison;
+	}
+
+	std::vector<LabColor> image_lab;
+	std::vector<LabColor> reference_lab;
+	toLab(image, image_lab);
+	toLab(reference, reference_lab);
+
+	int32_t width = (int32_t)image.width;
+	int32_t height = (int32_t)image.height;
+	int32_t radius = (int32_t)tolerance.searchRadius;
+
+	double total = 0.0;
+	size_t differing = 0;
+
+	for (int32_t y = 0; y < height; y++) {
+		for (int32_t x = 0; x < width; x++) {
+			const LabColor & color = image_lab[y * width + x];
+
+			// Exact matches are the common case, so the neighbourhood is only searched when the pixel itself is off
+			float distance = deltaE(color, reference_lab[y * width + x]);
+			for (int32_t ny = std::max(y - radius, 0); ny <= std::min(y + radius, height - 1) && distance > tolerance.pixelDeltaE; ny++) {
+				for (int32_t nx = std::max(x - radius, 0); nx <= std::min(x + radius, width - 1); nx++) {
+					distance = std::min(distance, deltaE(color, reference_lab[ny * width + nx]));
+				}
+			}
+
+			total += distance;
+			comparison.maxDeltaE = std::max(comparison.maxDeltaE, distance);
+			if (distance > tolerance.pixelDeltaE) {
+				differing++;
+			}
+		}
+	}
+
+	size_t pixel_count = (size_t)width * height;
+	comparison.meanDeltaE = (float)(total / pixel_count);
+	comparison.differingFraction = (float)differing / pixel_count;
+	comparison.passed = comparison.differingFraction <= tolerance.maxDifferingFraction && comparison.meanDeltaE <= tolerance.maxMeanDeltaE;
+
+	return comparison;
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* ImageCompare.h | Perceptual comparison of captured images against references
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "ImageCapture.h"
+
+// Differences are CIE76 colour distances between sRGB pixels. A distance of about 2.3 is just noticeable.
+// Each pixel is matched against the closest of the reference pixels within searchRadius, so edges that a
+// different rasterizer places a pixel over do not count as differences.
+struct ImageTolerance {
+	float pixelDeltaE; // Pixels further than this from the reference differ
+	float maxDifferingFraction; // Of all pixels
+	float maxMeanDeltaE;
+	uint32_t searchRadius;
+};
+
+const ImageTolerance DEFAULT_IMAGE_TOLERANCE = { 2.3f, 0.001f, 0.5f, 1 };
+
+struct ImageComparison {
+	bool sizeMatches;
+	float meanDeltaE;
+	float maxDeltaE;
+	float differingFraction;
+	bool passed;
+};
+
+ImageComparison compareImages(const CapturedImage & image, const CapturedImage & reference, const ImageTolerance & tolerance = DEFAULT_IMAGE_TOLERANCE);
\ No newline at end of file
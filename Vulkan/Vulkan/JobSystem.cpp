@@ -0,0 +1,163 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* JobSystem.cpp | Dependency graph of jobs run on the task scheduler
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "JobSystem.h"
+
+#include <assert.h>
+
+// Job
+Job::Job(const std::function<void()> & work, bool mainThread) : _work(work), _main_thread(mainThread) {
+	_dependency_count = 1;
+	_finished = false;
+}
+
+const bool Job::isFinished() const {
+	return _finished;
+}
+
+// JobSystem
+JobSystem::JobSystem(TaskScheduler * scheduler) {
+	_scheduler = scheduler;
+	_main_thread_id = std::this_thread::get_id();
+}
+
+JobSystem::~JobSystem() {
+	// Jobs already handed to the scheduler still reference this, main thread jobs and anything waiting on them are abandoned
+	_scheduler->wait(_group);
+
+	for (auto job : _jobs) {
+		delete job;
+	}
+	_jobs.clear();
+}
+
+Job * JobSystem::createJob(const std::function<void()> & work, bool mainThread) {
+	Job * job = new Job(work, mainThread);
+
+	std::lock_guard<std::mutex> lock(_jobs_mutex);
+	_jobs.push_back(job);
+
+	return job;
+}
+
+void JobSystem::addDependency(Job * job, Job * dependency) {
+	assert(job != dependency);
+
+	std::lock_guard<std::mutex> lock(dependency->_mutex);
+
+	// A dependency that has already finished only passes on its failure
+	if (dependency->_finished) {
+		if (dependency->_exception) {
+			std::lock_guard<std::mutex> job_lock(job->_mutex);
+			job->_exception = dependency->_exception;
+		}
+		return;
+	}
+
+	job->_dependency_count++;
+	dependency->_dependents.push_back(job);
+}
+
+void JobSystem::submit(Job * job) {
+	if (--job->_dependency_count == 0) {
+		_Schedule(job);
+	}
+}
+
+uint32_t JobSystem::runMainThreadJobs() {
+	assert(std::this_thread::get_id() == _main_thread_id);
+
+	// Only what is ready now, jobs these make ready wait for the next call. Swapping empty vectors allocates nothing
+	std::vector<Job *> jobs;
+	{
+		std::lock_guard<std::mutex> lock(_main_thread_mutex);
+		jobs.swap(_main_thread_jobs);
+	}
+
+	for (auto job : jobs) {
+		_Execute(job);
+	}
+
+	return (uint32_t)jobs.size();
+}
+
+void JobSystem::wait(Job * job) {
+	bool main_thread = std::this_thread::get_id() == _main_thread_id;
+
+	while (!job->_finished) {
+		if (main_thread && runMainThreadJobs() > 0) {
+			continue;
+		}
+
+		if (!_scheduler->runPendingTask()) {
+			std::this_thread::yield();
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(job->_mutex);
+	if (job->_exception) {
+		std::rethrow_exception(job->_exception);
+	}
+}
+
+void JobSystem::_Schedule(Job * job) {
+	if (job->_main_thread) {
+		std::lock_guard<std::mutex> lock(_main_thread_mutex);
+		_main_thread_jobs.push_back(job);
+		return;
+	}
+
+	_scheduler->run(_group, [this, job]() {
+		_Execute(job);
+	});
+}
+
+void JobSystem::_Execute(Job * job) {
+	std::exception_ptr exception;
+	{
+		std::lock_guard<std::mutex> lock(job->_mutex);
+		exception = job->_exception;
+	}
+
+	if (!exception) {
+		try {
+			job->_work();
+		}
+		catch (...) {
+			exception = std::current_exception();
+		}
+	}
+
+	std::vector<Job *> dependents;
+	{
+		std::lock_guard<std::mutex> lock(job->_mutex);
+		job->_exception = exception;
+		job->_finished = true;
+		dependents.swap(job->_dependents);
+	}
+
+	for (auto dependent : dependents) {
+		if (exception) {
+			std::lock_guard<std::mutex> lock(dependent->_mutex);
+			dependent->_exception = exception;
+		}
+		if (--dependent->_dependency_count == 0) {
+			_Schedule(dependent);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* JobSystem.h | Dependency graph of jobs run on the task scheduler
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "TaskScheduler.h"
+
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <exception>
+
+class JobSystem;
+
+// A node in the job graph. Created by JobSystem::createJob and owned by the JobSystem until it is destroyed
+class Job {
+public:
+	const bool isFinished() const;
+
+private:
+	friend class JobSystem;
+
+	Job(const std::function<void()> & work, bool mainThread);
+
+	std::function<void()> _work;
+	bool _main_thread = false;
+
+	std::atomic<uint32_t> _dependency_count; // Unfinished dependencies, plus one until submitted
+	std::atomic<bool> _finished;
+
+	std::mutex _mutex; // Guards the two below
+	std::vector<Job *> _dependents;
+	std::exception_ptr _exception; // Also set when a dependency failed, the work is then skipped
+};
+
+// A job becomes runnable once every job it depends on has finished, and is then handed to the scheduler as a task.
+// A job's dependents are spawned from the worker that ran it, so they tend to run on the core that has its data.
+// Jobs created with mainThread run only inside runMainThreadJobs(), for work like queue submission that must
+// stay on the thread that owns the device.
+class JobSystem {
+public:
+	JobSystem(TaskScheduler * scheduler);
+	~JobSystem();
+
+	Job * createJob(const std::function<void()> & work, bool mainThread = false);
+	// job will not start before dependency finishes. Must be called before job is submitted
+	void addDependency(Job * job, Job * dependency);
+	// Runs the job as soon as its dependencies have finished
+	void submit(Job * job);
+
+	// Runs the main thread jobs that are ready, returns how many ran
+	uint32_t runMainThreadJobs();
+	// Helps with other work until job has finished, then rethrows anything it or its dependencies threw
+	void wait(Job * job);
+
+private:
+	void _Schedule(Job * job);
+	void _Execute(Job * job);
+
+	TaskScheduler * _scheduler = nullptr;
+	TaskGroup _group; // Every job handed to the scheduler, failures are kept on the jobs instead
+
+	std::thread::id _main_thread_id;
+	std::mutex _main_thread_mutex;
+	std::vector<Job *> _main_thread_jobs;
+
+	std::mutex _jobs_mutex;
+	std::vector<Job *> _jobs;
+};
\ No newline at end of file
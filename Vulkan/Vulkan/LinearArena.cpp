@@ -0,0 +1,124 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* LinearArena.cpp | Linear arenas for transient host allocations, reset once per frame
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "LinearArena.h"
+#include "TaskScheduler.h"
+
+#include <assert.h>
+#include <new>
+
+// Linear arena
+LinearArena::LinearArena(size_t size) {
+	_size = size;
+	_memory = (char *)::operator new(_size); // Through operator new so the allocation tracker sees arena growth
+}
+
+LinearArena::~LinearArena() {
+	for (auto block : _overflow_blocks) {
+		::operator delete(block);
+	}
+	_overflow_blocks.clear();
+
+	::operator delete(_memory);
+	_memory = nullptr;
+}
+
+void * LinearArena::allocate(size_t size, size_t alignment) {
+	assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+	size_t offset = (_offset + alignment - 1) & ~(alignment - 1);
+	if (offset + size <= _size) {
+		_offset = offset + size;
+		return _memory + offset;
+	}
+
+	// Out of room this frame
+	char * block = (char *)::operator new(size + alignment);
+
+	_overflow_blocks.push_back(block);
+	_overflow_size += size + alignment;
+
+	return (char *)(((uintptr_t)block + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+void LinearArena::reset() {
+	_offset = 0;
+
+	if (_overflow_blocks.empty()) {
+		return;
+	}
+
+	for (auto block : _overflow_blocks) {
+		::operator delete(block);
+	}
+	_overflow_blocks.clear();
+
+	// Grow to fit the frame that overflowed, with some room to spare
+	_size += _overflow_size + _overflow_size / 2;
+	_overflow_size = 0;
+
+	::operator delete(_memory);
+	_memory = (char *)::operator new(_size);
+}
+
+const size_t LinearArena::getUsed() const {
+	return _offset + _overflow_size;
+}
+
+const size_t LinearArena::getCapacity() const {
+	return _size;
+}
+
+// Frame arena
+FrameArena::FrameArena(TaskScheduler * scheduler, uint32_t frameCount, size_t arenaSize) {
+	_scheduler = scheduler;
+	_thread_count = _scheduler->getWorkerCount() + 1;
+
+	_arenas.resize(frameCount * _thread_count);
+	for (auto & arena : _arenas) {
+		arena = new LinearArena(arenaSize);
+	}
+}
+
+FrameArena::~FrameArena() {
+	for (auto arena : _arenas) {
+		delete arena;
+	}
+	_arenas.clear();
+}
+
+void FrameArena::beginFrame(uint32_t frame) {
+	assert(frame * _thread_count < _arenas.size());
+	_frame = frame;
+
+	for (uint32_t i = 0; i < _thread_count; i++) {
+		_arenas[_frame * _thread_count + i]->reset();
+	}
+}
+
+LinearArena * FrameArena::get() const {
+	uint32_t thread = _scheduler->getThreadIndex();
+	assert(thread != NO_THREAD_INDEX && "Frame arenas belong to the scheduler's threads");
+
+	return _arenas[_frame * _thread_count + thread];
+}
+
+const uint32_t FrameArena::getFrame() const {
+	return _frame;
+}
\ No newline at end of file
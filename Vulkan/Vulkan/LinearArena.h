@@ -0,0 +1,142 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* LinearArena.h | Linear arenas for transient host allocations, reset once per frame
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+class TaskScheduler;
+
+const size_t DEFAULT_ARENA_SIZE = 256 * 1024;
+
+// Hands out memory by bumping an offset and takes it all back at once in reset(). Allocations that do not fit
+// go to overflow blocks, and the next reset() grows the arena to cover them, so a workload stops allocating
+// from the heap once the arena has seen its largest frame. Not thread safe, each thread needs its own.
+class LinearArena {
+public:
+	LinearArena(size_t size = DEFAULT_ARENA_SIZE);
+	~LinearArena();
+
+	void * allocate(size_t size, size_t alignment);
+
+	// Nothing made here is destroyed, so it must be trivially destructible or only own arena memory
+	template<typename T, typename... Args>
+	T * create(Args &&... args) {
+		return new (allocate(sizeof(T), std::alignment_of<T>::value)) T(std::forward<Args>(args)...);
+	}
+
+	// O(1) unless the last frame overflowed
+	void reset();
+
+	const size_t getUsed() const;
+	const size_t getCapacity() const;
+
+private:
+	LinearArena(const LinearArena &);
+	LinearArena & operator=(const LinearArena &);
+
+	char * _memory = nullptr;
+	size_t _size = 0;
+	size_t _offset = 0;
+
+	std::vector<char *> _overflow_blocks;
+	size_t _overflow_size = 0;
+};
+
+// STL allocator drawing from a LinearArena. Deallocation does nothing, memory comes back when the arena is reset,
+// so containers should reserve up front rather than grow
+template<typename T>
+class ArenaAllocator {
+public:
+	typedef T value_type;
+	typedef T * pointer;
+	typedef const T * const_pointer;
+	typedef T & reference;
+	typedef const T & const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+
+	template<typename U>
+	struct rebind {
+		typedef ArenaAllocator<U> other;
+	};
+
+	ArenaAllocator(LinearArena * arena) : _arena(arena) {}
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U> & other) : _arena(other.getArena()) {}
+
+	T * allocate(size_t count) {
+		return (T *)_arena->allocate(count * sizeof(T), std::alignment_of<T>::value);
+	}
+
+	void deallocate(T *, size_t) {}
+
+	size_t max_size() const {
+		return SIZE_MAX / sizeof(T);
+	}
+
+	LinearArena * getArena() const {
+		return _arena;
+	}
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U> & other) const {
+		return _arena == other.getArena();
+	}
+
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U> & other) const {
+		return _arena != other.getArena();
+	}
+
+private:
+	LinearArena * _arena;
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// A LinearArena for every frame in flight and every thread of the scheduler. beginFrame() resets the arenas of a
+// frame together, and must only be called once the queue timeline has reached that frame's last submission.
+// Anything allocated during a frame may then live until the GPU is done with the frame, like command data.
+class FrameArena {
+public:
+	FrameArena(TaskScheduler * scheduler, uint32_t frameCount, size_t arenaSize = DEFAULT_ARENA_SIZE);
+	~FrameArena();
+
+	void beginFrame(uint32_t frame);
+
+	// The calling thread's arena for the current frame. Only threads of the scheduler have one
+	LinearArena * get() const;
+
+	const uint32_t getFrame() const;
+
+private:
+	TaskScheduler * _scheduler = nullptr;
+	uint32_t _thread_count = 0;
+	uint32_t _frame = 0;
+
+	std::vector<LinearArena *> _arenas; // frame * _thread_count + thread
+};
\ No newline at end of file
@@ -19,6 +19,28 @@
 #include "Renderer.h"
 #include "Window.h"
 #include "util.h"
+#include "DescriptorAllocator.h"
+#include "TextureTable.h"
+#include "DrawBatcher.h"
+#include "GpuCuller.h"
+#include "Mesh.h"
+#include "MeshSimplifier.h"
+#include "MeshletBuilder.h"
+#include "MappedFile.h"
+#include "StagingUploader.h"
+#include "VirtualTexture.h"
+#include "Scene.h"
+#include "JobSystem.h"
+#include "RenderGraph.h"
+#include "Benchmark.h"
+#include "LinearArena.h"
+#include "AllocationTracker.h"
+#include "DeletionQueue.h"
+#include "QueueTimeline.h"
+#include "ClusteredLighting.h"
+#include "FramePacer.h"
+#include "ImageCapture.h"
+#include "ImageCompare.h"
 #include "BUILD_OPTIONS.h"
 
 #define GLM_FORCE_RADIANS
@@ -36,21 +58,25 @@
 
 #include <chrono>
 #include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <atomic>
 
 #if BUILD_ENABLE_MODEL
 #include <unordered_map>
 #else
 
 const std::vector<Vertex> vertices = {
-	{ { -1.0f, -1.0f, 0.0f }, { -2.0f, 1.25f, 0.0f }, { 0.0f, 0.0f } },
-	{ { 1.0f, -1.0f, 0.0f }, { 0.5f, 1.25f, 0.0f }, { 1.0f, 0.0f } },
-	{ { 1.0f, 1.0f, 0.0f }, { 0.5f, -1.25f, 0.0f }, { 1.0f, 1.0f } },
-	{ { -1.0f, 1.0f, 0.0f }, { -2.0f, -1.25f, 0.0f }, { 0.0f, 1.0f } },
-
-	{ { -1.0f, -1.0f, -0.5f }, { -2.0f, 1.25f, 0.0f }, { 0.0f, 0.0f } },
-	{ { 1.0f, -1.0f, -0.5f }, { 0.5f, 1.25f, 0.0f }, { 1.0f, 0.0f } },
-	{ { 1.0f, 1.0f, -0.5f }, { 0.5f, -1.25f, 0.0f }, { 1.0f, 1.0f } },
-	{ { -1.0f, 1.0f, -0.5f }, { -2.0f, -1.25f, 0.0f }, { 0.0f, 1.0f } }
+	{ { -1.0f, -1.0f, 0.0f }, { -2.0f, 1.25f, 0.0f }, { 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { 1.0f, -1.0f, 0.0f }, { 0.5f, 1.25f, 0.0f }, { 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { 1.0f, 1.0f, 0.0f }, { 0.5f, -1.25f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { -1.0f, 1.0f, 0.0f }, { -2.0f, -1.25f, 0.0f }, { 0.0f, 1.0f }, { 0.0f, 0.0f, 1.0f } },
+
+	{ { -1.0f, -1.0f, -0.5f }, { -2.0f, 1.25f, 0.0f }, { 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { 1.0f, -1.0f, -0.5f }, { 0.5f, 1.25f, 0.0f }, { 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { 1.0f, 1.0f, -0.5f }, { 0.5f, -1.25f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { -1.0f, 1.0f, -0.5f }, { -2.0f, -1.25f, 0.0f }, { 0.0f, 1.0f }, { 0.0f, 0.0f, 1.0f } }
 };
 
 const std::vector<uint32_t> indices = {
@@ -65,88 +91,128 @@ const std::vector<uint32_t> indices = {
 #if BUILD_ENABLE_MODEL
 const std::string MODEL_PATH = "models/chalet.obj";
 const std::string TEXTURE_PATH = "textures/chalet.jpg";
+const std::string VIRTUAL_TEXTURE_PATH = "textures/chalet.vtex";
 #else
 const std::string MODEL_PATH = "";
 const std::string TEXTURE_PATH = "textures/texture.jpg";
+const std::string VIRTUAL_TEXTURE_PATH = "textures/texture.vtex";
+
+// Fractal quality ladder, cheapest first. Palette scale tracks the iteration count so colours stay stable between levels
+const std::array<FractalSpecialization, 4> FRACTAL_QUALITY_LEVELS = { {
+	{ 32, 2.0f, 32.0f },
+	{ 64, 2.0f, 64.0f },
+	DEFAULT_FRACTAL_SPECIALIZATION,
+	{ 256, 2.0f, 256.0f }
+} };
+
+const double TARGET_FRAME_TIME = 1.0 / 60.0;
+const uint32_t FRAME_TIME_SAMPLE_COUNT = 60;
 #endif
 
-int main(void) {
-	Renderer r;
+const glm::vec3 CAMERA_POSITION(1.0f, 1.0f, 1.0f);
+const float CAMERA_NEAR = 0.1f;
+const float CAMERA_FAR = 10.0f;
 
-#if BUILD_ENABLE_MODEL
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
-#endif
-	r.openWindow(800, 600, "Vulkan Test");
+// Point lights scattered just above the scene, enough that only clustering keeps shading affordable
+const uint32_t SCENE_LIGHT_COUNT = 1024;
 
-	VkCommandPool command_pool;
+#if BUILD_ENABLE_FRAMERATE
+const uint32_t LATENCY_REPORT_INTERVAL = 120; // Frames between printing the pacer's measurements
+#endif
 
-	VkCommandPoolCreateInfo command_pool_create_info {};
-	command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	command_pool_create_info.queueFamilyIndex = r.getGraphicsFamilyIndex();
-	command_pool_create_info.flags = 0;
+#if BUILD_ENABLE_GOLDEN_IMAGES
+// Fixed frames compared against GOLDEN_IMAGE_PATH<name>.png. Animation time and cursor height stand in for the clock
+// and the mouse
+struct GoldenScene {
+	const char * name;
+	float time;
+	int yPos;
+};
 
-	ErrorCheck(vkCreateCommandPool(r.getDevice(), &command_pool_create_info, nullptr, &command_pool));
+const std::array<GoldenScene, 3> GOLDEN_SCENES = { {
+	{ "default", 0.0f, 450 },
+	{ "rotated", 1.0f, 450 },
+	{ "narrow", 0.5f, 400 }
+} };
 
-	// Create depth resources
-	VkImage depth_image;
-	VkDeviceMemory depth_image_memory;
-	VkImageView depth_image_view;
+const std::string GOLDEN_IMAGE_PATH = "Golden/"; // Relative to the working directory, the project directory under Visual Studio
+const uint32_t GOLDEN_WARMUP_FRAME_COUNT = 8; // Frames drawn before each capture, so culling works from a settled depth pyramid
+#endif
 
-	VkFormat depth_format = r.findSupportedFormat(
-		{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
-	);
+const uint32_t ALLOCATION_WARMUP_FRAME_COUNT = 16; // Frames after loading before allocations count against steady state
 
-	r.createImage(r.getWindow()->getWidth(), r.getWindow()->getHeight(), depth_format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depth_image, depth_image_memory);
-	r.createImageView(depth_image, depth_format, VK_IMAGE_ASPECT_DEPTH_BIT, depth_image_view);
+#if BUILD_ENABLE_MODEL
+const uint32_t INSTANCE_GRID_SIZE = 48; // Thousands of chalets, one instanced draw
+#else
+const uint32_t INSTANCE_GRID_SIZE = 1;
+#endif
 
-	r.transitionImageLayout(command_pool, depth_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+#if BUILD_ENABLE_GOLDEN_IMAGES
+// Runs on a worker. A scene without a golden image fails, references are only ever written by recording them
+static bool checkGoldenImage(const std::string & name, const CapturedImage & image) {
+	std::string golden_path = GOLDEN_IMAGE_PATH + name + ".png";
 
-	r.makeFramebuffers(depth_image_view);
+#if BUILD_RECORD_GOLDEN_IMAGES
+	ImageCapture::writePng(image, golden_path);
+	std::cout << name << ": recorded " << golden_path << std::endl;
+	return true;
+#else
+	CapturedImage golden;
+	if (!ImageCapture::readPng(golden_path, golden)) {
+		std::cout << name << ": FAILED, no golden image at " << golden_path << std::endl;
+		return false;
+	}
 
-	// Create texture image
-	int tex_width, tex_height, tex_channels;
-	stbi_uc * pixels = stbi_load(TEXTURE_PATH.c_str(), &tex_width, &tex_height, &tex_channels, STBI_rgb_alpha);
-	VkDeviceSize image_size = tex_width * tex_height * 4;
+	ImageComparison comparison = compareImages(image, golden);
+	if (!comparison.passed) {
+		ImageCapture::writePng(image, GOLDEN_IMAGE_PATH + name + "_failed.png");
+	}
 
-	if (!pixels) {
-		throw std::runtime_error("failed to load texture image!");
+	std::cout << name << ": " << (comparison.passed ? "passed" : "FAILED");
+	if (comparison.sizeMatches) {
+		std::cout << ", mean dE " << comparison.meanDeltaE << ", max dE " << comparison.maxDeltaE << ", " << comparison.differingFraction * 100.0f << "% differing";
+	}
+	else {
+		std::cout << ", size differs from " << golden_path;
 	}
+	std::cout << std::endl;
 
-	VkImage staging_image;
-	VkDeviceMemory staging_image_memory;
-	VkImage texture_image;
-	VkDeviceMemory texture_image_memory;
+	return comparison.passed;
+#endif
+}
+#endif
 
-	r.createImage(tex_width, tex_height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging_image, staging_image_memory);
+int main(void) {
+#if BUILD_ENABLE_BENCHMARKS
+	return runBenchmarks(); // Headless, no window or device
+#endif
 
-	void * data;
-	ErrorCheck(vkMapMemory(r.getDevice(), staging_image_memory, 0, image_size, 0, &data));
-	memcpy(data, pixels, (size_t)image_size);
-	vkUnmapMemory(r.getDevice(), staging_image_memory);
-	stbi_image_free(pixels);
+	Renderer r;
 
-	r.createImage(tex_width, tex_height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture_image, texture_image_memory);
+#if BUILD_ENABLE_MODEL
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+#endif
+	r.openWindow(800, 600, "Vulkan Test", (LatencyMode)BUILD_LATENCY_MODE);
 
-	// Copy staging image to texture image
-	r.transitionImageLayout(command_pool, staging_image, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-	r.transitionImageLayout(command_pool, texture_image, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-	r.copyImage(command_pool, staging_image, texture_image, tex_width, tex_height);
+	VkCommandPool command_pool;
 
-	r.transitionImageLayout(command_pool, texture_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	VkCommandPoolCreateInfo command_pool_create_info = vkStruct<VkCommandPoolCreateInfo>();
+	command_pool_create_info.queueFamilyIndex = r.getGraphicsFamilyIndex();
+	command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // Command buffers are re-recorded every frame
 
-	// Create texture image view
-	VkImageView texture_image_view;
+	ErrorCheck(vkCreateCommandPool(r.getDevice(), &command_pool_create_info, nullptr, &command_pool));
+
+	// Asset data goes to the GPU through a fixed staging budget, whatever its size
+	StagingUploader uploader(&r);
 
-	r.createImageView(texture_image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, texture_image_view);
+	// Objects below are owned by handles that release them through the queue, nothing waits on the GPU to free them
+	DeletionQueue * deletion_queue = r.getDeletionQueue();
 
 	// Create Texture Sampler
-	VkSampler texture_sampler;
+	UniqueSampler texture_sampler(deletion_queue);
 
-	VkSamplerCreateInfo sampler_info;
-	sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	VkSamplerCreateInfo sampler_info = vkStruct<VkSamplerCreateInfo>();
 	sampler_info.magFilter = VK_FILTER_LINEAR;
 	sampler_info.minFilter = VK_FILTER_LINEAR;
 	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
@@ -162,112 +228,49 @@ int main(void) {
 	sampler_info.mipLodBias = 0.0f;
 	sampler_info.minLod = 0.0f;
 	sampler_info.maxLod = 0.0f;
-	sampler_info.pNext = NULL;
 	sampler_info.flags = 0;
 
-	ErrorCheck(vkCreateSampler(r.getDevice(), &sampler_info, nullptr, &texture_sampler));
-
-#if BUILD_ENABLE_MODEL
-	// Load Model
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string err;
-
-	std::cout << "Loading Model" << std::endl;
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, MODEL_PATH.c_str())) {
-		throw std::runtime_error(err);
-	}
-	std::cout << "Done Loading Model" << std::endl;
-	
-	std::unordered_map<Vertex, int> unique_vertices = {};
-
-	for (const auto & shape : shapes) {
-		for (const auto & index : shape.mesh.indices) {
-			Vertex vertex {};
-
-			vertex.pos = {
-				attrib.vertices[3 * index.vertex_index + 0],
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]
-			};
-
-			vertex.texCoord = {
-				attrib.texcoords[2 * index.texcoord_index + 0],
-				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-			};
-
-			if (unique_vertices.count(vertex) == 0) {
-				unique_vertices[vertex] = (int)vertices.size();
-				vertices.push_back(vertex);
-			}
-			
-			indices.push_back(unique_vertices[vertex]);
-		}
-	}
-#endif
-	
-	// Create Vertex Buffer
-	VkBuffer vertex_buffer;
-	VkDeviceMemory vertex_buffer_memory;
-	VkDeviceSize vertex_buffer_size = sizeof(vertices[0]) * vertices.size();
-
-	VkBuffer vertex_staging_buffer;
-	VkDeviceMemory vertex_staging_buffer_memory;
+	ErrorCheck(vkCreateSampler(r.getDevice(), &sampler_info, nullptr, &texture_sampler.replace()));
 
-	r.createBuffer(vertex_buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vertex_staging_buffer, vertex_staging_buffer_memory);
+	// Placeholder texture, drawn with until the real one has loaded
+	UniqueImage placeholder_image(deletion_queue);
+	UniqueMemory placeholder_image_memory(deletion_queue);
+	UniqueImageView placeholder_image_view(deletion_queue);
+	const uint32_t placeholder_texel = 0xFF808080;
 
-	// data is already defined and is now re-used
-	ErrorCheck(vkMapMemory(r.getDevice(), vertex_staging_buffer_memory, 0, vertex_buffer_size, 0, &data));
-	memcpy(data, vertices.data(), (size_t)vertex_buffer_size);
-	vkUnmapMemory(r.getDevice(), vertex_staging_buffer_memory);
+	r.createImage(1, 1, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, placeholder_image.replace(), placeholder_image_memory.replace());
 
-	r.createBuffer(vertex_buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertex_buffer, vertex_buffer_memory);
+	uploader.transitionImage(placeholder_image, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	uploader.uploadImage(placeholder_image, 1, 1, 4, &placeholder_texel);
+	uploader.transitionImage(placeholder_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	uploader.flush();
 
-	// Copy staging buffer into vertex buffer
-	r.copyBuffer(command_pool, vertex_staging_buffer, vertex_buffer, vertex_buffer_size);
-
-	// Create index buffer
-	VkBuffer index_buffer;
-	VkDeviceMemory index_buffer_memory;
-	VkDeviceSize index_buffer_size = sizeof(indices[0]) * indices.size();
-
-	VkBuffer index_staging_buffer;
-	VkDeviceMemory index_staging_buffer_memory;
-
-	r.createBuffer(index_buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, index_staging_buffer, index_staging_buffer_memory);
-	
-	ErrorCheck(vkMapMemory(r.getDevice(), index_staging_buffer_memory, 0, index_buffer_size, 0, &data));
-	memcpy(data, indices.data(), (size_t)index_buffer_size);
-	vkUnmapMemory(r.getDevice(), index_staging_buffer_memory);
-
-	r.createBuffer(index_buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, index_buffer, index_buffer_memory);
-
-	// Copy staging buffer into index buffer
-	r.copyBuffer(command_pool, index_staging_buffer, index_buffer, index_buffer_size);
+	r.createImageView(placeholder_image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, placeholder_image_view.replace());
 
 	// Create uniform buffer
-	VkBuffer uniform_staging_buffer;
-	VkDeviceMemory uniform_staging_buffer_memory;
-	VkBuffer uniform_buffer;
-	VkDeviceMemory uniform_buffer_memory;
+	UniqueBuffer uniform_staging_buffer(deletion_queue);
+	UniqueMemory uniform_staging_buffer_memory(deletion_queue);
+	UniqueBuffer uniform_buffer(deletion_queue);
+	UniqueMemory uniform_buffer_memory(deletion_queue);
 
 	VkDeviceSize uniform_buffer_size = sizeof(UniformBufferObject);
 
-	r.createBuffer(uniform_buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniform_staging_buffer, uniform_staging_buffer_memory);
-	r.createBuffer(uniform_buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, uniform_buffer, uniform_buffer_memory);
+	// One staging slot per swapchain image, written once that image's last submission is done, so the copy can be
+	// recorded into the frame itself instead of being waited on
+	size_t uniform_staging_slot_count = r.getWindow()->getSwapchainImages().size();
+
+	r.createBuffer(uniform_buffer_size * uniform_staging_slot_count, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniform_staging_buffer.replace(), uniform_staging_buffer_memory.replace());
+	r.createBuffer(uniform_buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, uniform_buffer.replace(), uniform_buffer_memory.replace());
+
+	char * uniform_staging_data;
+	ErrorCheck(vkMapMemory(r.getDevice(), uniform_staging_buffer_memory, 0, VK_WHOLE_SIZE, 0, (void **)&uniform_staging_data)); // Stays mapped, freeing the memory unmaps it
 
 	// Create descriptor set
 	VkDescriptorSet descriptor_set;
 
-	VkDescriptorSetLayout layouts[] = { r.getDescriptorSetLayout() };
-	VkDescriptorSetAllocateInfo descriptor_set_allocate_info {};
-	descriptor_set_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	descriptor_set_allocate_info.descriptorPool = r.getDescriptorPool();
-	descriptor_set_allocate_info.descriptorSetCount = 1;
-	descriptor_set_allocate_info.pSetLayouts = layouts;
-
-	ErrorCheck(vkAllocateDescriptorSets(r.getDevice(), &descriptor_set_allocate_info, &descriptor_set));
+	if (!r.getDescriptorAllocator()->allocate(r.getDescriptorSetLayout(), descriptor_set)) {
+		throw std::runtime_error("failed to allocate descriptor set!");
+	}
 
 	// Configure descriptors
 	VkDescriptorBufferInfo buffer_info {};
@@ -275,91 +278,509 @@ int main(void) {
 	buffer_info.offset = 0;
 	buffer_info.range = sizeof(UniformBufferObject);
 
-	VkDescriptorImageInfo image_info {};
-	image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	image_info.imageView = texture_image_view;
-	image_info.sampler = texture_sampler;
-
 	// Info for writing descriptor
-	std::array<VkWriteDescriptorSet, 2> descriptor_writes {};
-	descriptor_writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptor_writes[0].dstSet = descriptor_set;
-	descriptor_writes[0].dstBinding = 0;
-	descriptor_writes[0].dstArrayElement = 0;
-	descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptor_writes[0].descriptorCount = 1;
-	descriptor_writes[0].pBufferInfo = &buffer_info; // Used if descriptor is buffer data
-	descriptor_writes[0].pImageInfo = nullptr; // Used if descriptor is image data
-	descriptor_writes[0].pTexelBufferView = nullptr; // Used if descriptor is buffer views
-
-	descriptor_writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptor_writes[1].dstSet = descriptor_set;
-	descriptor_writes[1].dstBinding = 1;
-	descriptor_writes[1].dstArrayElement = 0;
-	descriptor_writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	descriptor_writes[1].descriptorCount = 1;
-	descriptor_writes[1].pBufferInfo = nullptr;
-	descriptor_writes[1].pImageInfo = &image_info;
-	descriptor_writes[1].pTexelBufferView = nullptr;
-
-	vkUpdateDescriptorSets(r.getDevice(), (uint32_t)descriptor_writes.size(), descriptor_writes.data(), 0, nullptr);
+	VkWriteDescriptorSet descriptor_write = vkStruct<VkWriteDescriptorSet>();
+	descriptor_write.dstSet = descriptor_set;
+	descriptor_write.dstBinding = 0;
+	descriptor_write.dstArrayElement = 0;
+	descriptor_write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	descriptor_write.descriptorCount = 1;
+	descriptor_write.pBufferInfo = &buffer_info; // Used if descriptor is buffer data
+	descriptor_write.pImageInfo = nullptr; // Used if descriptor is image data
+	descriptor_write.pTexelBufferView = nullptr; // Used if descriptor is buffer views
+
+	vkUpdateDescriptorSets(r.getDevice(), 1, &descriptor_write, 0, nullptr);
+
+	// Textures live in the table, draws pick theirs by slot. The slot shows the placeholder until the texture is in
+	TextureTable * texture_table = r.getTextureTable();
+	texture_table->setDefaultTexture(placeholder_image_view, texture_sampler);
+	uint32_t texture_slot = texture_table->registerTexture(placeholder_image_view, texture_sampler);
+	uint32_t retired_texture_slot = INVALID_TEXTURE_SLOT;
+	uint64_t retired_texture_slot_submission = 0;
+	texture_table->flush(descriptor_set, TEXTURE_TABLE_BINDING);
+
+	// Lights, fixed in world space. Seeded so every run lights the scene the same way
+	ClusteredLighting lighting(&r);
+	{
+		std::mt19937 light_random(7);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		std::vector<PointLight> lights(SCENE_LIGHT_COUNT);
+		for (auto & light : lights) {
+			glm::vec3 position(unit(light_random) * 2.0f - 1.0f, unit(light_random) * 2.0f - 1.0f, 0.05f + unit(light_random) * 0.25f);
+			light.positionRadius = glm::vec4(position, 0.15f + unit(light_random) * 0.15f);
+			light.color = glm::vec4(unit(light_random), unit(light_random), unit(light_random), 0.0f);
+		}
+		lighting.setLights(lights);
+	}
 
 	// Create command buffers
-	std::vector<VkCommandBuffer> command_buffers(r.getSwapchainFramebuffers().size());
+	std::vector<VkCommandBuffer> command_buffers(r.getWindow()->getSwapchainImages().size());
 
-	VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
-	command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	VkCommandBufferAllocateInfo command_buffer_allocate_info = vkStruct<VkCommandBufferAllocateInfo>();
 	command_buffer_allocate_info.commandPool = command_pool;
 	command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 	command_buffer_allocate_info.commandBufferCount = (uint32_t)command_buffers.size();
 
 	ErrorCheck(vkAllocateCommandBuffers(r.getDevice(), &command_buffer_allocate_info, command_buffers.data()));
 
-	for (size_t i = 0; i < command_buffers.size(); i++) {
-		VkCommandBufferBeginInfo command_buffer_begin_info = {};
-		command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-		command_buffer_begin_info.pInheritanceInfo = nullptr;
+	// Command buffers are re-recorded every frame so per-draw data can go through push constants.
+	// Each is free again once the queue timeline passes its last submission
+	QueueTimeline * queue_timeline = r.getQueueTimeline();
+	std::vector<uint64_t> command_buffer_submissions(command_buffers.size(), 0);
 
-		vkBeginCommandBuffer(command_buffers[i], &command_buffer_begin_info);
+	VkPipeline current_pipeline = r.getGraphicsPipeline();
 
-		std::array<VkClearValue, 2> clear_values = {};
-		clear_values[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-		clear_values[1].depthStencil = { 1.0f, 0 };
+#if !BUILD_ENABLE_MODEL && !BUILD_ENABLE_GOLDEN_IMAGES
+	// Two timestamps per command buffer bracket the main pass, so the fractal quality follows the GPU's work rather
+	// than the present interval, which FIFO holds at the refresh rate however cheap the frame was
+	VkQueryPool frame_timestamps = VK_NULL_HANDLE;
+	if (r.getPhysicalDeviceProperties().limits.timestampComputeAndGraphics) {
+		VkQueryPoolCreateInfo query_pool_create_info = vkStruct<VkQueryPoolCreateInfo>();
+		query_pool_create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		query_pool_create_info.queryCount = 2 * (uint32_t)command_buffers.size();
 
-		VkRenderPassBeginInfo render_pass_begin_info{};
-		render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		render_pass_begin_info.renderPass = r.getRenderPass();
-		render_pass_begin_info.framebuffer = r.getSwapchainFramebuffers()[i];
-		render_pass_begin_info.renderArea.offset = { 0, 0 };
-		render_pass_begin_info.renderArea.extent.width = r.getWindow()->getWidth();
-		render_pass_begin_info.renderArea.extent.height = r.getWindow()->getHeight();
-		render_pass_begin_info.clearValueCount = (uint32_t)clear_values.size();
-		render_pass_begin_info.pClearValues = clear_values.data();
+		ErrorCheck(vkCreateQueryPool(r.getDevice(), &query_pool_create_info, nullptr, &frame_timestamps));
+	}
+#endif
 
-		vkCmdBeginRenderPass(command_buffers[i], &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindPipeline(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, r.getGraphicsPipeline());
+	// Shrink the copies so the whole grid covers the footprint of a single model
+	std::vector<glm::mat4> instance_transforms;
+	instance_transforms.reserve(INSTANCE_GRID_SIZE * INSTANCE_GRID_SIZE);
 
-		VkBuffer vertex_buffers[] = { vertex_buffer };
-		VkDeviceSize offsets[] = { 0 };
+	float instance_spacing = 2.0f / INSTANCE_GRID_SIZE;
+	for (uint32_t x = 0; x < INSTANCE_GRID_SIZE; x++) {
+		for (uint32_t y = 0; y < INSTANCE_GRID_SIZE; y++) {
+			glm::vec3 position((x + 0.5f) * instance_spacing - 1.0f, (y + 0.5f) * instance_spacing - 1.0f, 0.0f);
+			instance_transforms.push_back(glm::scale(glm::translate(glm::mat4(), position), glm::vec3(1.0f / INSTANCE_GRID_SIZE)));
+		}
+	}
 
-		vkCmdBindVertexBuffers(command_buffers[i], 0, 1, vertex_buffers, offsets);
+#if BUILD_ENABLE_GPU_CULLING
+	GpuCuller * gpu_culler = nullptr; // Created once the model is ready
+#else
+	DrawBatcher draw_batcher(&r, (uint32_t)command_buffers.size(), (uint32_t)instance_transforms.size());
+	Scene scene;
 
-		vkCmdBindIndexBuffer(command_buffers[i], index_buffer, 0, VK_INDEX_TYPE_UINT32);
+	std::vector<uint32_t> visible_objects;
+#endif
+#if BUILD_ENABLE_VIRTUAL_TEXTURE
+	VirtualTexture * virtual_texture = nullptr;
+#endif
 
-		vkCmdBindDescriptorSets(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, r.getPipelineLayout(), 0, 1, &descriptor_set, 0, nullptr);
+#if BUILD_ENABLE_GOLDEN_IMAGES
+	ImageCapture * image_capture = nullptr; // Created with the job system its conversions run on
+	bool capture_frame = false;
+	size_t golden_scene = 0;
+	uint32_t golden_frame = 0;
+	std::atomic<uint32_t> golden_failures(0);
+#endif
 
-		vkCmdDrawIndexed(command_buffers[i], (uint32_t)indices.size(), 1, 0, 0, 0);
-		vkCmdEndRenderPass(command_buffers[i]);
+	// Per-frame values the passes read when the graph is executed
+	struct FrameParameters {
+		uint32_t imageIndex;
+		UniformBufferObject ubo;
+		glm::mat4 transform;
+		float lodScale;
+	};
+	FrameParameters frame {};
+
+	// The frame as passes and the images they use. Barriers, layouts, load and store ops and the depth buffer's
+	// memory all follow from the declarations
+	RenderGraph render_graph(&r);
+	VkExtent2D frame_extent = { r.getWindow()->getWidth(), r.getWindow()->getHeight() };
+
+	// Acquired with a semaphore that colour output waits on
+	uint32_t swapchain_image = render_graph.importImage("swapchain", r.getWindow()->getSurfaceFormat().format, frame_extent, VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+	// With GPU culling the depth pyramid samples it after the main pass, so it is stored rather than lazily allocated
+	uint32_t depth_buffer = render_graph.createImage("depth", r.getDepthFormat(), frame_extent, r.getSampleCount());
+
+	// Multisampled colour only ever lives in the main pass, so it is lazily allocated. It is resolved into the swapchain image as the pass ends
+	bool multisampled = r.getSampleCount() != VK_SAMPLE_COUNT_1_BIT;
+	uint32_t color_buffer = swapchain_image;
+	if (multisampled) {
+		color_buffer = render_graph.createImage("color", r.getWindow()->getSurfaceFormat().format, frame_extent, r.getSampleCount());
+	}
 
-		ErrorCheck(vkEndCommandBuffer(command_buffers[i]));
+	uint32_t uniform_upload_pass = render_graph.addComputePass("uniform_upload", [&](VkCommandBuffer commandBuffer) {
+		// The previous frame's vertex shaders have to be done reading before the buffer is overwritten
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+		VkBufferCopy copy_region {};
+		copy_region.srcOffset = frame.imageIndex * uniform_buffer_size;
+		copy_region.dstOffset = 0;
+		copy_region.size = uniform_buffer_size;
+		vkCmdCopyBuffer(commandBuffer, uniform_staging_buffer, uniform_buffer, 1, &copy_region);
+
+		VkBufferMemoryBarrier barrier = vkStruct<VkBufferMemoryBarrier>();
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = uniform_buffer;
+		barrier.offset = 0;
+		barrier.size = uniform_buffer_size;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	});
+	render_graph.setSideEffects(uniform_upload_pass); // Synchronizes the uniform buffer itself
+
+#if BUILD_ENABLE_VIRTUAL_TEXTURE
+	uint32_t page_upload_pass = render_graph.addComputePass("virtual_texture_update", [&](VkCommandBuffer commandBuffer) {
+		if (virtual_texture != nullptr) {
+			virtual_texture->update(commandBuffer, frame.imageIndex);
+		}
+	});
+	render_graph.setSideEffects(page_upload_pass); // Writes the page cache and table, which the virtual texture synchronizes itself
+#endif
+
+#if BUILD_ENABLE_GPU_CULLING
+	uint32_t cull_pass = render_graph.addComputePass("cull", [&](VkCommandBuffer commandBuffer) {
+		if (gpu_culler != nullptr) {
+			glm::vec3 camera_position = glm::vec3(glm::inverse(frame.transform) * glm::vec4(CAMERA_POSITION, 1.0f)); // Into the space the culler works in
+			gpu_culler->cull(commandBuffer, frame.ubo.projection * frame.ubo.view * frame.transform, camera_position, frame.lodScale);
+		}
+	});
+	render_graph.setSideEffects(cull_pass); // Fills the indirect draw buffers
+#endif
+
+	uint32_t light_binning_pass = render_graph.addComputePass("light_binning", [&](VkCommandBuffer commandBuffer) {
+		lighting.bin(commandBuffer, frame.ubo.view, frame.ubo.projection, CAMERA_NEAR, CAMERA_FAR, frame_extent);
+	});
+	render_graph.setSideEffects(light_binning_pass); // Fills the cluster buffer, which the lighting synchronizes itself
+
+	uint32_t main_pass = render_graph.addGraphicsPass("main", [&](VkCommandBuffer commandBuffer) {
+#if !BUILD_ENABLE_MODEL && !BUILD_ENABLE_GOLDEN_IMAGES
+		if (frame_timestamps != VK_NULL_HANDLE) {
+			// At the stage the submission waits for the swapchain image, so time blocked on presentation is left out
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, frame_timestamps, 2 * frame.imageIndex);
+		}
+#endif
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, current_pipeline);
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, r.getPipelineLayout(), 0, 1, &descriptor_set, 0, nullptr);
+		lighting.bind(commandBuffer);
+#if BUILD_ENABLE_VIRTUAL_TEXTURE
+		if (virtual_texture != nullptr) {
+			virtual_texture->bind(commandBuffer, frame.imageIndex);
+		}
+#endif
+
+#if BUILD_ENABLE_GPU_CULLING
+		if (gpu_culler != nullptr) {
+			gpu_culler->draw(commandBuffer, frame.transform, texture_slot);
+		}
+#else
+		draw_batcher.record(commandBuffer, frame.transform);
+#endif
+
+#if !BUILD_ENABLE_MODEL && !BUILD_ENABLE_GOLDEN_IMAGES
+		if (frame_timestamps != VK_NULL_HANDLE) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame_timestamps, 2 * frame.imageIndex + 1);
+		}
+#endif
+	});
+
+	VkClearColorValue clear_color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+	VkClearDepthStencilValue clear_depth = { 1.0f, 0 };
+	render_graph.writeColorAttachment(main_pass, color_buffer, &clear_color);
+	render_graph.writeDepthAttachment(main_pass, depth_buffer, &clear_depth);
+	if (multisampled) {
+		render_graph.resolveColorAttachment(main_pass, color_buffer, swapchain_image);
 	}
 
+#if BUILD_ENABLE_GOLDEN_IMAGES
+	// Reads the finished frame back. Only the harness routes the swapchain image through TRANSFER_SRC
+	uint32_t capture_pass = render_graph.addComputePass("capture", [&](VkCommandBuffer commandBuffer) {
+		if (capture_frame) {
+			std::string name = GOLDEN_SCENES[golden_scene].name;
+			image_capture->capture(commandBuffer, render_graph.getImage(swapchain_image), r.getWindow()->getSurfaceFormat().format, frame_extent, [&golden_failures, name](const CapturedImage & image) {
+				if (!checkGoldenImage(name, image)) {
+					golden_failures++;
+				}
+			});
+		}
+	});
+	render_graph.readImage(capture_pass, swapchain_image, RenderGraph::ACCESS_TRANSFER_SRC, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	render_graph.setSideEffects(capture_pass); // Writes a host buffer
+#endif
+
+#if BUILD_ENABLE_VIRTUAL_TEXTURE
+	uint32_t feedback_pass = render_graph.addComputePass("virtual_texture_feedback", [&](VkCommandBuffer commandBuffer) {
+		if (virtual_texture != nullptr) {
+			virtual_texture->resolveFeedback(commandBuffer);
+		}
+	});
+	render_graph.setSideEffects(feedback_pass); // Read back on the host
+#endif
+
+#if BUILD_ENABLE_GPU_CULLING
+	// The only reader of the depth buffer. Without it depth is never stored
+	uint32_t depth_pyramid_pass = render_graph.addComputePass("depth_pyramid", [&](VkCommandBuffer commandBuffer) {
+		if (gpu_culler != nullptr) {
+			gpu_culler->buildDepthPyramid(commandBuffer);
+		}
+	});
+	render_graph.readImage(depth_pyramid_pass, depth_buffer, RenderGraph::ACCESS_SAMPLED, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	render_graph.setSideEffects(depth_pyramid_pass); // The pyramid outlives the frame, the next one culls against it
+#endif
+
+	render_graph.compile();
+
+	// Assets load in the background while frames are drawn. Anything that touches the queue runs as a main thread job
+	JobSystem jobs(r.getTaskScheduler());
+#if BUILD_ENABLE_GOLDEN_IMAGES
+	image_capture = new ImageCapture(&r, &jobs);
+#endif
+
+	// Texture: decode, upload, then swap it in for the placeholder
+	int tex_width, tex_height, tex_channels;
+	stbi_uc * pixels = nullptr;
+
+	UniqueImage texture_image(deletion_queue);
+	UniqueMemory texture_image_memory(deletion_queue);
+	UniqueImageView texture_image_view(deletion_queue);
+
+	Job * decode_texture = jobs.createJob([&]() {
+		// Decode straight out of the mapping rather than a heap copy of the file
+		MappedFile texture_file(TEXTURE_PATH);
+		texture_file.adviseAccess(MappedFile::ACCESS_SEQUENTIAL);
+		pixels = stbi_load_from_memory((const stbi_uc *)texture_file.getData(), (int)texture_file.getSize(), &tex_width, &tex_height, &tex_channels, STBI_rgb_alpha);
+
+		if (!pixels) {
+			throw std::runtime_error("failed to load texture image!");
+		}
+	});
+
+	Job * upload_texture = jobs.createJob([&]() {
+		r.createImage(tex_width, tex_height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture_image.replace(), texture_image_memory.replace());
+
+		uploader.transitionImage(texture_image, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+		uploader.uploadImage(texture_image, tex_width, tex_height, 4, pixels);
+		uploader.transitionImage(texture_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		uploader.flush();
+
+		r.createImageView(texture_image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, texture_image_view.replace());
+
+		if (texture_table->usesDescriptorIndexing()) {
+			// Frames in flight still use the placeholder's slot. A fresh one is not referenced by any of them, so it
+			// can be written while they run and later frames switch over; the old slot is freed once they are done
+			retired_texture_slot = texture_slot;
+			retired_texture_slot_submission = queue_timeline->getSubmittedValue();
+			texture_slot = texture_table->registerTexture(texture_image_view, texture_sampler);
+		} else {
+			// Without update after bind the whole set must be idle, which only needs the frames that bind it to finish
+			queue_timeline->wait(*std::max_element(command_buffer_submissions.begin(), command_buffer_submissions.end()));
+			texture_table->updateTexture(texture_slot, texture_image_view, texture_sampler);
+		}
+		texture_table->flush(descriptor_set, TEXTURE_TABLE_BINDING);
+	}, true);
+	jobs.addDependency(upload_texture, decode_texture);
+
+#if BUILD_ENABLE_VIRTUAL_TEXTURE
+	Job * bake_virtual_texture = jobs.createJob([&]() {
+		// Tiles are baked from the source image once, later runs stream them straight from the file
+		if (!std::ifstream(VIRTUAL_TEXTURE_PATH).good()) {
+			VirtualTexture::bake(pixels, tex_width, tex_height, VIRTUAL_TEXTURE_PATH);
+		}
+	});
+	jobs.addDependency(bake_virtual_texture, decode_texture);
+
+	Job * create_virtual_texture = jobs.createJob([&]() {
+		virtual_texture = new VirtualTexture(&r, VIRTUAL_TEXTURE_PATH, (uint32_t)command_buffers.size());
+	}, true);
+	jobs.addDependency(create_virtual_texture, bake_virtual_texture);
+#endif
+
+	Job * free_pixels = jobs.createJob([&]() {
+		stbi_image_free(pixels);
+		pixels = nullptr;
+	});
+	jobs.addDependency(free_pixels, upload_texture);
+#if BUILD_ENABLE_VIRTUAL_TEXTURE
+	jobs.addDependency(free_pixels, bake_virtual_texture);
+#endif
+
+	// Model: parse, optimize, upload, then hand it to the culler
+	uint32_t full_index_count = (uint32_t)indices.size();
+	std::vector<MeshLod> mesh_lods;
+	std::vector<Meshlet> mesh_meshlets;
+
+	UniqueBuffer vertex_buffer(deletion_queue);
+	UniqueMemory vertex_buffer_memory(deletion_queue);
+	UniqueBuffer index_buffer(deletion_queue);
+	UniqueMemory index_buffer_memory(deletion_queue);
+
+	Mesh mesh;
+	bool mesh_ready = false;
+
+#if BUILD_ENABLE_MODEL
+	Job * parse_model = jobs.createJob([&]() {
+		// Load Model
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::shape_t> shapes;
+		std::vector<tinyobj::material_t> materials;
+		std::string err;
+
+		std::cout << "Loading Model" << std::endl;
+		{
+			// The parser reads through the mapping front to back, so the file never needs a heap copy
+			MappedFile model_file(MODEL_PATH);
+			model_file.adviseAccess(MappedFile::ACCESS_SEQUENTIAL);
+
+			MemoryStreamBuffer model_buffer(model_file.getData(), model_file.getSize());
+			std::istream model_stream(&model_buffer);
+
+			if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, &model_stream)) {
+				throw std::runtime_error(err);
+			}
+		}
+		std::cout << "Done Loading Model" << std::endl;
+	
+		std::unordered_map<Vertex, int> unique_vertices = {};
+
+		for (const auto & shape : shapes) {
+			for (const auto & index : shape.mesh.indices) {
+				Vertex vertex {};
+
+				vertex.pos = {
+					attrib.vertices[3 * index.vertex_index + 0],
+					attrib.vertices[3 * index.vertex_index + 1],
+					attrib.vertices[3 * index.vertex_index + 2]
+				};
+
+				vertex.texCoord = {
+					attrib.texcoords[2 * index.texcoord_index + 0],
+					1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+				};
+
+				if (index.normal_index >= 0) {
+					vertex.normal = {
+						attrib.normals[3 * index.normal_index + 0],
+						attrib.normals[3 * index.normal_index + 1],
+						attrib.normals[3 * index.normal_index + 2]
+					};
+				}
+
+				if (unique_vertices.count(vertex) == 0) {
+					unique_vertices[vertex] = (int)vertices.size();
+					vertices.push_back(vertex);
+				}
+			
+				indices.push_back(unique_vertices[vertex]);
+			}
+		}
+
+		if (attrib.normals.empty()) {
+			Mesh::computeNormals(vertices, indices);
+		}
+	});
+
+	Job * optimize_model = jobs.createJob([&]() {
+		// Simplified copies of the model go on the end of the index buffer, sharing its vertices
+		full_index_count = (uint32_t)indices.size();
+		mesh_lods = MeshSimplifier::generateLods(vertices, indices, 0, full_index_count);
+
+		// Full detail is also split into meshlets, each its own index range, so hidden clusters can be skipped
+		mesh_meshlets = MeshletBuilder::buildMeshlets(vertices, indices, 0, full_index_count);
+	});
+	jobs.addDependency(optimize_model, parse_model);
+#endif
+
+	Job * upload_model = jobs.createJob([&]() {
+		VkDeviceSize vertex_buffer_size = sizeof(vertices[0]) * vertices.size();
+		r.createBuffer(vertex_buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertex_buffer.replace(), vertex_buffer_memory.replace());
+		uploader.uploadBuffer(vertex_buffer, 0, vertices.data(), vertex_buffer_size);
+
+		VkDeviceSize index_buffer_size = sizeof(indices[0]) * indices.size();
+		r.createBuffer(index_buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, index_buffer.replace(), index_buffer_memory.replace());
+		uploader.uploadBuffer(index_buffer, 0, indices.data(), index_buffer_size);
+
+		uploader.flush();
+	}, true);
+#if BUILD_ENABLE_MODEL
+	jobs.addDependency(upload_model, optimize_model);
+#endif
+
+	Job * model_ready = jobs.createJob([&]() {
+		mesh.vertexBuffer = vertex_buffer;
+		mesh.indexBuffer = index_buffer;
+		mesh.indexCount = full_index_count;
+		mesh.lods = mesh_lods;
+		mesh.meshlets = mesh_meshlets;
+		mesh.boundingSphere = Mesh::computeBoundingSphere(vertices);
+
+#if BUILD_ENABLE_GPU_CULLING
+		// The grid is static, so it is uploaded once and culled on the GPU every frame
+		gpu_culler = new GpuCuller(&r, command_pool, render_graph.getImageView(depth_buffer), frame_extent.width, frame_extent.height);
+
+		uint32_t mesh_index = gpu_culler->addMesh(mesh);
+		for (auto & instance_transform : instance_transforms) {
+			gpu_culler->addObject(mesh_index, instance_transform);
+		}
+		gpu_culler->upload();
+#else
+		// World space bounds of every instance, culled on the CPU before batching
+		for (auto & instance_transform : instance_transforms) {
+			glm::vec4 centre = instance_transform * glm::vec4(glm::vec3(mesh.boundingSphere), 1.0f);
+			float scale = glm::max(glm::length(glm::vec3(instance_transform[0])), glm::max(glm::length(glm::vec3(instance_transform[1])), glm::length(glm::vec3(instance_transform[2]))));
+			scene.addObject(glm::vec4(glm::vec3(centre), mesh.boundingSphere.w * scale));
+		}
+		scene.build();
+#endif
+
+		mesh_ready = true;
+	}, true);
+	jobs.addDependency(model_ready, upload_model);
+#if BUILD_ENABLE_VIRTUAL_TEXTURE
+	jobs.addDependency(model_ready, create_virtual_texture); // The shader reads the virtual texture, nothing may draw before it exists
+#endif
+
+	Job * assets_loaded = jobs.createJob([]() {});
+	jobs.addDependency(assets_loaded, model_ready);
+	jobs.addDependency(assets_loaded, free_pixels);
+	bool assets_ready = false;
+
+	// Independent branches of the graph run side by side
+	jobs.submit(decode_texture);
+	jobs.submit(upload_texture);
+#if BUILD_ENABLE_VIRTUAL_TEXTURE
+	jobs.submit(bake_virtual_texture);
+	jobs.submit(create_virtual_texture);
+#endif
+	jobs.submit(free_pixels);
+#if BUILD_ENABLE_MODEL
+	jobs.submit(parse_model);
+	jobs.submit(optimize_model);
+#endif
+	jobs.submit(upload_model);
+	jobs.submit(model_ready);
+	jobs.submit(assets_loaded);
+
+	auto record_command_buffer = [&](uint32_t i) {
+		VkCommandBufferBeginInfo command_buffer_begin_info = vkStruct<VkCommandBufferBeginInfo>();
+		command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		command_buffer_begin_info.pInheritanceInfo = nullptr;
+
+		ErrorCheck(vkBeginCommandBuffer(command_buffers[i], &command_buffer_begin_info));
+
+#if !BUILD_ENABLE_MODEL && !BUILD_ENABLE_GOLDEN_IMAGES
+		if (frame_timestamps != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(command_buffers[i], frame_timestamps, 2 * i, 2); // Not allowed inside the render pass
+		}
+#endif
+
+		render_graph.setImportedImage(swapchain_image, r.getWindow()->getSwapchainImages()[i], r.getWindow()->getSwapchainImageViews()[i]);
+		render_graph.execute(command_buffers[i]);
+
+		ErrorCheck(vkEndCommandBuffer(command_buffers[i]));
+	};
+
 	VkSemaphore image_available;
 	VkSemaphore render_finished;
 
-	VkSemaphoreCreateInfo semaphore_create_info {};
-	semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	VkSemaphoreCreateInfo semaphore_create_info = vkStruct<VkSemaphoreCreateInfo>();
 
 	ErrorCheck(vkCreateSemaphore(r.getDevice(), &semaphore_create_info, nullptr, &image_available));
 	ErrorCheck(vkCreateSemaphore(r.getDevice(), &semaphore_create_info, nullptr, &render_finished));
@@ -369,11 +790,50 @@ int main(void) {
 	int xPos = 1;
 	int yPos = 45;
 
+#if !BUILD_ENABLE_MODEL && !BUILD_ENABLE_GOLDEN_IMAGES
+	size_t fractal_quality = 2; // DEFAULT_FRACTAL_SPECIALIZATION
+	uint32_t frame_time_samples = 0;
+	double frame_time_total = 0.0;
+	auto last_frame_time = start_time;
+	// Without timestamps only the present interval is left, which says nothing about the work while it is vsynced
+	VkPresentModeKHR present_mode = r.getWindow()->getPresentMode();
+	bool present_interval_measures_work = present_mode != VK_PRESENT_MODE_FIFO_KHR && present_mode != VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+#endif
+
+#if BUILD_ENABLE_ALLOCATION_TRACKING
+	uint32_t steady_frame_count = 0;
+#endif
+
+	FramePacer frame_pacer(r.getWindow()->getLatencyMode(), BUILD_FRAME_RATE_LIMIT, queue_timeline);
+#if BUILD_ENABLE_FRAMERATE
+	uint32_t latency_report_frame = 0;
+#endif
+
 	while (r.run(&xPos, &yPos)) { // main loop
+		frame_pacer.markInput(r.getWindow()->getLastInputTime()); // Everything drawn this frame follows from the cursor just read
+
+#if BUILD_ENABLE_ALLOCATION_TRACKING
+		uint64_t frame_allocations = getAllocationCount();
+#endif
+
+		// Queue work for the loaders, then surface any failure once the whole graph is through
+		jobs.runMainThreadJobs();
+		if (!assets_ready && assets_loaded->isFinished()) {
+			jobs.wait(assets_loaded);
+			assets_ready = true;
+		}
+
 		// Update Uniform Buffer
 		auto current_time = std::chrono::high_resolution_clock::now();
 		float time = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count() / 1000.0f;
 
+#if BUILD_ENABLE_GOLDEN_IMAGES
+		// Hold each scene until loading is over and it has settled, then capture it
+		capture_frame = assets_ready && golden_frame == GOLDEN_WARMUP_FRAME_COUNT;
+		time = GOLDEN_SCENES[golden_scene].time;
+		yPos = GOLDEN_SCENES[golden_scene].yPos;
+#endif
+
 		// Get new viewing angle
 		auto height = r.getWindow()->getHeight();
 		double placeholder =  yPos - ((double)height / 2);
@@ -381,30 +841,103 @@ int main(void) {
 		float angle = placeholder * 90;
 
 		UniformBufferObject ubo {};
-		ubo.model = glm::rotate(glm::mat4(), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.view = glm::lookAt(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.projection = glm::perspective(glm::radians(angle), (float)(r.getWindow()->getSurfaceCapabilities().currentExtent.width) / (float)(r.getWindow()->getSurfaceCapabilities().currentExtent.height), 0.1f, 10.0f);
+		ubo.view = glm::lookAt(CAMERA_POSITION, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		ubo.projection = glm::perspective(glm::radians(angle), (float)(r.getWindow()->getSurfaceCapabilities().currentExtent.width) / (float)(r.getWindow()->getSurfaceCapabilities().currentExtent.height), CAMERA_NEAR, CAMERA_FAR);
 
 		ubo.projection[1][1] *= -1.0f; // GLM is for OpenGL, the Y-axis needs to be flipped for Vulkan
 
-		void * data;
-		vkMapMemory(r.getDevice(), uniform_staging_buffer_memory, 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(r.getDevice(), uniform_staging_buffer_memory);
-
-		r.copyBuffer(command_pool, uniform_staging_buffer, uniform_buffer, sizeof(ubo));
-
 		// Main Draw
 		uint32_t image_index;
-		vkAcquireNextImageKHR(r.getDevice(), r.getWindow()->getSwapchain(), UINT64_MAX, image_available, VK_NULL_HANDLE, &image_index);
+		if (ErrorCheckResult(vkAcquireNextImageKHR(r.getDevice(), r.getWindow()->getSwapchain(), UINT64_MAX, image_available, VK_NULL_HANDLE, &image_index), VK_ERROR_OUT_OF_DATE_KHR) == VK_ERROR_OUT_OF_DATE_KHR) {
+			break; // The swapchain is never rebuilt, so there is nothing left to draw into
+		}
+
+		// Wait for the last submission of this image's command buffer before recording over it
+		queue_timeline->wait(command_buffer_submissions[image_index]);
+
+		// Nothing from this image's last frame is in use any more, its staging slot included
+		memcpy(uniform_staging_data + image_index * uniform_buffer_size, &ubo, sizeof(ubo));
+
+		if (retired_texture_slot != INVALID_TEXTURE_SLOT && queue_timeline->isComplete(retired_texture_slot_submission)) {
+			texture_table->releaseTexture(retired_texture_slot);
+			retired_texture_slot = INVALID_TEXTURE_SLOT;
+		}
+
+		r.beginFrame(image_index);
+
+#if !BUILD_ENABLE_MODEL && !BUILD_ENABLE_GOLDEN_IMAGES // Captures must not depend on how fast the frames were
+		{ // Pick a fractal variant from the measured frame time
+			double frame_time = 0.0;
+			if (frame_timestamps != VK_NULL_HANDLE) {
+				// The last frame recorded into this command buffer is complete, so its timestamps are too
+				if (command_buffer_submissions[image_index] != 0) {
+					std::array<uint64_t, 2> timestamps {};
+					ErrorCheck(vkGetQueryPoolResults(r.getDevice(), frame_timestamps, 2 * image_index, 2, sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT));
+					frame_time = (timestamps[1] - timestamps[0]) * r.getPhysicalDeviceProperties().limits.timestampPeriod * 1e-9;
+				}
+			}
+			else if (present_interval_measures_work) {
+				auto now = std::chrono::high_resolution_clock::now();
+				frame_time = std::chrono::duration<double>(now - last_frame_time).count();
+				last_frame_time = now;
+			}
+
+			if (frame_time > 0.0) {
+				frame_time_total += frame_time;
+				frame_time_samples++;
+			}
+
+			if (frame_time_samples == FRAME_TIME_SAMPLE_COUNT) {
+				double average_frame_time = frame_time_total / frame_time_samples;
+				size_t new_quality = fractal_quality;
+
+				// Hysteresis keeps the ladder from oscillating around the target
+				if (average_frame_time > TARGET_FRAME_TIME * 1.2 && fractal_quality > 0) {
+					new_quality--;
+				}
+				else if (average_frame_time < TARGET_FRAME_TIME * 0.6 && fractal_quality + 1 < FRACTAL_QUALITY_LEVELS.size()) {
+					new_quality++;
+				}
+
+				if (new_quality != fractal_quality) {
+					fractal_quality = new_quality;
+					current_pipeline = r.getGraphicsPipeline(FRACTAL_QUALITY_LEVELS[fractal_quality]); // Picked up by this frame's recording
+				}
+
+				frame_time_samples = 0;
+				frame_time_total = 0.0;
+			}
+		}
+#endif
+
+		glm::mat4 transform = glm::rotate(glm::mat4(), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		float lod_scale = Mesh::computeLodScale(ubo.projection, r.getWindow()->getSurfaceCapabilities().currentExtent.height);
+
+#if !BUILD_ENABLE_GPU_CULLING
+		draw_batcher.begin(image_index);
+		if (mesh_ready) {
+			glm::mat4 view_projection = ubo.projection * ubo.view * transform;
+			scene.cull(view_projection, visible_objects, r.getTaskScheduler());
+
+			for (auto object : visible_objects) {
+				uint32_t lod = mesh.selectLod(view_projection, instance_transforms[object], lod_scale);
+				draw_batcher.draw(&mesh, texture_slot, instance_transforms[object], lod);
+			}
+		}
+#endif
+
+		frame.imageIndex = image_index;
+		frame.ubo = ubo;
+		frame.transform = transform;
+		frame.lodScale = lod_scale;
+		record_command_buffer(image_index);
 
 		VkSemaphore wait_semaphores[] = { image_available };
 		VkSemaphore signal_semaphores[] = { render_finished };
 
 		VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
 
-		VkSubmitInfo submit_info {};
-		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		TimelineSubmitInfo submit_info {};
 		submit_info.waitSemaphoreCount = 1;
 		submit_info.pWaitSemaphores = wait_semaphores;
 		submit_info.pWaitDstStageMask = wait_stages;
@@ -412,25 +945,16 @@ int main(void) {
 		submit_info.pCommandBuffers = &command_buffers[image_index];
 		submit_info.signalSemaphoreCount = 1;
 		submit_info.pSignalSemaphores = signal_semaphores;
-		
-		ErrorCheck(vkQueueSubmit(r.getQueue(), 1, &submit_info, VK_NULL_HANDLE));
 
-		VkSubpassDependency subpass_dependency {};
-		subpass_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-		subpass_dependency.dstSubpass = 0;
-		subpass_dependency.srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-		subpass_dependency.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-		subpass_dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		subpass_dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-		VkRenderPassCreateInfo render_pass_create_info {};
-		render_pass_create_info.dependencyCount = 1;
-		render_pass_create_info.pDependencies = &subpass_dependency;
+		command_buffer_submissions[image_index] = queue_timeline->submit(submit_info);
+#if BUILD_ENABLE_GOLDEN_IMAGES
+		image_capture->submitted(command_buffer_submissions[image_index]);
+		image_capture->update();
+#endif
 
 		VkSwapchainKHR swapchains[] = { r.getWindow()->getSwapchain() };
 
-		VkPresentInfoKHR present_info {};
-		present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		VkPresentInfoKHR present_info = vkStruct<VkPresentInfoKHR>();
 		present_info.waitSemaphoreCount = 1;
 		present_info.pWaitSemaphores = signal_semaphores;
 		present_info.swapchainCount = 1;
@@ -438,60 +962,81 @@ int main(void) {
 		present_info.pImageIndices = &image_index;
 		present_info.pResults = nullptr;
 
-		ErrorCheck(vkQueuePresentKHR(r.getQueue(), &present_info));
+		if (ErrorCheckResult(vkQueuePresentKHR(r.getQueue(), &present_info), VK_ERROR_OUT_OF_DATE_KHR) == VK_ERROR_OUT_OF_DATE_KHR) {
+			break;
+		}
+
+		frame_pacer.endFrame(command_buffer_submissions[image_index]);
+#if BUILD_ENABLE_FRAMERATE
+		if (++latency_report_frame == LATENCY_REPORT_INTERVAL) {
+			std::cout << "Frame " << frame_pacer.getFrameInterval() * 1000.0 << " ms, input to present " << frame_pacer.getInputLatency() * 1000.0 << " ms" << std::endl;
+			latency_report_frame = 0;
+		}
+#endif
+
+#if BUILD_ENABLE_ALLOCATION_TRACKING
+		// Once loading is over and the frame arenas have grown to fit, a frame should not touch the heap
+		frame_allocations = getAllocationCount() - frame_allocations;
+		if (assets_ready && ++steady_frame_count > ALLOCATION_WARMUP_FRAME_COUNT && frame_allocations > 0) {
+			std::cerr << "Steady state frame made " << frame_allocations << " heap allocations" << std::endl;
+		}
+#endif
+
+#if BUILD_ENABLE_GOLDEN_IMAGES
+		if (capture_frame) {
+			golden_frame = 0;
+			if (++golden_scene == GOLDEN_SCENES.size()) {
+				break;
+			}
+		}
+		else if (assets_ready) {
+			golden_frame++;
+		}
+#endif
 	}
 
-	vkQueueWaitIdle(r.getQueue());
+	// Closing early must not leave loaders writing into what is about to be destroyed
+	jobs.wait(assets_loaded);
+
+	queue_timeline->waitIdle();
 
+#if BUILD_ENABLE_GOLDEN_IMAGES
+	image_capture->flush();
+	delete image_capture;
+	image_capture = nullptr;
+#endif
+#if BUILD_ENABLE_GPU_CULLING
+	delete gpu_culler;
+	gpu_culler = nullptr;
+#endif
+#if BUILD_ENABLE_VIRTUAL_TEXTURE
+	delete virtual_texture;
+	virtual_texture = nullptr;
+#endif
+
+#if !BUILD_ENABLE_MODEL && !BUILD_ENABLE_GOLDEN_IMAGES
+	vkDestroyQueryPool(r.getDevice(), frame_timestamps, nullptr);
+	frame_timestamps = nullptr;
+#endif
 	vkDestroySemaphore(r.getDevice(), image_available, nullptr);
 	image_available = nullptr;
 	vkDestroySemaphore(r.getDevice(), render_finished, nullptr);
 	render_finished = nullptr;
 	vkFreeCommandBuffers(r.getDevice(), command_pool, (uint32_t) command_buffers.size(), command_buffers.data());
-	vkFreeMemory(r.getDevice(), uniform_buffer_memory, nullptr);
-	uniform_buffer_memory = nullptr;
-	vkFreeMemory(r.getDevice(), uniform_staging_buffer_memory, nullptr);
-	uniform_staging_buffer_memory = nullptr;
-	vkFreeMemory(r.getDevice(), index_buffer_memory, nullptr);
-	index_buffer_memory = nullptr;
-	vkFreeMemory(r.getDevice(), index_staging_buffer_memory, nullptr);
-	index_staging_buffer_memory = nullptr;
-	vkFreeMemory(r.getDevice(), vertex_buffer_memory, nullptr);
-	vertex_buffer_memory = nullptr;
-	vkFreeMemory(r.getDevice(), vertex_staging_buffer_memory, nullptr);
-	vertex_staging_buffer_memory = nullptr;
-	vkDestroyBuffer(r.getDevice(), uniform_buffer, nullptr);
-	uniform_buffer = nullptr;
-	vkDestroyBuffer(r.getDevice(), uniform_staging_buffer, nullptr);
-	uniform_staging_buffer = nullptr;
-	vkDestroyBuffer(r.getDevice(), index_buffer, nullptr);
-	index_buffer = nullptr;
-	vkDestroyBuffer(r.getDevice(), index_staging_buffer, nullptr);
-	index_staging_buffer = nullptr;
-	vkDestroyBuffer(r.getDevice(), vertex_buffer, nullptr);
-	vertex_buffer = nullptr;
-	vkDestroyBuffer(r.getDevice(), vertex_staging_buffer, nullptr);
-	vertex_staging_buffer = nullptr;
-	vkDestroySampler(r.getDevice(), texture_sampler, nullptr);
-	texture_sampler = nullptr;
-	vkDestroyImageView(r.getDevice(), texture_image_view, nullptr);
-	texture_image_view = nullptr;
-	vkFreeMemory(r.getDevice(), staging_image_memory, nullptr);
-	staging_image_memory = nullptr;
-	vkDestroyImage(r.getDevice(), staging_image, nullptr);
-	staging_image = nullptr;
-	vkFreeMemory(r.getDevice(), texture_image_memory, nullptr);
-	texture_image_memory = nullptr;
-	vkDestroyImage(r.getDevice(), texture_image, nullptr);
-	texture_image = nullptr;
-	vkDestroyImageView(r.getDevice(), depth_image_view, nullptr);
-	depth_image_view = nullptr;
-	vkFreeMemory(r.getDevice(), depth_image_memory, nullptr);
-	depth_image_memory = nullptr;
-	vkDestroyImage(r.getDevice(), depth_image, nullptr);
-	depth_image = nullptr;
+	texture_table->releaseTexture(texture_slot);
+	if (retired_texture_slot != INVALID_TEXTURE_SLOT) {
+		texture_table->releaseTexture(retired_texture_slot);
+	}
 	vkDestroyCommandPool(r.getDevice(), command_pool, nullptr);
 	command_pool = nullptr;
 
-	return 0;
+#if BUILD_ENABLE_GOLDEN_IMAGES
+	// Closing the window before every scene was captured fails too
+	if (golden_failures > 0 || golden_scene < GOLDEN_SCENES.size()) {
+		std::cerr << "Golden images: " << golden_failures << " failed, " << GOLDEN_SCENES.size() - std::min(golden_scene, GOLDEN_SCENES.size()) << " not captured" << std::endl;
+		return 1;
+	}
+#endif
+
+	return 0; // Buffers, images and the rest go to the deletion queue here, the renderer drains it once the device is idle
 }
\ No newline at end of file
@@ -0,0 +1,178 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* MappedFile.cpp | Read-only memory mapped files
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MappedFile.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile(const std::string & path) {
+	_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (_file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("Failed to open file: " + path);
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(_file, &size);
+	_size = (size_t)size.QuadPart;
+
+	// Empty files cannot be mapped, there is nothing to read anyway
+	if (_size == 0) {
+		return;
+	}
+
+	_mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (_mapping == NULL) {
+		CloseHandle(_file);
+		throw std::runtime_error("Failed to map file: " + path);
+	}
+
+	_data = (const char *)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (_data == nullptr) {
+		CloseHandle(_mapping);
+		CloseHandle(_file);
+		throw std::runtime_error("Failed to map file: " + path);
+	}
+}
+
+MappedFile::~MappedFile() {
+	if (_data != nullptr) {
+		UnmapViewOfFile(_data);
+	}
+	if (_mapping != NULL) {
+		CloseHandle(_mapping);
+	}
+	CloseHandle(_file);
+}
+
+void MappedFile::adviseAccess(AccessPattern pattern) const {
+	// Windows picks the read-ahead when the file is opened, not per mapping
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const {
+#if _WIN32_WINNT >= _WIN32_WINNT_WIN8
+	if (offset >= _size) {
+		return;
+	}
+
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = (PVOID)(_data + offset);
+	range.NumberOfBytes = std::min(size, _size - offset);
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+}
+
+void MappedFile::release(size_t offset, size_t size) const {
+	if (offset >= _size) {
+		return;
+	}
+
+	// Unlocking pages that were never locked removes them from the working set
+	VirtualUnlock((LPVOID)(_data + offset), std::min(size, _size - offset));
+}
+
+#else
+
+static long pageSize() {
+	static long page_size = sysconf(_SC_PAGESIZE);
+	return page_size;
+}
+
+MappedFile::MappedFile(const std::string & path) {
+	_file = open(path.c_str(), O_RDONLY);
+	if (_file < 0) {
+		throw std::runtime_error("Failed to open file: " + path);
+	}
+
+	struct stat file_stat;
+	fstat(_file, &file_stat);
+	_size = (size_t)file_stat.st_size;
+
+	// Empty files cannot be mapped, there is nothing to read anyway
+	if (_size == 0) {
+		return;
+	}
+
+	void * data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _file, 0);
+	if (data == MAP_FAILED) {
+		close(_file);
+		throw std::runtime_error("Failed to map file: " + path);
+	}
+	_data = (const char *)data;
+}
+
+MappedFile::~MappedFile() {
+	if (_data != nullptr) {
+		munmap((void *)_data, _size);
+	}
+	close(_file);
+}
+
+void MappedFile::adviseAccess(AccessPattern pattern) const {
+	if (_data == nullptr) {
+		return;
+	}
+
+	int advice = MADV_NORMAL;
+	if (pattern == ACCESS_SEQUENTIAL) {
+		advice = MADV_SEQUENTIAL;
+	}
+	else if (pattern == ACCESS_RANDOM) {
+		advice = MADV_RANDOM;
+	}
+
+	madvise((void *)_data, _size, advice);
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const {
+	if (offset >= _size) {
+		return;
+	}
+
+	// madvise wants a page aligned start
+	size_t start = offset - offset % pageSize();
+	madvise((void *)(_data + start), std::min(size, _size - offset) + (offset - start), MADV_WILLNEED);
+}
+
+void MappedFile::release(size_t offset, size_t size) const {
+	if (offset >= _size) {
+		return;
+	}
+
+	size_t start = offset - offset % pageSize();
+	madvise((void *)(_data + start), std::min(size, _size - offset) + (offset - start), MADV_DONTNEED);
+}
+
+#endif
+
+const char * MappedFile::getData() const {
+	return _data;
+}
+
+const size_t MappedFile::getSize() const {
+	return _size;
+}
\ No newline at end of file
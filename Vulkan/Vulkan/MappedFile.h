@@ -0,0 +1,70 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* MappedFile.h | Read-only memory mapped files
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+
+#include <string>
+#include <streambuf>
+
+// Maps a whole file read-only. Pages are faulted in from the OS file cache as they are touched, so nothing
+// is copied to the heap and the pages can be dropped again once consumed.
+class MappedFile {
+public:
+	enum AccessPattern {
+		ACCESS_NORMAL,
+		ACCESS_SEQUENTIAL, // Aggressive read-ahead, pages behind the reader are cheap to evict
+		ACCESS_RANDOM // No read-ahead
+	};
+
+	MappedFile(const std::string & path);
+	~MappedFile();
+
+	const char * getData() const;
+	const size_t getSize() const;
+
+	void adviseAccess(AccessPattern pattern) const;
+	// Starts reading a range in ahead of use
+	void prefetch(size_t offset, size_t size) const;
+	// Drops the pages of a range that has been consumed; touching it again reads it back in
+	void release(size_t offset, size_t size) const;
+
+private:
+	MappedFile(const MappedFile &);
+	MappedFile & operator=(const MappedFile &);
+
+	const char * _data = nullptr;
+	size_t _size = 0;
+
+#if defined(_WIN32)
+	HANDLE _file = INVALID_HANDLE_VALUE;
+	HANDLE _mapping = NULL;
+#else
+	int _file = -1;
+#endif
+};
+
+// Lets istream based parsers read straight out of a mapping
+class MemoryStreamBuffer : public std::streambuf {
+public:
+	MemoryStreamBuffer(const char * data, size_t size) {
+		char * begin = const_cast<char *>(data); // Only ever read through the get area
+		setg(begin, begin, begin + size);
+	}
+};
\ No newline at end of file
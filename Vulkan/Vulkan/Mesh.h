@@ -0,0 +1,150 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* Mesh.h | GPU geometry shared by draws
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Renderer.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+const uint32_t MAX_MESH_LODS = 8; // Including full detail; must match Cull.comp
+const float DEFAULT_LOD_THRESHOLD = 1.0f; // Largest acceptable simplification error, in pixels
+
+// A simplified copy of a mesh's index range, in the same buffers
+struct MeshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error; // Upper bound on the distance from the full detail surface, in mesh space
+};
+
+const uint32_t MAX_MESHLET_VERTICES = 64;
+const uint32_t MAX_MESHLET_TRIANGLES = 124;
+
+// A cluster of nearby triangles, culled as a unit. Must match Meshlet in ClusterCull.comp
+struct Meshlet {
+	glm::vec4 boundingSphere; // xyz centre, w radius, in mesh space
+	glm::vec4 coneApex; // xyz, w unused
+	glm::vec4 coneAxis; // xyz axis, w cutoff. Every triangle faces away from cameras where dot(normalize(apex - camera), axis) >= cutoff
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t vertexCount;
+	uint32_t padding;
+};
+
+// A range of indices in a vertex/index buffer pair. The buffers are owned elsewhere
+struct Mesh {
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	uint32_t indexCount = 0;
+	uint32_t firstIndex = 0;
+	int32_t vertexOffset = 0;
+
+	glm::vec4 boundingSphere = glm::vec4(0.0f); // xyz centre, w radius, in mesh space
+
+	// Coarser levels after the full detail indexCount/firstIndex, error increasing
+	std::vector<MeshLod> lods;
+
+	// Clusters covering the full detail range, as index ranges in the same buffers
+	std::vector<Meshlet> meshlets;
+
+	const uint32_t getLodCount() const {
+		return 1 + (uint32_t)lods.size();
+	}
+
+	MeshLod getLod(uint32_t level) const {
+		if (level == 0) {
+			MeshLod full_detail = { firstIndex, indexCount, 0.0f };
+			return full_detail;
+		}
+		return lods[level - 1];
+	}
+
+	// Coarsest level whose error, projected to the nearest point of the bounding sphere, stays under threshold pixels
+	uint32_t selectLod(const glm::mat4 & viewProjection, const glm::mat4 & model, float lodScale, float threshold = DEFAULT_LOD_THRESHOLD) const {
+		glm::vec4 centre = model * glm::vec4(glm::vec3(boundingSphere), 1.0f);
+		float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+
+		float depth = (viewProjection * centre).w - boundingSphere.w * scale;
+		if (depth <= 0.0f) {
+			return 0; // Camera is inside the bounds
+		}
+
+		float pixels_per_unit = lodScale * scale / depth;
+
+		uint32_t level = 0;
+		while (level < lods.size() && lods[level].error * pixels_per_unit <= threshold) {
+			level++;
+		}
+		return level;
+	}
+
+	// Pixels covered by one unit at a view depth of one unit, for selectLod
+	static float computeLodScale(const glm::mat4 & projection, uint32_t viewportHeight) {
+		return std::abs(projection[1][1]) * viewportHeight * 0.5f;
+	}
+
+	// Sphere around the centre of the bounding box; not minimal, but cheap and stable
+	static glm::vec4 computeBoundingSphere(const std::vector<Vertex> & vertices) {
+		if (vertices.empty()) {
+			return glm::vec4(0.0f);
+		}
+
+		glm::vec3 bounds_min = vertices[0].pos;
+		glm::vec3 bounds_max = vertices[0].pos;
+		for (const auto & vertex : vertices) {
+			bounds_min = glm::min(bounds_min, vertex.pos);
+			bounds_max = glm::max(bounds_max, vertex.pos);
+		}
+
+		glm::vec3 centre = (bounds_min + bounds_max) * 0.5f;
+		float radius = 0.0f;
+		for (const auto & vertex : vertices) {
+			radius = std::max(radius, glm::length(vertex.pos - centre));
+		}
+
+		return glm::vec4(centre, radius);
+	}
+
+	// Smooth normals for meshes that come without them. Larger faces pull harder
+	static void computeNormals(std::vector<Vertex> & vertices, const std::vector<uint32_t> & indices) {
+		for (auto & vertex : vertices) {
+			vertex.normal = glm::vec3(0.0f);
+		}
+
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+			Vertex & a = vertices[indices[i + 0]];
+			Vertex & b = vertices[indices[i + 1]];
+			Vertex & c = vertices[indices[i + 2]];
+
+			glm::vec3 face_normal = glm::cross(b.pos - a.pos, c.pos - a.pos); // Length is twice the area
+			a.normal += face_normal;
+			b.normal += face_normal;
+			c.normal += face_normal;
+		}
+
+		for (auto & vertex : vertices) {
+			float length = glm::length(vertex.normal);
+			vertex.normal = (length > 0.0f) ? vertex.normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+		}
+	}
+};
\ No newline at end of file
@@ -0,0 +1,376 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* MeshSimplifier.cpp | Quadric error metric simplification for mesh levels of detail
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MeshSimplifier.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <unordered_map>
+
+#include <glm/gtx/hash.hpp>
+
+const double BORDER_WEIGHT = 10.0; // Keeps open edges from shrinking inwards
+const float MIN_LOD_REDUCTION = 0.9f; // Stop adding levels once one keeps more than this fraction of the last
+
+// Quadric
+MeshSimplifier::Quadric::Quadric() {
+	a00 = a01 = a02 = a03 = 0.0;
+	a11 = a12 = a13 = 0.0;
+	a22 = a23 = 0.0;
+	a33 = 0.0;
+}
+
+MeshSimplifier::Quadric::Quadric(const glm::vec3 & normal, float distance, double weight) {
+	double a = normal.x, b = normal.y, c = normal.z, d = distance;
+
+	a00 = weight * a * a; a01 = weight * a * b; a02 = weight * a * c; a03 = weight * a * d;
+	a11 = weight * b * b; a12 = weight * b * c; a13 = weight * b * d;
+	a22 = weight * c * c; a23 = weight * c * d;
+	a33 = weight * d * d;
+}
+
+MeshSimplifier::Quadric & MeshSimplifier::Quadric::operator+=(const Quadric & other) {
+	a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+	a11 += other.a11; a12 += other.a12; a13 += other.a13;
+	a22 += other.a22; a23 += other.a23;
+	a33 += other.a33;
+	return *this;
+}
+
+double MeshSimplifier::Quadric::evaluate(const glm::vec3 & point) const {
+	double x = point.x, y = point.y, z = point.z;
+
+	double result = a00 * x * x + 2.0 * a01 * x * y + 2.0 * a02 * x * z + 2.0 * a03 * x
+		+ a11 * y * y + 2.0 * a12 * y * z + 2.0 * a13 * y
+		+ a22 * z * z + 2.0 * a23 * z
+		+ a33;
+
+	return std::max(result, 0.0); // Rounding can dip just below zero
+}
+
+// Simplifier
+MeshSimplifier::MeshSimplifier(const std::vector<Vertex> & vertices, const uint32_t * indices, uint32_t indexCount) {
+	assert(indexCount % 3 == 0);
+
+	// Weld vertices that only differ in their attributes
+	std::unordered_map<glm::vec3, uint32_t> position_lookup;
+	_vertex_positions.resize(vertices.size());
+	_tex_coords.resize(vertices.size());
+
+	for (size_t i = 0; i < vertices.size(); i++) {
+		auto inserted = position_lookup.emplace(vertices[i].pos, (uint32_t)_positions.size());
+		if (inserted.second) {
+			_positions.push_back(vertices[i].pos);
+		}
+
+		_vertex_positions[i] = inserted.first->second;
+		_tex_coords[i] = vertices[i].texCoord;
+	}
+
+	uint32_t position_count = (uint32_t)_positions.size();
+
+	_position_vertex_first.assign(position_count + 1, 0);
+	for (auto position : _vertex_positions) {
+		_position_vertex_first[position + 1]++;
+	}
+	for (uint32_t i = 0; i < position_count; i++) {
+		_position_vertex_first[i + 1] += _position_vertex_first[i];
+	}
+
+	_position_vertices.resize(vertices.size());
+	std::vector<uint32_t> fill = _position_vertex_first;
+	for (uint32_t i = 0; i < vertices.size(); i++) {
+		_position_vertices[fill[_vertex_positions[i]]++] = i;
+	}
+
+	_quadrics.resize(position_count);
+	_alive.assign(position_count, true);
+	_versions.assign(position_count, 0);
+	_position_triangles.resize(position_count);
+
+	// Triangles that are already degenerate once welded are dropped
+	std::unordered_map<uint64_t, uint32_t> edge_uses;
+
+	for (uint32_t i = 0; i < indexCount; i += 3) {
+		uint32_t corner[3] = { _vertex_positions[indices[i]], _vertex_positions[indices[i + 1]], _vertex_positions[indices[i + 2]] };
+		if (corner[0] == corner[1] || corner[1] == corner[2] || corner[2] == corner[0]) {
+			continue;
+		}
+
+		uint32_t triangle = _triangle_count++;
+		for (uint32_t k = 0; k < 3; k++) {
+			_triangles.push_back(corner[k]);
+			_corners.push_back(indices[i + k]);
+			_position_triangles[corner[k]].push_back(triangle);
+
+			uint32_t a = std::min(corner[k], corner[(k + 1) % 3]);
+			uint32_t b = std::max(corner[k], corner[(k + 1) % 3]);
+			edge_uses[((uint64_t)a << 32) | b]++;
+		}
+
+		glm::vec3 normal = glm::cross(_positions[corner[1]] - _positions[corner[0]], _positions[corner[2]] - _positions[corner[0]]);
+		float length = glm::length(normal);
+		if (length <= 0.0f) {
+			continue;
+		}
+		normal /= length;
+
+		Quadric plane(normal, -glm::dot(normal, _positions[corner[0]]), 1.0);
+		for (uint32_t k = 0; k < 3; k++) {
+			_quadrics[corner[k]] += plane;
+		}
+	}
+
+	_triangle_alive.assign(_triangle_count, true);
+
+	// Open edges get a plane standing up along them, so collapsing away from the border costs
+	for (uint32_t triangle = 0; triangle < _triangle_count; triangle++) {
+		const uint32_t * corner = &_triangles[triangle * 3];
+
+		glm::vec3 normal = glm::cross(_positions[corner[1]] - _positions[corner[0]], _positions[corner[2]] - _positions[corner[0]]);
+
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t a = corner[k];
+			uint32_t b = corner[(k + 1) % 3];
+			if (edge_uses[((uint64_t)std::min(a, b) << 32) | std::max(a, b)] != 1) {
+				continue;
+			}
+
+			glm::vec3 border_normal = glm::cross(_positions[b] - _positions[a], normal);
+			float length = glm::length(border_normal);
+			if (length <= 0.0f) {
+				continue;
+			}
+			border_normal /= length;
+
+			Quadric plane(border_normal, -glm::dot(border_normal, _positions[a]), BORDER_WEIGHT);
+			_quadrics[a] += plane;
+			_quadrics[b] += plane;
+		}
+	}
+
+	// Each interior edge is queued from both of its triangles; the duplicate is harmless
+	for (uint32_t triangle = 0; triangle < _triangle_count; triangle++) {
+		for (uint32_t k = 0; k < 3; k++) {
+			_PushEdge(_triangles[triangle * 3 + k], _triangles[triangle * 3 + (k + 1) % 3]);
+		}
+	}
+}
+
+MeshSimplifier::~MeshSimplifier() {
+}
+
+bool MeshSimplifier::simplify(uint32_t targetIndexCount) {
+	uint32_t start_count = _triangle_count;
+
+	while (_triangle_count * 3 > targetIndexCount && !_collapses.empty()) {
+		Collapse collapse = _collapses.top();
+		_collapses.pop();
+
+		// Stale entries are left in the queue and skipped here
+		if (!_alive[collapse.from] || !_alive[collapse.to] || _versions[collapse.from] != collapse.fromVersion || _versions[collapse.to] != collapse.toVersion) {
+			continue;
+		}
+
+		if (_Flips(collapse.from, collapse.to)) {
+			continue;
+		}
+
+		_Collapse(collapse.from, collapse.to);
+		_max_cost = std::max(_max_cost, collapse.cost);
+	}
+
+	return _triangle_count < start_count;
+}
+
+void MeshSimplifier::getIndices(std::vector<uint32_t> & indices) const {
+	indices.reserve(indices.size() + _triangle_count * 3);
+
+	for (uint32_t triangle = 0; triangle < _triangle_alive.size(); triangle++) {
+		if (!_triangle_alive[triangle]) {
+			continue;
+		}
+
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t position = _triangles[triangle * 3 + k];
+			uint32_t original = _corners[triangle * 3 + k];
+
+			if (_vertex_positions[original] == position) {
+				indices.push_back(original);
+				continue;
+			}
+
+			// The corner moved, take the vertex at its new position whose UV is nearest the old one
+			uint32_t best = _position_vertices[_position_vertex_first[position]];
+			float best_distance = FLT_MAX;
+			for (uint32_t i = _position_vertex_first[position]; i < _position_vertex_first[position + 1]; i++) {
+				glm::vec2 offset = _tex_coords[_position_vertices[i]] - _tex_coords[original];
+				float distance = glm::dot(offset, offset);
+				if (distance < best_distance) {
+					best_distance = distance;
+					best = _position_vertices[i];
+				}
+			}
+
+			indices.push_back(best);
+		}
+	}
+}
+
+const uint32_t MeshSimplifier::getIndexCount() const {
+	return _triangle_count * 3;
+}
+
+const float MeshSimplifier::getError() const {
+	return (float)std::sqrt(_max_cost);
+}
+
+std::vector<MeshLod> MeshSimplifier::generateLods(const std::vector<Vertex> & vertices, std::vector<uint32_t> & indices, uint32_t firstIndex, uint32_t indexCount, uint32_t maxLevels) {
+	std::vector<MeshLod> lods;
+	if (indexCount == 0) {
+		return lods;
+	}
+
+	// One simplifier for every level, so the error of each includes all the collapses before it
+	MeshSimplifier simplifier(vertices, indices.data() + firstIndex, indexCount);
+
+	uint32_t previous_count = indexCount;
+	for (uint32_t level = 0; level < maxLevels; level++) {
+		uint32_t target = previous_count / 6 * 3;
+		if (target == 0 || !simplifier.simplify(target)) {
+			break;
+		}
+
+		uint32_t count = simplifier.getIndexCount();
+		if (count == 0 || count > previous_count * MIN_LOD_REDUCTION) {
+			break;
+		}
+
+		MeshLod lod {};
+		lod.firstIndex = (uint32_t)indices.size();
+		lod.indexCount = count;
+		lod.error = simplifier.getError();
+		simplifier.getIndices(indices);
+
+		lods.push_back(lod);
+		previous_count = count;
+	}
+
+	return lods;
+}
+
+void MeshSimplifier::_PushEdge(uint32_t a, uint32_t b) {
+	Quadric quadric = _quadrics[a];
+	quadric += _quadrics[b];
+
+	// Only endpoints are considered as targets, so no new vertices are needed
+	double cost_to_b = quadric.evaluate(_positions[b]);
+	double cost_to_a = quadric.evaluate(_positions[a]);
+
+	Collapse collapse {};
+	if (cost_to_b <= cost_to_a) {
+		collapse = { cost_to_b, a, b, _versions[a], _versions[b] };
+	}
+	else {
+		collapse = { cost_to_a, b, a, _versions[b], _versions[a] };
+	}
+
+	_collapses.push(collapse);
+}
+
+bool MeshSimplifier::_Flips(uint32_t from, uint32_t to) const {
+	for (auto triangle : _position_triangles[from]) {
+		if (!_triangle_alive[triangle]) {
+			continue;
+		}
+
+		const uint32_t * corner = &_triangles[triangle * 3];
+		if (corner[0] == to || corner[1] == to || corner[2] == to) {
+			continue; // Collapses away
+		}
+
+		glm::vec3 before[3];
+		glm::vec3 after[3];
+		for (uint32_t k = 0; k < 3; k++) {
+			before[k] = _positions[corner[k]];
+			after[k] = (corner[k] == from) ? _positions[to] : before[k];
+		}
+
+		glm::vec3 normal_before = glm::cross(before[1] - before[0], before[2] - before[0]);
+		glm::vec3 normal_after = glm::cross(after[1] - after[0], after[2] - after[0]);
+
+		if (glm::dot(normal_before, normal_after) <= 0.0f) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void MeshSimplifier::_Collapse(uint32_t from, uint32_t to) {
+	std::vector<uint32_t> & to_triangles = _position_triangles[to];
+
+	for (auto triangle : _position_triangles[from]) {
+		if (!_triangle_alive[triangle]) {
+			continue;
+		}
+
+		uint32_t * corner = &_triangles[triangle * 3];
+		if (corner[0] == to || corner[1] == to || corner[2] == to) {
+			_triangle_alive[triangle] = false;
+			_triangle_count--;
+			continue;
+		}
+
+		for (uint32_t k = 0; k < 3; k++) {
+			if (corner[k] == from) {
+				corner[k] = to;
+			}
+		}
+		to_triangles.push_back(triangle);
+	}
+
+	std::vector<uint32_t>().swap(_position_triangles[from]);
+	_alive[from] = false;
+
+	_quadrics[to] += _quadrics[from];
+	_versions[to]++;
+
+	to_triangles.erase(std::remove_if(to_triangles.begin(), to_triangles.end(), [&](uint32_t triangle) {
+		return !_triangle_alive[triangle];
+	}), to_triangles.end());
+
+	// Every edge around the merged position has a new cost
+	std::vector<uint32_t> neighbours;
+	for (auto triangle : to_triangles) {
+		for (uint32_t k = 0; k < 3; k++) {
+			if (_triangles[triangle * 3 + k] != to) {
+				neighbours.push_back(_triangles[triangle * 3 + k]);
+			}
+		}
+	}
+
+	std::sort(neighbours.begin(), neighbours.end());
+	neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+
+	for (auto neighbour : neighbours) {
+		_PushEdge(to, neighbour);
+	}
+}
\ No newline at end of file
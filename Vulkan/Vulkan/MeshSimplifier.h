@@ -0,0 +1,101 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* MeshSimplifier.h | Quadric error metric simplification for mesh levels of detail
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Renderer.h"
+#include "Mesh.h"
+
+#include <vector>
+#include <queue>
+
+#include <glm/glm.hpp>
+
+// Collapses edges of an indexed triangle list in order of quadric error (Garland & Heckbert).
+// Vertices that share a position are welded, so UV seams do not tear; every collapse moves a
+// vertex onto one of its neighbours, so the output indexes the original vertex buffer.
+// simplify() can be called repeatedly with smaller targets, each result building on the last.
+class MeshSimplifier {
+public:
+	MeshSimplifier(const std::vector<Vertex> & vertices, const uint32_t * indices, uint32_t indexCount);
+	~MeshSimplifier();
+
+	// Collapses edges until at most targetIndexCount indices remain. Returns false if nothing could be collapsed
+	bool simplify(uint32_t targetIndexCount);
+
+	// Appends the current triangles
+	void getIndices(std::vector<uint32_t> & indices) const;
+	const uint32_t getIndexCount() const;
+	// Upper bound on the distance from the original surface, in mesh space
+	const float getError() const;
+
+	// Appends up to maxLevels simplified copies of a range to indices, each with roughly half the triangles of the last
+	static std::vector<MeshLod> generateLods(const std::vector<Vertex> & vertices, std::vector<uint32_t> & indices, uint32_t firstIndex, uint32_t indexCount, uint32_t maxLevels = MAX_MESH_LODS - 1);
+
+private:
+	// Symmetric 4x4 matrix summing squared distances to a set of planes
+	struct Quadric {
+		double a00, a01, a02, a03;
+		double a11, a12, a13;
+		double a22, a23;
+		double a33;
+
+		Quadric();
+		Quadric(const glm::vec3 & normal, float distance, double weight);
+
+		Quadric & operator+=(const Quadric & other);
+		double evaluate(const glm::vec3 & point) const;
+	};
+
+	struct Collapse {
+		double cost;
+		uint32_t from;
+		uint32_t to;
+		uint32_t fromVersion;
+		uint32_t toVersion;
+
+		bool operator<(const Collapse & other) const {
+			return cost > other.cost; // Cheapest on top of the priority queue
+		}
+	};
+
+	void _PushEdge(uint32_t a, uint32_t b);
+	bool _Flips(uint32_t from, uint32_t to) const;
+	void _Collapse(uint32_t from, uint32_t to);
+
+	// Welded positions, each a node of the simplified mesh
+	std::vector<glm::vec3> _positions;
+	std::vector<Quadric> _quadrics;
+	std::vector<bool> _alive;
+	std::vector<uint32_t> _versions; // Bumped when a position's quadric changes, invalidating its queued collapses
+	std::vector<std::vector<uint32_t>> _position_triangles;
+
+	// Original vertices and the welded position each one maps to
+	std::vector<glm::vec2> _tex_coords;
+	std::vector<uint32_t> _vertex_positions;
+	std::vector<uint32_t> _position_vertex_first; // Vertices of position p are _position_vertices[first[p], first[p + 1])
+	std::vector<uint32_t> _position_vertices;
+
+	std::vector<uint32_t> _triangles; // Three welded positions per triangle
+	std::vector<uint32_t> _corners; // The original vertex behind each triangle corner
+	std::vector<bool> _triangle_alive;
+	uint32_t _triangle_count = 0;
+
+	std::priority_queue<Collapse> _collapses;
+	double _max_cost = 0.0;
+};
\ No newline at end of file
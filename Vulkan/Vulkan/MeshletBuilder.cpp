@@ -0,0 +1,216 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* MeshletBuilder.cpp | Splits meshes into meshlets with culling bounds
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MeshletBuilder.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+
+const float MIN_CONE_SPREAD = 0.1f; // Cones wider than this (as a dot product) would almost never cull
+
+std::vector<Meshlet> MeshletBuilder::buildMeshlets(const std::vector<Vertex> & vertices, std::vector<uint32_t> & indices, uint32_t firstIndex, uint32_t indexCount) {
+	assert(indexCount % 3 == 0);
+
+	std::vector<Meshlet> meshlets;
+
+	// Copied, indices grows as meshlets are written
+	std::vector<uint32_t> source(indices.begin() + firstIndex, indices.begin() + firstIndex + indexCount);
+	uint32_t triangle_count = indexCount / 3;
+	uint32_t vertex_count = (uint32_t)vertices.size();
+
+	// Triangles around each vertex; triangles around v are adjacency[first[v], first[v + 1])
+	std::vector<uint32_t> adjacency_first(vertex_count + 1, 0);
+	for (auto index : source) {
+		adjacency_first[index + 1]++;
+	}
+	for (uint32_t i = 0; i < vertex_count; i++) {
+		adjacency_first[i + 1] += adjacency_first[i];
+	}
+
+	std::vector<uint32_t> adjacency(source.size());
+	std::vector<uint32_t> fill = adjacency_first;
+	for (uint32_t i = 0; i < source.size(); i++) {
+		adjacency[fill[source[i]]++] = i / 3;
+	}
+
+	std::vector<bool> emitted(triangle_count, false);
+	std::vector<uint32_t> vertex_meshlet(vertex_count, UINT32_MAX); // Which meshlet last took each vertex
+
+	std::vector<uint32_t> meshlet_vertices;
+	std::vector<uint32_t> meshlet_indices;
+	std::vector<uint32_t> candidates;
+
+	auto new_vertex_count = [&](uint32_t triangle) {
+		uint32_t count = 0;
+		for (uint32_t k = 0; k < 3; k++) {
+			if (vertex_meshlet[source[triangle * 3 + k]] != (uint32_t)meshlets.size()) {
+				count++;
+			}
+		}
+		return count;
+	};
+
+	auto flush = [&]() {
+		Meshlet meshlet = _ComputeBounds(vertices, meshlet_vertices, meshlet_indices.data(), (uint32_t)meshlet_indices.size() / 3);
+		meshlet.firstIndex = (uint32_t)indices.size();
+		meshlet.indexCount = (uint32_t)meshlet_indices.size();
+		meshlet.vertexCount = (uint32_t)meshlet_vertices.size();
+
+		indices.insert(indices.end(), meshlet_indices.begin(), meshlet_indices.end());
+		meshlets.push_back(meshlet);
+
+		meshlet_vertices.clear();
+		meshlet_indices.clear();
+		candidates.clear();
+	};
+
+	uint32_t next_seed = 0;
+	uint32_t remaining = triangle_count;
+
+	while (remaining > 0) {
+		// Neighbour adding the fewest vertices; emitted triangles are dropped from the list on the way
+		uint32_t best = UINT32_MAX;
+		uint32_t best_new_vertices = 4;
+
+		uint32_t kept = 0;
+		for (uint32_t i = 0; i < candidates.size(); i++) {
+			uint32_t triangle = candidates[i];
+			if (emitted[triangle]) {
+				continue;
+			}
+			candidates[kept++] = triangle;
+
+			uint32_t new_vertices = new_vertex_count(triangle);
+			if (new_vertices < best_new_vertices) {
+				best = triangle;
+				best_new_vertices = new_vertices;
+			}
+		}
+		candidates.resize(kept);
+
+		// Nothing connected left, continue from the next unused triangle in index order
+		if (best == UINT32_MAX) {
+			while (emitted[next_seed]) {
+				next_seed++;
+			}
+			best = next_seed;
+			best_new_vertices = new_vertex_count(best);
+		}
+
+		if (meshlet_vertices.size() + best_new_vertices > MAX_MESHLET_VERTICES || meshlet_indices.size() / 3 >= MAX_MESHLET_TRIANGLES) {
+			flush();
+		}
+
+		emitted[best] = true;
+		remaining--;
+
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t vertex = source[best * 3 + k];
+			meshlet_indices.push_back(vertex);
+
+			if (vertex_meshlet[vertex] == (uint32_t)meshlets.size()) {
+				continue;
+			}
+			vertex_meshlet[vertex] = (uint32_t)meshlets.size();
+			meshlet_vertices.push_back(vertex);
+
+			for (uint32_t i = adjacency_first[vertex]; i < adjacency_first[vertex + 1]; i++) {
+				if (!emitted[adjacency[i]]) {
+					candidates.push_back(adjacency[i]);
+				}
+			}
+		}
+	}
+
+	if (!meshlet_indices.empty()) {
+		flush();
+	}
+
+	return meshlets;
+}
+
+Meshlet MeshletBuilder::_ComputeBounds(const std::vector<Vertex> & vertices, const std::vector<uint32_t> & meshletVertices, const uint32_t * triangleIndices, uint32_t triangleCount) {
+	Meshlet meshlet {};
+
+	glm::vec3 bounds_min = vertices[meshletVertices[0]].pos;
+	glm::vec3 bounds_max = bounds_min;
+	for (auto vertex : meshletVertices) {
+		bounds_min = glm::min(bounds_min, vertices[vertex].pos);
+		bounds_max = glm::max(bounds_max, vertices[vertex].pos);
+	}
+
+	glm::vec3 centre = (bounds_min + bounds_max) * 0.5f;
+	float radius = 0.0f;
+	for (auto vertex : meshletVertices) {
+		radius = std::max(radius, glm::length(vertices[vertex].pos - centre));
+	}
+	meshlet.boundingSphere = glm::vec4(centre, radius);
+
+	// The cone axis is the average facing; the cutoff comes from the triangle furthest from it
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec3> corners;
+	glm::vec3 normal_sum(0.0f);
+
+	for (uint32_t i = 0; i < triangleCount; i++) {
+		glm::vec3 p0 = vertices[triangleIndices[i * 3 + 0]].pos;
+		glm::vec3 p1 = vertices[triangleIndices[i * 3 + 1]].pos;
+		glm::vec3 p2 = vertices[triangleIndices[i * 3 + 2]].pos;
+
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length <= 0.0f) {
+			continue; // Degenerate, faces nowhere
+		}
+
+		normals.push_back(normal / length);
+		corners.push_back(p0);
+		normal_sum += normal / length;
+	}
+
+	// A zero axis never passes the cull test
+	meshlet.coneApex = glm::vec4(centre, 0.0f);
+	meshlet.coneAxis = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	float axis_length = glm::length(normal_sum);
+	if (axis_length <= 0.0f) {
+		return meshlet;
+	}
+	glm::vec3 axis = normal_sum / axis_length;
+
+	float min_dot = 1.0f;
+	for (const auto & normal : normals) {
+		min_dot = std::min(min_dot, glm::dot(axis, normal));
+	}
+
+	if (min_dot <= MIN_CONE_SPREAD) {
+		return meshlet;
+	}
+
+	// Slide the apex back along the axis until it is behind every triangle's plane
+	float max_t = 0.0f;
+	for (size_t i = 0; i < normals.size(); i++) {
+		float t = glm::dot(centre - corners[i], normals[i]) / glm::dot(axis, normals[i]);
+		max_t = std::max(max_t, t);
+	}
+
+	meshlet.coneApex = glm::vec4(centre - axis * max_t, 0.0f);
+	meshlet.coneAxis = glm::vec4(axis, std::sqrt(1.0f - min_dot * min_dot));
+
+	return meshlet;
+}
\ No newline at end of file
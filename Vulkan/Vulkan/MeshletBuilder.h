@@ -0,0 +1,36 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* MeshletBuilder.h | Splits meshes into meshlets with culling bounds
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Renderer.h"
+#include "Mesh.h"
+
+#include <vector>
+
+// Greedily grows meshlets of at most MAX_MESHLET_VERTICES vertices and MAX_MESHLET_TRIANGLES triangles,
+// always adding the neighbouring triangle that brings in the fewest new vertices. Each meshlet gets a
+// bounding sphere and a normal cone for backface culling of the whole cluster.
+class MeshletBuilder {
+public:
+	// Appends each meshlet's triangles to indices as their own range
+	static std::vector<Meshlet> buildMeshlets(const std::vector<Vertex> & vertices, std::vector<uint32_t> & indices, uint32_t firstIndex, uint32_t indexCount);
+
+private:
+	static Meshlet _ComputeBounds(const std::vector<Vertex> & vertices, const std::vector<uint32_t> & meshletVertices, const uint32_t * triangleIndices, uint32_t triangleCount);
+};
\ No newline at end of file
@@ -18,20 +18,30 @@
 
 #pragma once
 
+#include "BUILD_OPTIONS.h"
+
 #if defined(_WIN32)
 // Windows
 
 #define VK_USE_PLATFORM_WIN32_KHR 1
 #define PLATFORM_SURFACE_EXTENSION_NAME VK_KHR_WIN32_SURFACE_EXTENSION_NAME
 
-
+#define NOMINMAX // Keep std::min and std::max usable
 #include <Windows.h>
 
+#elif defined(__linux) && BUILD_ENABLE_WAYLAND
+// Wayland, windows come from xdg-shell whose client code is generated by wayland-scanner from wayland-protocols
+
+#define VK_USE_PLATFORM_WAYLAND_KHR 1
+#define PLATFORM_SURFACE_EXTENSION_NAME VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME
+
+#include <wayland-client.h>
+
 #elif defined(__linux)
 // XCB library
 
 #define VK_USE_PLATFORM_XCB_KHR 1
-#define PLATFORM_SURFACE_EXTENSION_NAME VK_KHR_XCB_EXTENSION_NAME
+#define PLATFORM_SURFACE_EXTENSION_NAME VK_KHR_XCB_SURFACE_EXTENSION_NAME
 
 #include <xcb/xcb.h>
 
@@ -39,4 +49,26 @@
 #error Platform not yet supported
 #endif
 
-#include <vulkan\vulkan.h>
\ No newline at end of file
+#include <vulkan/vulkan.h>
+
+// Compiler specific annotations
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#define NODISCARD [[nodiscard]]
+#elif defined(_MSC_VER)
+#define NODISCARD _Check_return_ // Enforced by /analyze
+#elif defined(__GNUC__)
+#define NODISCARD __attribute__((warn_unused_result))
+#else
+#define NODISCARD
+#endif
+
+#if defined(_MSC_VER)
+#define COLD __declspec(noinline)
+#define UNLIKELY(condition) (condition)
+#elif defined(__GNUC__)
+#define COLD __attribute__((cold, noinline))
+#define UNLIKELY(condition) __builtin_expect(!!(condition), 0)
+#else
+#define COLD
+#define UNLIKELY(condition) (condition)
+#endif
\ No newline at end of file
@@ -0,0 +1,303 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* QueueTimeline.cpp | Queue submission ordered by a monotonically increasing timeline value
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "QueueTimeline.h"
+#include "util.h"
+
+#include <assert.h>
+#include <algorithm>
+
+QueueTimeline::QueueTimeline(VkDevice device, VkQueue queue, uint32_t queueFamilyIndex, bool timelineSemaphore) : _submitted_value(0), _completed_value(0) {
+	_device = device;
+	_queue = queue;
+	_timeline_semaphore = false;
+
+#ifdef VK_KHR_timeline_semaphore
+	if (timelineSemaphore) {
+		_fvkWaitSemaphoresKHR = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(_device, "vkWaitSemaphoresKHR");
+		_fvkGetSemaphoreCounterValueKHR = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(_device, "vkGetSemaphoreCounterValueKHR");
+		_timeline_semaphore = _fvkWaitSemaphoresKHR != nullptr && _fvkGetSemaphoreCounterValueKHR != nullptr;
+	}
+
+	if (_timeline_semaphore) {
+		VkSemaphoreTypeCreateInfoKHR semaphore_type_create_info = vkStruct<VkSemaphoreTypeCreateInfoKHR>();
+		semaphore_type_create_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		semaphore_type_create_info.initialValue = 0;
+
+		VkSemaphoreCreateInfo semaphore_create_info = vkStruct<VkSemaphoreCreateInfo>();
+		vkChain(semaphore_create_info, semaphore_type_create_info);
+
+		ErrorCheck(vkCreateSemaphore(_device, &semaphore_create_info, nullptr, &_semaphore));
+		return;
+	}
+#endif
+
+	// Fence path. The barrier is recorded once and shared by every submission that waits on this queue
+	VkCommandPoolCreateInfo command_pool_create_info = vkStruct<VkCommandPoolCreateInfo>();
+	command_pool_create_info.queueFamilyIndex = queueFamilyIndex;
+
+	ErrorCheck(vkCreateCommandPool(_device, &command_pool_create_info, nullptr, &_command_pool));
+
+	VkCommandBufferAllocateInfo command_buffer_allocate_info = vkStruct<VkCommandBufferAllocateInfo>();
+	command_buffer_allocate_info.commandPool = _command_pool;
+	command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	command_buffer_allocate_info.commandBufferCount = 1;
+
+	ErrorCheck(vkAllocateCommandBuffers(_device, &command_buffer_allocate_info, &_wait_barrier));
+
+	VkCommandBufferBeginInfo begin_info = vkStruct<VkCommandBufferBeginInfo>();
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+	ErrorCheck(vkBeginCommandBuffer(_wait_barrier, &begin_info));
+
+	// Everything submitted earlier, which includes whatever value is waited for, before anything after
+	VkMemoryBarrier memory_barrier = vkStruct<VkMemoryBarrier>();
+	memory_barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+	memory_barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+	vkCmdPipelineBarrier(_wait_barrier, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+	ErrorCheck(vkEndCommandBuffer(_wait_barrier));
+}
+
+QueueTimeline::~QueueTimeline() {
+	waitIdle();
+
+	if (_semaphore != VK_NULL_HANDLE) {
+		vkDestroySemaphore(_device, _semaphore, nullptr);
+		_semaphore = VK_NULL_HANDLE;
+	}
+
+	_RetireFences();
+	for (auto fence : _free_fences) {
+		vkDestroyFence(_device, fence, nullptr);
+	}
+	_free_fences.clear();
+
+	if (_command_pool != VK_NULL_HANDLE) {
+		vkDestroyCommandPool(_device, _command_pool, nullptr); // Frees the barrier with it
+		_command_pool = VK_NULL_HANDLE;
+		_wait_barrier = VK_NULL_HANDLE;
+	}
+}
+
+uint64_t QueueTimeline::submit(const TimelineSubmitInfo & submitInfo) {
+	// Other queues have to get there first, and without a semaphore only the CPU can tell
+	if (!_timeline_semaphore) {
+		for (uint32_t i = 0; i < submitInfo.waitCount; i++) {
+			if (submitInfo.pWaits[i].timeline != this) {
+				submitInfo.pWaits[i].timeline->wait(submitInfo.pWaits[i].value);
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	// Values follow submission order, so they are assigned under the same lock as the submit
+	uint64_t value = _submitted_value + 1;
+
+	if (_timeline_semaphore) {
+		_SubmitTimeline(submitInfo, value);
+	}
+	else {
+		_SubmitFence(submitInfo, value);
+	}
+
+	_submitted_value = value;
+	return value;
+}
+
+const uint64_t QueueTimeline::getSubmittedValue() const {
+	return _submitted_value;
+}
+
+uint64_t QueueTimeline::getCompletedValue() const {
+#ifdef VK_KHR_timeline_semaphore
+	if (_timeline_semaphore) {
+		uint64_t value = 0;
+		ErrorCheck(_fvkGetSemaphoreCounterValueKHR(_device, _semaphore, &value));
+		return value;
+	}
+#endif
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_RetireFences();
+	return _completed_value;
+}
+
+bool QueueTimeline::isComplete(uint64_t value) const {
+	return value <= _completed_value || value <= getCompletedValue();
+}
+
+bool QueueTimeline::wait(uint64_t value, uint64_t timeout) const {
+	assert(value <= _submitted_value); // Nothing could ever signal it
+	if (value <= _completed_value) {
+		return true;
+	}
+
+#ifdef VK_KHR_timeline_semaphore
+	if (_timeline_semaphore) {
+		VkSemaphoreWaitInfoKHR wait_info = vkStruct<VkSemaphoreWaitInfoKHR>();
+		wait_info.semaphoreCount = 1;
+		wait_info.pSemaphores = &_semaphore;
+		wait_info.pValues = &value;
+
+		VkResult result = _fvkWaitSemaphoresKHR(_device, &wait_info, timeout);
+		ErrorCheck(result);
+		return result == VK_SUCCESS;
+	}
+#endif
+
+	// The wait happens outside the lock so submits and polls from other threads carry on. The waiter count keeps
+	// the fence from being recycled under it, and the entry in place so it can be found again by value
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	auto pending = std::find_if(_pending_fences.begin(), _pending_fences.end(), [&](const PendingFence & fence) {
+		return fence.value >= value;
+	});
+
+	if (pending == _pending_fences.end()) {
+		_RetireFences();
+		return true;
+	}
+
+	VkFence fence = pending->fence;
+	uint64_t fence_value = pending->value;
+	pending->waiters++;
+
+	lock.unlock();
+	VkResult result = vkWaitForFences(_device, 1, &fence, VK_TRUE, timeout);
+	ErrorCheck(result);
+	lock.lock();
+
+	pending = std::find_if(_pending_fences.begin(), _pending_fences.end(), [&](const PendingFence & entry) {
+		return entry.value == fence_value;
+	});
+	assert(pending != _pending_fences.end());
+	pending->waiters--;
+
+	_RetireFences();
+	return result == VK_SUCCESS;
+}
+
+void QueueTimeline::waitIdle() const {
+	wait(_submitted_value);
+}
+
+const bool QueueTimeline::usesTimelineSemaphore() const {
+	return _timeline_semaphore;
+}
+
+void QueueTimeline::_SubmitTimeline(const TimelineSubmitInfo & submitInfo, uint64_t value) {
+#ifdef VK_KHR_timeline_semaphore
+	// Binary semaphores come first, their values are ignored
+	_wait_semaphores.assign(submitInfo.pWaitSemaphores, submitInfo.pWaitSemaphores + submitInfo.waitSemaphoreCount);
+	_wait_stages.assign(submitInfo.pWaitDstStageMask, submitInfo.pWaitDstStageMask + submitInfo.waitSemaphoreCount);
+	_wait_values.assign(submitInfo.waitSemaphoreCount, 0);
+
+	for (uint32_t i = 0; i < submitInfo.waitCount; i++) {
+		const TimelineWait & wait = submitInfo.pWaits[i];
+		assert(wait.timeline->_timeline_semaphore);
+
+		_wait_semaphores.push_back(wait.timeline->_semaphore);
+		_wait_stages.push_back(wait.stageMask);
+		_wait_values.push_back(wait.value);
+	}
+
+	_signal_semaphores.assign(submitInfo.pSignalSemaphores, submitInfo.pSignalSemaphores + submitInfo.signalSemaphoreCount);
+	_signal_values.assign(submitInfo.signalSemaphoreCount, 0);
+	_signal_semaphores.push_back(_semaphore);
+	_signal_values.push_back(value);
+
+	VkTimelineSemaphoreSubmitInfoKHR timeline_submit_info = vkStruct<VkTimelineSemaphoreSubmitInfoKHR>();
+	timeline_submit_info.waitSemaphoreValueCount = (uint32_t)_wait_values.size();
+	timeline_submit_info.pWaitSemaphoreValues = _wait_values.data();
+	timeline_submit_info.signalSemaphoreValueCount = (uint32_t)_signal_values.size();
+	timeline_submit_info.pSignalSemaphoreValues = _signal_values.data();
+
+	VkSubmitInfo submit_info = vkStruct<VkSubmitInfo>();
+	vkChain(submit_info, timeline_submit_info);
+	submit_info.waitSemaphoreCount = (uint32_t)_wait_semaphores.size();
+	submit_info.pWaitSemaphores = _wait_semaphores.data();
+	submit_info.pWaitDstStageMask = _wait_stages.data();
+	submit_info.commandBufferCount = submitInfo.commandBufferCount;
+	submit_info.pCommandBuffers = submitInfo.pCommandBuffers;
+	submit_info.signalSemaphoreCount = (uint32_t)_signal_semaphores.size();
+	submit_info.pSignalSemaphores = _signal_semaphores.data();
+
+	ErrorCheck(vkQueueSubmit(_queue, 1, &submit_info, VK_NULL_HANDLE));
+#endif
+}
+
+void QueueTimeline::_SubmitFence(const TimelineSubmitInfo & submitInfo, uint64_t value) {
+	bool waits_on_queue = false;
+	for (uint32_t i = 0; i < submitInfo.waitCount; i++) {
+		waits_on_queue = waits_on_queue || (submitInfo.pWaits[i].timeline == this && submitInfo.pWaits[i].value > _completed_value);
+	}
+
+	_command_buffers.clear();
+	if (waits_on_queue) {
+		_command_buffers.push_back(_wait_barrier);
+	}
+	_command_buffers.insert(_command_buffers.end(), submitInfo.pCommandBuffers, submitInfo.pCommandBuffers + submitInfo.commandBufferCount);
+
+	VkFence fence;
+	if (!_free_fences.empty()) {
+		fence = _free_fences.back();
+		_free_fences.pop_back();
+	}
+	else {
+		VkFenceCreateInfo fence_create_info = vkStruct<VkFenceCreateInfo>();
+
+		ErrorCheck(vkCreateFence(_device, &fence_create_info, nullptr, &fence));
+	}
+
+	VkSubmitInfo submit_info = vkStruct<VkSubmitInfo>();
+	submit_info.waitSemaphoreCount = submitInfo.waitSemaphoreCount;
+	submit_info.pWaitSemaphores = submitInfo.pWaitSemaphores;
+	submit_info.pWaitDstStageMask = submitInfo.pWaitDstStageMask;
+	submit_info.commandBufferCount = (uint32_t)_command_buffers.size();
+	submit_info.pCommandBuffers = _command_buffers.data();
+	submit_info.signalSemaphoreCount = submitInfo.signalSemaphoreCount;
+	submit_info.pSignalSemaphores = submitInfo.pSignalSemaphores;
+
+	ErrorCheck(vkQueueSubmit(_queue, 1, &submit_info, fence));
+
+	PendingFence pending = { value, fence, 0 };
+	_pending_fences.push_back(pending);
+}
+
+void QueueTimeline::_RetireFences() const {
+	// A fence only signals once every earlier submission is done, so they retire in order. One that is still being
+	// waited on holds up the rest until its waiters take the lock again, which they do as soon as it signals
+	size_t retired = 0;
+	while (retired < _pending_fences.size() && _pending_fences[retired].waiters == 0 && vkGetFenceStatus(_device, _pending_fences[retired].fence) == VK_SUCCESS) {
+		retired++;
+	}
+
+	if (retired == 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < retired; i++) {
+		ErrorCheck(vkResetFences(_device, 1, &_pending_fences[i].fence));
+		_free_fences.push_back(_pending_fences[i].fence);
+	}
+	_completed_value = _pending_fences[retired - 1].value;
+	_pending_fences.erase(_pending_fences.begin(), _pending_fences.begin() + retired);
+}
\ No newline at end of file
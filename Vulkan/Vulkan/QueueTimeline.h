@@ -0,0 +1,118 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* QueueTimeline.h | Queue submission ordered by a monotonically increasing timeline value
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+class QueueTimeline;
+
+// A submission waits until a timeline reaches value, from stageMask onwards
+struct TimelineWait {
+	const QueueTimeline * timeline;
+	uint64_t value;
+	VkPipelineStageFlags stageMask;
+};
+
+struct TimelineSubmitInfo {
+	uint32_t commandBufferCount = 0;
+	const VkCommandBuffer * pCommandBuffers = nullptr;
+	uint32_t waitCount = 0;
+	const TimelineWait * pWaits = nullptr;
+
+	// Binary semaphores, only for what the timeline cannot express: swapchain acquire and present
+	uint32_t waitSemaphoreCount = 0;
+	const VkSemaphore * pWaitSemaphores = nullptr;
+	const VkPipelineStageFlags * pWaitDstStageMask = nullptr;
+	uint32_t signalSemaphoreCount = 0;
+	const VkSemaphore * pSignalSemaphores = nullptr;
+};
+
+// Every submission to a queue goes through its timeline and gets the next value, which the timeline reaches once
+// the submission and everything before it on the queue is complete. Values replace fences and wait-idles: the CPU
+// can poll or wait for any value from any thread, and later submissions can wait for values on the GPU.
+// Backed by a timeline semaphore where VK_KHR_timeline_semaphore is available. Otherwise each submission signals a
+// pooled fence, GPU waits on this queue become a full barrier ahead of the submission, and waits on other queues
+// are made on the CPU before submitting.
+class QueueTimeline {
+public:
+	QueueTimeline(VkDevice device, VkQueue queue, uint32_t queueFamilyIndex, bool timelineSemaphore);
+	// Waits for everything submitted
+	~QueueTimeline();
+
+	// Returns the value reached when this submission is complete
+	NODISCARD uint64_t submit(const TimelineSubmitInfo & submitInfo);
+
+	// The value of the latest submission. Waiting for it waits for the queue to drain
+	const uint64_t getSubmittedValue() const;
+	// Polls, values up to the result are complete
+	uint64_t getCompletedValue() const;
+	bool isComplete(uint64_t value) const;
+
+	// Returns false if timeout, in nanoseconds, ran out first
+	bool wait(uint64_t value, uint64_t timeout = UINT64_MAX) const;
+	void waitIdle() const;
+
+	const bool usesTimelineSemaphore() const;
+
+private:
+	QueueTimeline(const QueueTimeline &);
+	QueueTimeline & operator=(const QueueTimeline &);
+
+	struct PendingFence {
+		uint64_t value;
+		VkFence fence;
+		uint32_t waiters; // Threads waiting on the fence outside the lock, it is not recycled until they are done
+	};
+
+	void _SubmitTimeline(const TimelineSubmitInfo & submitInfo, uint64_t value);
+	void _SubmitFence(const TimelineSubmitInfo & submitInfo, uint64_t value);
+	// Fence path only, with _mutex held. Recycles the fences of finished submissions, stopping at one still waited on
+	void _RetireFences() const;
+
+	VkDevice _device = VK_NULL_HANDLE;
+	VkQueue _queue = VK_NULL_HANDLE;
+	bool _timeline_semaphore = false;
+
+	mutable std::mutex _mutex; // Guards the queue and everything below
+	std::atomic<uint64_t> _submitted_value;
+	mutable std::atomic<uint64_t> _completed_value; // Fence path only, the semaphore holds its own
+
+	// Reused between submissions so steady state submits do not allocate
+	std::vector<VkCommandBuffer> _command_buffers;
+	std::vector<VkSemaphore> _wait_semaphores;
+	std::vector<uint64_t> _wait_values;
+	std::vector<VkPipelineStageFlags> _wait_stages;
+	std::vector<VkSemaphore> _signal_semaphores;
+	std::vector<uint64_t> _signal_values;
+
+	VkSemaphore _semaphore = VK_NULL_HANDLE;
+#ifdef VK_KHR_timeline_semaphore
+	PFN_vkWaitSemaphoresKHR _fvkWaitSemaphoresKHR = nullptr;
+	PFN_vkGetSemaphoreCounterValueKHR _fvkGetSemaphoreCounterValueKHR = nullptr;
+#endif
+
+	mutable std::vector<PendingFence> _pending_fences; // Oldest first
+	mutable std::vector<VkFence> _free_fences;
+	VkCommandPool _command_pool = VK_NULL_HANDLE;
+	VkCommandBuffer _wait_barrier = VK_NULL_HANDLE; // Runs ahead of submissions that wait on this queue
+};
\ No newline at end of file
@@ -0,0 +1,944 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* RenderGraph.cpp | Passes declared with their image reads and writes, scheduled with derived barriers
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "RenderGraph.h"
+#include "Renderer.h"
+#include "util.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <assert.h>
+
+const VkImageUsageFlags ATTACHMENT_USAGE_MASK = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+const VkAccessFlags WRITE_ACCESS_MASK = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+	VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+void getImageLayoutAccess(VkImageLayout layout, VkAccessFlags & accessMask, VkPipelineStageFlags & stageMask) {
+	switch (layout) {
+	case VK_IMAGE_LAYOUT_UNDEFINED:
+		accessMask = 0;
+		stageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_PREINITIALIZED:
+		accessMask = VK_ACCESS_HOST_WRITE_BIT;
+		stageMask = VK_PIPELINE_STAGE_HOST_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_GENERAL:
+		accessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		stageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+		accessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		stageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+		accessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		stageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+		accessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		stageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+		accessMask = VK_ACCESS_SHADER_READ_BIT;
+		stageMask = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+		accessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		stageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+		accessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		stageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+		accessMask = 0; // The presentation engine waits on a semaphore, not a barrier
+		stageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		break;
+	default:
+		throw std::invalid_argument("Unsupported image layout");
+	}
+}
+
+VkImageAspectFlags getFormatAspectFlags(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_D16_UNORM:
+	case VK_FORMAT_X8_D24_UNORM_PACK32:
+	case VK_FORMAT_D32_SFLOAT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT;
+	case VK_FORMAT_S8_UINT:
+		return VK_IMAGE_ASPECT_STENCIL_BIT;
+	case VK_FORMAT_D16_UNORM_S8_UINT:
+	case VK_FORMAT_D24_UNORM_S8_UINT:
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	default:
+		return VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+}
+
+static bool isAttachmentAccess(RenderGraph::ImageAccess access) {
+	return access == RenderGraph::ACCESS_COLOR_ATTACHMENT || access == RenderGraph::ACCESS_DEPTH_ATTACHMENT;
+}
+
+static VkImageLayout accessLayout(RenderGraph::ImageAccess access, bool write) {
+	switch (access) {
+	case RenderGraph::ACCESS_COLOR_ATTACHMENT:
+		return VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	case RenderGraph::ACCESS_DEPTH_ATTACHMENT:
+		return write ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	case RenderGraph::ACCESS_SAMPLED:
+		return VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	case RenderGraph::ACCESS_STORAGE:
+		return VK_IMAGE_LAYOUT_GENERAL;
+	case RenderGraph::ACCESS_TRANSFER_SRC:
+		return VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	default:
+		return VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	}
+}
+
+static VkAccessFlags accessMask(RenderGraph::ImageAccess access, bool read, bool write) {
+	VkAccessFlags mask = 0;
+	switch (access) {
+	case RenderGraph::ACCESS_COLOR_ATTACHMENT:
+		mask |= read ? VK_ACCESS_COLOR_ATTACHMENT_READ_BIT : 0;
+		mask |= write ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : 0;
+		break;
+	case RenderGraph::ACCESS_DEPTH_ATTACHMENT:
+		mask |= read ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT : 0;
+		mask |= write ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : 0;
+		break;
+	case RenderGraph::ACCESS_SAMPLED:
+		mask |= VK_ACCESS_SHADER_READ_BIT;
+		break;
+	case RenderGraph::ACCESS_STORAGE:
+		mask |= read ? VK_ACCESS_SHADER_READ_BIT : 0;
+		mask |= write ? VK_ACCESS_SHADER_WRITE_BIT : 0;
+		break;
+	case RenderGraph::ACCESS_TRANSFER_SRC:
+		mask |= VK_ACCESS_TRANSFER_READ_BIT;
+		break;
+	default:
+		mask |= VK_ACCESS_TRANSFER_WRITE_BIT;
+		break;
+	}
+	return mask;
+}
+
+static VkImageUsageFlags accessUsage(RenderGraph::ImageAccess access) {
+	switch (access) {
+	case RenderGraph::ACCESS_COLOR_ATTACHMENT:
+		return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	case RenderGraph::ACCESS_DEPTH_ATTACHMENT:
+		return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	case RenderGraph::ACCESS_SAMPLED:
+		return VK_IMAGE_USAGE_SAMPLED_BIT;
+	case RenderGraph::ACCESS_STORAGE:
+		return VK_IMAGE_USAGE_STORAGE_BIT;
+	case RenderGraph::ACCESS_TRANSFER_SRC:
+		return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	default:
+		return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	}
+}
+
+static uint32_t findMemoryType(const VkPhysicalDeviceMemoryProperties & memoryProperties, uint32_t typeBits, VkMemoryPropertyFlags properties) {
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if ((typeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return i;
+		}
+	}
+	return UINT32_MAX;
+}
+
+RenderGraph::RenderGraph(Renderer * renderer) {
+	_renderer = renderer;
+	_device = renderer->getDevice();
+}
+
+RenderGraph::~RenderGraph() {
+	for (auto & pass : _passes) {
+		for (auto & framebuffer : pass.framebuffers) {
+			vkDestroyFramebuffer(_device, framebuffer.second, nullptr);
+		}
+		pass.framebuffers.clear();
+
+		if (pass.renderPass != VK_NULL_HANDLE) {
+			vkDestroyRenderPass(_device, pass.renderPass, nullptr);
+			pass.renderPass = VK_NULL_HANDLE;
+		}
+	}
+
+	for (auto & image : _images) {
+		if (image.imported) {
+			continue;
+		}
+		if (image.view != VK_NULL_HANDLE) {
+			vkDestroyImageView(_device, image.view, nullptr);
+			image.view = VK_NULL_HANDLE;
+		}
+		if (image.image != VK_NULL_HANDLE) {
+			vkDestroyImage(_device, image.image, nullptr);
+			image.image = VK_NULL_HANDLE;
+		}
+	}
+
+	for (auto & block : _memory_blocks) {
+		vkFreeMemory(_device, block.memory, nullptr);
+		block.memory = VK_NULL_HANDLE;
+	}
+}
+
+uint32_t RenderGraph::importImage(const std::string & name, VkFormat format, VkExtent2D extent, VkImageLayout initialLayout, VkPipelineStageFlags initialStages, VkImageLayout finalLayout) {
+	assert(!_compiled);
+
+	ImageResource image {};
+	image.name = name;
+	image.format = format;
+	image.extent = extent;
+	image.samples = VK_SAMPLE_COUNT_1_BIT;
+	image.imported = true;
+	image.initialLayout = initialLayout;
+	image.initialStages = initialStages;
+	image.finalLayout = finalLayout;
+	_images.push_back(image);
+
+	return (uint32_t)_images.size() - 1;
+}
+
+void RenderGraph::setImportedImage(uint32_t image, VkImage vkImage, VkImageView view) {
+	assert(image < _images.size() && _images[image].imported);
+
+	_images[image].image = vkImage;
+	_images[image].view = view;
+}
+
+uint32_t RenderGraph::createImage(const std::string & name, VkFormat format, VkExtent2D extent, VkSampleCountFlagBits samples) {
+	assert(!_compiled);
+
+	ImageResource image {};
+	image.name = name;
+	image.format = format;
+	image.extent = extent;
+	image.samples = samples;
+	image.imported = false;
+	image.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	image.finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	_images.push_back(image);
+
+	return (uint32_t)_images.size() - 1;
+}
+
+uint32_t RenderGraph::addGraphicsPass(const std::string & name, PassFunction function) {
+	assert(!_compiled);
+
+	Pass pass {};
+	pass.name = name;
+	pass.graphics = true;
+	pass.function = function;
+	_passes.push_back(pass);
+
+	return (uint32_t)_passes.size() - 1;
+}
+
+uint32_t RenderGraph::addComputePass(const std::string & name, PassFunction function) {
+	assert(!_compiled);
+
+	Pass pass {};
+	pass.name = name;
+	pass.graphics = false;
+	pass.function = function;
+	_passes.push_back(pass);
+
+	return (uint32_t)_passes.size() - 1;
+}
+
+void RenderGraph::setSideEffects(uint32_t pass) {
+	assert(pass < _passes.size());
+	_passes[pass].sideEffects = true;
+}
+
+void RenderGraph::readImage(uint32_t pass, uint32_t image, ImageAccess access, VkPipelineStageFlags stages) {
+	_UseImage(pass, image, access, stages, false, nullptr);
+}
+
+void RenderGraph::writeImage(uint32_t pass, uint32_t image, ImageAccess access, VkPipelineStageFlags stages) {
+	_UseImage(pass, image, access, stages, true, nullptr);
+}
+
+void RenderGraph::writeColorAttachment(uint32_t pass, uint32_t image, const VkClearColorValue * clear) {
+	VkClearValue clear_value {};
+	if (clear != nullptr) {
+		clear_value.color = *clear;
+	}
+	_UseImage(pass, image, ACCESS_COLOR_ATTACHMENT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, true, (clear != nullptr) ? &clear_value : nullptr);
+}
+
+void RenderGraph::writeDepthAttachment(uint32_t pass, uint32_t image, const VkClearDepthStencilValue * clear) {
+	VkClearValue clear_value {};
+	if (clear != nullptr) {
+		clear_value.depthStencil = *clear;
+	}
+	_UseImage(pass, image, ACCESS_DEPTH_ATTACHMENT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, true, (clear != nullptr) ? &clear_value : nullptr);
+}
+
+void RenderGraph::resolveColorAttachment(uint32_t pass, uint32_t source, uint32_t image) {
+	assert(source < _images.size());
+	if (_images[source].samples == VK_SAMPLE_COUNT_1_BIT || _images[image].samples != VK_SAMPLE_COUNT_1_BIT) {
+		throw std::invalid_argument("Resolves go from a multisampled image to a single sampled one");
+	}
+	_UseImage(pass, image, ACCESS_COLOR_ATTACHMENT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, true, nullptr, source);
+}
+
+void RenderGraph::compile() {
+	assert(!_compiled);
+
+	_CullPasses();
+	_AllocateImages();
+	_ScheduleBarriers();
+	_InitRenderPasses();
+
+	// Sized for the largest batch so execute() never allocates
+	size_t max_barriers = _final_barriers.size();
+	for (const auto & pass : _passes) {
+		max_barriers = std::max(max_barriers, pass.barriers.size());
+	}
+	_barrier_scratch.reserve(max_barriers);
+
+	_compiled = true;
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer) {
+	assert(_compiled);
+
+	for (auto & pass : _passes) {
+		if (pass.culled) {
+			continue;
+		}
+
+		_RecordBarriers(commandBuffer, pass.barriers, pass.srcStages, pass.dstStages);
+
+		if (!pass.graphics) {
+			pass.function(commandBuffer);
+			continue;
+		}
+
+		const ImageResource & first_attachment = _images[pass.attachments[0]];
+
+		VkRenderPassBeginInfo render_pass_begin_info = vkStruct<VkRenderPassBeginInfo>();
+		render_pass_begin_info.renderPass = pass.renderPass;
+		render_pass_begin_info.framebuffer = _GetFramebuffer(pass);
+		render_pass_begin_info.renderArea.offset = { 0, 0 };
+		render_pass_begin_info.renderArea.extent = first_attachment.extent;
+		render_pass_begin_info.clearValueCount = (uint32_t)pass.clearValues.size();
+		render_pass_begin_info.pClearValues = pass.clearValues.data();
+
+		vkCmdBeginRenderPass(commandBuffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+		pass.function(commandBuffer);
+		vkCmdEndRenderPass(commandBuffer);
+	}
+
+	_RecordBarriers(commandBuffer, _final_barriers, _final_src_stages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+}
+
+const VkImage RenderGraph::getImage(uint32_t image) const {
+	assert(image < _images.size());
+	return _images[image].image;
+}
+
+const VkImageView RenderGraph::getImageView(uint32_t image) const {
+	assert(image < _images.size());
+	return _images[image].view;
+}
+
+const VkFormat RenderGraph::getFormat(uint32_t image) const {
+	assert(image < _images.size());
+	return _images[image].format;
+}
+
+const bool RenderGraph::isPassCulled(uint32_t pass) const {
+	assert(_compiled && pass < _passes.size());
+	return _passes[pass].culled;
+}
+
+const VkDeviceSize RenderGraph::getTransientMemorySize() const {
+	VkDeviceSize size = 0;
+	for (const auto & block : _memory_blocks) {
+		if (!block.lazy) {
+			size += block.size;
+		}
+	}
+	return size;
+}
+
+const VkDeviceSize RenderGraph::getLazyMemoryCommitment() const {
+	VkDeviceSize size = 0;
+	for (const auto & block : _memory_blocks) {
+		if (block.lazy) {
+			VkDeviceSize committed = 0;
+			vkGetDeviceMemoryCommitment(_device, block.memory, &committed);
+			size += committed;
+		}
+	}
+	return size;
+}
+
+void RenderGraph::_UseImage(uint32_t pass, uint32_t image, ImageAccess access, VkPipelineStageFlags stages, bool write, const VkClearValue * clear, uint32_t resolveSource) {
+	assert(!_compiled && pass < _passes.size() && image < _images.size());
+
+	if (isAttachmentAccess(access) && !_passes[pass].graphics) {
+		throw std::invalid_argument("Attachments need a graphics pass");
+	}
+
+	// An attachment that is not cleared loads what was there. A resolve overwrites every pixel
+	bool read = !write || (isAttachmentAccess(access) && clear == nullptr && resolveSource == UINT32_MAX);
+
+	for (auto & use : _passes[pass].uses) {
+		if (use.image != image) {
+			continue;
+		}
+
+		// One layout per image per pass
+		if (use.access != access || (isAttachmentAccess(access) && use.write != write) || use.resolveSource != resolveSource) {
+			throw std::invalid_argument("Image used two ways in one pass");
+		}
+
+		use.stages |= stages;
+		use.read = use.read || read;
+		use.write = use.write || write;
+		return;
+	}
+
+	ImageUse use {};
+	use.image = image;
+	use.access = access;
+	use.stages = stages;
+	use.read = read;
+	use.write = write;
+	use.clear = clear != nullptr;
+	use.resolveSource = resolveSource;
+	if (use.clear) {
+		use.clearValue = *clear;
+	}
+	_passes[pass].uses.push_back(use);
+}
+
+void RenderGraph::_CullPasses() {
+	// Walk backwards from what leaves the graph, keeping every pass something downstream still needs
+	std::vector<bool> needed(_images.size(), false);
+
+	for (size_t i = _passes.size(); i > 0; i--) {
+		Pass & pass = _passes[i - 1];
+
+		pass.culled = !pass.sideEffects;
+		for (const auto & use : pass.uses) {
+			if (use.write && (_images[use.image].imported || needed[use.image])) {
+				pass.culled = false;
+			}
+		}
+
+		if (pass.culled) {
+			continue;
+		}
+
+		// A clear replaces everything before it, so earlier writers are only needed for what this pass reads
+		for (const auto & use : pass.uses) {
+			if (use.clear) {
+				needed[use.image] = false;
+			}
+		}
+		for (const auto & use : pass.uses) {
+			if (use.read) {
+				needed[use.image] = true;
+			}
+		}
+	}
+}
+
+void RenderGraph::_AllocateImages() {
+	for (auto & image : _images) {
+		image.firstPass = UINT32_MAX;
+		image.lastPass = 0;
+		image.usage = 0;
+		image.lazy = false;
+	}
+
+	for (uint32_t i = 0; i < _passes.size(); i++) {
+		if (_passes[i].culled) {
+			continue;
+		}
+		for (const auto & use : _passes[i].uses) {
+			ImageResource & image = _images[use.image];
+			image.firstPass = std::min(image.firstPass, i);
+			image.lastPass = std::max(image.lastPass, i);
+			image.usage |= accessUsage(use.access);
+		}
+	}
+
+	std::vector<uint32_t> transients;
+	std::vector<VkMemoryRequirements> requirements(_images.size());
+
+	for (uint32_t i = 0; i < _images.size(); i++) {
+		ImageResource & image = _images[i];
+		image.memoryBlock = UINT32_MAX;
+		if (image.imported || image.firstPass == UINT32_MAX) {
+			continue; // Only read or written by culled passes
+		}
+
+		// An attachment that lives inside a single render pass is never loaded or stored, so a tiler can keep
+		// it in tile memory and never back it at all
+		image.lazy = image.firstPass == image.lastPass && (image.usage & ~ATTACHMENT_USAGE_MASK) == 0;
+		if (image.lazy) {
+			image.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		}
+
+		VkImageCreateInfo image_create_info = vkStruct<VkImageCreateInfo>();
+		image_create_info.imageType = VK_IMAGE_TYPE_2D;
+		image_create_info.extent.width = image.extent.width;
+		image_create_info.extent.height = image.extent.height;
+		image_create_info.extent.depth = 1;
+		image_create_info.mipLevels = 1;
+		image_create_info.arrayLayers = 1;
+		image_create_info.format = image.format;
+		image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		image_create_info.usage = image.usage;
+		image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		image_create_info.samples = image.samples;
+
+		ErrorCheck(vkCreateImage(_device, &image_create_info, nullptr, &image.image));
+		vkGetImageMemoryRequirements(_device, image.image, &requirements[i]);
+
+		transients.push_back(i);
+	}
+
+	// Largest first, each into the first block it fits beside without overlapping a lifetime. Everything is bound
+	// at offset zero, so a block only has to be as large as its largest image
+	std::sort(transients.begin(), transients.end(), [&](uint32_t a, uint32_t b) {
+		return requirements[a].size > requirements[b].size;
+	});
+
+	for (uint32_t index : transients) {
+		ImageResource & image = _images[index];
+
+		for (uint32_t b = 0; b < _memory_blocks.size() && image.memoryBlock == UINT32_MAX; b++) {
+			MemoryBlock & block = _memory_blocks[b];
+			if (block.lazy != image.lazy || (block.memoryTypeBits & requirements[index].memoryTypeBits) == 0) {
+				continue;
+			}
+
+			bool overlaps = false;
+			for (uint32_t other : block.images) {
+				if (image.firstPass <= _images[other].lastPass && _images[other].firstPass <= image.lastPass) {
+					overlaps = true;
+					break;
+				}
+			}
+
+			if (!overlaps) {
+				block.size = std::max(block.size, requirements[index].size);
+				block.memoryTypeBits &= requirements[index].memoryTypeBits;
+				block.images.push_back(index);
+				image.memoryBlock = b;
+			}
+		}
+
+		if (image.memoryBlock == UINT32_MAX) {
+			MemoryBlock block {};
+			block.size = requirements[index].size;
+			block.memoryTypeBits = requirements[index].memoryTypeBits;
+			block.lazy = image.lazy;
+			block.images.push_back(index);
+			_memory_blocks.push_back(block);
+			image.memoryBlock = (uint32_t)_memory_blocks.size() - 1;
+		}
+	}
+
+	const VkPhysicalDeviceMemoryProperties & memory_properties = _renderer->getPhysicalDeviceMemoryProperties();
+
+	for (auto & block : _memory_blocks) {
+		VkMemoryAllocateInfo memory_allocate_info = vkStruct<VkMemoryAllocateInfo>();
+		memory_allocate_info.allocationSize = block.size;
+		memory_allocate_info.memoryTypeIndex = UINT32_MAX;
+		if (block.lazy) {
+			memory_allocate_info.memoryTypeIndex = findMemoryType(memory_properties, block.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+		}
+		if (memory_allocate_info.memoryTypeIndex == UINT32_MAX) {
+			// Desktop GPUs rarely expose lazily allocated memory, the transient usage is still a hint to them
+			block.lazy = false;
+			memory_allocate_info.memoryTypeIndex = findMemoryType(memory_properties, block.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		}
+		if (memory_allocate_info.memoryTypeIndex == UINT32_MAX) {
+			throw std::runtime_error("No memory type for render graph images");
+		}
+
+		ErrorCheck(vkAllocateMemory(_device, &memory_allocate_info, nullptr, &block.memory));
+
+		for (uint32_t index : block.images) {
+			ImageResource & image = _images[index];
+			ErrorCheck(vkBindImageMemory(_device, image.image, block.memory, 0));
+
+			// Sampling a depth/stencil image goes through a depth only view
+			VkImageAspectFlags aspect = getFormatAspectFlags(image.format);
+			if (aspect & VK_IMAGE_ASPECT_DEPTH_BIT) {
+				aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+			}
+			_renderer->createImageView(image.image, image.format, aspect, image.view);
+		}
+	}
+}
+
+void RenderGraph::_ScheduleBarriers() {
+	// What has happened to each image since its last barrier
+	struct ImageState {
+		VkImageLayout layout;
+		VkPipelineStageFlags writeStages;
+		VkAccessFlags writeAccess; // Not yet made available
+		VkPipelineStageFlags readStages; // Since the last write
+		VkPipelineStageFlags visibleStages; // The last write has been made visible to these
+	};
+
+	// Per memory block, every stage and write that touches it in a frame
+	std::vector<VkPipelineStageFlags> block_stages(_memory_blocks.size(), 0);
+	std::vector<VkAccessFlags> block_writes(_memory_blocks.size(), 0);
+
+	for (const auto & pass : _passes) {
+		if (pass.culled) {
+			continue;
+		}
+		for (const auto & use : pass.uses) {
+			uint32_t block = _images[use.image].memoryBlock;
+			if (block != UINT32_MAX) {
+				block_stages[block] |= use.stages;
+				block_writes[block] |= accessMask(use.access, use.read, use.write) & WRITE_ACCESS_MASK;
+			}
+		}
+	}
+
+	std::vector<ImageState> states(_images.size());
+	for (uint32_t i = 0; i < _images.size(); i++) {
+		const ImageResource & image = _images[i];
+		ImageState & state = states[i];
+
+		if (image.imported) {
+			VkAccessFlags layout_access;
+			VkPipelineStageFlags layout_stages;
+			getImageLayoutAccess(image.initialLayout, layout_access, layout_stages);
+
+			state.layout = image.initialLayout;
+			state.writeStages = image.initialStages;
+			state.writeAccess = layout_access & WRITE_ACCESS_MASK;
+			state.readStages = 0;
+			state.visibleStages = 0;
+		}
+		else if (image.memoryBlock != UINT32_MAX) {
+			// Contents are discarded, but whatever last used the memory, this image last frame or an alias this
+			// frame, has to be finished with it first
+			state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			state.writeStages = block_stages[image.memoryBlock];
+			state.writeAccess = block_writes[image.memoryBlock];
+			state.readStages = 0;
+			state.visibleStages = 0;
+		}
+	}
+
+	for (auto & pass : _passes) {
+		pass.barriers.clear();
+		pass.srcStages = 0;
+		pass.dstStages = 0;
+
+		if (pass.culled) {
+			continue;
+		}
+
+		for (const auto & use : pass.uses) {
+			ImageState & state = states[use.image];
+
+			VkImageLayout layout = accessLayout(use.access, use.write);
+			VkAccessFlags dst_access = accessMask(use.access, use.read, use.write);
+
+			bool transition = layout != state.layout;
+			bool barrier = false;
+			VkPipelineStageFlags src_stages = 0;
+			VkAccessFlags src_access = 0;
+
+			if (transition || use.write) {
+				// Layout changes and writes wait for everything before them
+				src_stages = state.writeStages | state.readStages;
+				src_access = state.writeAccess;
+				barrier = transition || src_stages != 0;
+			}
+			else if (state.writeAccess != 0 && (use.stages & ~state.visibleStages) != 0) {
+				// A read only waits for the last write, and only if no barrier has already shown it to these stages
+				src_stages = state.writeStages;
+				src_access = state.writeAccess;
+				barrier = true;
+			}
+
+			if (barrier) {
+				pass.srcStages |= src_stages;
+				pass.dstStages |= use.stages;
+
+				// Pure execution dependencies need no image barrier, the stage masks carry them
+				if (transition || src_access != 0) {
+					ImageBarrier image_barrier {};
+					image_barrier.image = use.image;
+					image_barrier.oldLayout = state.layout;
+					image_barrier.newLayout = layout;
+					image_barrier.srcAccessMask = src_access;
+					image_barrier.dstAccessMask = dst_access;
+					pass.barriers.push_back(image_barrier);
+				}
+			}
+
+			state.layout = layout;
+			if (use.write) {
+				state.writeStages = use.stages;
+				state.writeAccess = dst_access & WRITE_ACCESS_MASK;
+				state.readStages = 0;
+				state.visibleStages = 0;
+			}
+			else {
+				state.readStages |= use.stages;
+				if (barrier) {
+					state.visibleStages |= use.stages;
+				}
+			}
+		}
+	}
+
+	_final_barriers.clear();
+	_final_src_stages = 0;
+
+	for (uint32_t i = 0; i < _images.size(); i++) {
+		const ImageResource & image = _images[i];
+		const ImageState & state = states[i];
+
+		if (!image.imported || image.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED || image.finalLayout == state.layout) {
+			continue;
+		}
+
+		VkAccessFlags final_access;
+		VkPipelineStageFlags final_stages;
+		getImageLayoutAccess(image.finalLayout, final_access, final_stages);
+
+		ImageBarrier image_barrier {};
+		image_barrier.image = i;
+		image_barrier.oldLayout = state.layout;
+		image_barrier.newLayout = image.finalLayout;
+		image_barrier.srcAccessMask = state.writeAccess;
+		image_barrier.dstAccessMask = 0; // Whoever uses it next synchronizes against the end of the graph
+		_final_barriers.push_back(image_barrier);
+
+		_final_src_stages |= state.writeStages | state.readStages;
+	}
+}
+
+void RenderGraph::_InitRenderPasses() {
+	for (uint32_t p = 0; p < _passes.size(); p++) {
+		Pass & pass = _passes[p];
+		pass.attachments.clear();
+		pass.clearValues.clear();
+
+		if (pass.culled || !pass.graphics) {
+			continue;
+		}
+
+		std::vector<const ImageUse *> attachment_uses;
+		std::vector<const ImageUse *> resolve_uses;
+		const ImageUse * depth_use = nullptr;
+		for (const auto & use : pass.uses) {
+			if (use.resolveSource != UINT32_MAX) {
+				resolve_uses.push_back(&use);
+			}
+			else if (use.access == ACCESS_COLOR_ATTACHMENT) {
+				attachment_uses.push_back(&use);
+			}
+			else if (use.access == ACCESS_DEPTH_ATTACHMENT) {
+				if (depth_use != nullptr) {
+					throw std::invalid_argument("A pass can have only one depth attachment");
+				}
+				depth_use = &use;
+			}
+		}
+
+		uint32_t color_count = (uint32_t)attachment_uses.size();
+		if (color_count > MAX_PASS_COLOR_ATTACHMENTS) {
+			throw std::invalid_argument("Too many colour attachments");
+		}
+		if (depth_use != nullptr) {
+			attachment_uses.push_back(depth_use);
+		}
+		if (attachment_uses.empty()) {
+			throw std::invalid_argument("Graphics pass without attachments");
+		}
+
+		// Resolve attachments go last, each paired with the colour attachment it resolves
+		std::vector<uint32_t> resolve_indices(color_count, VK_ATTACHMENT_UNUSED);
+		for (const ImageUse * resolve_use : resolve_uses) {
+			uint32_t color = 0;
+			while (color < color_count && attachment_uses[color]->image != resolve_use->resolveSource) {
+				color++;
+			}
+			if (color == color_count) {
+				throw std::invalid_argument("Resolve source is not a colour attachment of the pass");
+			}
+			resolve_indices[color] = (uint32_t)attachment_uses.size();
+			attachment_uses.push_back(resolve_use);
+		}
+
+		std::vector<VkAttachmentDescription> attachments;
+		std::vector<VkAttachmentReference> references;
+
+		for (uint32_t a = 0; a < attachment_uses.size(); a++) {
+			const ImageUse & use = *attachment_uses[a];
+			const ImageResource & image = _images[use.image];
+
+			// Earlier contents exist if they came in from outside or a live pass before this one wrote them
+			bool has_contents = image.imported && image.initialLayout != VK_IMAGE_LAYOUT_UNDEFINED;
+			for (uint32_t earlier = 0; earlier < p && !has_contents; earlier++) {
+				if (_passes[earlier].culled) {
+					continue;
+				}
+				for (const auto & other : _passes[earlier].uses) {
+					has_contents = has_contents || (other.image == use.image && other.write);
+				}
+			}
+
+			// Contents are kept if they leave the graph or a later live pass reads them
+			bool read_later = image.imported && image.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED;
+			for (uint32_t later = p + 1; later < _passes.size() && !read_later; later++) {
+				if (_passes[later].culled) {
+					continue;
+				}
+				for (const auto & other : _passes[later].uses) {
+					read_later = read_later || (other.image == use.image && other.read);
+				}
+			}
+
+			VkImageLayout layout = accessLayout(use.access, use.write);
+
+			VkAttachmentDescription attachment {};
+			attachment.format = image.format;
+			attachment.samples = image.samples;
+			attachment.loadOp = use.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : ((has_contents && use.read) ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+			attachment.storeOp = read_later ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE; // Even unwritten, DONT_CARE may discard
+			attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			attachment.initialLayout = layout; // Transitions happen in the barrier before the pass
+			attachment.finalLayout = layout;
+			attachments.push_back(attachment);
+
+			VkAttachmentReference reference {};
+			reference.attachment = a;
+			reference.layout = layout;
+			references.push_back(reference);
+
+			pass.attachments.push_back(use.image);
+			pass.clearValues.push_back(use.clearValue);
+		}
+
+		std::vector<VkAttachmentReference> resolve_references(color_count, VkAttachmentReference { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED });
+		for (uint32_t c = 0; c < color_count; c++) {
+			if (resolve_indices[c] != VK_ATTACHMENT_UNUSED) {
+				resolve_references[c] = references[resolve_indices[c]];
+			}
+		}
+
+		VkSubpassDescription subpass {};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = color_count;
+		subpass.pColorAttachments = (color_count > 0) ? references.data() : nullptr;
+		subpass.pResolveAttachments = !resolve_uses.empty() ? resolve_references.data() : nullptr;
+		subpass.pDepthStencilAttachment = (depth_use != nullptr) ? &references[color_count] : nullptr;
+
+		VkRenderPassCreateInfo render_pass_create_info = vkStruct<VkRenderPassCreateInfo>();
+		render_pass_create_info.attachmentCount = (uint32_t)attachments.size();
+		render_pass_create_info.pAttachments = attachments.data();
+		render_pass_create_info.subpassCount = 1;
+		render_pass_create_info.pSubpasses = &subpass;
+
+		ErrorCheck(vkCreateRenderPass(_device, &render_pass_create_info, nullptr, &pass.renderPass));
+	}
+}
+
+VkFramebuffer RenderGraph::_GetFramebuffer(Pass & pass) {
+	FramebufferKey key {};
+	for (uint32_t a = 0; a < pass.attachments.size(); a++) {
+		key[a] = _images[pass.attachments[a]].view;
+		assert(key[a] != VK_NULL_HANDLE);
+	}
+
+	auto cached = pass.framebuffers.find(key);
+	if (cached != pass.framebuffers.end()) {
+		return cached->second;
+	}
+
+	const ImageResource & first_attachment = _images[pass.attachments[0]];
+
+	VkFramebufferCreateInfo framebuffer_create_info = vkStruct<VkFramebufferCreateInfo>();
+	framebuffer_create_info.renderPass = pass.renderPass;
+	framebuffer_create_info.attachmentCount = (uint32_t)pass.attachments.size();
+	framebuffer_create_info.pAttachments = key.data();
+	framebuffer_create_info.width = first_attachment.extent.width;
+	framebuffer_create_info.height = first_attachment.extent.height;
+	framebuffer_create_info.layers = 1;
+
+	VkFramebuffer framebuffer;
+	ErrorCheck(vkCreateFramebuffer(_device, &framebuffer_create_info, nullptr, &framebuffer));
+
+	pass.framebuffers[key] = framebuffer;
+	return framebuffer;
+}
+
+void RenderGraph::_RecordBarriers(VkCommandBuffer commandBuffer, const std::vector<ImageBarrier> & barriers, VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages) {
+	if (barriers.empty() && srcStages == 0) {
+		return;
+	}
+
+	_barrier_scratch.clear();
+	for (const auto & barrier : barriers) {
+		const ImageResource & image = _images[barrier.image];
+		if (image.image == VK_NULL_HANDLE) {
+			continue; // An import that has not been bound yet
+		}
+
+		VkImageMemoryBarrier image_barrier = vkStruct<VkImageMemoryBarrier>();
+		image_barrier.srcAccessMask = barrier.srcAccessMask;
+		image_barrier.dstAccessMask = barrier.dstAccessMask;
+		image_barrier.oldLayout = barrier.oldLayout;
+		image_barrier.newLayout = barrier.newLayout;
+		image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		image_barrier.image = image.image;
+		image_barrier.subresourceRange = { getFormatAspectFlags(image.format), 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+		_barrier_scratch.push_back(image_barrier);
+	}
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		(srcStages != 0) ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		(dstStages != 0) ? dstStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		(uint32_t)_barrier_scratch.size(), _barrier_scratch.data()
+	);
+}
\ No newline at end of file
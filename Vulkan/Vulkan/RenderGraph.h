@@ -0,0 +1,186 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* RenderGraph.h | Passes declared with their image reads and writes, scheduled with derived barriers
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+
+#include <vector>
+#include <array>
+#include <map>
+#include <string>
+#include <functional>
+
+class Renderer;
+
+const uint32_t MAX_PASS_COLOR_ATTACHMENTS = 8;
+
+// Access and pipeline stages that use an image in the given layout, for barriers into or out of it
+void getImageLayoutAccess(VkImageLayout layout, VkAccessFlags & accessMask, VkPipelineStageFlags & stageMask);
+VkImageAspectFlags getFormatAspectFlags(VkFormat format);
+
+// Records a frame from passes that declare which images they read and write, and how.
+// compile() works out everything the declarations imply, once:
+//  - passes whose results are never read are culled
+//  - each pass gets one vkCmdPipelineBarrier with every layout transition and dependency it needs, nothing more
+//  - attachments only load and store when an earlier pass wrote them or a later one reads them
+//  - transient images whose lifetimes do not overlap share memory
+//  - transient attachments that never leave their render pass are lazily allocated, where the device allows it
+// execute() then replays it into a command buffer every frame. Imported images live outside the graph and may
+// change between frames, the swapchain image for one. Buffers are not tracked, their owners synchronize them.
+// Passes run in declaration order.
+class RenderGraph {
+public:
+	enum ImageAccess {
+		ACCESS_COLOR_ATTACHMENT,
+		ACCESS_DEPTH_ATTACHMENT,
+		ACCESS_SAMPLED,
+		ACCESS_STORAGE,
+		ACCESS_TRANSFER_SRC,
+		ACCESS_TRANSFER_DST
+	};
+
+	typedef std::function<void(VkCommandBuffer commandBuffer)> PassFunction;
+
+	RenderGraph(Renderer * renderer);
+	~RenderGraph();
+
+	// Content arrives in initialLayout, after initialStages, and is left in finalLayout. UNDEFINED discards it
+	uint32_t importImage(const std::string & name, VkFormat format, VkExtent2D extent, VkImageLayout initialLayout, VkPipelineStageFlags initialStages, VkImageLayout finalLayout);
+	// Before each execute(), if the image behind an import changes
+	void setImportedImage(uint32_t image, VkImage vkImage, VkImageView view);
+	// Created by compile(), contents do not survive the frame
+	uint32_t createImage(const std::string & name, VkFormat format, VkExtent2D extent, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT);
+
+	// Graphics passes run inside a render pass built from their attachments
+	uint32_t addGraphicsPass(const std::string & name, PassFunction function);
+	uint32_t addComputePass(const std::string & name, PassFunction function);
+	// Kept even if nothing in the graph reads what it writes, e.g. it writes buffers or images the graph cannot see
+	void setSideEffects(uint32_t pass);
+
+	void readImage(uint32_t pass, uint32_t image, ImageAccess access, VkPipelineStageFlags stages);
+	void writeImage(uint32_t pass, uint32_t image, ImageAccess access, VkPipelineStageFlags stages);
+	// Without a clear value earlier contents are loaded, if there are any
+	void writeColorAttachment(uint32_t pass, uint32_t image, const VkClearColorValue * clear = nullptr);
+	void writeDepthAttachment(uint32_t pass, uint32_t image, const VkClearDepthStencilValue * clear = nullptr);
+	// Resolves a multisampled colour attachment of the pass into image at the end of the subpass, so the samples
+	// themselves never have to be stored
+	void resolveColorAttachment(uint32_t pass, uint32_t source, uint32_t image);
+
+	void compile();
+	void execute(VkCommandBuffer commandBuffer);
+
+	const VkImage getImage(uint32_t image) const;
+	const VkImageView getImageView(uint32_t image) const;
+	const VkFormat getFormat(uint32_t image) const;
+	const bool isPassCulled(uint32_t pass) const;
+	const VkDeviceSize getTransientMemorySize() const;
+	// What the driver has actually backed the lazily allocated attachments with, zero on a tiler that kept them on chip
+	const VkDeviceSize getLazyMemoryCommitment() const;
+
+private:
+	struct ImageResource {
+		std::string name;
+		VkFormat format;
+		VkExtent2D extent;
+		VkSampleCountFlagBits samples;
+		bool imported;
+		VkImageLayout initialLayout;
+		VkPipelineStageFlags initialStages;
+		VkImageLayout finalLayout;
+		VkImageUsageFlags usage;
+		bool lazy;
+
+		VkImage image;
+		VkImageView view;
+		uint32_t memoryBlock;
+		uint32_t firstPass; // Live passes only
+		uint32_t lastPass;
+	};
+
+	struct ImageUse {
+		uint32_t image;
+		ImageAccess access;
+		VkPipelineStageFlags stages;
+		bool read;
+		bool write;
+		bool clear;
+		VkClearValue clearValue;
+		uint32_t resolveSource; // UINT32_MAX unless the use is a resolve attachment
+	};
+
+	struct ImageBarrier {
+		uint32_t image;
+		VkImageLayout oldLayout;
+		VkImageLayout newLayout;
+		VkAccessFlags srcAccessMask;
+		VkAccessFlags dstAccessMask;
+	};
+
+	typedef std::array<VkImageView, 2 * MAX_PASS_COLOR_ATTACHMENTS + 1> FramebufferKey;
+
+	struct Pass {
+		std::string name;
+		bool graphics;
+		bool sideEffects;
+		bool culled;
+		PassFunction function;
+		std::vector<ImageUse> uses;
+
+		std::vector<ImageBarrier> barriers;
+		VkPipelineStageFlags srcStages;
+		VkPipelineStageFlags dstStages;
+
+		std::vector<uint32_t> attachments; // Colour first, then depth, then resolves
+		std::vector<VkClearValue> clearValues;
+		VkRenderPass renderPass;
+		std::map<FramebufferKey, VkFramebuffer> framebuffers; // One per set of imported views seen
+	};
+
+	struct MemoryBlock {
+		VkDeviceMemory memory;
+		VkDeviceSize size;
+		uint32_t memoryTypeBits;
+		bool lazy; // Lazily allocated images only ever share with each other
+		std::vector<uint32_t> images;
+	};
+
+	void _UseImage(uint32_t pass, uint32_t image, ImageAccess access, VkPipelineStageFlags stages, bool write, const VkClearValue * clear, uint32_t resolveSource = UINT32_MAX);
+
+	void _CullPasses();
+	void _AllocateImages();
+	void _ScheduleBarriers();
+	void _InitRenderPasses();
+
+	VkFramebuffer _GetFramebuffer(Pass & pass);
+	void _RecordBarriers(VkCommandBuffer commandBuffer, const std::vector<ImageBarrier> & barriers, VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages);
+
+	Renderer * _renderer = nullptr;
+	VkDevice _device = VK_NULL_HANDLE;
+
+	std::vector<ImageResource> _images;
+	std::vector<Pass> _passes;
+	std::vector<MemoryBlock> _memory_blocks;
+	bool _compiled = false;
+
+	// Imported images leave the graph in their final layouts
+	std::vector<ImageBarrier> _final_barriers;
+	VkPipelineStageFlags _final_src_stages = 0;
+
+	std::vector<VkImageMemoryBarrier> _barrier_scratch; // Reused every execute()
+};
\ No newline at end of file
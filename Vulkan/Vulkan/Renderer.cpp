@@ -21,6 +21,15 @@
 #include "BUILD_OPTIONS.h"
 #include "Platform.h"
 #include "Window.h"
+#include "DescriptorAllocator.h"
+#include "TextureTable.h"
+#include "VirtualTexture.h"
+#include "ClusteredLighting.h"
+#include "TaskScheduler.h"
+#include "LinearArena.h"
+#include "DeletionQueue.h"
+#include "QueueTimeline.h"
+#include "RenderGraph.h"
 
 #include <vulkan/vk_layer.h>
 
@@ -28,15 +37,21 @@
 #include <assert.h>
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <cstring>
 
 #include <iostream>
 #include <sstream>
 
 const std::string VERT_PATH = "vert.spv";
 const std::string FRAG_PATH = "frag.spv";
+const std::string VIRTUAL_TEXTURE_FRAG_PATH = "virtual_texture_frag.spv";
 
 // Construction
 Renderer::Renderer() {
+	// Created first so it belongs to the main thread, which then works through its deque while waiting
+	_task_scheduler = new TaskScheduler(0, BUILD_ENABLE_THREAD_PINNING != 0);
+
 	_SetupLayersAndExtensions();
 	_SetupDebug();
 	_InitInstance();
@@ -45,20 +60,34 @@ Renderer::Renderer() {
 }
 
 Renderer::~Renderer() {
-	_DeInitFramebuffers();
+	// Whatever is still queued may belong to the last frames submitted
+	if (nullptr != _deletion_queue) {
+		_queue_timeline->waitIdle();
+		delete _deletion_queue;
+		_deletion_queue = nullptr;
+	}
+
+	delete _frame_arena;
+	_frame_arena = nullptr;
+
 	_DeInitGraphicsPipeline();
-	_DeInitDescriptorSetLayout();
 	_DeInitDescriptorPool();
+	_DeInitDescriptorSetLayout();
 	_DeInitRenderPass();
 	delete _window;
 
 	_DeInitDevice();
 	_DeInitDebug();
 	_DeInitInstance();
+
+	delete _task_scheduler;
+	_task_scheduler = nullptr;
 }
 
-Window * Renderer::openWindow(uint32_t size_x, uint32_t size_y, std::string name) {
-	_window = new Window(this, size_x, size_y, name);
+Window * Renderer::openWindow(uint32_t size_x, uint32_t size_y, std::string name, LatencyMode latencyMode) {
+	_window = new Window(this, size_x, size_y, name, latencyMode);
+	_frame_arena = new FrameArena(_task_scheduler, (uint32_t)_window->getSwapchainImages().size());
+	_deletion_queue = new DeletionQueue(_device, (uint32_t)_window->getSwapchainImages().size());
 	_InitRenderPass();
 	_InitDescriptorSetLayout();
 	_InitDescriptorPool();
@@ -73,6 +102,12 @@ bool Renderer::run(int * xPos, int * yPos) {
 	return true;
 }
 
+void Renderer::beginFrame(uint32_t frame) {
+	_frame_arena->beginFrame(frame);
+	_deletion_queue->beginFrame(frame);
+	_frame_descriptor_allocators[frame]->resetPools(); // Every transient set of the frame at once, a reset per pool
+}
+
 const VkInstance Renderer::getInstance() const {
 	return _instance;
 }
@@ -89,6 +124,10 @@ const VkQueue Renderer::getQueue() const {
 	return _queue;
 }
 
+QueueTimeline * Renderer::getQueueTimeline() const {
+	return _queue_timeline;
+}
+
 const uint32_t Renderer::getGraphicsFamilyIndex() const {
 	return _graphics_family_index;
 }
@@ -101,6 +140,10 @@ const VkPhysicalDeviceMemoryProperties & Renderer::getPhysicalDeviceMemoryProper
 	return _gpu_memory_properties;
 }
 
+const VkPhysicalDeviceFeatures & Renderer::getPhysicalDeviceFeatures() const {
+	return _gpu_features;
+}
+
 const Window * Renderer::getWindow() const {
 	return _window;
 }
@@ -109,8 +152,12 @@ const VkRenderPass Renderer::getRenderPass() const {
 	return _render_pass;
 }
 
-const std::vector<VkFramebuffer> Renderer::getSwapchainFramebuffers() const {
-	return _swapchain_framebuffers;
+const VkFormat Renderer::getDepthFormat() const {
+	return _depth_format;
+}
+
+const VkSampleCountFlagBits Renderer::getSampleCount() const {
+	return _sample_count;
 }
 
 const VkPipelineLayout Renderer::getPipelineLayout() const {
@@ -125,13 +172,36 @@ const VkDescriptorSetLayout Renderer::getDescriptorSetLayout() const {
 	return _descriptor_set_layout;
 }
 
-const VkDescriptorPool Renderer::getDescriptorPool() const {
-	return _descriptor_pool;
+DescriptorLayoutCache * Renderer::getDescriptorLayoutCache() const {
+	return _descriptor_layout_cache;
+}
+
+DescriptorAllocator * Renderer::getDescriptorAllocator() const {
+	return _descriptor_allocator;
+}
+
+DescriptorAllocator * Renderer::getFrameDescriptorAllocator(uint32_t frame) const {
+	return _frame_descriptor_allocators[frame];
+}
+
+TextureTable * Renderer::getTextureTable() const {
+	return _texture_table;
+}
+
+TaskScheduler * Renderer::getTaskScheduler() const {
+	return _task_scheduler;
+}
+
+FrameArena * Renderer::getFrameArena() const {
+	return _frame_arena;
+}
+
+DeletionQueue * Renderer::getDeletionQueue() const {
+	return _deletion_queue;
 }
 
 void Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memory_properties, VkBuffer & buffer, VkDeviceMemory & buffer_memory) {
-	VkBufferCreateInfo buffer_create_info{};
-	buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	VkBufferCreateInfo buffer_create_info = vkStruct<VkBufferCreateInfo>();
 	buffer_create_info.size = size;
 	buffer_create_info.usage = usage;
 	buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
@@ -151,8 +221,7 @@ void Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemor
 		}
 	}
 
-	VkMemoryAllocateInfo memory_allocate_info{};
-	memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	VkMemoryAllocateInfo memory_allocate_info = vkStruct<VkMemoryAllocateInfo>();
 	memory_allocate_info.allocationSize = mem_requirements.size;
 	memory_allocate_info.memoryTypeIndex = memory_type;
 
@@ -173,14 +242,13 @@ void Renderer::copyBuffer(VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffe
 	_EndSingleTimeCommands(commandPool, command_buffer);
 }
 
-void Renderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags memoryProperties, VkImage & image, VkDeviceMemory & imageMemory) {
-	VkImageCreateInfo image_create_info{};
-	image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+void Renderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags memoryProperties, VkImage & image, VkDeviceMemory & imageMemory, uint32_t mipLevels) {
+	VkImageCreateInfo image_create_info = vkStruct<VkImageCreateInfo>();
 	image_create_info.imageType = VK_IMAGE_TYPE_2D;
 	image_create_info.extent.width = width;
 	image_create_info.extent.height = height;
 	image_create_info.extent.depth = 1;
-	image_create_info.mipLevels = 1;
+	image_create_info.mipLevels = mipLevels;
 	image_create_info.arrayLayers = 1;
 	image_create_info.format = format;
 	image_create_info.tiling = tiling;
@@ -195,8 +263,7 @@ void Renderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkI
 	VkMemoryRequirements mem_reqs;
 	vkGetImageMemoryRequirements(_device, image, &mem_reqs);
 
-	VkMemoryAllocateInfo mem_alloc_info{};
-	mem_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	VkMemoryAllocateInfo mem_alloc_info = vkStruct<VkMemoryAllocateInfo>();
 	mem_alloc_info.allocationSize = mem_reqs.size;
 
 	uint32_t type_filter = mem_reqs.memoryTypeBits;
@@ -211,62 +278,48 @@ void Renderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkI
 	mem_alloc_info.memoryTypeIndex = memory_type;
 
 	ErrorCheck(vkAllocateMemory(_device, &mem_alloc_info, nullptr, &imageMemory));
-	vkBindImageMemory(_device, image, imageMemory, 0);
+	ErrorCheck(vkBindImageMemory(_device, image, imageMemory, 0));
 }
 
-void Renderer::transitionImageLayout(VkCommandPool pool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout) {
+void Renderer::transitionImageLayout(VkCommandPool pool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
 	VkCommandBuffer command_buffer = _BeginSingleTimeCommands(pool);
+	recordImageLayoutTransition(command_buffer, image, oldLayout, newLayout, mipLevels);
+	_EndSingleTimeCommands(pool, command_buffer);
+}
 
-	VkImageMemoryBarrier barrier {};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+void Renderer::recordImageLayoutTransition(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
+	VkImageMemoryBarrier barrier = vkStruct<VkImageMemoryBarrier>();
 	barrier.oldLayout = oldLayout;
 	barrier.newLayout = newLayout;
 	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 	barrier.image = image;
-	if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+	if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL || newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL) {
 		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
 	}
 	else {
 		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	}
 	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.levelCount = mipLevels;
 	barrier.subresourceRange.baseArrayLayer = 0;
 	barrier.subresourceRange.layerCount = 1;
-	barrier.srcAccessMask = 0;
-	barrier.dstAccessMask = 0;
 
-	if (oldLayout == VK_IMAGE_LAYOUT_PREINITIALIZED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
-		barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-	}
-	else if (oldLayout == VK_IMAGE_LAYOUT_PREINITIALIZED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-		barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	}
-	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-	}
-	else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-	}
-	else {
-		throw std::invalid_argument("Unsupported layout transition.");
-	}
+	// Wait for whatever used the old layout, block whatever uses the new one. Only writes need making available
+	VkPipelineStageFlags src_stages;
+	VkPipelineStageFlags dst_stages;
+	getImageLayoutAccess(oldLayout, barrier.srcAccessMask, src_stages);
+	getImageLayoutAccess(newLayout, barrier.dstAccessMask, dst_stages);
+	barrier.srcAccessMask &= VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT;
 
 	vkCmdPipelineBarrier(
-		command_buffer,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		commandBuffer,
+		src_stages, dst_stages,
 		0,
 		0, nullptr,
 		0, nullptr,
 		1, &barrier
 	);
-
-	_EndSingleTimeCommands(pool, command_buffer);
 }
 
 void Renderer::copyImage(VkCommandPool pool, VkImage srcImage, VkImage dstImage, uint32_t width, uint32_t height) {
@@ -297,8 +350,18 @@ void Renderer::copyImage(VkCommandPool pool, VkImage srcImage, VkImage dstImage,
 	_EndSingleTimeCommands(pool, command_buffer);
 }
 
-void Renderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView & imageView) {
-	_window->createImageView(image, format, aspectFlags, imageView);
+void Renderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView & imageView, uint32_t baseMipLevel, uint32_t levelCount) {
+	_window->createImageView(image, format, aspectFlags, imageView, baseMipLevel, levelCount);
+}
+
+void Renderer::createShaderModule(const std::string & path, VkShaderModule & shaderModule) {
+	std::vector<char> shader_code = readFile(path);
+
+	VkShaderModuleCreateInfo shader_module_create_info = vkStruct<VkShaderModuleCreateInfo>();
+	shader_module_create_info.codeSize = shader_code.size();
+	shader_module_create_info.pCode = (uint32_t *)shader_code.data();
+
+	ErrorCheck(vkCreateShaderModule(_device, &shader_module_create_info, nullptr, &shaderModule));
 }
 
 VkFormat Renderer::findSupportedFormat(const std::vector<VkFormat> & candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
@@ -317,35 +380,48 @@ VkFormat Renderer::findSupportedFormat(const std::vector<VkFormat> & candidates,
 	throw std::runtime_error("Unable to find supported format");
 }
 
-void Renderer::makeFramebuffers(VkImageView depthImageView) {
-	_InitFramebuffers(depthImageView);
-}
 void Renderer::_SetupLayersAndExtensions() {
 	//_instance_extension_list.push_back(VK_KHR_DISPLAY_EXTENSION_NAME); // Exclusive mode only
 	_instance_extension_list.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
 	_instance_extension_list.push_back(PLATFORM_SURFACE_EXTENSION_NAME);
 	
 	_device_extension_list.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+#if defined(VK_EXT_descriptor_indexing) || defined(VK_KHR_timeline_semaphore)
+	{ // Descriptor indexing and timeline semaphore features can only be queried through vkGetPhysicalDeviceFeatures2KHR
+		uint32_t extension_count = 0;
+		ErrorCheck(vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, nullptr));
+
+		std::vector<VkExtensionProperties> extension_property_list(extension_count);
+		ErrorCheck(vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, extension_property_list.data()));
+
+		for (auto & extension : extension_property_list) {
+			if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+				_instance_extension_list.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+			}
+		}
+	}
+#endif
 }
 
 // Instances
 void Renderer::_InitInstance() {
 	// Application info
-	VkApplicationInfo application_info {};
-	application_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	VkApplicationInfo application_info = vkStruct<VkApplicationInfo>();
 	application_info.apiVersion = VK_MAKE_VERSION(1, 0, 13);
 	application_info.applicationVersion = VK_MAKE_VERSION(0, 1, 0);
 	application_info.pApplicationName = "Vulkan Testing";
 
 	// Instance create info
-	VkInstanceCreateInfo instance_create_info{};
-	instance_create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	VkInstanceCreateInfo instance_create_info = vkStruct<VkInstanceCreateInfo>();
 	instance_create_info.pApplicationInfo = &application_info;
 	instance_create_info.enabledLayerCount = (uint32_t) _instance_layer_list.size();
 	instance_create_info.ppEnabledLayerNames = _instance_layer_list.data();
 	instance_create_info.enabledExtensionCount = (uint32_t) _instance_extension_list.size();
 	instance_create_info.ppEnabledExtensionNames = _instance_extension_list.data();
-	instance_create_info.pNext = &_debug_callback_create_info;
+#if BUILD_ENABLE_VULKAN_DEBUG
+	vkChain(instance_create_info, _debug_callback_create_info); // Also reports on instance creation itself
+#endif
 
 	ErrorCheck(vkCreateInstance(&instance_create_info, nullptr, &_instance));
 }
@@ -361,16 +437,33 @@ void Renderer::_InitDevice() {
 		uint32_t gpu_count = 0;
 		
 		// Read number of GPU's
-		vkEnumeratePhysicalDevices(_instance, &gpu_count, nullptr);
+		ErrorCheck(vkEnumeratePhysicalDevices(_instance, &gpu_count, nullptr));
 		
 		std::vector<VkPhysicalDevice> gpu_list(gpu_count);
 
 		// Populate list
-		vkEnumeratePhysicalDevices(_instance, &gpu_count, gpu_list.data());
+		ErrorCheck(vkEnumeratePhysicalDevices(_instance, &gpu_count, gpu_list.data()));
 
 		_gpu = gpu_list[0]; // Get the first available list
+#if BUILD_ENABLE_GOLDEN_IMAGES
+		// A software implementation renders the same pixels on every machine, so golden images stay comparable
+		for (auto gpu : gpu_list) {
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(gpu, &properties);
+			if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU) {
+				_gpu = gpu;
+				break;
+			}
+		}
+#endif
 		vkGetPhysicalDeviceProperties(_gpu, &_gpu_properties);
 		vkGetPhysicalDeviceMemoryProperties(_gpu, &_gpu_memory_properties);
+		vkGetPhysicalDeviceFeatures(_gpu, &_gpu_features);
+
+		// Every draw picks its texture from the TextureTable array with a push constant index
+		if (!_gpu_features.shaderSampledImageArrayDynamicIndexing) {
+			throw std::runtime_error("GPU does not support dynamically indexing sampled image arrays");
+		}
 	}
 	
 	{
@@ -388,8 +481,11 @@ void Renderer::_InitDevice() {
 		bool found = false;
 		for (uint32_t i = 0; i < family_count; ++i) {
 			if (family_property_list[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+				// Prefer a family that can also run the culling compute passes
+				if (!found || (family_property_list[i].queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+					_graphics_family_index = i;
+				}
 				found = true;
-				_graphics_family_index = i;
 			}
 		}
 
@@ -404,12 +500,12 @@ void Renderer::_InitDevice() {
 		uint32_t layer_count = 0;
 
 		// Read the number of layers
-		vkEnumerateInstanceLayerProperties(&layer_count, nullptr);
+		ErrorCheck(vkEnumerateInstanceLayerProperties(&layer_count, nullptr));
 
 		std::vector<VkLayerProperties> layer_property_list(layer_count);
 
 		// Populate list
-		vkEnumerateInstanceLayerProperties(&layer_count, layer_property_list.data());
+		ErrorCheck(vkEnumerateInstanceLayerProperties(&layer_count, layer_property_list.data()));
 
 #if BUILD_ENABLE_VULKAN_RUNTIME_DEBUG
 		std::cout << "Instance layers: \n";
@@ -425,12 +521,12 @@ void Renderer::_InitDevice() {
 		uint32_t extension_count = 0;
 
 		// Read the number of extensions
-		vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, nullptr);
+		ErrorCheck(vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, nullptr));
 
 		std::vector<VkExtensionProperties> extension_property_list(extension_count);
 
 		// Populate list
-		vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, extension_property_list.data());
+		ErrorCheck(vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, extension_property_list.data()));
 
 #if BUILD_ENABLE_VULKAN_RUNTIME_DEBUG
 		std::cout << "Instance extensions: \n";
@@ -446,12 +542,12 @@ void Renderer::_InitDevice() {
 		uint32_t layer_count = 0;
 
 		// Read the number of layers
-		vkEnumerateDeviceLayerProperties(_gpu, &layer_count, nullptr);
+		ErrorCheck(vkEnumerateDeviceLayerProperties(_gpu, &layer_count, nullptr));
 
 		std::vector<VkLayerProperties> layer_property_list(layer_count);
 
 		// Populate list
-		vkEnumerateDeviceLayerProperties(_gpu, &layer_count, layer_property_list.data());
+		ErrorCheck(vkEnumerateDeviceLayerProperties(_gpu, &layer_count, layer_property_list.data()));
 
 #if BUILD_ENABLE_VULKAN_RUNTIME_DEBUG
 		std::cout << "Device layers: \n";
@@ -467,12 +563,12 @@ void Renderer::_InitDevice() {
 		uint32_t extension_count = 0;
 
 		// Read the number of extensions
-		vkEnumerateDeviceExtensionProperties(_gpu, nullptr, &extension_count, nullptr);
+		ErrorCheck(vkEnumerateDeviceExtensionProperties(_gpu, nullptr, &extension_count, nullptr));
 
 		std::vector<VkExtensionProperties> extension_property_list(extension_count);
 
 		// Populate list
-		vkEnumerateDeviceExtensionProperties(_gpu, nullptr, &extension_count, extension_property_list.data());
+		ErrorCheck(vkEnumerateDeviceExtensionProperties(_gpu, nullptr, &extension_count, extension_property_list.data()));
 
 #if BUILD_ENABLE_VULKAN_RUNTIME_DEBUG
 		std::cout << "Device extensions: \n";
@@ -481,31 +577,116 @@ void Renderer::_InitDevice() {
 		}
 		std::cout << std::endl;
 #endif
+
+#if defined(VK_EXT_descriptor_indexing) || defined(VK_KHR_timeline_semaphore)
+		PFN_vkGetPhysicalDeviceFeatures2KHR fvkGetPhysicalDeviceFeatures2KHR = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(_instance, "vkGetPhysicalDeviceFeatures2KHR");
+#endif
+
+#ifdef VK_EXT_descriptor_indexing
+		// Partially bound, update-after-bind texture table
+		bool descriptor_indexing_present = false;
+		for (auto & extension : extension_property_list) {
+			if (strcmp(extension.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0) {
+				descriptor_indexing_present = true;
+			}
+		}
+
+		if (descriptor_indexing_present && fvkGetPhysicalDeviceFeatures2KHR != nullptr) {
+			VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = vkStruct<VkPhysicalDeviceDescriptorIndexingFeaturesEXT>();
+
+			VkPhysicalDeviceFeatures2KHR features = vkStruct<VkPhysicalDeviceFeatures2KHR>();
+			vkChain(features, indexing_features);
+
+			fvkGetPhysicalDeviceFeatures2KHR(_gpu, &features);
+
+			_descriptor_indexing_supported = indexing_features.descriptorBindingPartiallyBound && indexing_features.descriptorBindingSampledImageUpdateAfterBind;
+		}
+
+		if (_descriptor_indexing_supported) {
+			_device_extension_list.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+			_device_extension_list.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		}
+#endif
+
+#ifdef VK_KHR_timeline_semaphore
+		// Queue timelines use a semaphore instead of a fence per submission
+		bool timeline_semaphore_present = false;
+		for (auto & extension : extension_property_list) {
+			if (strcmp(extension.extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0) {
+				timeline_semaphore_present = true;
+			}
+		}
+
+		if (timeline_semaphore_present && fvkGetPhysicalDeviceFeatures2KHR != nullptr) {
+			VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = vkStruct<VkPhysicalDeviceTimelineSemaphoreFeaturesKHR>();
+
+			VkPhysicalDeviceFeatures2KHR features = vkStruct<VkPhysicalDeviceFeatures2KHR>();
+			vkChain(features, timeline_features);
+
+			fvkGetPhysicalDeviceFeatures2KHR(_gpu, &features);
+
+			_timeline_semaphore_supported = timeline_features.timelineSemaphore == VK_TRUE;
+		}
+
+		if (_timeline_semaphore_supported) {
+			_device_extension_list.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+		}
+#endif
 	}
 
 	float queue_priorities[] {1.0f};
 
-	VkDeviceQueueCreateInfo device_queue_create_info {};
-	device_queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	VkDeviceQueueCreateInfo device_queue_create_info = vkStruct<VkDeviceQueueCreateInfo>();
 	device_queue_create_info.queueFamilyIndex = _graphics_family_index;
 	device_queue_create_info.queueCount = 1;
 	device_queue_create_info.pQueuePriorities = queue_priorities;
 
-	VkDeviceCreateInfo device_create_info = {};
-	device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	// Only enable what is actually used
+	VkPhysicalDeviceFeatures enabled_features {};
+	enabled_features.samplerAnisotropy = _gpu_features.samplerAnisotropy;
+	enabled_features.shaderSampledImageArrayDynamicIndexing = VK_TRUE; // Checked when the GPU was picked
+	enabled_features.multiDrawIndirect = _gpu_features.multiDrawIndirect;
+	enabled_features.drawIndirectFirstInstance = _gpu_features.drawIndirectFirstInstance;
+	enabled_features.fragmentStoresAndAtomics = _gpu_features.fragmentStoresAndAtomics;
+
+	VkDeviceCreateInfo device_create_info = vkStruct<VkDeviceCreateInfo>();
 	device_create_info.queueCreateInfoCount = 1;
 	device_create_info.pQueueCreateInfos = &device_queue_create_info;
 	device_create_info.enabledLayerCount = (uint32_t) _device_layer_list.size();
 	device_create_info.ppEnabledLayerNames = _device_layer_list.data();
 	device_create_info.enabledExtensionCount = (uint32_t) _device_extension_list.size();
 	device_create_info.ppEnabledExtensionNames = _device_extension_list.data();
+	device_create_info.pEnabledFeatures = &enabled_features;
+
+#ifdef VK_EXT_descriptor_indexing
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = vkStruct<VkPhysicalDeviceDescriptorIndexingFeaturesEXT>();
+	indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+	indexing_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+
+	if (_descriptor_indexing_supported) {
+		vkChain(device_create_info, indexing_features);
+	}
+#endif
+
+#ifdef VK_KHR_timeline_semaphore
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = vkStruct<VkPhysicalDeviceTimelineSemaphoreFeaturesKHR>();
+	timeline_features.timelineSemaphore = VK_TRUE;
+
+	if (_timeline_semaphore_supported) {
+		vkChain(device_create_info, timeline_features);
+	}
+#endif
 
 	ErrorCheck(vkCreateDevice(_gpu, &device_create_info, nullptr, &_device));
 
 	vkGetDeviceQueue(_device, _graphics_family_index, 0, &_queue);
+	_queue_timeline = new QueueTimeline(_device, _queue, _graphics_family_index, _timeline_semaphore_supported);
 }
 
 void Renderer::_DeInitDevice() {
+	delete _queue_timeline; // Waits for the queue to drain
+	_queue_timeline = nullptr;
+
 	vkDestroyDevice(_device, nullptr);
 	_device = nullptr;
 }
@@ -557,7 +738,7 @@ VKAPI_ATTR VkBool32 VKAPI_CALL VulkanDebugCallback(
 }
 
 void Renderer::_SetupDebug() {
-	_debug_callback_create_info.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CREATE_INFO_EXT;
+	_debug_callback_create_info = vkStruct<VkDebugReportCallbackCreateInfoEXT>();
 	_debug_callback_create_info.pfnCallback = VulkanDebugCallback;
 	_debug_callback_create_info.flags =
 		VK_DEBUG_REPORT_INFORMATION_BIT_EXT |
@@ -613,10 +794,37 @@ void Renderer::_InitDebug() {};
 void Renderer::_DeInitDebug() {};
 #endif // BUILD_ENABLE_VULKAN_DEBUG
 
+// Only ever used to create pipelines, so just the attachment formats and sample counts matter
 void Renderer::_InitRenderPass() {
+#if BUILD_ENABLE_GPU_CULLING
+	// The culling pass reduces the depth buffer into a pyramid, so it must be sampleable
+	VkFormatFeatureFlags depth_format_features = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+#else
+	VkFormatFeatureFlags depth_format_features = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+#endif
+
+	_depth_format = findSupportedFormat(
+		{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
+		VK_IMAGE_TILING_OPTIMAL,
+		depth_format_features
+	);
+
+	// The highest count up to the requested one that both colour and depth attachments support. 1 always is
+	VkSampleCountFlags supported_sample_counts = _gpu_properties.limits.framebufferColorSampleCounts & _gpu_properties.limits.framebufferDepthSampleCounts;
+#if BUILD_ENABLE_GPU_CULLING
+	supported_sample_counts &= _gpu_properties.limits.sampledImageDepthSampleCounts; // The pyramid samples the depth buffer as it is
+#endif
+	_sample_count = VK_SAMPLE_COUNT_1_BIT;
+	for (uint32_t count = BUILD_MSAA_SAMPLE_COUNT; count > 1; count >>= 1) {
+		if (supported_sample_counts & count) {
+			_sample_count = (VkSampleCountFlagBits)count;
+			break;
+		}
+	}
+
 	VkAttachmentDescription color_attachment {};
 	color_attachment.format = _window->getSurfaceFormat().format;
-	color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	color_attachment.samples = _sample_count;
 	color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
@@ -625,12 +833,8 @@ void Renderer::_InitRenderPass() {
 	color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentDescription depth_attachment {};
-	depth_attachment.format = findSupportedFormat(
-		{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
-	);
-	depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	depth_attachment.format = _depth_format;
+	depth_attachment.samples = _sample_count;
 	depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
@@ -646,10 +850,19 @@ void Renderer::_InitRenderPass() {
 	depth_attachment_reference.attachment = 1;
 	depth_attachment_reference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
+	VkAttachmentDescription resolve_attachment = color_attachment;
+	resolve_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	resolve_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+
+	VkAttachmentReference resolve_attachment_reference {};
+	resolve_attachment_reference.attachment = 2;
+	resolve_attachment_reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
 	VkSubpassDescription subpass{};
 	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &color_attachment_reference;
+	subpass.pResolveAttachments = (_sample_count != VK_SAMPLE_COUNT_1_BIT) ? &resolve_attachment_reference : nullptr;
 	subpass.pDepthStencilAttachment = &depth_attachment_reference;
 
 	VkSubpassDependency dependency {};
@@ -660,11 +873,10 @@ void Renderer::_InitRenderPass() {
 	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
-	std::array<VkAttachmentDescription, 2> attachments = { color_attachment, depth_attachment };
+	std::array<VkAttachmentDescription, 3> attachments = { color_attachment, depth_attachment, resolve_attachment };
 
-	VkRenderPassCreateInfo render_pass_create_info {};
-	render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	render_pass_create_info.attachmentCount = (uint32_t)attachments.size();
+	VkRenderPassCreateInfo render_pass_create_info = vkStruct<VkRenderPassCreateInfo>();
+	render_pass_create_info.attachmentCount = (_sample_count != VK_SAMPLE_COUNT_1_BIT) ? 3 : 2;
 	render_pass_create_info.pAttachments = attachments.data();
 	render_pass_create_info.subpassCount = 1;
 	render_pass_create_info.pSubpasses = &subpass;
@@ -680,54 +892,97 @@ void Renderer::_DeInitRenderPass() {
 }
 
 void Renderer::_InitGraphicsPipeline() {
-	{ // Create Vertex Shader Module
-		std::vector<char> vert_shader_code = readFile(VERT_PATH);
+	createShaderModule(VERT_PATH, _vert_module);
+#if BUILD_ENABLE_VIRTUAL_TEXTURE
+	createShaderModule(VIRTUAL_TEXTURE_FRAG_PATH, _frag_module);
+#else
+	createShaderModule(FRAG_PATH, _frag_module);
+#endif
 
-		VkShaderModuleCreateInfo shader_module_create_info{};
-		shader_module_create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		shader_module_create_info.codeSize = vert_shader_code.size();
-		shader_module_create_info.pCode = (uint32_t *)vert_shader_code.data();
+	std::vector<VkDescriptorSetLayout> descriptor_set_layouts = { _descriptor_set_layout };
+	descriptor_set_layouts.push_back(ClusteredLighting::getSetLayout(_descriptor_layout_cache)); // Set 1
+#if BUILD_ENABLE_VIRTUAL_TEXTURE
+	descriptor_set_layouts.push_back(VirtualTexture::getSetLayout(_descriptor_layout_cache)); // Set 2
+#endif
+	assert(sizeof(DrawPushConstants) <= _gpu_properties.limits.maxPushConstantsSize); // 128 bytes are always available
+	std::array<VkPushConstantRange, 1> push_constant_ranges = DrawPushConstants::getPushConstantRanges();
 
-		ErrorCheck(vkCreateShaderModule(_device, &shader_module_create_info, nullptr, &_vert_module));
-	}
+	VkPipelineLayoutCreateInfo pipeline_layout_create_info = vkStruct<VkPipelineLayoutCreateInfo>();
+	pipeline_layout_create_info.setLayoutCount = (uint32_t)descriptor_set_layouts.size();
+	pipeline_layout_create_info.pSetLayouts = descriptor_set_layouts.data();
+	pipeline_layout_create_info.pushConstantRangeCount = (uint32_t)push_constant_ranges.size();
+	pipeline_layout_create_info.pPushConstantRanges = push_constant_ranges.data();
 
-	{ // Create Fragment Shader Module
-		std::vector<char> frag_shader_code = readFile(FRAG_PATH);
+	ErrorCheck(vkCreatePipelineLayout(_device, &pipeline_layout_create_info, nullptr, &_pipeline_layout));
+
+	VkPipelineCacheCreateInfo pipeline_cache_create_info = vkStruct<VkPipelineCacheCreateInfo>();
 
-		VkShaderModuleCreateInfo shader_module_create_info{};
-		shader_module_create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		shader_module_create_info.codeSize = frag_shader_code.size();
-		shader_module_create_info.pCode = (uint32_t *)frag_shader_code.data();
+	ErrorCheck(vkCreatePipelineCache(_device, &pipeline_cache_create_info, nullptr, &_pipeline_cache));
 
-		ErrorCheck(vkCreateShaderModule(_device, &shader_module_create_info, nullptr, &_frag_module));
+	_graphics_pipeline = getGraphicsPipeline(DEFAULT_FRACTAL_SPECIALIZATION);
+}
+
+VkPipeline Renderer::getGraphicsPipeline(const FractalSpecialization & specialization) {
+	auto variant = _pipeline_variants.find(specialization);
+	if (variant != _pipeline_variants.end()) {
+		return variant->second;
 	}
 
-	VkPipelineShaderStageCreateInfo vert_shader_stage_create_info{};
-	vert_shader_stage_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	// Variants are built on first use and kept until the renderer shuts down
+	VkPipeline pipeline = _CreateGraphicsPipeline(specialization);
+	_pipeline_variants[specialization] = pipeline;
+	return pipeline;
+}
+
+VkPipeline Renderer::_CreateGraphicsPipeline(const FractalSpecialization & specialization) {
+	struct {
+		FractalSpecialization fractal;
+		uint32_t textureTableSize;
+	} specialization_data = { specialization, _texture_table->getSize() };
+
+	std::array<VkSpecializationMapEntry, 3> fractal_map_entries = FractalSpecialization::getMapEntries();
+	std::vector<VkSpecializationMapEntry> specialization_map_entries(fractal_map_entries.begin(), fractal_map_entries.end());
+
+	VkSpecializationMapEntry texture_table_size_entry {};
+	texture_table_size_entry.constantID = TEXTURE_TABLE_SIZE_CONSTANT_ID;
+	texture_table_size_entry.offset = offsetof(decltype(specialization_data), textureTableSize);
+	texture_table_size_entry.size = sizeof(uint32_t);
+	specialization_map_entries.push_back(texture_table_size_entry);
+
+	VkSpecializationInfo specialization_info {};
+	specialization_info.mapEntryCount = (uint32_t)specialization_map_entries.size();
+	specialization_info.pMapEntries = specialization_map_entries.data();
+	specialization_info.dataSize = sizeof(specialization_data);
+	specialization_info.pData = &specialization_data;
+
+	VkPipelineShaderStageCreateInfo vert_shader_stage_create_info = vkStruct<VkPipelineShaderStageCreateInfo>();
 	vert_shader_stage_create_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
 	vert_shader_stage_create_info.module = _vert_module;
 	vert_shader_stage_create_info.pName = "main";
 
-	VkPipelineShaderStageCreateInfo frag_shader_stage_create_info{};
-	frag_shader_stage_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	VkPipelineShaderStageCreateInfo frag_shader_stage_create_info = vkStruct<VkPipelineShaderStageCreateInfo>();
 	frag_shader_stage_create_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 	frag_shader_stage_create_info.module = _frag_module;
 	frag_shader_stage_create_info.pName = "main";
+	frag_shader_stage_create_info.pSpecializationInfo = &specialization_info;
 
 	VkPipelineShaderStageCreateInfo shader_stages[] = { vert_shader_stage_create_info, frag_shader_stage_create_info };
 
-	VkVertexInputBindingDescription binding_description = Vertex::getBindingDescription();
-	std::array<VkVertexInputAttributeDescription, 3> attribute_descriptions = Vertex::getAttributeDescriptions();
+	std::array<VkVertexInputBindingDescription, 2> binding_descriptions = { Vertex::getBindingDescription(), InstanceData::getBindingDescription() };
 
-	VkPipelineVertexInputStateCreateInfo vertex_input_info_create_info{};
-	vertex_input_info_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertex_input_info_create_info.vertexBindingDescriptionCount = 1;
-	vertex_input_info_create_info.pVertexBindingDescriptions = &binding_description;
+	std::array<VkVertexInputAttributeDescription, 4> vertex_attribute_descriptions = Vertex::getAttributeDescriptions();
+	std::array<VkVertexInputAttributeDescription, 4> instance_attribute_descriptions = InstanceData::getAttributeDescriptions();
+
+	std::vector<VkVertexInputAttributeDescription> attribute_descriptions(vertex_attribute_descriptions.begin(), vertex_attribute_descriptions.end());
+	attribute_descriptions.insert(attribute_descriptions.end(), instance_attribute_descriptions.begin(), instance_attribute_descriptions.end());
+
+	VkPipelineVertexInputStateCreateInfo vertex_input_info_create_info = vkStruct<VkPipelineVertexInputStateCreateInfo>();
+	vertex_input_info_create_info.vertexBindingDescriptionCount = (uint32_t)binding_descriptions.size();
+	vertex_input_info_create_info.pVertexBindingDescriptions = binding_descriptions.data();
 	vertex_input_info_create_info.vertexAttributeDescriptionCount = (uint32_t)attribute_descriptions.size();
 	vertex_input_info_create_info.pVertexAttributeDescriptions = attribute_descriptions.data();
 
-	VkPipelineInputAssemblyStateCreateInfo pipeline_input_assembly_state_create_info{};
-	pipeline_input_assembly_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	VkPipelineInputAssemblyStateCreateInfo pipeline_input_assembly_state_create_info = vkStruct<VkPipelineInputAssemblyStateCreateInfo>();
 	pipeline_input_assembly_state_create_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	pipeline_input_assembly_state_create_info.primitiveRestartEnable = VK_FALSE;
 
@@ -744,15 +999,13 @@ void Renderer::_InitGraphicsPipeline() {
 	scissor.extent.width = _window->getWidth();
 	scissor.extent.height = _window->getHeight();
 
-	VkPipelineViewportStateCreateInfo pipeline_viewport_state_create_info{};
-	pipeline_viewport_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	VkPipelineViewportStateCreateInfo pipeline_viewport_state_create_info = vkStruct<VkPipelineViewportStateCreateInfo>();
 	pipeline_viewport_state_create_info.viewportCount = 1;
 	pipeline_viewport_state_create_info.pViewports = &viewport;
 	pipeline_viewport_state_create_info.scissorCount = 1;
 	pipeline_viewport_state_create_info.pScissors = &scissor;
 
-	VkPipelineRasterizationStateCreateInfo rasterization_state_create_info{};
-	rasterization_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	VkPipelineRasterizationStateCreateInfo rasterization_state_create_info = vkStruct<VkPipelineRasterizationStateCreateInfo>();
 	rasterization_state_create_info.depthClampEnable = VK_FALSE;
 	rasterization_state_create_info.rasterizerDiscardEnable = VK_FALSE;
 	rasterization_state_create_info.polygonMode = VK_POLYGON_MODE_FILL;
@@ -764,10 +1017,9 @@ void Renderer::_InitGraphicsPipeline() {
 	rasterization_state_create_info.depthBiasClamp = 0.0f;
 	rasterization_state_create_info.depthBiasSlopeFactor = 0.0f;
 
-	VkPipelineMultisampleStateCreateInfo pipeline_multisample_state_create_info{}; // Anti-Aliasing
-	pipeline_multisample_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	VkPipelineMultisampleStateCreateInfo pipeline_multisample_state_create_info = vkStruct<VkPipelineMultisampleStateCreateInfo>(); // Anti-Aliasing
 	pipeline_multisample_state_create_info.sampleShadingEnable = VK_FALSE;
-	pipeline_multisample_state_create_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	pipeline_multisample_state_create_info.rasterizationSamples = _sample_count;
 	pipeline_multisample_state_create_info.minSampleShading = 1.0f;
 	pipeline_multisample_state_create_info.pSampleMask = nullptr;
 	pipeline_multisample_state_create_info.alphaToCoverageEnable = VK_FALSE;
@@ -783,8 +1035,7 @@ void Renderer::_InitGraphicsPipeline() {
 	pipeline_color_blend_attachment_state.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
 	pipeline_color_blend_attachment_state.alphaBlendOp = VK_BLEND_OP_ADD;
 
-	VkPipelineColorBlendStateCreateInfo pipeline_color_blend_state_create_info{};
-	pipeline_color_blend_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	VkPipelineColorBlendStateCreateInfo pipeline_color_blend_state_create_info = vkStruct<VkPipelineColorBlendStateCreateInfo>();
 	pipeline_color_blend_state_create_info.logicOpEnable = VK_FALSE;
 	pipeline_color_blend_state_create_info.logicOp = VK_LOGIC_OP_COPY;
 	pipeline_color_blend_state_create_info.attachmentCount = 1;
@@ -794,8 +1045,7 @@ void Renderer::_InitGraphicsPipeline() {
 	pipeline_color_blend_state_create_info.blendConstants[2] = 0.0f;
 	pipeline_color_blend_state_create_info.blendConstants[3] = 0.0f;
 
-	VkPipelineDepthStencilStateCreateInfo depth_stencil{};
-	depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	VkPipelineDepthStencilStateCreateInfo depth_stencil = vkStruct<VkPipelineDepthStencilStateCreateInfo>();
 	depth_stencil.depthTestEnable = VK_TRUE;
 	depth_stencil.depthWriteEnable = VK_TRUE;
 	depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
@@ -806,18 +1056,7 @@ void Renderer::_InitGraphicsPipeline() {
 	depth_stencil.front = {};
 	depth_stencil.back = {};
 
-	VkDescriptorSetLayout descriptor_set_layouts[] = { _descriptor_set_layout };
-	VkPipelineLayoutCreateInfo pipeline_layout_create_info {};
-	pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipeline_layout_create_info.setLayoutCount = 1;
-	pipeline_layout_create_info.pSetLayouts = descriptor_set_layouts;
-	pipeline_layout_create_info.pushConstantRangeCount = 0;
-	pipeline_layout_create_info.pPushConstantRanges = 0;
-
-	ErrorCheck(vkCreatePipelineLayout(_device, &pipeline_layout_create_info, nullptr, &_pipeline_layout));
-
-	VkGraphicsPipelineCreateInfo graphics_pipeline_create_info {};
-	graphics_pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	VkGraphicsPipelineCreateInfo graphics_pipeline_create_info = vkStruct<VkGraphicsPipelineCreateInfo>();
 	graphics_pipeline_create_info.stageCount = 2; // Shader stages
 	graphics_pipeline_create_info.pStages = shader_stages;
 	graphics_pipeline_create_info.pVertexInputState = &vertex_input_info_create_info;
@@ -834,7 +1073,10 @@ void Renderer::_InitGraphicsPipeline() {
 	graphics_pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
 	graphics_pipeline_create_info.basePipelineIndex = -1;
 
-	ErrorCheck(vkCreateGraphicsPipelines(_device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &_graphics_pipeline));
+	VkPipeline pipeline;
+	ErrorCheck(vkCreateGraphicsPipelines(_device, _pipeline_cache, 1, &graphics_pipeline_create_info, nullptr, &pipeline));
+
+	return pipeline;
 }
 
 void Renderer::_DeInitGraphicsPipeline() {
@@ -844,40 +1086,27 @@ void Renderer::_DeInitGraphicsPipeline() {
 	_frag_module = nullptr;
 	vkDestroyShaderModule(_device, _vert_module, nullptr);
 	_vert_module = nullptr;
-	vkDestroyPipeline(_device, _graphics_pipeline, nullptr);
-	_graphics_pipeline = nullptr;
-}
-
-void Renderer::_InitFramebuffers(VkImageView depthImageView) {
-	_swapchain_framebuffers.resize(_window->getSwapchainImageViews().size());
-
-	for (size_t i = 0; i < _window->getSwapchainImageViews().size(); i++) {
-		std::array<VkImageView, 2> attachments = {
-			_window->getSwapchainImageViews()[i],
-			depthImageView
-		};
-
-		VkFramebufferCreateInfo framebuffer_create_info {};
-		framebuffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		framebuffer_create_info.renderPass = _render_pass;
-		framebuffer_create_info.attachmentCount = (uint32_t)attachments.size();
-		framebuffer_create_info.pAttachments = attachments.data();
-		framebuffer_create_info.width = _window->getSurfaceCapabilities().currentExtent.width;
-		framebuffer_create_info.height = _window->getSurfaceCapabilities().currentExtent.height;
-		framebuffer_create_info.layers = 1;
-
-		ErrorCheck(vkCreateFramebuffer(_device, &framebuffer_create_info, nullptr, &_swapchain_framebuffers[i]));
-	}
-}
-
-void Renderer::_DeInitFramebuffers() {
-	for (size_t i = 0; i < _window->getSwapchainImageViews().size(); i++) {
-		vkDestroyFramebuffer(_device, _swapchain_framebuffers[i], nullptr);
-		_swapchain_framebuffers[i] = nullptr;
+	for (auto & variant : _pipeline_variants) {
+		vkDestroyPipeline(_device, variant.second, nullptr);
 	}
+	_pipeline_variants.clear();
+	_graphics_pipeline = nullptr;
+	vkDestroyPipelineCache(_device, _pipeline_cache, nullptr);
+	_pipeline_cache = nullptr;
 }
 
 void Renderer::_InitDescriptorSetLayout() {
+	// The texture table may be no larger than the device allows in one stage or one set, each
+	// combined image sampler counting as both a sampler and a sampled image
+	uint32_t texture_table_size = std::min({
+		MAX_TEXTURE_TABLE_SIZE,
+		_gpu_properties.limits.maxPerStageDescriptorSamplers,
+		_gpu_properties.limits.maxPerStageDescriptorSampledImages,
+		_gpu_properties.limits.maxDescriptorSetSamplers,
+		_gpu_properties.limits.maxDescriptorSetSampledImages
+	});
+	_texture_table = new TextureTable(_device, texture_table_size, _descriptor_indexing_supported);
+
 	VkDescriptorSetLayoutBinding ubo_layout_binding {};
 	ubo_layout_binding.binding = 0;
 	ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -885,51 +1114,61 @@ void Renderer::_InitDescriptorSetLayout() {
 	ubo_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 	ubo_layout_binding.pImmutableSamplers = nullptr;
 
-	VkDescriptorSetLayoutBinding sampler_layout_binding {};
-	sampler_layout_binding.binding = 1;
-	sampler_layout_binding.descriptorCount = 1;
-	sampler_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	sampler_layout_binding.pImmutableSamplers = nullptr;
-	sampler_layout_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	VkDescriptorSetLayoutBinding sampler_layout_binding = _texture_table->getLayoutBinding(TEXTURE_TABLE_BINDING);
 
 	std::array<VkDescriptorSetLayoutBinding, 2> bindings = { ubo_layout_binding, sampler_layout_binding };
-	VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info {};
-	descriptor_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = vkStruct<VkDescriptorSetLayoutCreateInfo>();
+	descriptor_set_layout_create_info.flags = _texture_table->getLayoutFlags();
 	descriptor_set_layout_create_info.bindingCount = (uint32_t)bindings.size();
 	descriptor_set_layout_create_info.pBindings = bindings.data();
 
-	ErrorCheck(vkCreateDescriptorSetLayout(_device, &descriptor_set_layout_create_info, nullptr, &_descriptor_set_layout));
+#ifdef VK_EXT_descriptor_indexing
+	std::array<VkDescriptorBindingFlagsEXT, 2> binding_flags = {
+		0,
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT
+	};
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT binding_flags_create_info = vkStruct<VkDescriptorSetLayoutBindingFlagsCreateInfoEXT>();
+	binding_flags_create_info.bindingCount = (uint32_t)binding_flags.size();
+	binding_flags_create_info.pBindingFlags = binding_flags.data();
+
+	if (_texture_table->usesDescriptorIndexing()) {
+		vkChain(descriptor_set_layout_create_info, binding_flags_create_info);
+	}
+#endif
+
+	_descriptor_layout_cache = new DescriptorLayoutCache(_device);
+	_descriptor_set_layout = _descriptor_layout_cache->createDescriptorLayout(descriptor_set_layout_create_info);
 }
 
 void Renderer::_DeInitDescriptorSetLayout() {
-	vkDestroyDescriptorSetLayout(_device, _descriptor_set_layout, nullptr);
+	delete _descriptor_layout_cache; // Owns every cached layout
+	_descriptor_layout_cache = nullptr;
 	_descriptor_set_layout = nullptr;
+	delete _texture_table;
+	_texture_table = nullptr;
 }
 
 void Renderer::_InitDescriptorPool() {
-	std::array<VkDescriptorPoolSize, 2> pool_sizes {};
-	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	pool_sizes[0].descriptorCount = 1;
-	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	pool_sizes[1].descriptorCount = 1;
+	_descriptor_allocator = new DescriptorAllocator(_device, _descriptor_layout_cache, _texture_table->getPoolFlags());
 
-	VkDescriptorPoolCreateInfo pool_create_info {};
-	pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	pool_create_info.poolSizeCount = (uint32_t)pool_sizes.size();
-	pool_create_info.pPoolSizes = pool_sizes.data();
-	pool_create_info.maxSets = 1;
-
-	ErrorCheck(vkCreateDescriptorPool(_device, &pool_create_info, nullptr, &_descriptor_pool));
+	for (size_t i = 0; i < _window->getSwapchainImages().size(); i++) {
+		_frame_descriptor_allocators.push_back(new DescriptorAllocator(_device, _descriptor_layout_cache));
+	}
 }
 
 void Renderer::_DeInitDescriptorPool() {
-	vkDestroyDescriptorPool(_device, _descriptor_pool, nullptr);
-	_descriptor_pool = nullptr;
+	for (auto allocator : _frame_descriptor_allocators) {
+		delete allocator;
+	}
+	_frame_descriptor_allocators.clear();
+
+	delete _descriptor_allocator;
+	_descriptor_allocator = nullptr;
 }
 
 VkCommandBuffer Renderer::_BeginSingleTimeCommands(VkCommandPool pool) {
-	VkCommandBufferAllocateInfo allocate_info {};
-	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	VkCommandBufferAllocateInfo allocate_info = vkStruct<VkCommandBufferAllocateInfo>();
 	allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 	allocate_info.commandPool = pool;
 	allocate_info.commandBufferCount = 1;
@@ -937,8 +1176,7 @@ VkCommandBuffer Renderer::_BeginSingleTimeCommands(VkCommandPool pool) {
 	VkCommandBuffer command_buffer;
 	ErrorCheck(vkAllocateCommandBuffers(_device, &allocate_info, &command_buffer));
 
-	VkCommandBufferBeginInfo begin_info {};
-	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	VkCommandBufferBeginInfo begin_info = vkStruct<VkCommandBufferBeginInfo>();
 	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
 	ErrorCheck(vkBeginCommandBuffer(command_buffer, &begin_info));
@@ -949,13 +1187,12 @@ VkCommandBuffer Renderer::_BeginSingleTimeCommands(VkCommandPool pool) {
 void Renderer::_EndSingleTimeCommands(VkCommandPool pool, VkCommandBuffer commandBuffer) {
 	ErrorCheck(vkEndCommandBuffer(commandBuffer));
 
-	VkSubmitInfo submit_info {};
-	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	TimelineSubmitInfo submit_info {};
 	submit_info.commandBufferCount = 1;
 	submit_info.pCommandBuffers = &commandBuffer;
 
-	ErrorCheck(vkQueueSubmit(_queue, 1, &submit_info, VK_NULL_HANDLE));
-	ErrorCheck(vkQueueWaitIdle(_queue));
+	// Waits for this submission rather than idling the queue, so work submitted after it from other threads keeps going
+	_queue_timeline->wait(_queue_timeline->submit(submit_info));
 
 	vkFreeCommandBuffers(_device, pool, 1, &commandBuffer);
 }
\ No newline at end of file
@@ -19,9 +19,11 @@
 #pragma once
 
 #include "Platform.h"
+#include "FramePacer.h"
 
 #include <vector>
 #include <array>
+#include <unordered_map>
 
 #include <glm/glm.hpp>
 #include <glm/gtx/hash.hpp>
@@ -30,6 +32,7 @@ struct Vertex {
 	glm::vec3 pos;
 	glm::vec3 color;
 	glm::vec2 texCoord;
+	glm::vec3 normal;
 
 	static VkVertexInputBindingDescription getBindingDescription() {
 		VkVertexInputBindingDescription binding_description {};
@@ -40,8 +43,8 @@ struct Vertex {
 		return binding_description;
 	}
 
-	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
-		std::array<VkVertexInputAttributeDescription, 3> attribute_descriptions;
+	static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 4> attribute_descriptions;
 		attribute_descriptions[0].binding = 0;
 		attribute_descriptions[0].location = 0;
 		attribute_descriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
@@ -57,31 +60,127 @@ struct Vertex {
 		attribute_descriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
 		attribute_descriptions[2].offset = offsetof(Vertex, texCoord);
 
+		attribute_descriptions[3].binding = 0;
+		attribute_descriptions[3].location = 7; // After the instance matrix
+		attribute_descriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attribute_descriptions[3].offset = offsetof(Vertex, normal);
+
 		return attribute_descriptions;
 	}
 
 	bool operator==(const Vertex & other) const {
-		return pos == other.pos && color == other.color && texCoord == other.texCoord;
+		return pos == other.pos && color == other.color && texCoord == other.texCoord && normal == other.normal;
+	}
+};
+
+struct InstanceData { // Per-instance vertex input, read at VK_VERTEX_INPUT_RATE_INSTANCE
+	glm::mat4 model;
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription binding_description {};
+		binding_description.binding = 1;
+		binding_description.stride = sizeof(InstanceData);
+		binding_description.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+		return binding_description;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions() {
+		// A mat4 attribute takes one location per column
+		std::array<VkVertexInputAttributeDescription, 4> attribute_descriptions;
+		for (uint32_t i = 0; i < attribute_descriptions.size(); i++) {
+			attribute_descriptions[i].binding = 1;
+			attribute_descriptions[i].location = 3 + i;
+			attribute_descriptions[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			attribute_descriptions[i].offset = offsetof(InstanceData, model) + i * sizeof(glm::vec4);
+		}
+
+		return attribute_descriptions;
 	}
 };
 
 namespace std {
 	template<> struct hash<Vertex> {
 		size_t operator()(Vertex const & vertex) const {
-			return ((hash<glm::vec3>()(vertex.pos) ^
+			return ((((hash<glm::vec3>()(vertex.pos) ^
 				(hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-				(hash<glm::vec2>()(vertex.texCoord) << 1);
+				(hash<glm::vec2>()(vertex.texCoord) << 1)) >> 1) ^
+				(hash<glm::vec3>()(vertex.normal) << 1);
 		}
 	};
 }
 
-struct UniformBufferObject { // UBO
-	glm::mat4 model;
+struct UniformBufferObject { // UBO, per-frame data only
 	glm::mat4 view;
 	glm::mat4 projection;
 };
 
+struct FractalSpecialization { // Specialization constants for Fractal.frag
+	int32_t maxIterations;
+	float escapeRadius;
+	float paletteScale;
+
+	static std::array<VkSpecializationMapEntry, 3> getMapEntries() {
+		std::array<VkSpecializationMapEntry, 3> map_entries;
+		map_entries[0].constantID = 0;
+		map_entries[0].offset = offsetof(FractalSpecialization, maxIterations);
+		map_entries[0].size = sizeof(int32_t);
+
+		map_entries[1].constantID = 1;
+		map_entries[1].offset = offsetof(FractalSpecialization, escapeRadius);
+		map_entries[1].size = sizeof(float);
+
+		map_entries[2].constantID = 2;
+		map_entries[2].offset = offsetof(FractalSpecialization, paletteScale);
+		map_entries[2].size = sizeof(float);
+
+		return map_entries;
+	}
+
+	bool operator==(const FractalSpecialization & other) const {
+		return maxIterations == other.maxIterations && escapeRadius == other.escapeRadius && paletteScale == other.paletteScale;
+	}
+};
+
+namespace std {
+	template<> struct hash<FractalSpecialization> {
+		size_t operator()(FractalSpecialization const & specialization) const {
+			return ((hash<int32_t>()(specialization.maxIterations) ^
+				(hash<float>()(specialization.escapeRadius) << 1)) >> 1) ^
+				(hash<float>()(specialization.paletteScale) << 1);
+		}
+	};
+}
+
+// Matches the defaults declared in Fractal.frag
+const FractalSpecialization DEFAULT_FRACTAL_SPECIALIZATION = { 100, 2.0f, 100.0f };
+
+const uint32_t TEXTURE_TABLE_BINDING = 1;
+const uint32_t TEXTURE_TABLE_SIZE_CONSTANT_ID = 3;
+
+struct DrawPushConstants { // Per-draw data, pushed with one vkCmdPushConstants
+	glm::mat4 model; // Applied on top of each InstanceData::model
+	uint32_t textureIndex; // Slot in the TextureTable
+
+	// One range shared by both stages, so a draw is a single push of the whole struct
+	static std::array<VkPushConstantRange, 1> getPushConstantRanges() {
+		std::array<VkPushConstantRange, 1> push_constant_ranges;
+		push_constant_ranges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+		push_constant_ranges[0].offset = 0;
+		push_constant_ranges[0].size = sizeof(DrawPushConstants);
+
+		return push_constant_ranges;
+	}
+};
+
 class Window;
+class DescriptorLayoutCache;
+class DescriptorAllocator;
+class TextureTable;
+class TaskScheduler;
+class FrameArena;
+class DeletionQueue;
+class QueueTimeline;
 
 class Renderer
 {
@@ -89,33 +188,49 @@ public:
 	Renderer();
 	~Renderer();
 
-	Window * openWindow(uint32_t size_x, uint32_t size_y, std::string name);
+	Window * openWindow(uint32_t size_x, uint32_t size_y, std::string name, LatencyMode latencyMode = LATENCY_MODE_VSYNC);
 
 	bool run(int * xPos, int * yPos);
 
+	// Frees what the frame used the last time it was current, once the queue timeline has reached its last submission
+	void beginFrame(uint32_t frame);
+
 	const VkInstance getInstance() const;
 	const VkPhysicalDevice getPhysicalDevice() const;
 	const VkDevice getDevice() const;
 	const VkQueue getQueue() const;
+	// Every submission to the queue goes through it
+	QueueTimeline * getQueueTimeline() const;
 	const uint32_t getGraphicsFamilyIndex() const;
 	const VkPhysicalDeviceProperties & getPhysicalDeviceProperties() const;
 	const VkPhysicalDeviceMemoryProperties & getPhysicalDeviceMemoryProperties() const;
+	const VkPhysicalDeviceFeatures & getPhysicalDeviceFeatures() const;
 	const Window * getWindow() const;
 	const VkRenderPass getRenderPass() const;
-	const std::vector<VkFramebuffer> getSwapchainFramebuffers() const;
+	const VkFormat getDepthFormat() const;
+	// Of the colour and depth attachments the main pass draws into, the swapchain image is their resolve target
+	const VkSampleCountFlagBits getSampleCount() const;
 	const VkPipelineLayout getPipelineLayout() const;
 	const VkPipeline getGraphicsPipeline() const;
+	VkPipeline getGraphicsPipeline(const FractalSpecialization & specialization);
 	const VkDescriptorSetLayout getDescriptorSetLayout() const;
-	const VkDescriptorPool getDescriptorPool() const;
-
-	void makeFramebuffers(VkImageView depthImageView);
+	DescriptorLayoutCache * getDescriptorLayoutCache() const;
+	DescriptorAllocator * getDescriptorAllocator() const;
+	// Sets allocated from it only last until the frame is begun again
+	DescriptorAllocator * getFrameDescriptorAllocator(uint32_t frame) const;
+	TextureTable * getTextureTable() const;
+	TaskScheduler * getTaskScheduler() const;
+	FrameArena * getFrameArena() const;
+	DeletionQueue * getDeletionQueue() const;
 
 	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memory_properties, VkBuffer & buffer, VkDeviceMemory & buffer_memory);
 	void copyBuffer(VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage & image, VkDeviceMemory & imageMemory);
-	void transitionImageLayout(VkCommandPool pool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout);
+	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage & image, VkDeviceMemory & imageMemory, uint32_t mipLevels = 1);
+	void transitionImageLayout(VkCommandPool pool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1);
+	void recordImageLayoutTransition(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1);
 	void copyImage(VkCommandPool pool, VkImage srcImage, VkImage dstImage, uint32_t width, uint32_t height);
-	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView & imageView);
+	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView & imageView, uint32_t baseMipLevel = 0, uint32_t levelCount = 1);
+	void createShaderModule(const std::string & path, VkShaderModule & shaderModule);
 
 	VkFormat findSupportedFormat(const std::vector<VkFormat> & candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 
@@ -134,13 +249,11 @@ private:
 
 	void _InitGraphicsPipeline();
 	void _DeInitGraphicsPipeline();
+	VkPipeline _CreateGraphicsPipeline(const FractalSpecialization & specialization);
 
 	void _InitRenderPass();
 	void _DeInitRenderPass();
 
-	void _InitFramebuffers(VkImageView depthImageView);
-	void _DeInitFramebuffers();
-
 	void _InitDescriptorSetLayout();
 	void _DeInitDescriptorSetLayout();
 
@@ -154,16 +267,29 @@ private:
 	VkPhysicalDevice _gpu = VK_NULL_HANDLE;
 	VkPhysicalDeviceProperties _gpu_properties = {};
 	VkPhysicalDeviceMemoryProperties _gpu_memory_properties = {};
+	VkPhysicalDeviceFeatures _gpu_features = {};
+	bool _descriptor_indexing_supported = false;
+	bool _timeline_semaphore_supported = false;
 	VkDevice _device = VK_NULL_HANDLE;
 	VkQueue _queue = VK_NULL_HANDLE;
+	QueueTimeline * _queue_timeline = nullptr;
 	VkShaderModule _vert_module;
 	VkShaderModule _frag_module;
 	VkDescriptorSetLayout _descriptor_set_layout;
-	VkDescriptorPool _descriptor_pool;
+	DescriptorLayoutCache * _descriptor_layout_cache = nullptr;
+	DescriptorAllocator * _descriptor_allocator = nullptr;
+	std::vector<DescriptorAllocator *> _frame_descriptor_allocators; // One per swapchain image
+	TextureTable * _texture_table = nullptr;
+	TaskScheduler * _task_scheduler = nullptr;
+	FrameArena * _frame_arena = nullptr;
+	DeletionQueue * _deletion_queue = nullptr;
 	VkPipelineLayout _pipeline_layout;
-	VkRenderPass _render_pass;
+	VkRenderPass _render_pass; // Pipelines are built against it, frames are drawn in render passes from a RenderGraph
+	VkFormat _depth_format = VK_FORMAT_UNDEFINED;
+	VkSampleCountFlagBits _sample_count = VK_SAMPLE_COUNT_1_BIT;
 	VkPipeline _graphics_pipeline;
-	std::vector<VkFramebuffer> _swapchain_framebuffers;
+	VkPipelineCache _pipeline_cache = VK_NULL_HANDLE;
+	std::unordered_map<FractalSpecialization, VkPipeline> _pipeline_variants;
 
 	uint32_t _graphics_family_index = 0;
 
@@ -176,5 +302,4 @@ private:
 
 	VkDebugReportCallbackEXT _debug_report = VK_NULL_HANDLE;
 	VkDebugReportCallbackCreateInfoEXT _debug_callback_create_info {};
-};
-
+};
\ No newline at end of file
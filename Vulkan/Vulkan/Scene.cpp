@@ -0,0 +1,365 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* Scene.cpp | Object bounds in SoA layout with a BVH for CPU culling
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Scene.h"
+#include "TaskScheduler.h"
+
+#include <assert.h>
+#include <cfloat>
+#include <algorithm>
+#include <numeric>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SCENE_SIMD_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCENE_SIMD_SSE 1
+#endif
+
+// Reorders values so that values[i] becomes values[order[i]]
+template<typename T>
+static void permute(std::vector<T> & values, const std::vector<uint32_t> & order) {
+	std::vector<T> sorted(values.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		sorted[i] = values[order[i]];
+	}
+	values.swap(sorted);
+}
+
+Scene::Scene() {
+}
+
+Scene::~Scene() {
+}
+
+uint32_t Scene::addObject(const glm::vec4 & boundingSphere) {
+	uint32_t id = (uint32_t)_ids.size();
+
+	_centre_x.push_back(boundingSphere.x);
+	_centre_y.push_back(boundingSphere.y);
+	_centre_z.push_back(boundingSphere.z);
+	_radius.push_back(boundingSphere.w);
+	_ids.push_back(id);
+
+	_built = false;
+	return id;
+}
+
+void Scene::clear() {
+	_centre_x.clear();
+	_centre_y.clear();
+	_centre_z.clear();
+	_radius.clear();
+	_ids.clear();
+	_nodes.clear();
+	_built = false;
+}
+
+void Scene::build() {
+	_nodes.clear();
+	_built = true;
+
+	uint32_t object_count = getObjectCount();
+	if (object_count == 0) {
+		return;
+	}
+
+	std::vector<uint32_t> order(object_count);
+	std::iota(order.begin(), order.end(), 0);
+
+	std::vector<glm::vec3> centres(object_count);
+	for (uint32_t i = 0; i < object_count; i++) {
+		centres[i] = glm::vec3(_centre_x[i], _centre_y[i], _centre_z[i]);
+	}
+
+	_nodes.reserve(2 * (object_count / BVH_LEAF_SIZE + 1));
+	_nodes.push_back(BvhNode());
+	_BuildNode(0, 0, object_count, order, centres);
+
+	// Move the objects into leaf order so each leaf is one contiguous SIMD run
+	permute(_centre_x, order);
+	permute(_centre_y, order);
+	permute(_centre_z, order);
+	permute(_radius, order);
+	permute(_ids, order);
+}
+
+void Scene::cull(const glm::mat4 & viewProjection, std::vector<uint32_t> & visible, TaskScheduler * scheduler) const {
+	assert(_built && "Scene::build() must be called after adding objects");
+
+	visible.clear();
+	if (_nodes.empty()) {
+		return;
+	}
+
+	Frustum frustum = Frustum::fromViewProjection(viewProjection);
+
+	if (nullptr == scheduler || scheduler->getWorkerCount() == 0) {
+		_CullNode(frustum, 0, visible);
+		return;
+	}
+
+	// A few subtrees per thread evens out frustums that only cover part of the scene
+	uint32_t thread_count = scheduler->getWorkerCount() + 1;
+	uint32_t task_depth = 0;
+	while ((1u << task_depth) < thread_count * 4) {
+		task_depth++;
+	}
+
+	_tasks.clear();
+	_GatherTasks(frustum, 0, 0, task_depth, _tasks, visible);
+
+	// Cleared rather than freed, so a steady view culls without touching the heap
+	if (_task_results.size() < _tasks.size()) {
+		_task_results.resize(_tasks.size());
+	}
+	for (uint32_t task = 0; task < _tasks.size(); task++) {
+		_task_results[task].clear();
+	}
+
+	scheduler->parallelFor(0, (uint32_t)_tasks.size(), 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t task = begin; task < end; task++) {
+			_CullNode(frustum, _tasks[task], _task_results[task]);
+		}
+	});
+
+	// Appending in task order keeps the result independent of scheduling
+	for (uint32_t task = 0; task < _tasks.size(); task++) {
+		visible.insert(visible.end(), _task_results[task].begin(), _task_results[task].end());
+	}
+}
+
+void Scene::cullBruteForce(const glm::mat4 & viewProjection, std::vector<uint32_t> & visible) const {
+	visible.clear();
+
+	Frustum frustum = Frustum::fromViewProjection(viewProjection);
+	for (uint32_t i = 0; i < getObjectCount(); i++) {
+		if (frustum.intersectsSphere(glm::vec3(_centre_x[i], _centre_y[i], _centre_z[i]), _radius[i])) {
+			visible.push_back(_ids[i]);
+		}
+	}
+}
+
+const uint32_t Scene::getObjectCount() const {
+	return (uint32_t)_ids.size();
+}
+
+const uint32_t Scene::getNodeCount() const {
+	return (uint32_t)_nodes.size();
+}
+
+void Scene::_BuildNode(uint32_t nodeIndex, uint32_t first, uint32_t count, std::vector<uint32_t> & order, const std::vector<glm::vec3> & centres) {
+	glm::vec3 bounds_min(FLT_MAX);
+	glm::vec3 bounds_max(-FLT_MAX);
+	glm::vec3 centre_min(FLT_MAX);
+	glm::vec3 centre_max(-FLT_MAX);
+
+	for (uint32_t i = first; i < first + count; i++) {
+		uint32_t object = order[i];
+		glm::vec3 radius(_radius[object]);
+
+		bounds_min = glm::min(bounds_min, centres[object] - radius);
+		bounds_max = glm::max(bounds_max, centres[object] + radius);
+		centre_min = glm::min(centre_min, centres[object]);
+		centre_max = glm::max(centre_max, centres[object]);
+	}
+
+	BvhNode node {};
+	node.boundsMin = bounds_min;
+	node.boundsMax = bounds_max;
+	node.first = first;
+	node.count = count;
+	node.left = 0;
+
+	if (count <= BVH_LEAF_SIZE) {
+		_nodes[nodeIndex] = node;
+		return;
+	}
+
+	// Median split along the widest axis of the centres, rounded so the left leaves stay whole SIMD batches
+	glm::vec3 extent = centre_max - centre_min;
+	int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+
+	uint32_t left_count = (count / 2 + SCENE_SIMD_WIDTH - 1) / SCENE_SIMD_WIDTH * SCENE_SIMD_WIDTH;
+	if (left_count >= count) {
+		left_count = count / 2;
+	}
+
+	std::nth_element(order.begin() + first, order.begin() + first + left_count, order.begin() + first + count, [&](uint32_t a, uint32_t b) {
+		return centres[a][axis] < centres[b][axis];
+	});
+
+	node.left = (uint32_t)_nodes.size();
+	_nodes[nodeIndex] = node;
+
+	// Children go in as a pair; _nodes may reallocate, so nothing holds a reference across the recursion
+	_nodes.push_back(BvhNode());
+	_nodes.push_back(BvhNode());
+
+	_BuildNode(node.left, first, left_count, order, centres);
+	_BuildNode(node.left + 1, first + left_count, count - left_count, order, centres);
+}
+
+Scene::Containment Scene::_Classify(const Frustum & frustum, const BvhNode & node) const {
+	Containment result = INSIDE;
+
+	for (const auto & plane : frustum.planes) {
+		// Corner farthest along the plane normal, and the one nearest to it
+		glm::vec3 positive(plane.x >= 0.0f ? node.boundsMax.x : node.boundsMin.x, plane.y >= 0.0f ? node.boundsMax.y : node.boundsMin.y, plane.z >= 0.0f ? node.boundsMax.z : node.boundsMin.z);
+		glm::vec3 negative(plane.x >= 0.0f ? node.boundsMin.x : node.boundsMax.x, plane.y >= 0.0f ? node.boundsMin.y : node.boundsMax.y, plane.z >= 0.0f ? node.boundsMin.z : node.boundsMax.z);
+
+		if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f) {
+			return OUTSIDE;
+		}
+		if (glm::dot(glm::vec3(plane), negative) + plane.w < 0.0f) {
+			result = INTERSECTING;
+		}
+	}
+
+	return result;
+}
+
+void Scene::_GatherTasks(const Frustum & frustum, uint32_t nodeIndex, uint32_t depth, uint32_t taskDepth, std::vector<uint32_t> & tasks, std::vector<uint32_t> & visible) const {
+	const BvhNode & node = _nodes[nodeIndex];
+
+	Containment containment = _Classify(frustum, node);
+	if (containment == OUTSIDE) {
+		return;
+	}
+	if (containment == INSIDE) {
+		_AcceptRange(node.first, node.count, visible);
+		return;
+	}
+
+	if (node.left == 0 || depth == taskDepth) {
+		tasks.push_back(nodeIndex);
+		return;
+	}
+
+	_GatherTasks(frustum, node.left, depth + 1, taskDepth, tasks, visible);
+	_GatherTasks(frustum, node.left + 1, depth + 1, taskDepth, tasks, visible);
+}
+
+void Scene::_CullNode(const Frustum & frustum, uint32_t nodeIndex, std::vector<uint32_t> & visible) const {
+	const BvhNode & node = _nodes[nodeIndex];
+
+	Containment containment = _Classify(frustum, node);
+	if (containment == OUTSIDE) {
+		return;
+	}
+	if (containment == INSIDE) {
+		_AcceptRange(node.first, node.count, visible);
+		return;
+	}
+
+	if (node.left == 0) {
+		_CullRange(frustum, node.first, node.count, visible);
+		return;
+	}
+
+	_CullNode(frustum, node.left, visible);
+	_CullNode(frustum, node.left + 1, visible);
+}
+
+void Scene::_CullRange(const Frustum & frustum, uint32_t first, uint32_t count, std::vector<uint32_t> & visible) const {
+	uint32_t i = 0;
+
+#if SCENE_SIMD_AVX
+	// Eight spheres against all six planes per iteration
+	__m256 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+	for (int p = 0; p < 6; p++) {
+		plane_x[p] = _mm256_set1_ps(frustum.planes[p].x);
+		plane_y[p] = _mm256_set1_ps(frustum.planes[p].y);
+		plane_z[p] = _mm256_set1_ps(frustum.planes[p].z);
+		plane_w[p] = _mm256_set1_ps(frustum.planes[p].w);
+	}
+
+	for (; i + 8 <= count; i += 8) {
+		uint32_t offset = first + i;
+		__m256 x = _mm256_loadu_ps(&_centre_x[offset]);
+		__m256 y = _mm256_loadu_ps(&_centre_y[offset]);
+		__m256 z = _mm256_loadu_ps(&_centre_z[offset]);
+		__m256 negative_radius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&_radius[offset]));
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; p++) {
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(plane_x[p], x), _mm256_mul_ps(plane_y[p], y)), _mm256_add_ps(_mm256_mul_ps(plane_z[p], z), plane_w[p]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negative_radius, _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		for (int bit = 0; mask != 0; bit++, mask >>= 1) {
+			if (mask & 1) {
+				visible.push_back(_ids[offset + bit]);
+			}
+		}
+	}
+#elif SCENE_SIMD_SSE
+	// Eight spheres against all six planes per iteration, as two groups of four so a leaf takes as many steps as with AVX.
+	// The project doesn't build with /arch:AVX, so this is the path the x64 build takes
+	__m128 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+	for (int p = 0; p < 6; p++) {
+		plane_x[p] = _mm_set1_ps(frustum.planes[p].x);
+		plane_y[p] = _mm_set1_ps(frustum.planes[p].y);
+		plane_z[p] = _mm_set1_ps(frustum.planes[p].z);
+		plane_w[p] = _mm_set1_ps(frustum.planes[p].w);
+	}
+
+	for (; i + 8 <= count; i += 8) {
+		uint32_t offset = first + i;
+		__m128 x_low = _mm_loadu_ps(&_centre_x[offset]);
+		__m128 y_low = _mm_loadu_ps(&_centre_y[offset]);
+		__m128 z_low = _mm_loadu_ps(&_centre_z[offset]);
+		__m128 negative_radius_low = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&_radius[offset]));
+		__m128 x_high = _mm_loadu_ps(&_centre_x[offset + 4]);
+		__m128 y_high = _mm_loadu_ps(&_centre_y[offset + 4]);
+		__m128 z_high = _mm_loadu_ps(&_centre_z[offset + 4]);
+		__m128 negative_radius_high = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&_radius[offset + 4]));
+
+		// The two groups are independent, interleaving them hides the multiply and add latency
+		__m128 inside_low = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		__m128 inside_high = inside_low;
+		for (int p = 0; p < 6; p++) {
+			__m128 distance_low = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x[p], x_low), _mm_mul_ps(plane_y[p], y_low)), _mm_add_ps(_mm_mul_ps(plane_z[p], z_low), plane_w[p]));
+			__m128 distance_high = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x[p], x_high), _mm_mul_ps(plane_y[p], y_high)), _mm_add_ps(_mm_mul_ps(plane_z[p], z_high), plane_w[p]));
+			inside_low = _mm_and_ps(inside_low, _mm_cmpge_ps(distance_low, negative_radius_low));
+			inside_high = _mm_and_ps(inside_high, _mm_cmpge_ps(distance_high, negative_radius_high));
+		}
+
+		int mask = _mm_movemask_ps(inside_low) | (_mm_movemask_ps(inside_high) << 4);
+		for (int bit = 0; mask != 0; bit++, mask >>= 1) {
+			if (mask & 1) {
+				visible.push_back(_ids[offset + bit]);
+			}
+		}
+	}
+#endif
+
+	// Remainder, or everything without SIMD
+	for (; i < count; i++) {
+		uint32_t offset = first + i;
+		if (frustum.intersectsSphere(glm::vec3(_centre_x[offset], _centre_y[offset], _centre_z[offset]), _radius[offset])) {
+			visible.push_back(_ids[offset]);
+		}
+	}
+}
+
+void Scene::_AcceptRange(uint32_t first, uint32_t count, std::vector<uint32_t> & visible) const {
+	visible.insert(visible.end(), _ids.begin() + first, _ids.begin() + first + count);
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* Scene.h | Object bounds in SoA layout with a BVH for CPU culling
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Frustum.h"
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+class TaskScheduler;
+
+const uint32_t BVH_LEAF_SIZE = 32; // Multiple of the SIMD batch width
+const uint32_t SCENE_SIMD_WIDTH = 8;
+
+// Bounding spheres of scene objects, stored as separate x/y/z/radius arrays so eight can be
+// tested against a plane at once. build() sorts them into the leaves of a BVH; cull() walks it,
+// skipping subtrees outside the frustum, accepting those inside and SIMD testing the rest.
+class Scene {
+public:
+	Scene();
+	~Scene();
+
+	// Returns the id handed back by cull()
+	uint32_t addObject(const glm::vec4 & boundingSphere);
+	void clear();
+
+	// Must be called after adding objects and before culling
+	void build();
+
+	// Subtrees are culled in parallel on the scheduler when one is given
+	void cull(const glm::mat4 & viewProjection, std::vector<uint32_t> & visible, TaskScheduler * scheduler = nullptr) const;
+	// Tests every object one at a time, for reference and benchmarking
+	void cullBruteForce(const glm::mat4 & viewProjection, std::vector<uint32_t> & visible) const;
+
+	const uint32_t getObjectCount() const;
+	const uint32_t getNodeCount() const;
+
+private:
+	struct BvhNode {
+		glm::vec3 boundsMin;
+		uint32_t first; // Objects under a node are contiguous
+		glm::vec3 boundsMax;
+		uint32_t count;
+		uint32_t left; // Right child is left + 1. 0 for a leaf, the root is never a child
+	};
+
+	enum Containment { OUTSIDE, INTERSECTING, INSIDE };
+
+	void _BuildNode(uint32_t nodeIndex, uint32_t first, uint32_t count, std::vector<uint32_t> & order, const std::vector<glm::vec3> & centres);
+	Containment _Classify(const Frustum & frustum, const BvhNode & node) const;
+
+	// Splits the tree into independent subtrees for the scheduler, handling the rest on the calling thread
+	void _GatherTasks(const Frustum & frustum, uint32_t nodeIndex, uint32_t depth, uint32_t taskDepth, std::vector<uint32_t> & tasks, std::vector<uint32_t> & visible) const;
+	void _CullNode(const Frustum & frustum, uint32_t nodeIndex, std::vector<uint32_t> & visible) const;
+	void _CullRange(const Frustum & frustum, uint32_t first, uint32_t count, std::vector<uint32_t> & visible) const;
+	void _AcceptRange(uint32_t first, uint32_t count, std::vector<uint32_t> & visible) const;
+
+	// SoA, in BVH leaf order once built
+	std::vector<float> _centre_x;
+	std::vector<float> _centre_y;
+	std::vector<float> _centre_z;
+	std::vector<float> _radius;
+	std::vector<uint32_t> _ids;
+
+	std::vector<BvhNode> _nodes;
+	bool _built = false;
+
+	// Scratch for threaded culls, kept between calls. cull() is const but not reentrant
+	mutable std::vector<uint32_t> _tasks;
+	mutable std::vector<std::vector<uint32_t>> _task_results;
+};
\ No newline at end of file
@@ -0,0 +1,78 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* SpscQueue.h | Lock free single producer, single consumer ring
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+
+#include <atomic>
+#include <cstdint>
+
+// Fixed size ring between exactly one producer thread and one consumer thread. Each side only ever writes its own
+// index, so neither push nor pop can block or spin on the other.
+template<typename T, uint32_t Capacity>
+class SpscQueue {
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+	SpscQueue() {
+		_head = 0;
+		_tail = 0;
+	}
+
+	// Producer only. False when full, the item is not queued
+	bool push(const T & item) {
+		uint32_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _head.load(std::memory_order_acquire) == Capacity) {
+			return false;
+		}
+
+		_items[tail & (Capacity - 1)] = item;
+		_tail.store(tail + 1, std::memory_order_release); // Publishes the item to the consumer
+		return true;
+	}
+
+	// Consumer only. Oldest first, false when empty
+	NODISCARD bool pop(T & item) {
+		uint32_t head = _head.load(std::memory_order_relaxed);
+		if (head == _tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+
+		item = _items[head & (Capacity - 1)];
+		_head.store(head + 1, std::memory_order_release); // Hands the slot back to the producer
+		return true;
+	}
+
+	// Approximate unless called from the consumer
+	const bool empty() const {
+		return _head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_relaxed);
+	}
+
+private:
+	SpscQueue(const SpscQueue &);
+
+	// Indices run freely and wrap, only their difference matters.
+	// Padded onto separate cache lines, the consumer writes one and the producer the other
+	std::atomic<uint32_t> _head;
+	char _head_padding[64 - sizeof(std::atomic<uint32_t>)];
+	std::atomic<uint32_t> _tail;
+	char _tail_padding[64 - sizeof(std::atomic<uint32_t>)];
+
+	T _items[Capacity];
+};
\ No newline at end of file
@@ -0,0 +1,281 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* StagingUploader.cpp | Uploads through a bounded, persistently mapped staging ring
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "StagingUploader.h"
+#include "util.h"
+#include "QueueTimeline.h"
+#include "DeletionQueue.h"
+
+#include <algorithm>
+#include <cstring>
+#include <assert.h>
+
+StagingUploader::StagingUploader(Renderer * renderer, VkDeviceSize budget) {
+	_renderer = renderer;
+	_chunk_size = budget / STAGING_CHUNK_COUNT;
+	assert(_chunk_size >= 64);
+
+	VkDevice device = _renderer->getDevice();
+
+	VkCommandPoolCreateInfo command_pool_create_info = vkStruct<VkCommandPoolCreateInfo>();
+	command_pool_create_info.queueFamilyIndex = _renderer->getGraphicsFamilyIndex();
+	command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	ErrorCheck(vkCreateCommandPool(device, &command_pool_create_info, nullptr, &_command_pool));
+
+	_renderer->createBuffer(_chunk_size * STAGING_CHUNK_COUNT, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _staging_buffer, _staging_buffer_memory);
+
+	// Stays mapped for the lifetime of the uploader
+	void * data;
+	ErrorCheck(vkMapMemory(device, _staging_buffer_memory, 0, _chunk_size * STAGING_CHUNK_COUNT, 0, &data));
+	_staging_data = (char *)data;
+
+	std::vector<VkCommandBuffer> command_buffers(STAGING_CHUNK_COUNT);
+
+	VkCommandBufferAllocateInfo command_buffer_allocate_info = vkStruct<VkCommandBufferAllocateInfo>();
+	command_buffer_allocate_info.commandPool = _command_pool;
+	command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	command_buffer_allocate_info.commandBufferCount = STAGING_CHUNK_COUNT;
+
+	ErrorCheck(vkAllocateCommandBuffers(device, &command_buffer_allocate_info, command_buffers.data()));
+
+	_chunks.resize(STAGING_CHUNK_COUNT);
+	for (uint32_t i = 0; i < STAGING_CHUNK_COUNT; i++) {
+		_chunks[i].commandBuffer = command_buffers[i];
+		_chunks[i].submission = 0; // Already reached, so the first use of each chunk does not wait
+		_chunks[i].used = 0;
+		_chunks[i].recording = false;
+	}
+}
+
+StagingUploader::~StagingUploader() {
+	flush();
+
+	VkDevice device = _renderer->getDevice();
+
+	for (auto & chunk : _chunks) {
+		vkFreeCommandBuffers(device, _command_pool, 1, &chunk.commandBuffer);
+	}
+	_chunks.clear();
+
+	// Freeing the memory unmaps it
+	_staging_data = nullptr;
+
+	_renderer->getDeletionQueue()->destroyBuffer(_staging_buffer);
+	_staging_buffer = nullptr;
+	_renderer->getDeletionQueue()->freeMemory(_staging_buffer_memory);
+	_staging_buffer_memory = nullptr;
+	vkDestroyCommandPool(device, _command_pool, nullptr);
+	_command_pool = nullptr;
+}
+
+void StagingUploader::uploadBuffer(VkBuffer buffer, VkDeviceSize bufferOffset, const void * data, VkDeviceSize size) {
+	const char * source = (const char *)data;
+
+	while (size > 0) {
+		VkDeviceSize staging_offset;
+		VkDeviceSize copy_size = _Reserve(size, 4, 1, staging_offset);
+
+		memcpy(_staging_data + staging_offset, source, (size_t)copy_size);
+
+		VkBufferCopy copy_region {};
+		copy_region.srcOffset = staging_offset;
+		copy_region.dstOffset = bufferOffset;
+		copy_region.size = copy_size;
+
+		vkCmdCopyBuffer(_chunks[_current_chunk].commandBuffer, _staging_buffer, buffer, 1, &copy_region);
+
+		source += copy_size;
+		bufferOffset += copy_size;
+		size -= copy_size;
+	}
+}
+
+void StagingUploader::uploadBuffer(VkBuffer buffer, VkDeviceSize bufferOffset, const MappedFile & file, size_t fileOffset, VkDeviceSize size) {
+	assert(fileOffset + size <= file.getSize());
+
+	// Read ahead by a chunk so the disk works while the previous chunk is copied
+	file.prefetch(fileOffset, (size_t)std::min(size, _chunk_size));
+
+	while (size > 0) {
+		VkDeviceSize staging_offset;
+		VkDeviceSize copy_size = _Reserve(size, 4, 1, staging_offset);
+
+		file.prefetch(fileOffset + (size_t)copy_size, (size_t)std::min(size - copy_size, _chunk_size));
+
+		memcpy(_staging_data + staging_offset, file.getData() + fileOffset, (size_t)copy_size);
+		file.release(fileOffset, (size_t)copy_size);
+
+		VkBufferCopy copy_region {};
+		copy_region.srcOffset = staging_offset;
+		copy_region.dstOffset = bufferOffset;
+		copy_region.size = copy_size;
+
+		vkCmdCopyBuffer(_chunks[_current_chunk].commandBuffer, _staging_buffer, buffer, 1, &copy_region);
+
+		fileOffset += (size_t)copy_size;
+		bufferOffset += copy_size;
+		size -= copy_size;
+	}
+}
+
+void StagingUploader::uploadImage(VkImage image, uint32_t width, uint32_t height, uint32_t texelSize, const void * data) {
+	const char * source = (const char *)data;
+	VkDeviceSize row_size = (VkDeviceSize)width * texelSize;
+
+	// bufferOffset must be a multiple of both 4 and the texel size
+	VkDeviceSize alignment = (texelSize % 4 == 0) ? texelSize : texelSize * 4;
+
+	VkBufferImageCopy region {};
+	region.bufferRowLength = 0; // Tightly packed
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent.depth = 1;
+
+	if (row_size + alignment <= _chunk_size) {
+		// Whole rows at a time, as many as fit in the chunk
+		uint32_t row = 0;
+		while (row < height) {
+			VkDeviceSize staging_offset;
+			VkDeviceSize copy_size = _Reserve((height - row) * row_size, alignment, row_size, staging_offset);
+			uint32_t row_count = (uint32_t)(copy_size / row_size);
+
+			memcpy(_staging_data + staging_offset, source + row * row_size, (size_t)(row_count * row_size));
+
+			region.bufferOffset = staging_offset;
+			region.imageOffset = { 0, (int32_t)row, 0 };
+			region.imageExtent.width = width;
+			region.imageExtent.height = row_count;
+
+			vkCmdCopyBufferToImage(_chunks[_current_chunk].commandBuffer, _staging_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+			row += row_count;
+		}
+	}
+	else {
+		// A single row is larger than a chunk, split each row into spans
+		for (uint32_t row = 0; row < height; row++) {
+			uint32_t x = 0;
+			while (x < width) {
+				VkDeviceSize staging_offset;
+				VkDeviceSize copy_size = _Reserve((VkDeviceSize)(width - x) * texelSize, alignment, texelSize, staging_offset);
+				uint32_t texel_count = (uint32_t)(copy_size / texelSize);
+
+				memcpy(_staging_data + staging_offset, source + row * row_size + x * texelSize, (size_t)texel_count * texelSize);
+
+				region.bufferOffset = staging_offset;
+				region.imageOffset = { (int32_t)x, (int32_t)row, 0 };
+				region.imageExtent.width = texel_count;
+				region.imageExtent.height = 1;
+
+				vkCmdCopyBufferToImage(_chunks[_current_chunk].commandBuffer, _staging_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+				x += texel_count;
+			}
+		}
+	}
+}
+
+void StagingUploader::transitionImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
+	if (!_chunks[_current_chunk].recording) {
+		_BeginChunk();
+	}
+
+	_renderer->recordImageLayoutTransition(_chunks[_current_chunk].commandBuffer, image, oldLayout, newLayout, mipLevels);
+}
+
+void StagingUploader::flush() {
+	_renderer->getQueueTimeline()->wait(submit());
+}
+
+uint64_t StagingUploader::submit() {
+	if (_chunks[_current_chunk].recording) {
+		_SubmitChunk();
+	}
+
+	// Chunks are submitted in order, so the last one covers the rest
+	return _last_submission;
+}
+
+const VkDeviceSize StagingUploader::getBudget() const {
+	return _chunk_size * STAGING_CHUNK_COUNT;
+}
+
+VkDeviceSize StagingUploader::_Reserve(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize minimum, VkDeviceSize & stagingOffset) {
+	if (!_chunks[_current_chunk].recording) {
+		_BeginChunk();
+	}
+
+	// Alignment applies to the offset into the whole staging buffer
+	VkDeviceSize chunk_start = _current_chunk * _chunk_size;
+	VkDeviceSize offset = (chunk_start + _chunks[_current_chunk].used + alignment - 1) / alignment * alignment - chunk_start;
+
+	// Not enough room left, hand the chunk to the GPU and move on to the next
+	if (offset + minimum > _chunk_size) {
+		_SubmitChunk();
+		_BeginChunk();
+
+		chunk_start = _current_chunk * _chunk_size;
+		offset = (chunk_start + alignment - 1) / alignment * alignment - chunk_start;
+		assert(offset + minimum <= _chunk_size);
+	}
+
+	VkDeviceSize reserved = std::min(size, _chunk_size - offset);
+	reserved -= reserved % minimum; // Callers copy whole rows or texels
+
+	_chunks[_current_chunk].used = offset + reserved;
+	stagingOffset = chunk_start + offset;
+
+	return reserved;
+}
+
+void StagingUploader::_BeginChunk() {
+	Chunk & chunk = _chunks[_current_chunk];
+
+	// The GPU may still be reading this chunk from its last submission
+	_renderer->getQueueTimeline()->wait(chunk.submission);
+
+	ErrorCheck(vkResetCommandBuffer(chunk.commandBuffer, 0));
+
+	VkCommandBufferBeginInfo begin_info = vkStruct<VkCommandBufferBeginInfo>();
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	ErrorCheck(vkBeginCommandBuffer(chunk.commandBuffer, &begin_info));
+
+	chunk.used = 0;
+	chunk.recording = true;
+}
+
+void StagingUploader::_SubmitChunk() {
+	Chunk & chunk = _chunks[_current_chunk];
+
+	ErrorCheck(vkEndCommandBuffer(chunk.commandBuffer));
+
+	TimelineSubmitInfo submit_info {};
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &chunk.commandBuffer;
+
+	chunk.submission = _renderer->getQueueTimeline()->submit(submit_info);
+	_last_submission = chunk.submission;
+
+	chunk.recording = false;
+	_current_chunk = (_current_chunk + 1) % STAGING_CHUNK_COUNT;
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* StagingUploader.h | Uploads through a bounded, persistently mapped staging ring
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Renderer.h"
+#include "MappedFile.h"
+
+#include <vector>
+
+const VkDeviceSize DEFAULT_STAGING_BUDGET = 16 * 1024 * 1024;
+const uint32_t STAGING_CHUNK_COUNT = 4;
+
+// Streams data of any size to device local buffers and images through a fixed amount of staging memory.
+// The staging buffer is split into chunks, each with its own command buffer. Copies are recorded into the current
+// chunk until it fills, then it is submitted and the next chunk is reused once the queue timeline passes its last
+// submission, so the CPU fills one chunk while the GPU drains the others.
+// Uploads are complete only after flush(). Images must be in TRANSFER_DST_OPTIMAL while uploads are in flight.
+class StagingUploader {
+public:
+	StagingUploader(Renderer * renderer, VkDeviceSize budget = DEFAULT_STAGING_BUDGET);
+	~StagingUploader();
+
+	void uploadBuffer(VkBuffer buffer, VkDeviceSize bufferOffset, const void * data, VkDeviceSize size);
+	// Copies straight out of the mapping and releases the file pages behind the copy
+	void uploadBuffer(VkBuffer buffer, VkDeviceSize bufferOffset, const MappedFile & file, size_t fileOffset, VkDeviceSize size);
+	// Tightly packed texels for mip level 0
+	void uploadImage(VkImage image, uint32_t width, uint32_t height, uint32_t texelSize, const void * data);
+	// Recorded in order with the copies, so a layout change costs no submission of its own
+	void transitionImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1);
+
+	// Submits pending copies and waits for all of them
+	void flush();
+	// Submits pending copies without waiting. The uploads are complete once the queue timeline reaches the result
+	NODISCARD uint64_t submit();
+
+	const VkDeviceSize getBudget() const;
+
+private:
+	struct Chunk {
+		VkCommandBuffer commandBuffer;
+		uint64_t submission; // Timeline value of the last submit, 0 before the first
+		VkDeviceSize used;
+		bool recording;
+	};
+
+	// Reserves up to size bytes, at least minimum, in the current chunk. Returns the amount reserved
+	VkDeviceSize _Reserve(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize minimum, VkDeviceSize & stagingOffset);
+	void _BeginChunk();
+	void _SubmitChunk();
+
+	Renderer * _renderer = nullptr;
+
+	VkCommandPool _command_pool = VK_NULL_HANDLE;
+	VkBuffer _staging_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory _staging_buffer_memory = VK_NULL_HANDLE;
+	char * _staging_data = nullptr;
+
+	VkDeviceSize _chunk_size = 0;
+	std::vector<Chunk> _chunks;
+	uint32_t _current_chunk = 0;
+	uint64_t _last_submission = 0;
+};
\ No newline at end of file
@@ -0,0 +1,321 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* TaskScheduler.cpp | Work-stealing task scheduler shared by the engine
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "TaskScheduler.h"
+#include "Platform.h"
+
+#include <algorithm>
+#include <assert.h>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// TaskGroup
+TaskGroup::TaskGroup() {
+	_pending = 0;
+	_failed = false;
+}
+
+const bool TaskGroup::isFinished() const {
+	return _pending.load(std::memory_order_acquire) == 0;
+}
+
+// TaskScheduler
+TaskScheduler::TaskScheduler(uint32_t workerCount, bool pinWorkers) {
+	uint32_t core_count = std::max(std::thread::hardware_concurrency(), 1u);
+	if (workerCount == 0) {
+		workerCount = std::max(core_count, 2u) - 1;
+	}
+
+	_queued_count = 0;
+	_sleeping_count = 0;
+
+	for (uint32_t i = 0; i <= workerCount; i++) {
+		Worker * worker = new Worker();
+		worker->random = i * 0x9E3779B9u + 1;
+		_workers.push_back(worker);
+	}
+	_workers[0]->id = std::this_thread::get_id();
+
+	// Workers wait on the lock until every id is known, so getThreadIndex() never sees a half built list
+	std::lock_guard<std::mutex> lock(_sleep_mutex);
+	for (uint32_t i = 1; i <= workerCount; i++) {
+		_workers[i]->thread = std::thread(&TaskScheduler::_WorkerThread, this, i);
+		_workers[i]->id = _workers[i]->thread.get_id();
+
+		// Core 0 is left to the creating thread
+		if (pinWorkers) {
+			_PinThread(_workers[i]->thread, i % core_count);
+		}
+	}
+}
+
+TaskScheduler::~TaskScheduler() {
+	{
+		std::lock_guard<std::mutex> lock(_sleep_mutex);
+		_exit = true;
+	}
+	_sleep_condition.notify_all();
+
+	// Every group must have been waited on, there is nothing left to run
+	for (uint32_t i = 1; i < _workers.size(); i++) {
+		_workers[i]->thread.join();
+	}
+	for (auto worker : _workers) {
+		delete worker;
+	}
+	_workers.clear();
+}
+
+void TaskScheduler::run(TaskGroup & group, const std::function<void()> & work) {
+	FunctionTask * task = new FunctionTask();
+	task->owned = true;
+	task->work = work;
+
+	_Spawn(group, task);
+}
+
+void TaskScheduler::wait(TaskGroup & group) {
+	uint32_t index = getThreadIndex();
+
+	while (!group.isFinished()) {
+		Task * task = _FindTask(index);
+		if (task != nullptr) {
+			_Execute(task);
+		}
+		else {
+			std::this_thread::yield();
+		}
+	}
+
+	if (group._failed) {
+		std::exception_ptr exception = group._exception;
+		group._exception = nullptr;
+		group._failed = false;
+
+		std::rethrow_exception(exception);
+	}
+}
+
+bool TaskScheduler::runPendingTask() {
+	Task * task = _FindTask(getThreadIndex());
+	if (task == nullptr) {
+		return false;
+	}
+
+	_Execute(task);
+	return true;
+}
+
+const uint32_t TaskScheduler::getWorkerCount() const {
+	return (uint32_t)_workers.size() - 1;
+}
+
+const uint32_t TaskScheduler::getThreadIndex() const {
+	std::thread::id id = std::this_thread::get_id();
+	for (uint32_t i = 0; i < _workers.size(); i++) {
+		if (_workers[i]->id == id) {
+			return i;
+		}
+	}
+	return NO_THREAD_INDEX;
+}
+
+void TaskScheduler::_WorkerThread(uint32_t index) {
+	{
+		std::lock_guard<std::mutex> lock(_sleep_mutex);
+	}
+
+	while (true) {
+		Task * task = _FindTask(index);
+		if (task != nullptr) {
+			_Execute(task);
+			continue;
+		}
+
+		// Counted as sleeping before checking for work, so a push either sees us or we see it
+		std::unique_lock<std::mutex> lock(_sleep_mutex);
+		_sleeping_count++;
+		_sleep_condition.wait(lock, [this]() {
+			return _exit || _queued_count > 0;
+		});
+		_sleeping_count--;
+
+		if (_exit) {
+			return;
+		}
+	}
+}
+
+void TaskScheduler::_Spawn(TaskGroup & group, Task * task) {
+	task->group = &group;
+
+	group._pending++;
+	_queued_count++; // Before the push, so the count never runs behind what can be taken
+
+	uint32_t index = getThreadIndex();
+	if (index != NO_THREAD_INDEX) {
+		_workers[index]->tasks.push(task);
+	}
+	else {
+		std::lock_guard<std::mutex> lock(_injected_mutex);
+		_injected.push_back(task);
+	}
+
+	_Notify();
+}
+
+TaskScheduler::Task * TaskScheduler::_FindTask(uint32_t index) {
+	if (_queued_count == 0) {
+		return nullptr;
+	}
+
+	// Newest from our own deque, it is the most likely to still be in cache
+	Task * task = nullptr;
+	if (index != NO_THREAD_INDEX) {
+		task = _workers[index]->tasks.pop();
+	}
+
+	if (task == nullptr) {
+		std::lock_guard<std::mutex> lock(_injected_mutex);
+		if (!_injected.empty()) {
+			task = _injected.front();
+			_injected.pop_front();
+		}
+	}
+
+	// Oldest from someone else's, it is the most likely to spawn more work. Random victims keep thieves apart
+	if (task == nullptr) {
+		uint32_t start = 0;
+		if (index != NO_THREAD_INDEX) {
+			uint32_t & random = _workers[index]->random;
+			random ^= random << 13;
+			random ^= random >> 17;
+			random ^= random << 5;
+			start = random;
+		}
+
+		for (uint32_t i = 0; i < _workers.size() && task == nullptr; i++) {
+			uint32_t victim = (start + i) % _workers.size();
+			if (victim != index) {
+				task = _workers[victim]->tasks.steal();
+			}
+		}
+	}
+
+	if (task != nullptr) {
+		_queued_count--;
+	}
+
+	return task;
+}
+
+void TaskScheduler::_Execute(Task * task) {
+	TaskGroup * group = task->group;
+
+	try {
+		task->execute();
+	}
+	catch (...) {
+		bool failed = false;
+		if (group->_failed.compare_exchange_strong(failed, true)) {
+			group->_exception = std::current_exception();
+		}
+	}
+
+	if (task->owned) {
+		delete task;
+	}
+
+	// Last touch of the group, a waiter may destroy it as soon as this lands
+	group->_pending.fetch_sub(1, std::memory_order_release);
+}
+
+void TaskScheduler::_Notify() {
+	// Taking the lock orders this after a sleeper's check, so the wake up cannot be lost
+	if (_sleeping_count > 0) {
+		{
+			std::lock_guard<std::mutex> lock(_sleep_mutex);
+		}
+		_sleep_condition.notify_one();
+	}
+}
+
+void TaskScheduler::_ParallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, const void * body, RangeFunction function) {
+	if (begin >= end) {
+		return;
+	}
+
+	_ParallelForRange(begin, end, std::max(grainSize, 1u), body, function);
+}
+
+void TaskScheduler::_ParallelForRange(uint32_t begin, uint32_t end, uint32_t grainSize, const void * body, RangeFunction function) {
+	if (end - begin <= grainSize) {
+		function(body, begin, end);
+		return;
+	}
+
+	// The upper half is offered to thieves while this thread carries on with the lower. The task lives on this
+	// stack frame, so nothing is allocated, and the frame cannot unwind before the upper half has finished
+	uint32_t middle = begin + (end - begin) / 2;
+
+	TaskGroup group;
+	RangeTask upper;
+	upper.scheduler = this;
+	upper.begin = middle;
+	upper.end = end;
+	upper.grainSize = grainSize;
+	upper.body = body;
+	upper.function = function;
+	_Spawn(group, &upper);
+
+	std::exception_ptr exception;
+	try {
+		_ParallelForRange(begin, middle, grainSize, body, function);
+	}
+	catch (...) {
+		exception = std::current_exception();
+	}
+
+	try {
+		wait(group);
+	}
+	catch (...) {
+		if (!exception) {
+			exception = std::current_exception();
+		}
+	}
+
+	if (exception) {
+		std::rethrow_exception(exception);
+	}
+}
+
+void TaskScheduler::_PinThread(std::thread & thread, uint32_t core) {
+#if defined(_WIN32)
+	SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << core);
+#else
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	CPU_SET(core, &cpu_set);
+	pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpu_set);
+#endif
+}
\ No newline at end of file
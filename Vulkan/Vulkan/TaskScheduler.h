@@ -0,0 +1,139 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* TaskScheduler.h | Work-stealing task scheduler shared by the engine
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "WorkStealingDeque.h"
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+
+const uint32_t NO_THREAD_INDEX = UINT32_MAX;
+
+// Tasks run through a group, which tracks how many are unfinished and the first exception any of them threw.
+// A group may be reused once it has been waited on
+class TaskGroup {
+public:
+	TaskGroup();
+
+	const bool isFinished() const;
+
+private:
+	friend class TaskScheduler;
+
+	std::atomic<uint32_t> _pending;
+	std::atomic<bool> _failed;
+	std::exception_ptr _exception; // Written once, by the first task to fail
+};
+
+// A pool of worker threads, each owning a lock-free deque. Tasks spawned on a pool thread go on its own deque,
+// where it takes the newest first; idle threads steal the oldest from a random victim. The thread that creates
+// the scheduler owns a deque too and works through it while waiting, so it is a worker whenever it blocks.
+// Other threads hand their tasks in through a locked queue.
+class TaskScheduler {
+public:
+	TaskScheduler(uint32_t workerCount = 0, bool pinWorkers = false); // Zero uses one worker per core besides the creating thread
+	~TaskScheduler();
+
+	// Allocates the task on the heap, parallelFor() does not
+	void run(TaskGroup & group, const std::function<void()> & work);
+	// Runs tasks until the group is finished, then rethrows the first exception from it
+	void wait(TaskGroup & group);
+	// Runs one queued task on the calling thread, returns false if there was none
+	bool runPendingTask();
+
+	// Calls body(first, last) on subranges of [begin, end) no larger than grainSize. The range is split in half
+	// recursively, so a thief takes a large piece and splits it further on its own deque
+	template<typename Function>
+	void parallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, const Function & body) {
+		_ParallelFor(begin, end, grainSize, &body, &TaskScheduler::_InvokeRange<Function>);
+	}
+
+	// Threads in the pool, not counting the one that created it
+	const uint32_t getWorkerCount() const;
+	// Index of the calling thread in [0, getWorkerCount()], the creating thread is 0. NO_THREAD_INDEX outside the pool
+	const uint32_t getThreadIndex() const;
+
+private:
+	typedef void (*RangeFunction)(const void * body, uint32_t begin, uint32_t end);
+
+	struct Task {
+		TaskGroup * group = nullptr;
+		bool owned = false; // Deleted once run, otherwise it lives on the stack of whoever waits on the group
+
+		virtual ~Task() {}
+		virtual void execute() = 0;
+	};
+
+	struct FunctionTask : Task {
+		std::function<void()> work;
+
+		void execute() { work(); }
+	};
+
+	struct RangeTask : Task {
+		TaskScheduler * scheduler;
+		uint32_t begin;
+		uint32_t end;
+		uint32_t grainSize;
+		const void * body;
+		RangeFunction function;
+
+		void execute() { scheduler->_ParallelForRange(begin, end, grainSize, body, function); }
+	};
+
+	struct Worker {
+		std::thread thread;
+		std::thread::id id;
+		WorkStealingDeque<Task> tasks;
+		uint32_t random; // Victim selection, owner only
+	};
+
+	void _WorkerThread(uint32_t index);
+	void _Spawn(TaskGroup & group, Task * task);
+	Task * _FindTask(uint32_t index);
+	void _Execute(Task * task);
+	void _Notify();
+	void _ParallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, const void * body, RangeFunction function);
+	void _ParallelForRange(uint32_t begin, uint32_t end, uint32_t grainSize, const void * body, RangeFunction function);
+
+	template<typename Function>
+	static void _InvokeRange(const void * body, uint32_t begin, uint32_t end) {
+		(*(const Function *)body)(begin, end);
+	}
+
+	static void _PinThread(std::thread & thread, uint32_t core);
+
+	std::vector<Worker *> _workers; // The first belongs to the creating thread
+
+	std::mutex _injected_mutex;
+	std::deque<Task *> _injected; // From threads outside the pool
+
+	std::atomic<uint32_t> _queued_count; // Pushed but not yet taken, anywhere
+	std::atomic<uint32_t> _sleeping_count;
+	std::mutex _sleep_mutex;
+	std::condition_variable _sleep_condition;
+	bool _exit = false;
+};
\ No newline at end of file
@@ -0,0 +1,177 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* TextureTable.cpp | Bindless table of textures indexed from push constants
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TextureTable.h"
+#include "util.h"
+
+#include <assert.h>
+#include <stdexcept>
+
+TextureTable::TextureTable(VkDevice device, uint32_t size, bool descriptorIndexing) {
+	_device = device;
+	_size = size;
+	_descriptor_indexing = descriptorIndexing;
+
+	_slots.resize(_size, VkDescriptorImageInfo {});
+	_dirty.resize(_size, false);
+
+	// Hand out the lowest slots first
+	_free_slots.reserve(_size);
+	for (uint32_t i = _size; i > 0; i--) {
+		_free_slots.push_back(i - 1);
+	}
+}
+
+TextureTable::~TextureTable() {
+	// The table only references views and samplers, their owners destroy them
+}
+
+uint32_t TextureTable::registerTexture(VkImageView imageView, VkSampler sampler) {
+	if (_free_slots.empty()) {
+		throw std::runtime_error("Texture table is full");
+	}
+
+	uint32_t slot = _free_slots.back();
+	_free_slots.pop_back();
+
+	updateTexture(slot, imageView, sampler);
+
+	return slot;
+}
+
+void TextureTable::updateTexture(uint32_t slot, VkImageView imageView, VkSampler sampler) {
+	assert(slot < _size);
+
+	_slots[slot].imageView = imageView;
+	_slots[slot].sampler = sampler;
+	_slots[slot].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	_dirty[slot] = true;
+	_any_dirty = true;
+}
+
+void TextureTable::releaseTexture(uint32_t slot) {
+	assert(slot < _size);
+
+	_slots[slot] = VkDescriptorImageInfo {};
+	_free_slots.push_back(slot);
+
+	// A partially bound array can simply leave the slot stale, it is never indexed again
+	if (!_descriptor_indexing) {
+		_dirty[slot] = true;
+		_any_dirty = true;
+	}
+}
+
+void TextureTable::setDefaultTexture(VkImageView imageView, VkSampler sampler) {
+	_default_texture.imageView = imageView;
+	_default_texture.sampler = sampler;
+	_default_texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	if (_descriptor_indexing) {
+		return;
+	}
+
+	for (uint32_t i = 0; i < _size; i++) {
+		if (_slots[i].imageView == VK_NULL_HANDLE) {
+			_dirty[i] = true;
+			_any_dirty = true;
+		}
+	}
+}
+
+void TextureTable::flush(VkDescriptorSet descriptorSet, uint32_t binding) {
+	if (!_any_dirty) {
+		return;
+	}
+
+	std::vector<VkDescriptorImageInfo> image_infos(_size);
+	std::vector<VkWriteDescriptorSet> descriptor_writes;
+
+	// Empty slots can only be written once there is a default texture to point them at
+	auto writable = [&](uint32_t slot) {
+		return _dirty[slot] && (_slots[slot].imageView != VK_NULL_HANDLE || _default_texture.imageView != VK_NULL_HANDLE);
+	};
+
+	// Coalesce runs of dirty slots into one write each
+	uint32_t i = 0;
+	while (i < _size) {
+		if (!writable(i)) {
+			i++;
+			continue;
+		}
+
+		uint32_t first = i;
+		for (; i < _size && writable(i); i++) {
+			image_infos[i] = (_slots[i].imageView != VK_NULL_HANDLE) ? _slots[i] : _default_texture;
+			_dirty[i] = false;
+		}
+
+		VkWriteDescriptorSet descriptor_write = vkStruct<VkWriteDescriptorSet>();
+		descriptor_write.dstSet = descriptorSet;
+		descriptor_write.dstBinding = binding;
+		descriptor_write.dstArrayElement = first;
+		descriptor_write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptor_write.descriptorCount = i - first;
+		descriptor_write.pImageInfo = &image_infos[first];
+		descriptor_writes.push_back(descriptor_write);
+	}
+
+	_any_dirty = _default_texture.imageView == VK_NULL_HANDLE && !_descriptor_indexing;
+
+	if (!descriptor_writes.empty()) {
+		vkUpdateDescriptorSets(_device, (uint32_t)descriptor_writes.size(), descriptor_writes.data(), 0, nullptr);
+	}
+}
+
+const uint32_t TextureTable::getSize() const {
+	return _size;
+}
+
+VkDescriptorSetLayoutBinding TextureTable::getLayoutBinding(uint32_t binding) const {
+	VkDescriptorSetLayoutBinding layout_binding {};
+	layout_binding.binding = binding;
+	layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	layout_binding.descriptorCount = _size;
+	layout_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	layout_binding.pImmutableSamplers = nullptr;
+
+	return layout_binding;
+}
+
+const VkDescriptorSetLayoutCreateFlags TextureTable::getLayoutFlags() const {
+#ifdef VK_EXT_descriptor_indexing
+	if (_descriptor_indexing) {
+		return VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+	}
+#endif
+	return 0;
+}
+
+const VkDescriptorPoolCreateFlags TextureTable::getPoolFlags() const {
+#ifdef VK_EXT_descriptor_indexing
+	if (_descriptor_indexing) {
+		return VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+	}
+#endif
+	return 0;
+}
+
+const bool TextureTable::usesDescriptorIndexing() const {
+	return _descriptor_indexing;
+}
\ No newline at end of file
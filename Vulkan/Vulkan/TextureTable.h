@@ -0,0 +1,65 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* TextureTable.h | Bindless table of textures indexed from push constants
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+
+#include <vector>
+
+// Upper bound on the table size, matching the default of TEXTURE_TABLE_SIZE in the fragment shaders.
+// The Renderer clamps it to the device's sampler and sampled image limits and specializes the shaders to match
+const uint32_t MAX_TEXTURE_TABLE_SIZE = 128;
+const uint32_t INVALID_TEXTURE_SLOT = UINT32_MAX;
+
+// One COMBINED_IMAGE_SAMPLER array binding shared by every draw.
+// Textures get a stable slot for their lifetime; draws select one through DrawPushConstants::textureIndex.
+// With descriptor indexing the array is partially bound and updated after bind, otherwise empty slots
+// point at the default texture and writes must happen while the set is not in use.
+class TextureTable {
+public:
+	TextureTable(VkDevice device, uint32_t size, bool descriptorIndexing);
+	~TextureTable();
+
+	NODISCARD uint32_t registerTexture(VkImageView imageView, VkSampler sampler);
+	void updateTexture(uint32_t slot, VkImageView imageView, VkSampler sampler);
+	void releaseTexture(uint32_t slot);
+
+	void setDefaultTexture(VkImageView imageView, VkSampler sampler);
+
+	// Writes every slot changed since the last flush into the descriptor set
+	void flush(VkDescriptorSet descriptorSet, uint32_t binding);
+
+	const uint32_t getSize() const;
+	VkDescriptorSetLayoutBinding getLayoutBinding(uint32_t binding) const;
+	const VkDescriptorSetLayoutCreateFlags getLayoutFlags() const;
+	const VkDescriptorPoolCreateFlags getPoolFlags() const;
+	const bool usesDescriptorIndexing() const;
+
+private:
+	VkDevice _device = VK_NULL_HANDLE;
+	uint32_t _size = 0;
+	bool _descriptor_indexing = false;
+
+	std::vector<VkDescriptorImageInfo> _slots;
+	std::vector<uint32_t> _free_slots;
+	std::vector<bool> _dirty;
+	bool _any_dirty = false;
+
+	VkDescriptorImageInfo _default_texture = {};
+};
\ No newline at end of file
@@ -0,0 +1,657 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* VirtualTexture.cpp | Feedback driven virtual texture streamed from a pre-tiled file
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "VirtualTexture.h"
+#include "StagingUploader.h"
+#include "util.h"
+#include "LinearArena.h"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <assert.h>
+
+const uint32_t INVALID_PAGE = UINT32_MAX;
+const uint64_t PINNED_PAGE = UINT64_MAX; // lastUsed of pages that are never evicted
+const uint32_t PAGE_RESIDENT_BIT = 0x80000000;
+
+VirtualTexture::VirtualTexture(Renderer * renderer, const std::string & path, uint32_t frameCount, uint32_t cacheSize) : _file(path) {
+	_renderer = renderer;
+	_device = _renderer->getDevice();
+	_frame_count = frameCount;
+
+	// The cache is a single image, so it can be no larger than the device allows
+	_cache_size = std::min(cacheSize, _renderer->getPhysicalDeviceProperties().limits.maxImageDimension2D / VIRTUAL_PAGE_SIZE);
+
+	if (!_renderer->getPhysicalDeviceFeatures().fragmentStoresAndAtomics) {
+		throw std::runtime_error("Virtual texturing needs fragmentStoresAndAtomics for its feedback buffer");
+	}
+
+	if (_file.getSize() < sizeof(VirtualTextureHeader)) {
+		throw std::runtime_error("Not a virtual texture: " + path);
+	}
+	memcpy(&_header, _file.getData(), sizeof(VirtualTextureHeader));
+
+	_tile_bytes = (VkDeviceSize)VIRTUAL_PAGE_SIZE * VIRTUAL_PAGE_SIZE * 4;
+
+	if (_header.magic != VIRTUAL_TEXTURE_MAGIC || _header.version != VIRTUAL_TEXTURE_VERSION ||
+		_header.tileSize != VIRTUAL_TILE_SIZE || _header.border != VIRTUAL_PAGE_BORDER ||
+		_header.mipCount == 0 || _header.mipCount > MAX_VIRTUAL_TEXTURE_MIPS ||
+		_file.getSize() < sizeof(VirtualTextureHeader) + _header.pageCount * _tile_bytes) {
+		throw std::runtime_error("Unsupported virtual texture: " + path);
+	}
+
+	_info.width = _header.width;
+	_info.height = _header.height;
+	_info.tileSize = _header.tileSize;
+	_info.border = _header.border;
+	_info.mipCount = _header.mipCount;
+	_info.cacheSize = _cache_size;
+
+	uint32_t first_page = 0;
+	for (uint32_t mip = 0; mip < _header.mipCount; mip++) {
+		uint32_t mip_width = std::max(_header.width >> mip, 1u);
+		uint32_t mip_height = std::max(_header.height >> mip, 1u);
+
+		_info.mips[mip].firstPage = first_page;
+		_info.mips[mip].pagesX = (mip_width + _header.tileSize - 1) / _header.tileSize;
+		_info.mips[mip].pagesY = (mip_height + _header.tileSize - 1) / _header.tileSize;
+
+		first_page += _info.mips[mip].pagesX * _info.mips[mip].pagesY;
+		_page_mips.resize(first_page, mip);
+	}
+	assert(first_page == _header.pageCount);
+
+	Page empty_page = { INVALID_PAGE, 0, false };
+	_pages.resize(_header.pageCount, empty_page);
+
+	_cache_slots.resize(_cache_size * _cache_size, INVALID_PAGE);
+	for (uint32_t i = (uint32_t)_cache_slots.size(); i > 0; i--) {
+		_free_cache_slots.push_back(i - 1);
+	}
+
+	_tile_memory.resize((size_t)(MAX_PENDING_PAGE_LOADS * _tile_bytes));
+	for (uint32_t i = MAX_PENDING_PAGE_LOADS; i > 0; i--) {
+		_free_tile_slots.push_back(i - 1);
+	}
+
+	_InitCache();
+	_InitDescriptors();
+
+	// Random access, read-ahead would only pull in tiles nobody asked for
+	_file.adviseAccess(MappedFile::ACCESS_RANDOM);
+
+	_loader = std::thread(&VirtualTexture::_LoaderThread, this);
+
+	// The last mip is the fallback for everything, keep it resident from the start
+	uint32_t root = _header.pageCount - 1;
+	_pages[root].lastUsed = PINNED_PAGE;
+	_requests.push_back(root);
+	_IssueLoads();
+}
+
+VirtualTexture::~VirtualTexture() {
+	{
+		std::lock_guard<std::mutex> lock(_loader_mutex);
+		_loader_exit = true;
+	}
+	_loader_condition.notify_one();
+	_loader.join();
+
+	_DeInitCache();
+}
+
+void VirtualTexture::update(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	assert(frameIndex < _frame_count);
+
+	_frame++;
+
+	_ReadFeedback(frameIndex);
+	_IssueLoads();
+	_UploadPages(commandBuffer, frameIndex);
+	_UpdatePageTable(commandBuffer, frameIndex);
+}
+
+void VirtualTexture::bind(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	// Transient, the frame's allocator frees it along with the rest of the frame's sets
+	VkDescriptorSet set;
+	if (!_renderer->getFrameDescriptorAllocator(frameIndex)->allocate(_set_layout, set)) {
+		throw std::runtime_error("Failed to allocate a virtual texture descriptor set");
+	}
+	_WriteDescriptors(set, frameIndex);
+
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _renderer->getPipelineLayout(), 2, 1, &set, 0, nullptr);
+}
+
+void VirtualTexture::resolveFeedback(VkCommandBuffer commandBuffer) {
+	VkMemoryBarrier barrier = vkStruct<VkMemoryBarrier>();
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+const uint32_t VirtualTexture::getResidentPageCount() const {
+	return (uint32_t)(_cache_slots.size() - _free_cache_slots.size());
+}
+
+VkDescriptorSetLayout VirtualTexture::getSetLayout(DescriptorLayoutCache * layoutCache) {
+	std::array<VkDescriptorSetLayoutBinding, 3> bindings = {};
+
+	bindings[0].binding = 0; // Page cache
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	bindings[1].binding = 1; // Page table
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	bindings[2].binding = 2; // Feedback
+	bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[2].descriptorCount = 1;
+	bindings[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayoutCreateInfo set_layout_create_info = vkStruct<VkDescriptorSetLayoutCreateInfo>();
+	set_layout_create_info.bindingCount = (uint32_t)bindings.size();
+	set_layout_create_info.pBindings = bindings.data();
+
+	return layoutCache->createDescriptorLayout(set_layout_create_info);
+}
+
+void VirtualTexture::bake(const unsigned char * pixels, uint32_t width, uint32_t height, const std::string & path) {
+	// Halve until the whole mip fits in one tile
+	uint32_t mip_count = 1;
+	while (std::max(width >> (mip_count - 1), height >> (mip_count - 1)) > VIRTUAL_TILE_SIZE) {
+		mip_count++;
+	}
+
+	if (mip_count > MAX_VIRTUAL_TEXTURE_MIPS) {
+		throw std::runtime_error("Texture is too large to bake: " + path);
+	}
+
+	// Box filtered mip chain, level 0 is the source itself
+	std::vector<std::vector<unsigned char>> levels(mip_count);
+	std::vector<const unsigned char *> level_pixels(mip_count, pixels);
+	for (uint32_t mip = 1; mip < mip_count; mip++) {
+		uint32_t src_width = std::max(width >> (mip - 1), 1u);
+		uint32_t src_height = std::max(height >> (mip - 1), 1u);
+		uint32_t dst_width = std::max(width >> mip, 1u);
+		uint32_t dst_height = std::max(height >> mip, 1u);
+		const unsigned char * src = level_pixels[mip - 1];
+
+		levels[mip].resize((size_t)dst_width * dst_height * 4);
+		for (uint32_t y = 0; y < dst_height; y++) {
+			uint32_t y0 = std::min(y * 2, src_height - 1);
+			uint32_t y1 = std::min(y * 2 + 1, src_height - 1);
+			for (uint32_t x = 0; x < dst_width; x++) {
+				uint32_t x0 = std::min(x * 2, src_width - 1);
+				uint32_t x1 = std::min(x * 2 + 1, src_width - 1);
+				for (uint32_t c = 0; c < 4; c++) {
+					uint32_t sum = src[((size_t)y0 * src_width + x0) * 4 + c] + src[((size_t)y0 * src_width + x1) * 4 + c] +
+						src[((size_t)y1 * src_width + x0) * 4 + c] + src[((size_t)y1 * src_width + x1) * 4 + c];
+					levels[mip][((size_t)y * dst_width + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+				}
+			}
+		}
+		level_pixels[mip] = levels[mip].data();
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to create virtual texture: " + path);
+	}
+
+	VirtualTextureHeader header {};
+	header.magic = VIRTUAL_TEXTURE_MAGIC;
+	header.version = VIRTUAL_TEXTURE_VERSION;
+	header.width = width;
+	header.height = height;
+	header.tileSize = VIRTUAL_TILE_SIZE;
+	header.border = VIRTUAL_PAGE_BORDER;
+	header.mipCount = mip_count;
+	for (uint32_t mip = 0; mip < mip_count; mip++) {
+		uint32_t pages_x = (std::max(width >> mip, 1u) + VIRTUAL_TILE_SIZE - 1) / VIRTUAL_TILE_SIZE;
+		uint32_t pages_y = (std::max(height >> mip, 1u) + VIRTUAL_TILE_SIZE - 1) / VIRTUAL_TILE_SIZE;
+		header.pageCount += pages_x * pages_y;
+	}
+
+	file.write((const char *)&header, sizeof(header));
+
+	std::vector<unsigned char> tile(VIRTUAL_PAGE_SIZE * VIRTUAL_PAGE_SIZE * 4);
+	for (uint32_t mip = 0; mip < mip_count; mip++) {
+		int32_t mip_width = (int32_t)std::max(width >> mip, 1u);
+		int32_t mip_height = (int32_t)std::max(height >> mip, 1u);
+		uint32_t pages_x = (mip_width + VIRTUAL_TILE_SIZE - 1) / VIRTUAL_TILE_SIZE;
+		uint32_t pages_y = (mip_height + VIRTUAL_TILE_SIZE - 1) / VIRTUAL_TILE_SIZE;
+
+		for (uint32_t page_y = 0; page_y < pages_y; page_y++) {
+			for (uint32_t page_x = 0; page_x < pages_x; page_x++) {
+				// Borders and anything past the edge of the image wrap around, matching the repeat addressing of the shader
+				for (uint32_t y = 0; y < VIRTUAL_PAGE_SIZE; y++) {
+					int32_t src_y = (int32_t)(page_y * VIRTUAL_TILE_SIZE + y) - (int32_t)VIRTUAL_PAGE_BORDER;
+					src_y = ((src_y % mip_height) + mip_height) % mip_height;
+					for (uint32_t x = 0; x < VIRTUAL_PAGE_SIZE; x++) {
+						int32_t src_x = (int32_t)(page_x * VIRTUAL_TILE_SIZE + x) - (int32_t)VIRTUAL_PAGE_BORDER;
+						src_x = ((src_x % mip_width) + mip_width) % mip_width;
+						memcpy(&tile[(y * VIRTUAL_PAGE_SIZE + x) * 4], &level_pixels[mip][((size_t)src_y * mip_width + src_x) * 4], 4);
+					}
+				}
+				file.write((const char *)tile.data(), tile.size());
+			}
+		}
+	}
+
+	if (!file.good()) {
+		throw std::runtime_error("Failed to write virtual texture: " + path);
+	}
+}
+
+void VirtualTexture::_InitCache() {
+	VkDeviceSize min_offset_alignment = _renderer->getPhysicalDeviceProperties().limits.minStorageBufferOffsetAlignment;
+
+	// Page cache, the only memory that grows with the budget rather than the texture
+	uint32_t cache_extent = _cache_size * VIRTUAL_PAGE_SIZE;
+	_renderer->createImage(cache_extent, cache_extent, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _cache_image, _cache_image_memory);
+	_renderer->createImageView(_cache_image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, _cache_image_view);
+
+	// Pages carry their own borders, so filtering stays inside them and the cache needs no mips
+	VkSamplerCreateInfo sampler_info = vkStruct<VkSamplerCreateInfo>();
+	sampler_info.magFilter = VK_FILTER_LINEAR;
+	sampler_info.minFilter = VK_FILTER_LINEAR;
+	sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.anisotropyEnable = VK_FALSE;
+	sampler_info.maxAnisotropy = 1.0f;
+	sampler_info.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	sampler_info.unnormalizedCoordinates = VK_FALSE;
+	sampler_info.compareEnable = VK_FALSE;
+	sampler_info.compareOp = VK_COMPARE_OP_ALWAYS;
+	sampler_info.minLod = 0.0f;
+	sampler_info.maxLod = 0.0f;
+
+	ErrorCheck(vkCreateSampler(_device, &sampler_info, nullptr, &_cache_sampler));
+
+	// Page table, the info header followed by one entry per page
+	_page_table_size = sizeof(VirtualTextureInfo) + _header.pageCount * sizeof(uint32_t);
+	_renderer->createBuffer(_page_table_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _page_table_buffer, _page_table_buffer_memory);
+
+	{
+		// The header never changes, entries are written by the first update
+		StagingUploader uploader(_renderer, sizeof(VirtualTextureInfo) * STAGING_CHUNK_COUNT);
+		uploader.uploadBuffer(_page_table_buffer, 0, &_info, sizeof(VirtualTextureInfo));
+		uploader.flush();
+	}
+
+	// Staging, written by the CPU for a frame only after that frame's fence
+	VkDeviceSize page_table_staging_size = (_header.pageCount * sizeof(uint32_t) + 15) / 16 * 16;
+	_staging_frame_size = page_table_staging_size + MAX_PAGE_UPLOADS_PER_FRAME * _tile_bytes;
+	_renderer->createBuffer(_staging_frame_size * _frame_count, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _staging_buffer, _staging_buffer_memory);
+
+	void * data;
+	ErrorCheck(vkMapMemory(_device, _staging_buffer_memory, 0, _staging_frame_size * _frame_count, 0, &data));
+	_staging_data = (char *)data;
+
+	// Feedback, written by the GPU and read back once the frame's fence has signalled
+	_feedback_frame_size = (_header.pageCount * sizeof(uint32_t) + min_offset_alignment - 1) / min_offset_alignment * min_offset_alignment;
+	_renderer->createBuffer(_feedback_frame_size * _frame_count, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _feedback_buffer, _feedback_buffer_memory);
+
+	ErrorCheck(vkMapMemory(_device, _feedback_buffer_memory, 0, _feedback_frame_size * _frame_count, 0, &data));
+	_feedback_data = (uint32_t *)data;
+	memset(_feedback_data, 0, (size_t)(_feedback_frame_size * _frame_count));
+}
+
+void VirtualTexture::_DeInitCache() {
+	vkUnmapMemory(_device, _feedback_buffer_memory);
+	_feedback_data = nullptr;
+	vkUnmapMemory(_device, _staging_buffer_memory);
+	_staging_data = nullptr;
+
+	vkFreeMemory(_device, _feedback_buffer_memory, nullptr);
+	_feedback_buffer_memory = nullptr;
+	vkDestroyBuffer(_device, _feedback_buffer, nullptr);
+	_feedback_buffer = nullptr;
+	vkFreeMemory(_device, _staging_buffer_memory, nullptr);
+	_staging_buffer_memory = nullptr;
+	vkDestroyBuffer(_device, _staging_buffer, nullptr);
+	_staging_buffer = nullptr;
+	vkFreeMemory(_device, _page_table_buffer_memory, nullptr);
+	_page_table_buffer_memory = nullptr;
+	vkDestroyBuffer(_device, _page_table_buffer, nullptr);
+	_page_table_buffer = nullptr;
+	vkDestroySampler(_device, _cache_sampler, nullptr);
+	_cache_sampler = nullptr;
+	vkDestroyImageView(_device, _cache_image_view, nullptr);
+	_cache_image_view = nullptr;
+	vkFreeMemory(_device, _cache_image_memory, nullptr);
+	_cache_image_memory = nullptr;
+	vkDestroyImage(_device, _cache_image, nullptr);
+	_cache_image = nullptr;
+}
+
+void VirtualTexture::_InitDescriptors() {
+	_set_layout = getSetLayout(_renderer->getDescriptorLayoutCache());
+}
+
+void VirtualTexture::_WriteDescriptors(VkDescriptorSet set, uint32_t frameIndex) {
+	// Sets differ only in which feedback range they write
+	VkDescriptorImageInfo cache_info {};
+	cache_info.sampler = _cache_sampler;
+	cache_info.imageView = _cache_image_view;
+	cache_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkDescriptorBufferInfo page_table_info {};
+	page_table_info.buffer = _page_table_buffer;
+	page_table_info.offset = 0;
+	page_table_info.range = _page_table_size;
+
+	VkDescriptorBufferInfo feedback_info {};
+	feedback_info.buffer = _feedback_buffer;
+	feedback_info.offset = frameIndex * _feedback_frame_size;
+	feedback_info.range = _header.pageCount * sizeof(uint32_t);
+
+	std::array<VkWriteDescriptorSet, 3> descriptor_writes = {};
+	for (uint32_t binding = 0; binding < descriptor_writes.size(); binding++) {
+		descriptor_writes[binding] = vkStruct<VkWriteDescriptorSet>();
+		descriptor_writes[binding].dstSet = set;
+		descriptor_writes[binding].dstBinding = binding;
+		descriptor_writes[binding].descriptorCount = 1;
+	}
+
+	descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptor_writes[0].pImageInfo = &cache_info;
+	descriptor_writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptor_writes[1].pBufferInfo = &page_table_info;
+	descriptor_writes[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptor_writes[2].pBufferInfo = &feedback_info;
+
+	vkUpdateDescriptorSets(_device, (uint32_t)descriptor_writes.size(), descriptor_writes.data(), 0, nullptr);
+}
+
+void VirtualTexture::_ReadFeedback(uint32_t frameIndex) {
+	uint32_t * feedback = (uint32_t *)((char *)_feedback_data + frameIndex * _feedback_frame_size);
+
+	_requests.clear();
+
+	for (uint32_t page = 0; page < _header.pageCount; page++) {
+		if (feedback[page] == 0) {
+			continue;
+		}
+		feedback[page] = 0;
+
+		// The page and every ancestor it could fall back to are in use. Missing ones are requested too,
+		// so coarse pages arrive first and detail sharpens as the finer ones follow
+		for (uint32_t p = page; p != INVALID_PAGE; p = _ParentPage(p, _page_mips[p])) {
+			if (_pages[p].lastUsed == _frame) {
+				break; // Already walked from a sibling
+			}
+			if (_pages[p].lastUsed != PINNED_PAGE) {
+				_pages[p].lastUsed = _frame;
+			}
+			if (_pages[p].cacheSlot == INVALID_PAGE && !_pages[p].pending) {
+				_requests.push_back(p);
+			}
+		}
+	}
+}
+
+void VirtualTexture::_IssueLoads() {
+	// Coarsest first, they cover the most of the screen
+	std::sort(_requests.begin(), _requests.end(), [this](uint32_t a, uint32_t b) {
+		return _page_mips[a] > _page_mips[b];
+	});
+
+	{
+		std::lock_guard<std::mutex> lock(_loader_mutex);
+
+		// Loads that have not started yet were asked for by older feedback, the latest takes priority
+		for (const auto & load : _load_queue) {
+			_pages[load.page].pending = false;
+			_free_tile_slots.push_back(load.tileSlot);
+		}
+		_load_queue.clear();
+
+		for (auto page : _requests) {
+			if (_free_tile_slots.empty()) {
+				break;
+			}
+			if (_pages[page].pending) {
+				continue;
+			}
+
+			PageLoad load;
+			load.page = page;
+			load.tileSlot = _free_tile_slots.back();
+			_free_tile_slots.pop_back();
+
+			_pages[page].pending = true;
+			_load_queue.push_back(load);
+		}
+	}
+	_loader_condition.notify_one();
+
+	_requests.clear();
+}
+
+void VirtualTexture::_UploadPages(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	LinearArena * arena = _renderer->getFrameArena()->get();
+
+	ArenaVector<PageLoad> loads(arena);
+	loads.reserve(MAX_PAGE_UPLOADS_PER_FRAME);
+	{
+		std::lock_guard<std::mutex> lock(_loader_mutex);
+		while (!_loaded.empty() && loads.size() < MAX_PAGE_UPLOADS_PER_FRAME) {
+			loads.push_back(_loaded.front());
+			_loaded.pop_front();
+		}
+	}
+
+	char * staging = _staging_data + frameIndex * _staging_frame_size;
+	VkDeviceSize tile_staging_offset = _staging_frame_size - MAX_PAGE_UPLOADS_PER_FRAME * _tile_bytes;
+
+	ArenaVector<VkBufferImageCopy> regions(arena);
+	regions.reserve(loads.size());
+	for (const auto & load : loads) {
+		uint32_t slot = _AllocateCacheSlot();
+
+		if (slot != INVALID_PAGE) {
+			VkDeviceSize offset = tile_staging_offset + regions.size() * _tile_bytes;
+			memcpy(staging + offset, &_tile_memory[(size_t)(load.tileSlot * _tile_bytes)], (size_t)_tile_bytes);
+
+			VkBufferImageCopy region {};
+			region.bufferOffset = frameIndex * _staging_frame_size + offset;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = 0;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageOffset = { (int32_t)((slot % _cache_size) * VIRTUAL_PAGE_SIZE), (int32_t)((slot / _cache_size) * VIRTUAL_PAGE_SIZE), 0 };
+			region.imageExtent = { VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_SIZE, 1 };
+			regions.push_back(region);
+
+			_pages[load.page].cacheSlot = slot;
+			_cache_slots[slot] = load.page;
+			_page_table_dirty = true;
+		}
+		// Otherwise every page is in use this frame; drop the tile, it will be asked for again
+
+		_pages[load.page].pending = false;
+		_free_tile_slots.push_back(load.tileSlot);
+	}
+
+	// The cache has to leave its initial layout before the first frame samples it, uploads or not
+	if (regions.empty() && _cache_initialized) {
+		return;
+	}
+
+	VkImageMemoryBarrier barrier = vkStruct<VkImageMemoryBarrier>();
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = _cache_image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	// Earlier frames may still be sampling the slots about to be overwritten
+	barrier.oldLayout = _cache_initialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	if (!regions.empty()) {
+		vkCmdCopyBufferToImage(commandBuffer, _staging_buffer, _cache_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+	}
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	_cache_initialized = true;
+}
+
+void VirtualTexture::_UpdatePageTable(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	if (!_page_table_dirty) {
+		return;
+	}
+	_page_table_dirty = false;
+
+	uint32_t * entries = (uint32_t *)(_staging_data + frameIndex * _staging_frame_size);
+
+	// Coarse to fine, so a missing page can copy its parent's already final entry
+	for (uint32_t mip = _header.mipCount; mip > 0; mip--) {
+		const VirtualTextureMip & level = _info.mips[mip - 1];
+		for (uint32_t page = level.firstPage; page < level.firstPage + level.pagesX * level.pagesY; page++) {
+			uint32_t slot = _pages[page].cacheSlot;
+			if (slot != INVALID_PAGE) {
+				entries[page] = PAGE_RESIDENT_BIT | ((mip - 1) << 24) | ((slot / _cache_size) << 12) | (slot % _cache_size);
+			}
+			else {
+				uint32_t parent = _ParentPage(page, mip - 1);
+				entries[page] = (parent != INVALID_PAGE) ? entries[parent] : 0;
+			}
+		}
+	}
+
+	VkBufferMemoryBarrier barrier = vkStruct<VkBufferMemoryBarrier>();
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = _page_table_buffer;
+	barrier.offset = sizeof(VirtualTextureInfo);
+	barrier.size = _header.pageCount * sizeof(uint32_t);
+
+	// Earlier frames may still be reading the table
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	VkBufferCopy copy_region {};
+	copy_region.srcOffset = frameIndex * _staging_frame_size;
+	copy_region.dstOffset = sizeof(VirtualTextureInfo);
+	copy_region.size = _header.pageCount * sizeof(uint32_t);
+
+	vkCmdCopyBuffer(commandBuffer, _staging_buffer, _page_table_buffer, 1, &copy_region);
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+uint32_t VirtualTexture::_AllocateCacheSlot() {
+	if (!_free_cache_slots.empty()) {
+		uint32_t slot = _free_cache_slots.back();
+		_free_cache_slots.pop_back();
+		return slot;
+	}
+
+	// Least recently used, but never a page the latest feedback asked for or a pinned one
+	uint32_t victim = INVALID_PAGE;
+	uint64_t oldest = _frame;
+	for (uint32_t slot = 0; slot < _cache_slots.size(); slot++) {
+		uint64_t last_used = _pages[_cache_slots[slot]].lastUsed;
+		if (last_used < oldest) {
+			oldest = last_used;
+			victim = slot;
+		}
+	}
+
+	if (victim != INVALID_PAGE) {
+		_pages[_cache_slots[victim]].cacheSlot = INVALID_PAGE;
+		_cache_slots[victim] = INVALID_PAGE;
+		_page_table_dirty = true;
+	}
+
+	return victim;
+}
+
+void VirtualTexture::_LoaderThread() {
+	while (true) {
+		PageLoad load;
+		{
+			std::unique_lock<std::mutex> lock(_loader_mutex);
+			_loader_condition.wait(lock, [this]() {
+				return _loader_exit || !_load_queue.empty();
+			});
+
+			if (_loader_exit) {
+				return;
+			}
+
+			load = _load_queue.front();
+			_load_queue.pop_front();
+		}
+
+		// The copy is where the disk read happens, off the render thread. Dropping the mapped pages afterwards
+		// keeps the process footprint at the tile pool rather than growing with every tile ever read
+		size_t file_offset = (size_t)(sizeof(VirtualTextureHeader) + load.page * _tile_bytes);
+		memcpy(&_tile_memory[(size_t)(load.tileSlot * _tile_bytes)], _file.getData() + file_offset, (size_t)_tile_bytes);
+		_file.release(file_offset, (size_t)_tile_bytes);
+
+		{
+			std::lock_guard<std::mutex> lock(_loader_mutex);
+			_loaded.push_back(load);
+		}
+	}
+}
+
+uint32_t VirtualTexture::_ParentPage(uint32_t page, uint32_t mip) const {
+	if (mip + 1 >= _header.mipCount) {
+		return INVALID_PAGE;
+	}
+
+	const VirtualTextureMip & level = _info.mips[mip];
+	const VirtualTextureMip & parent_level = _info.mips[mip + 1];
+
+	uint32_t local = page - level.firstPage;
+	uint32_t x = std::min((local % level.pagesX) / 2, parent_level.pagesX - 1);
+	uint32_t y = std::min((local / level.pagesX) / 2, parent_level.pagesY - 1);
+
+	return parent_level.firstPage + y * parent_level.pagesX + x;
+}
\ No newline at end of file
@@ -0,0 +1,182 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* VirtualTexture.h | Feedback driven virtual texture streamed from a pre-tiled file
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+#include "Renderer.h"
+#include "MappedFile.h"
+#include "DescriptorAllocator.h"
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+const uint32_t VIRTUAL_PAGE_SIZE = 128; // Texels per side of a cache page, border included
+const uint32_t VIRTUAL_PAGE_BORDER = 4; // Duplicated from the neighbouring tiles so filtering never reads another page
+const uint32_t VIRTUAL_TILE_SIZE = VIRTUAL_PAGE_SIZE - 2 * VIRTUAL_PAGE_BORDER;
+const uint32_t MAX_VIRTUAL_TEXTURE_MIPS = 16;
+
+const uint32_t DEFAULT_PAGE_CACHE_SIZE = 32; // Pages per side, 4096x4096 RGBA8
+const uint32_t MAX_PAGE_UPLOADS_PER_FRAME = 16;
+const uint32_t MAX_PENDING_PAGE_LOADS = 64;
+
+const uint32_t VIRTUAL_TEXTURE_MAGIC = 0x58455456; // "VTEX"
+const uint32_t VIRTUAL_TEXTURE_VERSION = 1;
+
+// Start of a .vtex file. Tiles follow in page order, finest mip first and row-major within a mip, each
+// VIRTUAL_PAGE_SIZE squared RGBA8 texels with its border already filled in
+struct VirtualTextureHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t tileSize;
+	uint32_t border;
+	uint32_t mipCount; // The last mip fits in a single tile
+	uint32_t pageCount;
+};
+
+// Must match VirtualTexture.frag
+struct VirtualTextureMip {
+	uint32_t firstPage;
+	uint32_t pagesX;
+	uint32_t pagesY;
+	uint32_t padding;
+};
+
+struct VirtualTextureInfo { // std430, head of the page table buffer
+	uint32_t width;
+	uint32_t height;
+	uint32_t tileSize;
+	uint32_t border;
+	uint32_t mipCount;
+	uint32_t cacheSize;
+	uint32_t padding[2];
+	VirtualTextureMip mips[MAX_VIRTUAL_TEXTURE_MIPS];
+};
+
+// A texture far larger than device memory, drawn through a fixed size cache of pages.
+// The fragment shader looks up each sample's page in a page table and, for a sample of the pixels, marks the
+// page it wanted in a per-frame feedback buffer. Once a frame's fence has signalled, update() reads its feedback,
+// queues missing pages for a loader thread that copies tiles out of the mapped file, and copies finished tiles into
+// the cache, evicting the least recently used pages. Page table entries of missing pages point at their nearest
+// resident ancestor, and the single page of the last mip is always resident, so every sample has something to show.
+class VirtualTexture {
+public:
+	VirtualTexture(Renderer * renderer, const std::string & path, uint32_t frameCount, uint32_t cacheSize = DEFAULT_PAGE_CACHE_SIZE);
+	~VirtualTexture();
+
+	// Outside a render pass, after the fence of frameIndex's previous submission has been waited on
+	void update(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	// With the graphics pipeline bound, once the renderer has begun frameIndex
+	void bind(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	// After the render pass, makes the frame's feedback visible to the host
+	void resolveFeedback(VkCommandBuffer commandBuffer);
+
+	const uint32_t getResidentPageCount() const;
+
+	// Layout of set 2 in the virtual texture shader, shared by every instance through the cache
+	static VkDescriptorSetLayout getSetLayout(DescriptorLayoutCache * layoutCache);
+
+	// Writes a .vtex file from RGBA8 pixels, building the mip chain and every tile
+	static void bake(const unsigned char * pixels, uint32_t width, uint32_t height, const std::string & path);
+
+private:
+	struct Page {
+		uint32_t cacheSlot;
+		uint64_t lastUsed;
+		bool pending;
+	};
+
+	struct PageLoad {
+		uint32_t page;
+		uint32_t tileSlot; // Where in _tile_memory the loader puts it
+	};
+
+	void _InitCache();
+	void _DeInitCache();
+
+	void _InitDescriptors();
+	void _WriteDescriptors(VkDescriptorSet set, uint32_t frameIndex);
+
+	void _ReadFeedback(uint32_t frameIndex);
+	void _IssueLoads();
+	void _UploadPages(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	void _UpdatePageTable(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	uint32_t _AllocateCacheSlot();
+
+	void _LoaderThread();
+
+	uint32_t _ParentPage(uint32_t page, uint32_t mip) const;
+
+	Renderer * _renderer = nullptr;
+	VkDevice _device = VK_NULL_HANDLE;
+
+	MappedFile _file;
+	VirtualTextureHeader _header = {};
+	VirtualTextureInfo _info = {};
+	VkDeviceSize _tile_bytes = 0;
+
+	uint32_t _frame_count = 0;
+	uint32_t _cache_size = 0;
+	uint64_t _frame = 0;
+
+	std::vector<Page> _pages;
+	std::vector<uint32_t> _page_mips;
+	std::vector<uint32_t> _cache_slots; // Page held by each cache slot
+	std::vector<uint32_t> _free_cache_slots;
+	std::vector<uint32_t> _requests; // Missing pages seen in the latest feedback
+	bool _page_table_dirty = true;
+
+	// Loader thread
+	std::thread _loader;
+	std::mutex _loader_mutex;
+	std::condition_variable _loader_condition;
+	std::deque<PageLoad> _load_queue;
+	std::deque<PageLoad> _loaded;
+	bool _loader_exit = false;
+
+	std::vector<char> _tile_memory; // MAX_PENDING_PAGE_LOADS tiles, bounds host memory whatever the texture size
+	std::vector<uint32_t> _free_tile_slots;
+
+	// Device resources
+	VkImage _cache_image = VK_NULL_HANDLE;
+	VkDeviceMemory _cache_image_memory = VK_NULL_HANDLE;
+	VkImageView _cache_image_view = VK_NULL_HANDLE;
+	VkSampler _cache_sampler = VK_NULL_HANDLE;
+	bool _cache_initialized = false; // Still in UNDEFINED until the first upload
+
+	VkBuffer _page_table_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory _page_table_buffer_memory = VK_NULL_HANDLE;
+	VkDeviceSize _page_table_size = 0;
+
+	VkBuffer _staging_buffer = VK_NULL_HANDLE; // Per frame: page table entries then tile uploads
+	VkDeviceMemory _staging_buffer_memory = VK_NULL_HANDLE;
+	char * _staging_data = nullptr;
+	VkDeviceSize _staging_frame_size = 0;
+
+	VkBuffer _feedback_buffer = VK_NULL_HANDLE; // Per frame, one word per page
+	VkDeviceMemory _feedback_buffer_memory = VK_NULL_HANDLE;
+	uint32_t * _feedback_data = nullptr;
+	VkDeviceSize _feedback_frame_size = 0;
+
+	VkDescriptorSetLayout _set_layout = VK_NULL_HANDLE;
+};
\ No newline at end of file
@@ -0,0 +1,120 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* VkBuilders.h | Zero-initialised Vulkan structs with their sType filled in at compile time
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Platform.h"
+
+// Maps a Vulkan struct to its VkStructureType. Only declared for the general case,
+// so asking for a struct without a mapping fails to compile instead of leaving sType at zero
+template<typename T> struct VkStructureTypeOf;
+
+#define VK_STRUCTURE_TYPE_OF(type, structureType) \
+	template<> struct VkStructureTypeOf<type> { static const VkStructureType value = structureType; }
+
+VK_STRUCTURE_TYPE_OF(VkApplicationInfo, VK_STRUCTURE_TYPE_APPLICATION_INFO);
+VK_STRUCTURE_TYPE_OF(VkInstanceCreateInfo, VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkDeviceQueueCreateInfo, VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkDeviceCreateInfo, VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkSubmitInfo, VK_STRUCTURE_TYPE_SUBMIT_INFO);
+VK_STRUCTURE_TYPE_OF(VkMemoryAllocateInfo, VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkMappedMemoryRange, VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE);
+VK_STRUCTURE_TYPE_OF(VkFenceCreateInfo, VK_STRUCTURE_TYPE_FENCE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkSemaphoreCreateInfo, VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkQueryPoolCreateInfo, VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkBufferCreateInfo, VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkImageCreateInfo, VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkImageViewCreateInfo, VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkShaderModuleCreateInfo, VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkPipelineCacheCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkPipelineShaderStageCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkPipelineVertexInputStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkPipelineInputAssemblyStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkPipelineViewportStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkPipelineRasterizationStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkPipelineMultisampleStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkPipelineDepthStencilStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkPipelineColorBlendStateCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkGraphicsPipelineCreateInfo, VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkComputePipelineCreateInfo, VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkPipelineLayoutCreateInfo, VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkSamplerCreateInfo, VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkDescriptorSetLayoutCreateInfo, VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkDescriptorPoolCreateInfo, VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkDescriptorSetAllocateInfo, VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkWriteDescriptorSet, VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET);
+VK_STRUCTURE_TYPE_OF(VkFramebufferCreateInfo, VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkRenderPassCreateInfo, VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkCommandPoolCreateInfo, VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkCommandBufferAllocateInfo, VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO);
+VK_STRUCTURE_TYPE_OF(VkCommandBufferBeginInfo, VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO);
+VK_STRUCTURE_TYPE_OF(VkRenderPassBeginInfo, VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO);
+VK_STRUCTURE_TYPE_OF(VkBufferMemoryBarrier, VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER);
+VK_STRUCTURE_TYPE_OF(VkImageMemoryBarrier, VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER);
+VK_STRUCTURE_TYPE_OF(VkMemoryBarrier, VK_STRUCTURE_TYPE_MEMORY_BARRIER);
+
+// WSI
+VK_STRUCTURE_TYPE_OF(VkSwapchainCreateInfoKHR, VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR);
+VK_STRUCTURE_TYPE_OF(VkPresentInfoKHR, VK_STRUCTURE_TYPE_PRESENT_INFO_KHR);
+
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+VK_STRUCTURE_TYPE_OF(VkWin32SurfaceCreateInfoKHR, VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR);
+#endif
+#ifdef VK_USE_PLATFORM_XCB_KHR
+VK_STRUCTURE_TYPE_OF(VkXcbSurfaceCreateInfoKHR, VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR);
+#endif
+#ifdef VK_USE_PLATFORM_WAYLAND_KHR
+VK_STRUCTURE_TYPE_OF(VkWaylandSurfaceCreateInfoKHR, VK_STRUCTURE_TYPE_WAYLAND_SURFACE_CREATE_INFO_KHR);
+#endif
+
+// Extensions, only when the headers know about them
+VK_STRUCTURE_TYPE_OF(VkDebugReportCallbackCreateInfoEXT, VK_STRUCTURE_TYPE_DEBUG_REPORT_CREATE_INFO_EXT);
+
+#if defined(VK_EXT_descriptor_indexing) || defined(VK_KHR_timeline_semaphore)
+VK_STRUCTURE_TYPE_OF(VkPhysicalDeviceFeatures2KHR, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR);
+#endif
+
+#ifdef VK_EXT_descriptor_indexing
+VK_STRUCTURE_TYPE_OF(VkPhysicalDeviceDescriptorIndexingFeaturesEXT, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT);
+VK_STRUCTURE_TYPE_OF(VkDescriptorSetLayoutBindingFlagsCreateInfoEXT, VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT);
+#endif
+
+#ifdef VK_KHR_timeline_semaphore
+VK_STRUCTURE_TYPE_OF(VkPhysicalDeviceTimelineSemaphoreFeaturesKHR, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR);
+VK_STRUCTURE_TYPE_OF(VkSemaphoreTypeCreateInfoKHR, VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR);
+VK_STRUCTURE_TYPE_OF(VkTimelineSemaphoreSubmitInfoKHR, VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR);
+VK_STRUCTURE_TYPE_OF(VkSemaphoreWaitInfoKHR, VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR);
+#endif
+
+#undef VK_STRUCTURE_TYPE_OF
+
+// A zeroed struct of type T with sType set. Inlines down to the same stores as filling it by hand
+template<typename T>
+inline T vkStruct() {
+	T info = {};
+	info.sType = VkStructureTypeOf<T>::value;
+	return info;
+}
+
+// Links next in at the front of info's pNext chain. Both must outlive the call that consumes info
+template<typename T, typename Next>
+inline T & vkChain(T & info, Next & next) {
+	next.pNext = (void *)info.pNext;
+	info.pNext = &next;
+	return info;
+}
\ No newline at end of file
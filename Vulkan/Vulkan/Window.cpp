@@ -21,13 +21,16 @@
 #include "util.h"
 #include <cstdint>
 #include <assert.h>
+#include <algorithm>
 
 
-Window::Window(Renderer * renderer, uint32_t size_x, uint32_t size_y, std::string name) {
+Window::Window(Renderer * renderer, uint32_t size_x, uint32_t size_y, std::string name, LatencyMode latencyMode) {
 	_renderer = renderer;
 	_surface_size_x = size_x;
 	_surface_size_y = size_y;
 	_window_name = name;
+	_latency_mode = latencyMode;
+	_window_should_run = true;
 
 	_InitOSWindow();
 	_InitSurface();
@@ -39,8 +42,8 @@ Window::Window(Renderer * renderer, uint32_t size_x, uint32_t size_y, std::strin
 Window::~Window() {
 	_DeInitSwapchainImages();
 	_DeInitSwapchain();
+	_DeInitSurface(); // The surface must go before the window it presents to
 	_DeInitOSWindow();
-	_DeInitSurface();
 }
 
 void Window::close() {
@@ -48,7 +51,20 @@ void Window::close() {
 }
 
 bool Window::update(int * xPos, int * yPos) {
-	_UpdateOSWindow(xPos, yPos);
+	// Only the newest cursor position matters, but everything queued is drained so the ring never fills
+	InputEvent event;
+	while (_input_queue.pop(event)) {
+		switch (event.type) {
+		case INPUT_EVENT_MOUSE_MOVE:
+			*xPos = event.x;
+			*yPos = event.y;
+			break;
+		default:
+			break;
+		}
+		_last_input_time = event.time;
+	}
+
 	return _window_should_run;
 }
 
@@ -72,6 +88,14 @@ const VkSwapchainKHR Window::getSwapchain() const {
 	return _swapchain;
 }
 
+const VkPresentModeKHR Window::getPresentMode() const {
+	return _present_mode;
+}
+
+const LatencyMode Window::getLatencyMode() const {
+	return _latency_mode;
+}
+
 const std::vector<VkImage> & Window::getSwapchainImages() const {
 	return _swapchain_images;
 }
@@ -80,32 +104,46 @@ const std::vector<VkImageView> & Window::getSwapchainImageViews() const {
 	return _swapchain_image_views;
 }
 
-void Window::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView & imageView) {
-	VkImageViewCreateInfo view_info {};
-	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+const std::chrono::high_resolution_clock::time_point Window::getLastInputTime() const {
+	return _last_input_time;
+}
+
+void Window::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView & imageView, uint32_t baseMipLevel, uint32_t levelCount) {
+	VkImageViewCreateInfo view_info = vkStruct<VkImageViewCreateInfo>();
 	view_info.image = image;
 	view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
 	view_info.format = format;
 	view_info.subresourceRange.aspectMask = aspectFlags;
-	view_info.subresourceRange.baseMipLevel = 0;
-	view_info.subresourceRange.levelCount = 1;
+	view_info.subresourceRange.baseMipLevel = baseMipLevel;
+	view_info.subresourceRange.levelCount = levelCount;
 	view_info.subresourceRange.baseArrayLayer = 0;
 	view_info.subresourceRange.layerCount = 1;
 
 	ErrorCheck(vkCreateImageView(_renderer->getDevice(), &view_info, nullptr, &imageView));
 }
 
+void Window::_PostInputEvent(InputEventType type, int32_t x, int32_t y) {
+	InputEvent event {};
+	event.type = type;
+	event.x = x;
+	event.y = y;
+	event.time = std::chrono::high_resolution_clock::now();
+
+	// Full only if the render thread has stalled for a long time; the dropped event is superseded by the next one
+	_input_queue.push(event);
+}
+
 void Window::_InitSurface() {
 	_InitOSSurface();
 
 	VkBool32 WSI_support = false;
-	vkGetPhysicalDeviceSurfaceSupportKHR(_renderer->getPhysicalDevice(), _renderer->getGraphicsFamilyIndex(), _surface, &WSI_support);
+	ErrorCheck(vkGetPhysicalDeviceSurfaceSupportKHR(_renderer->getPhysicalDevice(), _renderer->getGraphicsFamilyIndex(), _surface, &WSI_support));
 	if (!WSI_support) {
 		assert(0 && "WSI not supported");
 		std::exit(-1);
 	}
 
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(_renderer->getPhysicalDevice(), _surface, &_surface_capabilities);
+	ErrorCheck(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(_renderer->getPhysicalDevice(), _surface, &_surface_capabilities));
 
 	if (_surface_capabilities.currentExtent.width < UINT32_MAX) {
 		_surface_size_x = _surface_capabilities.currentExtent.width;
@@ -114,7 +152,7 @@ void Window::_InitSurface() {
 
 	{
 		uint32_t format_count = 0;
-		vkGetPhysicalDeviceSurfaceFormatsKHR(_renderer->getPhysicalDevice(), _surface, &format_count, nullptr);
+		ErrorCheck(vkGetPhysicalDeviceSurfaceFormatsKHR(_renderer->getPhysicalDevice(), _surface, &format_count, nullptr));
 
 		if (format_count == 0) {
 			assert(0 && "No possible surface formats");
@@ -123,7 +161,7 @@ void Window::_InitSurface() {
 
 		std::vector<VkSurfaceFormatKHR> formats(format_count);
 
-		vkGetPhysicalDeviceSurfaceFormatsKHR(_renderer->getPhysicalDevice(), _surface, &format_count, formats.data());
+		ErrorCheck(vkGetPhysicalDeviceSurfaceFormatsKHR(_renderer->getPhysicalDevice(), _surface, &format_count, formats.data()));
 		if (formats[0].format == VK_FORMAT_UNDEFINED) {
 			_surface_format.format = VK_FORMAT_B8G8R8A8_UNORM;
 			_surface_format.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
@@ -140,28 +178,9 @@ void Window::_DeInitSurface() {
 
 
 void Window::_InitSwapchain() {
-	if (_swapchain_image_count < _surface_capabilities.minImageCount)
-		_swapchain_image_count = _surface_capabilities.minImageCount + 1;
-	if (_swapchain_image_count > _surface_capabilities.maxImageCount)
-		_swapchain_image_count = _surface_capabilities.maxImageCount;
-	
-	VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
-	{
-		uint32_t present_mode_count = 0;
-		ErrorCheck(vkGetPhysicalDeviceSurfacePresentModesKHR(_renderer->getPhysicalDevice(), _surface, &present_mode_count, nullptr));
-
-		std::vector<VkPresentModeKHR> present_mode_list(present_mode_count);
-
-		ErrorCheck(vkGetPhysicalDeviceSurfacePresentModesKHR(_renderer->getPhysicalDevice(), _surface, &present_mode_count, present_mode_list.data()));
-
-		for (auto m : present_mode_list) {
-			if (m == VK_PRESENT_MODE_MAILBOX_KHR)
-				present_mode = m;
-		}
-	}
+	_ChoosePresentMode();
 
-	VkSwapchainCreateInfoKHR swapchain_create_info {};
-	swapchain_create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	VkSwapchainCreateInfoKHR swapchain_create_info = vkStruct<VkSwapchainCreateInfoKHR>();
 	swapchain_create_info.surface = _surface;
 	swapchain_create_info.minImageCount = _swapchain_image_count; // Buffers
 	swapchain_create_info.imageFormat = _surface_format.format;
@@ -170,12 +189,15 @@ void Window::_InitSwapchain() {
 	swapchain_create_info.imageExtent.height = _surface_size_y;
 	swapchain_create_info.imageArrayLayers = 1; // Number of images (mono, stereo)
 	swapchain_create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	if (_surface_capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) {
+		swapchain_create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT; // Frames can be captured
+	}
 	swapchain_create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	swapchain_create_info.queueFamilyIndexCount = 0;
 	swapchain_create_info.pQueueFamilyIndices = nullptr;
 	swapchain_create_info.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
 	swapchain_create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-	swapchain_create_info.presentMode = present_mode;
+	swapchain_create_info.presentMode = _present_mode;
 	swapchain_create_info.clipped = VK_TRUE;
 	swapchain_create_info.oldSwapchain = VK_NULL_HANDLE;
 
@@ -184,6 +206,51 @@ void Window::_InitSwapchain() {
 	ErrorCheck(vkGetSwapchainImagesKHR(_renderer->getDevice(), _swapchain, &_swapchain_image_count, nullptr));
 }
 
+void Window::_ChoosePresentMode() {
+	uint32_t present_mode_count = 0;
+	ErrorCheck(vkGetPhysicalDeviceSurfacePresentModesKHR(_renderer->getPhysicalDevice(), _surface, &present_mode_count, nullptr));
+
+	std::vector<VkPresentModeKHR> present_mode_list(present_mode_count);
+
+	ErrorCheck(vkGetPhysicalDeviceSurfacePresentModesKHR(_renderer->getPhysicalDevice(), _surface, &present_mode_count, present_mode_list.data()));
+
+	auto supported = [&](VkPresentModeKHR mode) {
+		return std::find(present_mode_list.begin(), present_mode_list.end(), mode) != present_mode_list.end();
+	};
+
+	// FIFO is the only mode every surface has to support
+	_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+	uint32_t extra_images = 1; // Lets the next image be acquired while the presentation engine holds the rest
+
+	switch (_latency_mode) {
+	case LATENCY_MODE_LOW_LATENCY:
+		// Mailbox replaces a queued frame instead of waiting behind it. Plain FIFO gets the shortest queue it allows
+		if (supported(VK_PRESENT_MODE_MAILBOX_KHR)) {
+			_present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+		}
+		else {
+			extra_images = 0;
+		}
+		break;
+	case LATENCY_MODE_UNCAPPED:
+		if (supported(VK_PRESENT_MODE_IMMEDIATE_KHR)) {
+			_present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+		}
+		else if (supported(VK_PRESENT_MODE_MAILBOX_KHR)) {
+			_present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+		}
+		break;
+	default:
+		break;
+	}
+
+	_swapchain_image_count = _surface_capabilities.minImageCount + extra_images;
+	// A maximum of 0 means the surface puts no limit on the image count
+	if (_surface_capabilities.maxImageCount > 0 && _swapchain_image_count > _surface_capabilities.maxImageCount) {
+		_swapchain_image_count = _surface_capabilities.maxImageCount;
+	}
+}
+
 void Window::_DeInitSwapchain() {
 	vkDestroySwapchainKHR(_renderer->getDevice(), _swapchain, nullptr);
 }
@@ -203,4 +270,4 @@ void Window::_DeInitSwapchainImages() {
 	for (auto view : _swapchain_image_views) {
 		vkDestroyImageView(_renderer->getDevice(), view, nullptr);
 	}
-}
+}
\ No newline at end of file
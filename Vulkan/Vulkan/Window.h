@@ -19,18 +19,47 @@
 #pragma once
 
 #include "Platform.h"
+#include "FramePacer.h"
+#include "SpscQueue.h"
 #include <string>
 #include <cstdint>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 class Renderer;
 
+#if VK_USE_PLATFORM_WAYLAND_KHR
+struct xdg_wm_base;
+struct xdg_surface;
+struct xdg_toplevel;
+#endif
+
+enum InputEventType {
+	INPUT_EVENT_MOUSE_MOVE
+};
+
+// Stamped when the input thread receives it from the OS
+struct InputEvent {
+	InputEventType type;
+	int32_t x;
+	int32_t y;
+	std::chrono::high_resolution_clock::time_point time;
+};
+
+const uint32_t INPUT_QUEUE_CAPACITY = 1024;
+
+// OS events are drained on a dedicated input thread as soon as they arrive and handed to the render thread through
+// a lock free ring, so input is never held up by a long frame and a frame never waits on the event pump.
 class Window {
 public:
-	Window(Renderer * renderer, uint32_t size_x, uint32_t size_y, std::string name);
+	Window(Renderer * renderer, uint32_t size_x, uint32_t size_y, std::string name, LatencyMode latencyMode);
 	~Window();
 
+	// Any thread
 	void close();
+	// Render thread. Applies every input event queued since the last call, returns false once the window is closing
 	bool update(int * xPos, int * yPos);
 
 	const uint32_t getWidth() const;
@@ -38,26 +67,34 @@ public:
 	const VkSurfaceCapabilitiesKHR getSurfaceCapabilities() const;
 	const VkSurfaceFormatKHR getSurfaceFormat() const;
 	const VkSwapchainKHR getSwapchain() const;
+	const VkPresentModeKHR getPresentMode() const;
+	const LatencyMode getLatencyMode() const;
 	const std::vector<VkImage> & getSwapchainImages() const;
 	const std::vector<VkImageView> & getSwapchainImageViews() const;
+	// When the newest input applied by update() reached the input thread
+	const std::chrono::high_resolution_clock::time_point getLastInputTime() const;
 
-	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView & imageView);
+	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView & imageView, uint32_t baseMipLevel = 0, uint32_t levelCount = 1);
 
 private:
 	void _InitOSWindow();
 	void _DeInitOSWindow();
-	void _UpdateOSWindow(int * xPos, int * yPos);
+	void _RunInputThread();
 	void _InitOSSurface();
 
 	void _InitSurface();
 	void _DeInitSurface();
 
 	void _InitSwapchain();
+	void _ChoosePresentMode();
 	void _DeInitSwapchain();
 
 	void _InitSwapchainImages();
 	void _DeInitSwapchainImages();
 
+	// Input thread
+	void _PostInputEvent(InputEventType type, int32_t x, int32_t y);
+
 	Renderer * _renderer = nullptr;
 
 	VkSurfaceKHR _surface = VK_NULL_HANDLE;
@@ -68,19 +105,47 @@ private:
 	std::string _window_name;
 	uint32_t _swapchain_image_count = 2;
 
+	LatencyMode _latency_mode = LATENCY_MODE_VSYNC;
+	VkPresentModeKHR _present_mode = VK_PRESENT_MODE_FIFO_KHR;
+
 	VkSurfaceFormatKHR _surface_format = {};
 	VkSurfaceCapabilitiesKHR _surface_capabilities = {};
 
 	std::vector<VkImage> _swapchain_images;
 	std::vector<VkImageView> _swapchain_image_views;
 
-	bool _window_should_run = true;
+	std::atomic<bool> _window_should_run;
+
+	std::thread _input_thread;
+	SpscQueue<InputEvent, INPUT_QUEUE_CAPACITY> _input_queue;
+	std::chrono::high_resolution_clock::time_point _last_input_time;
 
 #if VK_USE_PLATFORM_WIN32_KHR
 	HINSTANCE _win32_instance = NULL;
 	HWND _win32_window = NULL;
+	friend LRESULT CALLBACK WindowsEventHandler(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+	void _CreateWin32Window();
 	std::string _win32_class_name;
 	static uint64_t _win32_class_id_counter;
+#elif VK_USE_PLATFORM_XCB_KHR
+	xcb_connection_t * _xcb_connection = nullptr;
+	xcb_screen_t * _xcb_screen = nullptr;
+	xcb_window_t _xcb_window = 0;
+	xcb_atom_t _xcb_atom_delete_window = 0;
+	xcb_atom_t _xcb_atom_stop_input = 0; // Sent to our own window to wake the input thread when closing
+#elif VK_USE_PLATFORM_WAYLAND_KHR
+	friend struct WaylandEvents;
+
+	wl_display * _wayland_display = nullptr;
+	wl_registry * _wayland_registry = nullptr;
+	wl_compositor * _wayland_compositor = nullptr;
+	wl_seat * _wayland_seat = nullptr;
+	wl_pointer * _wayland_pointer = nullptr;
+	wl_surface * _wayland_surface = nullptr;
+	xdg_wm_base * _xdg_wm_base = nullptr;
+	xdg_surface * _xdg_surface = nullptr;
+	xdg_toplevel * _xdg_toplevel = nullptr;
+	bool _wayland_configured = false;
+	int _wayland_stop_input[2] = { -1, -1 }; // Pipe that wakes the input thread when closing
 #endif
-};
-
+};
\ No newline at end of file
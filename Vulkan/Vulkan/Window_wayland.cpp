@@ -0,0 +1,246 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* Window_wayland.cpp | Wayland window creation and event handling
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BUILD_OPTIONS.h"
+#include "Platform.h"
+
+#include "Window.h"
+#include "Renderer.h"
+#include "util.h"
+#include <assert.h>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#if VK_USE_PLATFORM_WAYLAND_KHR
+
+#include "xdg-shell-client-protocol.h"
+
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+
+// Listener callbacks, kept in one place so they can reach into the window
+struct WaylandEvents {
+	static void registryGlobal(void * data, wl_registry * registry, uint32_t name, const char * interface, uint32_t version) {
+		Window * window = static_cast<Window *>(data);
+
+		// Version 1 of everything, later versions add events there are no listeners for
+		if (strcmp(interface, wl_compositor_interface.name) == 0) {
+			window->_wayland_compositor = static_cast<wl_compositor *>(wl_registry_bind(registry, name, &wl_compositor_interface, 1));
+		}
+		else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+			window->_xdg_wm_base = static_cast<xdg_wm_base *>(wl_registry_bind(registry, name, &xdg_wm_base_interface, 1));
+			xdg_wm_base_add_listener(window->_xdg_wm_base, &WM_BASE_LISTENER, window);
+		}
+		else if (strcmp(interface, wl_seat_interface.name) == 0 && nullptr == window->_wayland_seat) {
+			window->_wayland_seat = static_cast<wl_seat *>(wl_registry_bind(registry, name, &wl_seat_interface, 1));
+			wl_seat_add_listener(window->_wayland_seat, &SEAT_LISTENER, window);
+		}
+	}
+
+	static void registryGlobalRemove(void * data, wl_registry * registry, uint32_t name) {
+	}
+
+	static void wmBasePing(void * data, xdg_wm_base * wmBase, uint32_t serial) {
+		xdg_wm_base_pong(wmBase, serial);
+	}
+
+	static void surfaceConfigure(void * data, xdg_surface * surface, uint32_t serial) {
+		Window * window = static_cast<Window *>(data);
+		xdg_surface_ack_configure(surface, serial);
+		window->_wayland_configured = true;
+	}
+
+	static void toplevelConfigure(void * data, xdg_toplevel * toplevel, int32_t width, int32_t height, wl_array * states) {
+		// Window has changed size
+		// Should rebuild all resources
+		// Resizing has been disabled, the size is only a suggestion and the swapchain keeps its own
+	}
+
+	static void toplevelClose(void * data, xdg_toplevel * toplevel) {
+		static_cast<Window *>(data)->close();
+	}
+
+	static void seatCapabilities(void * data, wl_seat * seat, uint32_t capabilities) {
+		Window * window = static_cast<Window *>(data);
+
+		bool has_pointer = (capabilities & WL_SEAT_CAPABILITY_POINTER) != 0;
+		if (has_pointer && nullptr == window->_wayland_pointer) {
+			window->_wayland_pointer = wl_seat_get_pointer(seat);
+			wl_pointer_add_listener(window->_wayland_pointer, &POINTER_LISTENER, window);
+		}
+		else if (!has_pointer && nullptr != window->_wayland_pointer) {
+			wl_pointer_destroy(window->_wayland_pointer);
+			window->_wayland_pointer = nullptr;
+		}
+	}
+
+	static void pointerEnter(void * data, wl_pointer * pointer, uint32_t serial, wl_surface * surface, wl_fixed_t x, wl_fixed_t y) {
+		pointerMotion(data, pointer, 0, x, y);
+	}
+
+	static void pointerLeave(void * data, wl_pointer * pointer, uint32_t serial, wl_surface * surface) {
+	}
+
+	static void pointerMotion(void * data, wl_pointer * pointer, uint32_t time, wl_fixed_t x, wl_fixed_t y) {
+		static_cast<Window *>(data)->_PostInputEvent(INPUT_EVENT_MOUSE_MOVE, wl_fixed_to_int(x), wl_fixed_to_int(y));
+	}
+
+	static void pointerButton(void * data, wl_pointer * pointer, uint32_t serial, uint32_t time, uint32_t button, uint32_t state) {
+	}
+
+	static void pointerAxis(void * data, wl_pointer * pointer, uint32_t time, uint32_t axis, wl_fixed_t value) {
+	}
+
+	static const wl_registry_listener REGISTRY_LISTENER;
+	static const xdg_wm_base_listener WM_BASE_LISTENER;
+	static const xdg_surface_listener SURFACE_LISTENER;
+	static const xdg_toplevel_listener TOPLEVEL_LISTENER;
+	static const wl_seat_listener SEAT_LISTENER;
+	static const wl_pointer_listener POINTER_LISTENER;
+};
+
+const wl_registry_listener WaylandEvents::REGISTRY_LISTENER = { registryGlobal, registryGlobalRemove };
+const xdg_wm_base_listener WaylandEvents::WM_BASE_LISTENER = { wmBasePing };
+const xdg_surface_listener WaylandEvents::SURFACE_LISTENER = { surfaceConfigure };
+const xdg_toplevel_listener WaylandEvents::TOPLEVEL_LISTENER = { toplevelConfigure, toplevelClose };
+const wl_seat_listener WaylandEvents::SEAT_LISTENER = { seatCapabilities };
+const wl_pointer_listener WaylandEvents::POINTER_LISTENER = { pointerEnter, pointerLeave, pointerMotion, pointerButton, pointerAxis };
+
+void Window::_InitOSWindow() {
+	assert(_surface_size_x > 0);
+	assert(_surface_size_y > 0);
+
+	_wayland_display = wl_display_connect(nullptr);
+	if (nullptr == _wayland_display) {
+		assert(0 && "Cannot connect to the Wayland compositor!\n");
+		fflush(stdout);
+		std::exit(-1);
+	}
+
+	_wayland_registry = wl_display_get_registry(_wayland_display);
+	wl_registry_add_listener(_wayland_registry, &WaylandEvents::REGISTRY_LISTENER, this);
+	wl_display_roundtrip(_wayland_display);
+
+	if (nullptr == _wayland_compositor || nullptr == _xdg_wm_base) {
+		assert(0 && "Compositor does not support xdg-shell!\n");
+		fflush(stdout);
+		std::exit(-1);
+	}
+
+	_wayland_surface = wl_compositor_create_surface(_wayland_compositor);
+	_xdg_surface = xdg_wm_base_get_xdg_surface(_xdg_wm_base, _wayland_surface);
+	xdg_surface_add_listener(_xdg_surface, &WaylandEvents::SURFACE_LISTENER, this);
+	_xdg_toplevel = xdg_surface_get_toplevel(_xdg_surface);
+	xdg_toplevel_add_listener(_xdg_toplevel, &WaylandEvents::TOPLEVEL_LISTENER, this);
+
+	xdg_toplevel_set_title(_xdg_toplevel, _window_name.c_str());
+
+	// Fixed size, as on Windows
+	xdg_toplevel_set_min_size(_xdg_toplevel, (int32_t)_surface_size_x, (int32_t)_surface_size_y);
+	xdg_toplevel_set_max_size(_xdg_toplevel, (int32_t)_surface_size_x, (int32_t)_surface_size_y);
+
+	// Nothing may be presented to the surface before its first configure has been acknowledged
+	wl_surface_commit(_wayland_surface);
+	while (!_wayland_configured && wl_display_dispatch(_wayland_display) != -1) {
+	}
+
+	// From here on the default queue is only dispatched by the input thread, the WSI keeps its own
+	if (pipe(_wayland_stop_input) != 0) {
+		assert(0 && "Cannot create the input thread's wake up pipe!\n");
+		fflush(stdout);
+		std::exit(-1);
+	}
+	_input_thread = std::thread(&Window::_RunInputThread, this);
+}
+
+void Window::_DeInitOSWindow() {
+	char stop = 0;
+	ssize_t written = write(_wayland_stop_input[1], &stop, 1);
+	assert(written == 1);
+	_input_thread.join();
+	::close(_wayland_stop_input[0]);
+	::close(_wayland_stop_input[1]);
+
+	if (nullptr != _wayland_pointer) {
+		wl_pointer_destroy(_wayland_pointer);
+	}
+	if (nullptr != _wayland_seat) {
+		wl_seat_destroy(_wayland_seat);
+	}
+	xdg_toplevel_destroy(_xdg_toplevel);
+	xdg_surface_destroy(_xdg_surface);
+	wl_surface_destroy(_wayland_surface);
+	xdg_wm_base_destroy(_xdg_wm_base);
+	wl_compositor_destroy(_wayland_compositor);
+	wl_registry_destroy(_wayland_registry);
+	wl_display_disconnect(_wayland_display);
+	_wayland_display = nullptr;
+}
+
+void Window::_RunInputThread() {
+	pollfd fds[2] = {
+		{ wl_display_get_fd(_wayland_display), POLLIN, 0 },
+		{ _wayland_stop_input[0], POLLIN, 0 }
+	};
+
+	for (;;) {
+		while (wl_display_prepare_read(_wayland_display) != 0) {
+			wl_display_dispatch_pending(_wayland_display);
+		}
+		wl_display_flush(_wayland_display);
+
+		// Sleeps until the compositor sends something or the window closes, every event is handled as soon as it arrives
+		if (poll(fds, 2, -1) < 0) {
+			wl_display_cancel_read(_wayland_display);
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		if (fds[1].revents & POLLIN) {
+			wl_display_cancel_read(_wayland_display);
+			return;
+		}
+
+		// Errors surface through the read, so the dispatch below fails rather than spinning on a dead socket
+		if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+			wl_display_read_events(_wayland_display);
+		}
+		else {
+			wl_display_cancel_read(_wayland_display);
+		}
+
+		if (wl_display_dispatch_pending(_wayland_display) < 0) {
+			break;
+		}
+	}
+
+	// The compositor went away
+	close();
+}
+
+void Window::_InitOSSurface() {
+	VkWaylandSurfaceCreateInfoKHR surface_create_info = vkStruct<VkWaylandSurfaceCreateInfoKHR>();
+	surface_create_info.display = _wayland_display;
+	surface_create_info.surface = _wayland_surface;
+	ErrorCheck(vkCreateWaylandSurfaceKHR(_renderer->getInstance(), &surface_create_info, nullptr, &_surface));
+}
+#endif
\ No newline at end of file
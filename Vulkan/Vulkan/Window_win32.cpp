@@ -21,19 +21,16 @@
 
 #include "Window.h"
 #include "Renderer.h"
+#include "util.h"
 #include <assert.h>
-#include <iostream>
-#include <chrono>
-
-#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
 
 #if VK_USE_PLATFORM_WIN32_KHR
 
 #include <windowsx.h>
 
-int * x_pos;
-int * y_pos;
-
 LRESULT CALLBACK WindowsEventHandler(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
 	Window * window = reinterpret_cast<Window *>(GetWindowLongPtrW(hWnd, GWLP_USERDATA));
 
@@ -47,8 +44,8 @@ LRESULT CALLBACK WindowsEventHandler(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM
 		// Resizing has been disabled
 		break;
 	case WM_MOUSEMOVE:
-		*x_pos = GET_X_LPARAM(lParam);
-		*y_pos = GET_Y_LPARAM(lParam);
+		window->_PostInputEvent(INPUT_EVENT_MOUSE_MOVE, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
+		break;
 	default:
 		break;
 	}
@@ -59,6 +56,20 @@ LRESULT CALLBACK WindowsEventHandler(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM
 uint64_t Window::_win32_class_id_counter = 0;
 
 void Window::_InitOSWindow() {
+	// Messages go to the thread that created the window, so the input thread creates it and then pumps them
+	std::promise<void> window_created;
+	std::future<void> created = window_created.get_future();
+
+	_input_thread = std::thread([this, &window_created]() {
+		_CreateWin32Window();
+		window_created.set_value();
+		_RunInputThread();
+	});
+
+	created.wait();
+}
+
+void Window::_CreateWin32Window() {
 	WNDCLASSEX win_class {};
 	assert(_surface_size_x > 0);
 	assert(_surface_size_y > 0);
@@ -122,37 +133,27 @@ void Window::_InitOSWindow() {
 }
 
 void Window::_DeInitOSWindow() {
-	DestroyWindow(_win32_window);
+	PostThreadMessage(GetThreadId(_input_thread.native_handle()), WM_QUIT, 0, 0);
+	_input_thread.join();
+
 	UnregisterClass(_win32_class_name.c_str(), _win32_instance);
 }
 
-#if BUILD_ENABLE_FRAMERATE
-std::clock_t last_time = std::clock();
-#endif
-
-void Window::_UpdateOSWindow(int * xPos, int * yPos) {
-	x_pos = xPos;
-	y_pos = yPos;
+void Window::_RunInputThread() {
+	// Sleeps until a message arrives, every one is handled as soon as it does
 	MSG msg;
-	if (PeekMessage(&msg, _win32_window, 0, 0, PM_REMOVE)) {
+	while (GetMessage(&msg, NULL, 0, 0) > 0) {
 		TranslateMessage(&msg);
 		DispatchMessage(&msg);
 	}
-#if BUILD_ENABLE_FRAMERATE //TODO
-	std::clock_t diff = std::clock() - last_time;
-	if (diff == 0)
-		std::cout<<"1000+"<<std::endl;
-	else
-		std::cout<<1.0/(diff/1000.0)<<std::endl;
-	last_time = std::clock();
-#endif
+
+	DestroyWindow(_win32_window); // Only the creating thread may destroy it
 }
 
 void Window::_InitOSSurface() {
-	VkWin32SurfaceCreateInfoKHR surface_create_info {};
-	surface_create_info.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+	VkWin32SurfaceCreateInfoKHR surface_create_info = vkStruct<VkWin32SurfaceCreateInfoKHR>();
 	surface_create_info.hinstance = _win32_instance;
 	surface_create_info.hwnd = _win32_window;
-	vkCreateWin32SurfaceKHR(_renderer->getInstance(), &surface_create_info, nullptr, &_surface);
+	ErrorCheck(vkCreateWin32SurfaceKHR(_renderer->getInstance(), &surface_create_info, nullptr, &_surface));
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,178 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* Window_xcb.cpp | XCB window creation and event handling
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BUILD_OPTIONS.h"
+#include "Platform.h"
+
+#include "Window.h"
+#include "Renderer.h"
+#include "util.h"
+#include <assert.h>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#if VK_USE_PLATFORM_XCB_KHR
+
+// WM_SIZE_HINTS as laid out by ICCCM, only the size limits are filled in
+const uint32_t XCB_SIZE_HINTS_LENGTH = 18;
+const uint32_t XCB_SIZE_HINTS_P_MIN_SIZE = 1 << 4;
+const uint32_t XCB_SIZE_HINTS_P_MAX_SIZE = 1 << 5;
+
+static xcb_atom_t InternAtom(xcb_connection_t * connection, bool onlyIfExists, const char * name) {
+	xcb_intern_atom_cookie_t cookie = xcb_intern_atom(connection, onlyIfExists, (uint16_t)strlen(name), name);
+	xcb_intern_atom_reply_t * reply = xcb_intern_atom_reply(connection, cookie, nullptr);
+
+	xcb_atom_t atom = XCB_ATOM_NONE;
+	if (nullptr != reply) {
+		atom = reply->atom;
+		free(reply);
+	}
+	return atom;
+}
+
+void Window::_InitOSWindow() {
+	assert(_surface_size_x > 0);
+	assert(_surface_size_y > 0);
+
+	int screen_number = 0;
+	_xcb_connection = xcb_connect(nullptr, &screen_number);
+	if (xcb_connection_has_error(_xcb_connection)) {
+		assert(0 && "Cannot connect to the X server!\n");
+		fflush(stdout);
+		std::exit(-1);
+	}
+
+	xcb_screen_iterator_t screen_iterator = xcb_setup_roots_iterator(xcb_get_setup(_xcb_connection));
+	for (; screen_number > 0; screen_number--) {
+		xcb_screen_next(&screen_iterator);
+	}
+	_xcb_screen = screen_iterator.data;
+
+	uint32_t value_mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
+	uint32_t value_list[] = {
+		_xcb_screen->black_pixel,
+		XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_POINTER_MOTION
+	};
+
+	_xcb_window = xcb_generate_id(_xcb_connection);
+	xcb_create_window(_xcb_connection,
+		XCB_COPY_FROM_PARENT,          // depth
+		_xcb_window,                   // window
+		_xcb_screen->root,             // parent
+		0, 0,                          // x/y coords
+		(uint16_t)_surface_size_x,     // width
+		(uint16_t)_surface_size_y,     // height
+		0,                             // border width
+		XCB_WINDOW_CLASS_INPUT_OUTPUT, // class
+		_xcb_screen->root_visual,      // visual
+		value_mask,
+		value_list);
+
+	xcb_change_property(_xcb_connection, XCB_PROP_MODE_REPLACE, _xcb_window, XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, (uint32_t)_window_name.size(), _window_name.c_str());
+
+	// Have the close button send a message instead of the window manager killing the connection
+	xcb_atom_t protocols_atom = InternAtom(_xcb_connection, true, "WM_PROTOCOLS");
+	_xcb_atom_delete_window = InternAtom(_xcb_connection, false, "WM_DELETE_WINDOW");
+	_xcb_atom_stop_input = InternAtom(_xcb_connection, false, "_VULKAN_STOP_INPUT");
+	xcb_change_property(_xcb_connection, XCB_PROP_MODE_REPLACE, _xcb_window, protocols_atom, XCB_ATOM_ATOM, 32, 1, &_xcb_atom_delete_window);
+
+	// Fixed size, as on Windows
+	uint32_t size_hints[XCB_SIZE_HINTS_LENGTH] = {};
+	size_hints[0] = XCB_SIZE_HINTS_P_MIN_SIZE | XCB_SIZE_HINTS_P_MAX_SIZE;
+	size_hints[5] = _surface_size_x; // min width
+	size_hints[6] = _surface_size_y; // min height
+	size_hints[7] = _surface_size_x; // max width
+	size_hints[8] = _surface_size_y; // max height
+	xcb_change_property(_xcb_connection, XCB_PROP_MODE_REPLACE, _xcb_window, XCB_ATOM_WM_NORMAL_HINTS, XCB_ATOM_WM_SIZE_HINTS, 32, XCB_SIZE_HINTS_LENGTH, size_hints);
+
+	xcb_map_window(_xcb_connection, _xcb_window);
+	xcb_flush(_xcb_connection);
+
+	// The connection is thread safe, the input thread owns reading events from it
+	_input_thread = std::thread(&Window::_RunInputThread, this);
+}
+
+void Window::_DeInitOSWindow() {
+	// Wake the input thread with a message only it understands
+	xcb_client_message_event_t stop_event {};
+	stop_event.response_type = XCB_CLIENT_MESSAGE;
+	stop_event.format = 32;
+	stop_event.window = _xcb_window;
+	stop_event.type = _xcb_atom_stop_input;
+	xcb_send_event(_xcb_connection, 0, _xcb_window, XCB_EVENT_MASK_NO_EVENT, reinterpret_cast<const char *>(&stop_event));
+	xcb_flush(_xcb_connection);
+	_input_thread.join();
+
+	xcb_destroy_window(_xcb_connection, _xcb_window);
+	xcb_disconnect(_xcb_connection);
+	_xcb_window = 0;
+	_xcb_connection = nullptr;
+}
+
+void Window::_RunInputThread() {
+	// Sleeps until an event arrives, every one is handled as soon as it does.
+	// Returns nullptr once the X server has gone away
+	xcb_generic_event_t * event;
+	while ((event = xcb_wait_for_event(_xcb_connection)) != nullptr) {
+		bool stop = false;
+
+		switch (event->response_type & ~0x80) {
+		case XCB_CLIENT_MESSAGE: {
+			xcb_client_message_event_t * message = reinterpret_cast<xcb_client_message_event_t *>(event);
+			if (message->type == _xcb_atom_stop_input) {
+				stop = true;
+			}
+			else if (message->data.data32[0] == _xcb_atom_delete_window) {
+				close();
+			}
+			break;
+		}
+		case XCB_DESTROY_NOTIFY:
+			close();
+			break;
+		case XCB_CONFIGURE_NOTIFY:
+			// Window has changed size
+			// Should rebuild all resources
+			// Resizing has been disabled through the size hints
+			break;
+		case XCB_MOTION_NOTIFY: {
+			xcb_motion_notify_event_t * motion = reinterpret_cast<xcb_motion_notify_event_t *>(event);
+			_PostInputEvent(INPUT_EVENT_MOUSE_MOVE, motion->event_x, motion->event_y);
+			break;
+		}
+		default:
+			break;
+		}
+		free(event);
+
+		if (stop) {
+			return;
+		}
+	}
+
+	close();
+}
+
+void Window::_InitOSSurface() {
+	VkXcbSurfaceCreateInfoKHR surface_create_info = vkStruct<VkXcbSurfaceCreateInfoKHR>();
+	surface_create_info.connection = _xcb_connection;
+	surface_create_info.window = _xcb_window;
+	ErrorCheck(vkCreateXcbSurfaceKHR(_renderer->getInstance(), &surface_create_info, nullptr, &_surface));
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,146 @@
+/* Copyright (C) 2016 Daniel Grimshaw
+*
+* WorkStealingDeque.h | Lock-free Chase-Lev deque of task pointers
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <assert.h>
+
+// Single owner, many thieves. The owner pushes and pops at the bottom, thieves take from the top, and only
+// the last element is ever contended. Follows Chase and Lev, with the memory orderings of Le et al. for weak memory models.
+// The ring doubles when full; outgrown rings are kept until the deque dies, as a thief may still be reading one.
+template<typename T>
+class WorkStealingDeque {
+public:
+	WorkStealingDeque(int64_t capacity = 256) {
+		assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+		_top = 0;
+		_bottom = 0;
+		_ring = new Ring(capacity);
+	}
+
+	~WorkStealingDeque() {
+		for (auto ring : _old_rings) {
+			delete ring;
+		}
+		delete _ring.load();
+	}
+
+	// Owner only
+	void push(T * item) {
+		int64_t bottom = _bottom.load(std::memory_order_relaxed);
+		int64_t top = _top.load(std::memory_order_acquire);
+		Ring * ring = _ring.load(std::memory_order_relaxed);
+
+		if (bottom - top > ring->capacity - 1) {
+			ring = _Grow(ring, top, bottom);
+		}
+
+		ring->put(bottom, item);
+		_bottom.store(bottom + 1, std::memory_order_release); // Publishes the item to thieves
+	}
+
+	// Owner only. Newest first, nullptr when empty
+	T * pop() {
+		int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+		Ring * ring = _ring.load(std::memory_order_relaxed);
+		_bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t top = _top.load(std::memory_order_relaxed);
+
+		if (top > bottom) {
+			_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		T * item = ring->get(bottom);
+		if (top == bottom) {
+			// Last one, race the thieves for it
+			if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				item = nullptr;
+			}
+			_bottom.store(bottom + 1, std::memory_order_relaxed);
+		}
+
+		return item;
+	}
+
+	// Any thread. Oldest first, nullptr when empty or another thread won the race
+	T * steal() {
+		int64_t top = _top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t bottom = _bottom.load(std::memory_order_acquire);
+
+		if (top >= bottom) {
+			return nullptr;
+		}
+
+		Ring * ring = _ring.load(std::memory_order_acquire);
+		T * item = ring->get(top);
+		if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			return nullptr;
+		}
+
+		return item;
+	}
+
+	// Approximate, for deciding whether there is anything worth stealing
+	const bool empty() const {
+		return _bottom.load(std::memory_order_relaxed) <= _top.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Ring {
+		int64_t capacity; // Power of two
+		std::atomic<T *> * items;
+
+		Ring(int64_t size) : capacity(size), items(new std::atomic<T *>[size]) {}
+		~Ring() { delete[] items; }
+
+		void put(int64_t index, T * item) {
+			items[index & (capacity - 1)].store(item, std::memory_order_relaxed);
+		}
+		T * get(int64_t index) const {
+			return items[index & (capacity - 1)].load(std::memory_order_relaxed);
+		}
+	};
+
+	Ring * _Grow(Ring * ring, int64_t top, int64_t bottom) {
+		Ring * grown = new Ring(ring->capacity * 2);
+		for (int64_t i = top; i < bottom; i++) {
+			grown->put(i, ring->get(i));
+		}
+
+		_old_rings.push_back(ring);
+		_ring.store(grown, std::memory_order_release);
+		return grown;
+	}
+
+	// Padded onto separate cache lines, the owner writes one and thieves the other
+	std::atomic<int64_t> _top;
+	char _top_padding[64 - sizeof(std::atomic<int64_t>)];
+	std::atomic<int64_t> _bottom;
+	char _bottom_padding[64 - sizeof(std::atomic<int64_t>)];
+	std::atomic<Ring *> _ring;
+
+	std::vector<Ring *> _old_rings; // Owner only
+};
\ No newline at end of file
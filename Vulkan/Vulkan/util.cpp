@@ -23,96 +23,50 @@
 #include <cstdio>
 
 #include "util.h"
+#include "MappedFile.h"
 #include "BUILD_OPTIONS.h"
 
-#if BUILD_ENABLE_VULKAN_RUNTIME_DEBUG
-
-void ErrorCheck(VkResult result) {
-	using namespace std;
-	if (result < 0) {
-		switch (result) {
-		case VK_ERROR_OUT_OF_HOST_MEMORY:
-			cout << "VK_ERROR_OUT_OF_HOST_MEMORY" << endl;
-			break;
-		case VK_ERROR_OUT_OF_DEVICE_MEMORY:
-			cout << "VK_ERROR_OUT_OF_DEVICE_MEMORY" << endl;
-			break;
-		case VK_ERROR_INITIALIZATION_FAILED:
-			cout << "VK_ERROR_INITIALIZATION_FAILED" << endl;
-			break;
-		case VK_ERROR_DEVICE_LOST:
-			cout << "VK_ERROR_DEVICE_LOST" << endl;
-			break;
-		case VK_ERROR_MEMORY_MAP_FAILED:
-			cout << "VK_ERROR_MEMORY_MAP_FAILED" << endl;
-			break;
-		case VK_ERROR_LAYER_NOT_PRESENT:
-			cout << "VK_ERROR_LAYER_NOT_PRESENT" << endl;
-			break;
-		case VK_ERROR_EXTENSION_NOT_PRESENT:
-			cout << "VK_ERROR_EXTENSION_NOT_PRESENT" << endl;
-			break;
-		case VK_ERROR_FEATURE_NOT_PRESENT:
-			cout << "VK_ERROR_FEATURE_NOT_PRESENT" << endl;
-			break;
-		case VK_ERROR_INCOMPATIBLE_DRIVER:
-			cout << "VK_ERROR_INCOMPATIBLE_DRIVER" << endl;
-			break;
-		case VK_ERROR_TOO_MANY_OBJECTS:
-			cout << "VK_ERROR_TOO_MANY_OBJECTS" << endl;
-			break;
-		case VK_ERROR_FORMAT_NOT_SUPPORTED:
-			cout << "VK_ERROR_FORMAT_NOT_SUPPORTED" << endl;
-			break;
-		case VK_ERROR_SURFACE_LOST_KHR:
-			cout << "VK_ERROR_SURFACE_LOST_KHR" << endl;
-			break;
-		case VK_ERROR_NATIVE_WINDOW_IN_USE_KHR:
-			cout << "VK_ERROR_NATIVE_WINDOW_IN_USE_KHR" << endl;
-			break;
-		case VK_SUBOPTIMAL_KHR:
-			cout << "VK_SUBOPTIMAL_KHR" << endl;
-			break;
-		case VK_ERROR_OUT_OF_DATE_KHR:
-			cout << "VK_ERROR_OUT_OF_DATE_KHR" << endl;
-			break;
-		case VK_ERROR_INCOMPATIBLE_DISPLAY_KHR:
-			cout << "VK_ERROR_INCOMPATIBLE_DISPLAY_KHR" << endl;
-			break;
-		case VK_ERROR_VALIDATION_FAILED_EXT:
-			cout << "VK_ERROR_VALIDATION_FAILED_EXT" << endl;
-			break;
-		case VK_ERROR_INVALID_SHADER_NV:
-			cout << "VK_ERROR_INVALID_SHADER_NV" << endl;
-			break;
-		default:
-			break;
-		}
-
-		assert(0 && "Vulkan runtime error");
+const char * getResultName(VkResult result) {
+	switch (result) {
+	case VK_SUCCESS: return "VK_SUCCESS";
+	case VK_NOT_READY: return "VK_NOT_READY";
+	case VK_TIMEOUT: return "VK_TIMEOUT";
+	case VK_EVENT_SET: return "VK_EVENT_SET";
+	case VK_EVENT_RESET: return "VK_EVENT_RESET";
+	case VK_INCOMPLETE: return "VK_INCOMPLETE";
+	case VK_ERROR_OUT_OF_HOST_MEMORY: return "VK_ERROR_OUT_OF_HOST_MEMORY";
+	case VK_ERROR_OUT_OF_DEVICE_MEMORY: return "VK_ERROR_OUT_OF_DEVICE_MEMORY";
+	case VK_ERROR_INITIALIZATION_FAILED: return "VK_ERROR_INITIALIZATION_FAILED";
+	case VK_ERROR_DEVICE_LOST: return "VK_ERROR_DEVICE_LOST";
+	case VK_ERROR_MEMORY_MAP_FAILED: return "VK_ERROR_MEMORY_MAP_FAILED";
+	case VK_ERROR_LAYER_NOT_PRESENT: return "VK_ERROR_LAYER_NOT_PRESENT";
+	case VK_ERROR_EXTENSION_NOT_PRESENT: return "VK_ERROR_EXTENSION_NOT_PRESENT";
+	case VK_ERROR_FEATURE_NOT_PRESENT: return "VK_ERROR_FEATURE_NOT_PRESENT";
+	case VK_ERROR_INCOMPATIBLE_DRIVER: return "VK_ERROR_INCOMPATIBLE_DRIVER";
+	case VK_ERROR_TOO_MANY_OBJECTS: return "VK_ERROR_TOO_MANY_OBJECTS";
+	case VK_ERROR_FORMAT_NOT_SUPPORTED: return "VK_ERROR_FORMAT_NOT_SUPPORTED";
+	case VK_ERROR_SURFACE_LOST_KHR: return "VK_ERROR_SURFACE_LOST_KHR";
+	case VK_ERROR_NATIVE_WINDOW_IN_USE_KHR: return "VK_ERROR_NATIVE_WINDOW_IN_USE_KHR";
+	case VK_SUBOPTIMAL_KHR: return "VK_SUBOPTIMAL_KHR";
+	case VK_ERROR_OUT_OF_DATE_KHR: return "VK_ERROR_OUT_OF_DATE_KHR";
+	case VK_ERROR_INCOMPATIBLE_DISPLAY_KHR: return "VK_ERROR_INCOMPATIBLE_DISPLAY_KHR";
+	case VK_ERROR_VALIDATION_FAILED_EXT: return "VK_ERROR_VALIDATION_FAILED_EXT";
+	case VK_ERROR_INVALID_SHADER_NV: return "VK_ERROR_INVALID_SHADER_NV";
+	default: return "unknown VkResult";
 	}
 }
 
-#else
+void reportVulkanError(VkResult result, const char * call, const char * file, int line) {
+	std::cerr << file << "(" << line << "): " << call << " failed with " << getResultName(result) << " (" << result << ")" << std::endl;
 
-void ErrorCheck(VkResult result) {};
-
-#endif //BUILD_ENABLE_VULKAN_RUNTIME_DEBUG
+#if BUILD_ENABLE_VULKAN_RUNTIME_DEBUG
+	assert(0 && "Vulkan runtime error");
+#endif
+}
 
 std::vector<char> readFile(const std::string & filename) {
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-	if (!file.is_open()) {
-		throw std::runtime_error("Failed to open file!");
-	}
-
-	size_t fileSize = (size_t)file.tellg();
-	std::vector<char> buffer(fileSize);
-
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-
-	file.close();
+	MappedFile file(filename);
 
-	return buffer;
+	// One copy out of the page cache, instead of through an ifstream buffer as well
+	return std::vector<char>(file.getData(), file.getData() + file.getSize());
 }
\ No newline at end of file
@@ -19,9 +19,33 @@
 #pragma once
 
 #include <fstream>
+#include <string>
+#include <vector>
 
 #include "Platform.h"
+#include "VkBuilders.h"
 
-void ErrorCheck(VkResult result);
+// Reports a failed Vulkan call in every build. Success costs one compare, the report itself lives out of line.
+// ErrorCheck is the statement form; ErrorCheckResult hands back the result for callers that act on the one error they
+// expect, e.g. VK_ERROR_OUT_OF_DATE_KHR from present. That error is not reported, and dropping the result is diagnosed
+#define ErrorCheck(call) reportVulkanResult((call), #call, __FILE__, __LINE__)
+#define ErrorCheckResult(call, expected) checkVulkanResult((call), (expected), #call, __FILE__, __LINE__)
+
+COLD void reportVulkanError(VkResult result, const char * call, const char * file, int line);
+
+inline void reportVulkanResult(VkResult result, const char * call, const char * file, int line) {
+	if (UNLIKELY(result < 0)) {
+		reportVulkanError(result, call, file, line);
+	}
+}
+
+NODISCARD inline VkResult checkVulkanResult(VkResult result, VkResult expected, const char * call, const char * file, int line) {
+	if (UNLIKELY(result < 0) && result != expected) {
+		reportVulkanError(result, call, file, line);
+	}
+	return result;
+}
+
+const char * getResultName(VkResult result);
 
 std::vector<char> readFile(const std::string & filename);
\ No newline at end of file